@@ -624,6 +624,8 @@ sdb_data_cmp(const sdb_data_t *d1, const sdb_data_t *d2)
 	else if (d1->type == SDB_TYPE_DECIMAL)
 		return SDB_CMP(d1->data.decimal, d2->data.decimal);
 	else if (d1->type == SDB_TYPE_STRING) {
+		if (d1->data.string == d2->data.string)
+			return 0;
 		CMP_NULL(d1->data.string, d2->data.string);
 		return strcasecmp(d1->data.string, d2->data.string);
 	}
@@ -30,6 +30,8 @@
 #endif /* HAVE_CONFIG_H */
 
 #include "core/object.h"
+#include "utils/intern.h"
+#include "utils/slab.h"
 
 #include <assert.h>
 
@@ -85,14 +87,14 @@ sdb_object_vcreate(const char *name, sdb_type_t type, va_list ap)
 	if (type.size < sizeof(sdb_object_t))
 		return NULL;
 
-	obj = malloc(type.size);
+	obj = sdb_slab_alloc(type.size);
 	if (! obj)
 		return NULL;
 	memset(obj, 0, type.size);
 	obj->type = type;
 
 	if (name) {
-		obj->name = strdup(name);
+		obj->name = sdb_intern(name);
 		if (! obj->name) {
 			obj->ref_cnt = 1;
 			sdb_object_deref(obj);
@@ -142,22 +144,26 @@ sdb_object_create_wrapper(const char *name,
 void
 sdb_object_deref(sdb_object_t *obj)
 {
+	int ref_cnt;
+
 	if (! obj)
 		return;
 
-	--obj->ref_cnt;
-	if (obj->ref_cnt > 0)
+	/* acquire ordering makes all modifications done by other threads
+	 * before releasing their references visible to the destructor */
+	ref_cnt = __atomic_sub_fetch(&obj->ref_cnt, 1, __ATOMIC_ACQ_REL);
+	if (ref_cnt > 0)
 		return;
 
 	/* we'd access free'd memory in case ref_cnt < 0 */
-	assert(! obj->ref_cnt);
+	assert(! ref_cnt);
 
 	if (obj->type.destroy)
 		obj->type.destroy(obj);
 
 	if (obj->name)
-		free(obj->name);
-	free(obj);
+		sdb_intern_release(obj->name);
+	sdb_slab_free(obj, obj->type.size);
 } /* sdb_object_deref */
 
 void
@@ -165,8 +171,9 @@ sdb_object_ref(sdb_object_t *obj)
 {
 	if (! obj)
 		return;
-	assert(obj->ref_cnt > 0);
-	++obj->ref_cnt;
+	assert(__atomic_load_n(&obj->ref_cnt, __ATOMIC_RELAXED) > 0);
+	/* the caller already owns a reference, so no ordering is required */
+	__atomic_add_fetch(&obj->ref_cnt, 1, __ATOMIC_RELAXED);
 } /* sdb_object_ref */
 
 int
@@ -179,6 +186,9 @@ sdb_object_cmp_by_name(const sdb_object_t *o1, const sdb_object_t *o2)
 	else if (! o2)
 		return 1;
 
+	/* names are interned */
+	if (o1->name == o2->name)
+		return 0;
 	return strcasecmp(o1->name, o2->name);
 } /* sdb_object_cmp_by_name */
 
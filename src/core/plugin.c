@@ -33,6 +33,7 @@
 #include "core/plugin.h"
 #include "core/time.h"
 #include "utils/error.h"
+#include "utils/hashindex.h"
 #include "utils/llist.h"
 #include "utils/strbuf.h"
 
@@ -106,6 +107,23 @@ typedef struct {
 } sdb_plugin_writer_t;
 #define SDB_PLUGIN_WRITER(obj) ((sdb_plugin_writer_t *)(obj))
 
+/* The cname cache is a set-associative table: each name may only be stored
+ * in one of CNAME_WAYS slots determined by its hash. */
+#define CNAME_WAYS 4
+#define CNAME_LOCKS 64
+
+#define CNAME_DEFAULT_SIZE 1024
+#define CNAME_DEFAULT_TTL SECS_TO_SDB_TIME(300)
+#define CNAME_DEFAULT_NEGATIVE_TTL SECS_TO_SDB_TIME(60)
+
+typedef struct {
+	char *name;
+	/* NULL if none of the callbacks changed the name */
+	char *cname;
+	uint32_t hash;
+	sdb_time_t expires;
+} cname_entry_t;
+
 /*
  * private variables
  */
@@ -142,6 +160,30 @@ static struct {
 	{ "store writer",       &writer_list },
 };
 
+static struct {
+	/* protects the table and the settings; held for reading while
+	 * accessing entries (which are protected by the set locks) */
+	pthread_rwlock_t lock;
+	pthread_mutex_t set_locks[CNAME_LOCKS];
+
+	cname_entry_t *entries;
+	size_t sets_num;
+
+	size_t size;
+	sdb_time_t ttl;
+	sdb_time_t negative_ttl;
+
+	/* incremented whenever the cache is flushed; names canonicalized
+	 * before that will not be added to the cache */
+	unsigned long generation;
+} cname_cache = {
+	.lock = PTHREAD_RWLOCK_INITIALIZER,
+	.size = CNAME_DEFAULT_SIZE,
+	.ttl = CNAME_DEFAULT_TTL,
+	.negative_ttl = CNAME_DEFAULT_NEGATIVE_TTL,
+};
+static pthread_once_t cname_cache_once = PTHREAD_ONCE_INIT;
+
 /*
  * private helper functions
  */
@@ -168,6 +210,164 @@ plugin_info_clear(sdb_plugin_info_t *info)
 	*info = empty_info;
 } /* plugin_info_clear */
 
+static void
+cname_cache_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < CNAME_LOCKS; ++i)
+		pthread_mutex_init(&cname_cache.set_locks[i], /* attr = */ NULL);
+} /* cname_cache_init */
+
+static void
+cname_entry_clear(cname_entry_t *e)
+{
+	free(e->name);
+	free(e->cname);
+	memset(e, 0, sizeof(*e));
+} /* cname_entry_clear */
+
+/* The cache has to be write-locked before calling this function. */
+static void
+cname_cache_clear(void)
+{
+	size_t i;
+
+	if (cname_cache.entries)
+		for (i = 0; i < cname_cache.sets_num * CNAME_WAYS; ++i)
+			cname_entry_clear(cname_cache.entries + i);
+	__atomic_add_fetch(&cname_cache.generation, 1, __ATOMIC_RELEASE);
+} /* cname_cache_clear */
+
+/* Allocate the table according to the current settings unless that has
+ * already been done. The cache has to be write-locked before calling this
+ * function. */
+static int
+cname_cache_alloc(void)
+{
+	size_t sets_num = 1;
+
+	if (cname_cache.entries || (! cname_cache.size))
+		return 0;
+
+	while (sets_num * CNAME_WAYS < cname_cache.size)
+		sets_num <<= 1;
+
+	cname_cache.entries = calloc(sets_num * CNAME_WAYS,
+			sizeof(*cname_cache.entries));
+	if (! cname_cache.entries)
+		return -1;
+	cname_cache.sets_num = sets_num;
+	return 0;
+} /* cname_cache_alloc */
+
+static void
+cname_cache_flush(void)
+{
+	pthread_rwlock_wrlock(&cname_cache.lock);
+	cname_cache_clear();
+	pthread_rwlock_unlock(&cname_cache.lock);
+} /* cname_cache_flush */
+
+/* Look up the canonical name of 'name'. Returns a newly allocated copy of
+ * the cached name or NULL if the name does not change. 'found' is set to
+ * false if the name is not in the cache. */
+static char *
+cname_cache_lookup(const char *name, uint32_t hash, sdb_time_t now,
+		bool *found)
+{
+	pthread_mutex_t *lock;
+	cname_entry_t *set;
+	char *cname = NULL;
+	size_t i;
+
+	*found = 0;
+
+	pthread_rwlock_rdlock(&cname_cache.lock);
+	if (! cname_cache.entries) {
+		pthread_rwlock_unlock(&cname_cache.lock);
+		return NULL;
+	}
+
+	i = hash & (cname_cache.sets_num - 1);
+	set = cname_cache.entries + i * CNAME_WAYS;
+	lock = &cname_cache.set_locks[i % CNAME_LOCKS];
+
+	pthread_mutex_lock(lock);
+	for (i = 0; i < CNAME_WAYS; ++i) {
+		cname_entry_t *e = set + i;
+
+		if ((! e->name) || (e->hash != hash) || (e->expires <= now)
+				|| strcmp(e->name, name))
+			continue;
+
+		if (e->cname) {
+			cname = strdup(e->cname);
+			if (! cname)
+				break;
+		}
+		*found = 1;
+		break;
+	}
+	pthread_mutex_unlock(lock);
+	pthread_rwlock_unlock(&cname_cache.lock);
+	return cname;
+} /* cname_cache_lookup */
+
+/* Add the canonical name of 'name' to the cache. 'cname' may be NULL if the
+ * name does not change. Nothing is added if the cache has been flushed since
+ * 'generation' has been read. */
+static void
+cname_cache_insert(const char *name, uint32_t hash, const char *cname,
+		sdb_time_t now, unsigned long generation)
+{
+	cname_entry_t new = { NULL, NULL, hash, 0 };
+	cname_entry_t *set, *victim = NULL;
+	pthread_mutex_t *lock;
+	sdb_time_t ttl;
+	size_t i;
+
+	new.name = strdup(name);
+	if (cname)
+		new.cname = strdup(cname);
+	if ((! new.name) || (cname && (! new.cname))) {
+		cname_entry_clear(&new);
+		return;
+	}
+
+	pthread_rwlock_rdlock(&cname_cache.lock);
+	ttl = cname ? cname_cache.ttl : cname_cache.negative_ttl;
+	if ((! cname_cache.entries) || (! ttl)
+			|| (generation != cname_cache.generation)) {
+		pthread_rwlock_unlock(&cname_cache.lock);
+		cname_entry_clear(&new);
+		return;
+	}
+	new.expires = now + ttl;
+
+	i = hash & (cname_cache.sets_num - 1);
+	set = cname_cache.entries + i * CNAME_WAYS;
+	lock = &cname_cache.set_locks[i % CNAME_LOCKS];
+
+	pthread_mutex_lock(lock);
+	for (i = 0; i < CNAME_WAYS; ++i) {
+		cname_entry_t *e = set + i;
+
+		if ((! e->name) || (e->expires <= now)
+				|| ((e->hash == hash) && (! strcmp(e->name, name)))) {
+			victim = e;
+			break;
+		}
+		/* else: evict the entry which expires first */
+		if ((! victim) || (e->expires < victim->expires))
+			victim = e;
+	}
+	cname_entry_clear(victim);
+	*victim = new;
+	pthread_mutex_unlock(lock);
+	pthread_rwlock_unlock(&cname_cache.lock);
+} /* cname_cache_insert */
+
 static void
 ctx_key_init(void)
 {
@@ -244,11 +444,13 @@ plugin_unregister_by_name(const char *plugin_name)
 	obj = sdb_llist_search_by_name(all_plugins, plugin_name);
 	/* when called from sdb_plugin_reconfigure_finish, the object has already
 	 * been removed from the list */
-	if (obj && (obj->ref_cnt <= 1)) {
+	if (obj && (__atomic_load_n(&obj->ref_cnt, __ATOMIC_ACQUIRE) <= 1)) {
 		sdb_llist_remove_by_name(all_plugins, plugin_name);
 		sdb_object_deref(obj);
 	}
 	/* else: other callbacks still reference it */
+
+	cname_cache_flush();
 } /* plugin_unregister_by_name */
 
 /*
@@ -761,9 +963,21 @@ sdb_plugin_register_cname(const char *name, sdb_plugin_cname_cb callback,
 		sdb_object_t *user_data)
 {
 	char cb_name[1024];
-	return plugin_add_callback(&cname_list, "cname",
-			plugin_get_name(name, cb_name, sizeof(cb_name)),
-			callback, user_data);
+
+	if (plugin_add_callback(&cname_list, "cname",
+				plugin_get_name(name, cb_name, sizeof(cb_name)),
+				callback, user_data))
+		return -1;
+
+	pthread_once(&cname_cache_once, cname_cache_init);
+	pthread_rwlock_wrlock(&cname_cache.lock);
+	/* previously cached names might change now */
+	cname_cache_clear();
+	if (cname_cache_alloc())
+		sdb_log(SDB_LOG_WARNING, "core: Failed to allocate cname cache; "
+				"canonicalizing all host names on every update");
+	pthread_rwlock_unlock(&cname_cache.lock);
+	return 0;
 } /* sdb_plugin_register_cname */
 
 int
@@ -887,8 +1101,32 @@ sdb_plugin_unregister_all(void)
 		sdb_log(SDB_LOG_INFO, "core: Unregistered %zu %s callback%s",
 				len, type, len == 1 ? "" : "s");
 	}
+
+	cname_cache_flush();
 } /* sdb_plugin_unregister_all */
 
+int
+sdb_plugin_set_cname_cache(size_t size, sdb_time_t ttl,
+		sdb_time_t negative_ttl)
+{
+	int status;
+
+	pthread_once(&cname_cache_once, cname_cache_init);
+	pthread_rwlock_wrlock(&cname_cache.lock);
+	cname_cache_clear();
+	free(cname_cache.entries);
+	cname_cache.entries = NULL;
+	cname_cache.sets_num = 0;
+
+	cname_cache.size = size;
+	cname_cache.ttl = ttl;
+	cname_cache.negative_ttl = negative_ttl;
+	/* the table will be allocated once a cname callback is registered */
+	status = sdb_llist_len(cname_list) ? cname_cache_alloc() : 0;
+	pthread_rwlock_unlock(&cname_cache.lock);
+	return status;
+} /* sdb_plugin_set_cname_cache */
+
 sdb_plugin_ctx_t
 sdb_plugin_get_ctx(void)
 {
@@ -1022,6 +1260,9 @@ sdb_plugin_reconfigure_finish(void)
 		sdb_object_deref(SDB_OBJ(ctx));
 	}
 	sdb_llist_iter_destroy(iter);
+
+	/* the plugins might have been configured differently */
+	cname_cache_flush();
 	return 0;
 } /* sdb_plugin_reconfigure_finish */
 
@@ -1201,6 +1442,10 @@ char *
 sdb_plugin_cname(char *hostname)
 {
 	sdb_llist_iter_t *iter;
+	unsigned long generation;
+	char *name = NULL;
+	sdb_time_t now;
+	uint32_t hash;
 
 	if (! hostname)
 		return NULL;
@@ -1208,6 +1453,24 @@ sdb_plugin_cname(char *hostname)
 	if (! cname_list)
 		return hostname;
 
+	generation = __atomic_load_n(&cname_cache.generation, __ATOMIC_ACQUIRE);
+	hash = sdb_hashindex_hash(hostname);
+	now = sdb_gettime();
+	if (now) {
+		bool found = 0;
+		char *cname = cname_cache_lookup(hostname, hash, now, &found);
+
+		if (found) {
+			if (cname) {
+				free(hostname);
+				return cname;
+			}
+			return hostname;
+		}
+		/* remember the original name (which might be freed below) */
+		name = strdup(hostname);
+	}
+
 	iter = sdb_llist_get_iter(cname_list);
 	while (sdb_llist_iter_has_next(iter)) {
 		sdb_plugin_cname_cb callback;
@@ -1225,6 +1488,12 @@ sdb_plugin_cname(char *hostname)
 		/* else: don't change hostname */
 	}
 	sdb_llist_iter_destroy(iter);
+
+	if (name) {
+		cname_cache_insert(name, hash, strcmp(name, hostname) ? hostname : NULL,
+				now, generation);
+		free(name);
+	}
 	return hostname;
 } /* sdb_plugin_cname */
 
@@ -1386,7 +1655,7 @@ sdb_plugin_store_metric(const char *hostname, const char *name,
 	if ((! hostname) || (! name))
 		return -1;
 
-	if ((! store->type) || (! store->id))
+	if (store && ((! store->type) || (! store->id)))
 		store = NULL;
 
 	iter = sdb_llist_get_iter(writer_list);
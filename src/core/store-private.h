@@ -34,8 +34,31 @@
 
 #include "core/store.h"
 #include "utils/avltree.h"
+#include "utils/mvcc.h"
+
+#ifdef ENABLE_BTREE
+/* use B-trees instead of AVL trees for all indexes (see utils/btree.h) */
+#	include "utils/btree.h"
+#	define sdb_avltree_t sdb_btree_t
+#	define sdb_avltree_iter_t sdb_btree_iter_t
+#	define sdb_avltree_create sdb_btree_create
+#	define sdb_avltree_destroy sdb_btree_destroy
+#	define sdb_avltree_clear sdb_btree_clear
+#	define sdb_avltree_insert sdb_btree_insert
+#	define sdb_avltree_replace sdb_btree_replace
+#	define sdb_avltree_remove sdb_btree_remove
+#	define sdb_avltree_lookup sdb_btree_lookup
+#	define sdb_avltree_get_iter sdb_btree_get_iter
+#	define sdb_avltree_iter_destroy sdb_btree_iter_destroy
+#	define sdb_avltree_iter_has_next sdb_btree_iter_has_next
+#	define sdb_avltree_iter_get_next sdb_btree_iter_get_next
+#	define sdb_avltree_iter_peek_next sdb_btree_iter_peek_next
+#	define sdb_avltree_size sdb_btree_size
+#	define sdb_avltree_valid sdb_btree_valid
+#endif /* ENABLE_BTREE */
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <regex.h>
 
 #ifdef __cplusplus
@@ -55,13 +78,163 @@ struct sdb_store_obj {
 	/* common meta information */
 	sdb_time_t last_update;
 	sdb_time_t interval; /* moving average */
-	char **backends;
-	size_t backends_num;
+	uint64_t backends; /* set of backend IDs */
 	sdb_store_obj_t *parent;
+
+	/* increases whenever the object or any of its children change
+	 * (see sdb_store_get_generation) */
+	uint64_t generation;
+
+	/* pending expiry timer, if any (see sdb_store_set_expiry) */
+	sdb_object_t *expiry;
+
+	/* approximate memory usage of the object itself (excluding its
+	 * children), fixed after initialization (see sdb_store_get_usage) */
+	size_t size;
 };
 #define STORE_OBJ(obj) ((sdb_store_obj_t *)(obj))
 #define STORE_CONST_OBJ(obj) ((const sdb_store_obj_t *)(obj))
 
+/* Backend names are interned into a global registry and each object stores
+ * the set of IDs of the backends that provided it. Backends may be added
+ * concurrently to lock-free readers, so the set has to be loaded atomically.
+ * Registered names are never removed. */
+#define STORE_BACKENDS_MAX 64
+#define STORE_OBJ_BACKENDS(obj) \
+	__atomic_load_n(&(obj)->backends, __ATOMIC_ACQUIRE)
+
+/* The update time and interval of existing objects are updated in place, so
+ * lock-free readers have to load them atomically as well. */
+#define STORE_OBJ_LAST_UPDATE(obj) \
+	__atomic_load_n(&(obj)->last_update, __ATOMIC_RELAXED)
+#define STORE_OBJ_INTERVAL(obj) \
+	__atomic_load_n(&(obj)->interval, __ATOMIC_RELAXED)
+
+/*
+ * sdb_store_backend_names:
+ * Store the names of all backends in the specified set in 'names' (which
+ * has to provide space for STORE_BACKENDS_MAX entries) in the order in which
+ * they have been registered. IDs of backends which have not been registered
+ * are ignored. The names remain valid for the lifetime of the process.
+ *
+ * Returns:
+ *  - the number of names
+ */
+size_t
+sdb_store_backend_names(uint64_t backends, const char **names);
+
+/*
+ * sdb_store_backend_id:
+ * Returns the ID of the backend with the specified name, registering it if
+ * it's not known yet, or a negative value on error.
+ */
+int
+sdb_store_backend_id(const char *name);
+
+/*
+ * sdb_store_get_hosts_by_usage:
+ * Store all hosts in a newly allocated array in 'hosts', ordered by their
+ * memory usage (largest first). The array has to be free'd by the caller.
+ * This function has to be called from inside an epoch critical section; the
+ * hosts remain valid until leaving it.
+ *
+ * Returns:
+ *  - the number of hosts on success
+ *  - a negative value else
+ */
+ssize_t
+sdb_store_get_hosts_by_usage(sdb_store_obj_t ***hosts);
+
+/*
+ * store snapshots
+ */
+
+/*
+ * sdb_store_snapshot_obj_t:
+ * An object restored from a snapshot. Objects are identified by their type
+ * and name, the (canonical) name of their host and, for attributes of
+ * services and metrics, the type and name of their parent.
+ */
+typedef struct {
+	int type;
+	const char *hostname;
+	int parent_type;
+	const char *parent;
+	const char *name;
+
+	sdb_time_t last_update;
+	sdb_time_t interval;
+	uint64_t backends; /* set of backend IDs */
+
+	/* attributes only */
+	const sdb_data_t *value;
+	/* metrics only (optional) */
+	const char *store_type;
+	const char *store_id;
+} sdb_store_snapshot_obj_t;
+
+/*
+ * sdb_store_restore:
+ * Restore an object from a snapshot. Unlike the sdb_store_<type> functions,
+ * this sets the update interval and the backends of the object as specified
+ * rather than deriving them from its updates and the calling plugin. The
+ * object's name is not canonicalized and it is not passed on to any store
+ * plugins. Objects which have been updated more recently are left untouched.
+ * The object's parent has to be restored first.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_store_restore(const sdb_store_snapshot_obj_t *obj);
+
+/*
+ * sdb_store_restore_remove:
+ * Remove an object (including all of its children) from the store unless it
+ * has been updated after 'obj->last_update'. This is used to replay the
+ * expiry of objects recorded in the journal.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_store_restore_remove(const sdb_store_snapshot_obj_t *obj);
+
+/*
+ * sdb_store_snapshot_marshal:
+ * Encode the current state of an object as stored in snapshots. Only
+ * backends included in 'backends_mask' are encoded. This function has to be
+ * called from inside an epoch critical section or while holding the lock of
+ * the object's shard.
+ *
+ * Returns:
+ *  - the number of bytes of the encoded object on success; the object is
+ *    written to 'buf' only if it provides enough space
+ *  - a negative value else
+ */
+ssize_t
+sdb_store_snapshot_marshal(char *buf, size_t buf_len,
+		sdb_store_obj_t *obj, uint64_t backends_mask);
+
+/*
+ * sdb_store_snapshot_unmarshal:
+ * Decode an object encoded by sdb_store_snapshot_marshal. 'backend_ids' maps
+ * the encoded backends to backend IDs (STORE_BACKENDS_MAX entries, negative
+ * for unknown backends). All strings point into 'buf'. The value of
+ * attributes is stored in 'value' and has to be free'd using
+ * sdb_data_free_datum.
+ *
+ * Returns:
+ *  - the number of bytes read on success
+ *  - a negative value else
+ */
+ssize_t
+sdb_store_snapshot_unmarshal(const char *buf, size_t len,
+		const int *backend_ids, sdb_store_snapshot_obj_t *obj,
+		sdb_data_t *value);
+
 typedef struct {
 	sdb_store_obj_t super;
 
@@ -70,10 +243,117 @@ typedef struct {
 #define ATTR(obj) ((sdb_attribute_t *)(obj))
 #define CONST_ATTR(obj) ((const sdb_attribute_t *)(obj))
 
+/*
+ * Services and metrics usually have few attributes. Up to STORE_ATTRS_INLINE
+ * of them are stored in a sorted array, which is replaced as a whole on each
+ * update such that lock-free readers always see a consistent version. Larger
+ * sets are moved to a tree (and stay there). Readers have to load the array
+ * first and use the tree only if there is no array. Writers have to be
+ * serialized by the caller (usually by holding the lock of the shard).
+ */
+#define STORE_ATTRS_INLINE 8
+
+typedef struct {
+	size_t len;
+	sdb_store_obj_t *attrs[];
+} sdb_attr_array_t;
+
+typedef struct {
+	/* both accessed atomically and NULL if the set is empty; the array is
+	 * versioned (see utils/mvcc.h) */
+	sdb_mvcc_ptr_t array;
+	sdb_avltree_t *tree;
+} sdb_attrs_t;
+#define SDB_ATTRS_INIT { SDB_MVCC_PTR_INIT, NULL }
+
+/*
+ * sdb_attrs_t iterator; see sdb_attrs_iter_init.
+ */
+typedef struct {
+	sdb_avltree_iter_t *tree;
+	sdb_attr_array_t *array;
+	size_t idx;
+} sdb_attrs_iter_t;
+
+/*
+ * sdb_attrs_destroy:
+ * Release all attributes of the set. This may only be called once no reader
+ * may access the set any longer.
+ */
+void
+sdb_attrs_destroy(sdb_attrs_t *attrs);
+
+/*
+ * sdb_attrs_size:
+ * Returns the number of attributes in the set.
+ */
+size_t
+sdb_attrs_size(sdb_attrs_t *attrs);
+
+/*
+ * sdb_attrs_lookup:
+ * Lookup an attribute by name. A reference to the attribute is returned,
+ * which has to be released by the caller.
+ *
+ * Returns:
+ *  - the attribute
+ *  - NULL if no such attribute exists
+ */
+sdb_store_obj_t *
+sdb_attrs_lookup(sdb_attrs_t *attrs, const char *name);
+
+/*
+ * sdb_attrs_insert, sdb_attrs_replace, sdb_attrs_remove:
+ * Insert a new attribute, replace the attribute with the same name, or remove
+ * the named attribute. The set keeps its own reference to inserted
+ * attributes; replaced or removed attributes are released once no reader
+ * may access them any longer. These functions behave like the respective
+ * functions of AVL trees (see utils/avltree.h).
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_attrs_insert(sdb_attrs_t *attrs, sdb_store_obj_t *attr);
+int
+sdb_attrs_replace(sdb_attrs_t *attrs, sdb_store_obj_t *attr);
+int
+sdb_attrs_remove(sdb_attrs_t *attrs, const char *name);
+
+/*
+ * sdb_attrs_iter_init, sdb_attrs_iter_has_next, sdb_attrs_iter_get_next,
+ * sdb_attrs_iter_peek_next, sdb_attrs_iter_finish:
+ * Iterate through all attributes of the set in order of their names. Like
+ * tree iterators, an iterator operates on the version of the set at the time
+ * it was initialized. It has to be finished by the same thread that
+ * initialized it. sdb_attrs_iter_get_next and sdb_attrs_iter_peek_next
+ * return NULL if there is no next attribute.
+ */
+void
+sdb_attrs_iter_init(sdb_attrs_iter_t *iter, sdb_attrs_t *attrs);
+bool
+sdb_attrs_iter_has_next(sdb_attrs_iter_t *iter);
+sdb_store_obj_t *
+sdb_attrs_iter_get_next(sdb_attrs_iter_t *iter);
+sdb_store_obj_t *
+sdb_attrs_iter_peek_next(sdb_attrs_iter_t *iter);
+void
+sdb_attrs_iter_finish(sdb_attrs_iter_t *iter);
+
+/*
+ * sdb_store_attrs_iter:
+ * Initialize an iterator over the attributes of any stored object (see
+ * sdb_attrs_iter_init). The iterator is empty for objects which don't have
+ * any attributes.
+ */
+void
+sdb_store_attrs_iter(sdb_attrs_iter_t *iter, sdb_store_obj_t *obj);
+
 typedef struct {
 	sdb_store_obj_t super;
 
-	sdb_avltree_t *attributes;
+	sdb_attrs_t attributes;
 } sdb_service_t;
 #define SVC(obj) ((sdb_service_t *)(obj))
 #define CONST_SVC(obj) ((const sdb_service_t *)(obj))
@@ -81,7 +361,7 @@ typedef struct {
 typedef struct {
 	sdb_store_obj_t super;
 
-	sdb_avltree_t *attributes;
+	sdb_attrs_t attributes;
 	struct {
 		char *type;
 		char *id;
@@ -95,6 +375,10 @@ typedef struct {
 	sdb_avltree_t *services;
 	sdb_avltree_t *metrics;
 	sdb_avltree_t *attributes;
+
+	/* usage of the host including all of its children; only modified while
+	 * holding the shard's lock and loaded atomically */
+	sdb_store_usage_t usage;
 } sdb_host_t;
 #define HOST(obj) ((sdb_host_t *)(obj))
 #define CONST_HOST(obj) ((const sdb_host_t *)(obj))
@@ -103,6 +387,88 @@ typedef struct {
 #define _last_update super.last_update
 #define _interval super.interval
 
+/*
+ * store journal
+ */
+
+/*
+ * sdb_store_journal_update, sdb_store_journal_remove:
+ * Record the current state of an updated object or the removal of an object
+ * in the journal (if enabled). The lock of the object's shard has to be
+ * acquired before calling these functions, which ensures that updates of an
+ * object are recorded in order.
+ */
+void
+sdb_store_journal_update(sdb_store_obj_t *obj);
+void
+sdb_store_journal_remove(sdb_store_obj_t *obj);
+
+/*
+ * sdb_store_journal_checkpoint, sdb_store_journal_checkpoint_done:
+ * Start a new journal before writing a snapshot. All updates recorded so far
+ * will be included in the snapshot; once it has been written successfully,
+ * the previous journal is no longer required and will be removed.
+ *
+ * Returns:
+ *  - 0 on success (or if the journal is disabled)
+ *  - a negative value else
+ */
+int
+sdb_store_journal_checkpoint(void);
+void
+sdb_store_journal_checkpoint_done(bool success);
+
+/*
+ * regular expressions
+ */
+
+/*
+ * sdb_store_regex_t:
+ * A compiled pattern of the =~ and !~ matchers, that is, an extended,
+ * case-insensitive POSIX regular expression (see SDB_TYPE_REGEX). Patterns
+ * consisting of literal characters only are matched without using the regex
+ * engine. A regex may be used by multiple threads concurrently.
+ */
+typedef struct sdb_store_regex sdb_store_regex_t;
+
+/*
+ * sdb_store_regex_create, sdb_store_regex_destroy:
+ * Compile a pattern or destroy a compiled regex. A pattern which fails to
+ * compile still yields a regex which never matches (see
+ * sdb_store_regex_valid); NULL is returned on other errors.
+ */
+sdb_store_regex_t *
+sdb_store_regex_create(const char *pattern);
+void
+sdb_store_regex_destroy(sdb_store_regex_t *re);
+
+/*
+ * sdb_store_regex_valid:
+ * Returns true if the regex has been compiled successfully.
+ */
+bool
+sdb_store_regex_valid(const sdb_store_regex_t *re);
+
+/*
+ * sdb_store_regex_lookup:
+ * Look up the compiled version of the pattern in a bounded cache, compiling
+ * it on a miss. This function has to be called from inside an epoch critical
+ * section; the regex remains valid until leaving it.
+ *
+ * Returns:
+ *  - the compiled regex
+ *  - NULL if the pattern failed to compile or on error
+ */
+const sdb_store_regex_t *
+sdb_store_regex_lookup(const char *pattern);
+
+/*
+ * sdb_store_regex_exec:
+ * Returns true if the value matches the regex.
+ */
+bool
+sdb_store_regex_exec(const sdb_store_regex_t *re, const char *value);
+
 /*
  * expressions
  */
@@ -135,6 +501,39 @@ struct sdb_store_expr {
 		: ((e)->type > 0) ? SDB_DATA_OP_TO_STRING((e)->type) \
 		: "<unknown>")
 
+/*
+ * sdb_store_get_field_ref, sdb_store_get_attr_ref:
+ * Like sdb_store_get_field and sdb_store_get_attr but return the name of the
+ * object and attribute values by reference rather than copying them.
+ * sdb_store_get_field_ref sets 'owned' to true if the value has been
+ * allocated and has to be free'd by the caller. sdb_store_get_attr_ref
+ * returns NULL if the attribute does not exist. These functions have to be
+ * called from inside an epoch critical section; the values remain valid
+ * until leaving it.
+ */
+int
+sdb_store_get_field_ref(sdb_store_obj_t *obj, int field, sdb_data_t *res,
+		bool *owned);
+const sdb_data_t *
+sdb_store_get_attr_ref(sdb_store_obj_t *obj, const char *name,
+		sdb_store_matcher_t *filter);
+
+/*
+ * sdb_store_expr_eval_ref:
+ * Evaluate an expression like sdb_store_expr_eval but return constants,
+ * fields, and attribute values by reference (see sdb_store_get_field_ref).
+ * Only computed values are allocated, in which case 'owned' is set to true
+ * and the caller has to free the result. This function has to be called from
+ * inside an epoch critical section.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_store_expr_eval_ref(sdb_store_expr_t *expr, sdb_store_obj_t *obj,
+		sdb_data_t *res, bool *owned, sdb_store_matcher_t *filter);
+
 /*
  * matchers
  */
@@ -230,6 +629,16 @@ typedef struct {
 } cmp_matcher_t;
 #define CMP_M(m) ((cmp_matcher_t *)(m))
 
+/* IN / NOT IN matcher */
+typedef struct {
+	cmp_matcher_t super;
+
+	/* sorted copy of a constant array of integers, decimals, or strings
+	 * (right hand operand); SDB_TYPE_NULL if not available */
+	sdb_data_t set;
+} in_matcher_t;
+#define IN_M(m) ((in_matcher_t *)(m))
+
 typedef struct {
 	sdb_store_matcher_t super;
 	sdb_store_expr_t *expr;
@@ -33,12 +33,18 @@
 #include "core/store-private.h"
 #include "core/plugin.h"
 #include "utils/avltree.h"
+#include "utils/epoch.h"
 #include "utils/error.h"
+#include "utils/intern.h"
+#include "utils/llist.h"
+#include "utils/timerwheel.h"
 
 #include <assert.h>
 
+#include <ctype.h>
 #include <errno.h>
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -50,18 +56,243 @@
  * private variables
  */
 
-static sdb_avltree_t *hosts = NULL;
-static pthread_rwlock_t host_lock = PTHREAD_RWLOCK_INITIALIZER;
+/*
+ * Hosts are distributed across a number of shards based on a hash of their
+ * canonicalized name. Each shard manages its own tree of hosts and has its
+ * own lock, such that writers updating different hosts don't serialize on a
+ * single lock. Readers don't take any locks at all; all objects are accessed
+ * from inside an epoch critical section (see utils/epoch.h) instead and any
+ * data replaced by a writer is retired rather than destroyed immediately.
+ */
+#define STORE_MAX_SHARDS SDB_STORE_MAX_SHARDS
+#define STORE_DEFAULT_SHARDS 16
+
+typedef struct {
+	sdb_avltree_t *hosts;
+	/* attribute index: attribute key -> value -> hosts */
+	sdb_avltree_t *index;
+	/* name index for each object type: trigram -> hosts */
+	sdb_avltree_t *trigrams[SDB_METRIC];
+	/* serializes writers */
+	pthread_mutex_t lock;
+} store_shard_t;
+
+static store_shard_t shards[STORE_MAX_SHARDS];
+static size_t shards_num = STORE_DEFAULT_SHARDS;
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+/* only modified while all shards are locked */
+static bool names_indexed = 0;
+
+/* Interned backend names: objects refer to backends by their index into this
+ * list. Names are only ever appended (while holding the lock) and published
+ * by incrementing the number of entries afterwards. */
+static char *backend_names[STORE_BACKENDS_MAX];
+static int backend_names_num = 0;
+static pthread_mutex_t backend_names_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Expiry of stale objects: each object with a known deadline has a pending
+ * timer in the wheel. The parameters are only modified while all shards are
+ * locked. */
+static sdb_timerwheel_t *expiry_wheel = NULL;
+static int expiry_missed = 0;
+static sdb_time_t expiry_ttl = 0;
+
+/* Memory usage of all objects by type (see usage_index) and by backend ID;
+ * maintained (atomically) when creating and destroying objects. */
+static sdb_store_usage_t type_usage[4];
+static sdb_store_usage_t backend_usage[STORE_BACKENDS_MAX];
+
+/* the backend looked up most recently by the current thread */
+static __thread const char *backend_last_name = NULL;
+static __thread int backend_last_id = -1;
+
+/* Callbacks notified about changes of objects. The list is rarely modified;
+ * writers check the (atomically accessed) number of watchers to avoid taking
+ * the lock if nobody is watching. */
+typedef struct {
+	int type;
+	sdb_store_watch_cb cb;
+	sdb_object_t *user_data;
+} watcher_t;
+
+static watcher_t *watchers = NULL;
+static size_t watchers_num = 0;
+static pthread_rwlock_t watchers_lock = PTHREAD_RWLOCK_INITIALIZER;
 
 /*
  * private types
  */
 
+/* A node of the attribute index: either an indexed attribute (mapping
+ * formatted attribute values to index nodes) or an attribute value (mapping
+ * host names to hosts). */
+typedef struct {
+	sdb_object_t super;
+	sdb_avltree_t *tree;
+} index_node_t;
+#define INDEX_NODE(obj) ((index_node_t *)(obj))
+
+/* The children of a single type of a stored object: hosts store their
+ * children in trees while services and metrics store their attributes in
+ * attribute sets (see sdb_attrs_t). At most one of them is set. */
+typedef struct {
+	sdb_avltree_t *tree;
+	sdb_attrs_t *attrs;
+} children_t;
+#define CHILDREN_NONE ((children_t){ NULL, NULL })
+#define CHILDREN_TREE(t) ((children_t){ (t), NULL })
+#define CHILDREN_ATTRS(a) ((children_t){ NULL, (a) })
+
+/* A pending expiry check of a stored object. Objects are identified by their
+ * path rather than by pointer since they may be removed (and re-created) in
+ * the meantime and parent objects are not reference counted. */
+typedef struct {
+	sdb_object_t super; /* the object's name */
+	int type;
+	char *hostname;
+	/* the service or metric of attributes not belonging to a host */
+	int parent_type;
+	char *parent;
+
+	sdb_time_t deadline;
+} expiry_t;
+#define EXPIRY(obj) ((expiry_t *)(obj))
+
+/* A single update of the store as passed to the sdb_store_<type> functions.
+ * 'parent_type' and 'parent' identify the service or metric of attributes
+ * not belonging to a host. */
+typedef struct {
+	int type;
+	int parent_type;
+	const char *hostname;
+	const char *parent;
+	const char *name;
+	const sdb_data_t *value;
+	sdb_metric_store_t *store;
+	sdb_time_t last_update;
+} store_update_t;
+#define STORE_UPDATE_INIT { 0, 0, NULL, NULL, NULL, NULL, NULL, 0 }
+
+/* Strings of a batch are allocated from a list of chunks. */
+typedef struct batch_chunk {
+	struct batch_chunk *next;
+	size_t used;
+	size_t size;
+	char data[];
+} batch_chunk_t;
+#define BATCH_CHUNK_SIZE 65536
+
+typedef struct {
+	store_update_t u;
+	/* copies of the value and the metric store; the update's pointers are
+	 * set when applying it since updates are moved around in between */
+	sdb_data_t value;
+	sdb_metric_store_t store;
+	/* the canonicalized host name */
+	const char *cname;
+	size_t seq;
+} batch_update_t;
+
+struct sdb_store_batch {
+	batch_update_t *updates;
+	size_t updates_num;
+	size_t updates_size;
+
+	batch_chunk_t *strings;
+};
+
 static sdb_type_t sdb_host_type;
 static sdb_type_t sdb_service_type;
 static sdb_type_t sdb_metric_type;
 static sdb_type_t sdb_attribute_type;
 
+/* the generation of the most recently modified object */
+static uint64_t generation = 0;
+
+static uint64_t
+generation_next(void)
+{
+	uint64_t gen = __atomic_load_n(&generation, __ATOMIC_RELAXED);
+
+	if (! gen) {
+		/* start with the current time such that generations keep
+		 * increasing across restarts; see sdb_store_get_generation */
+		sdb_time_t now = sdb_gettime();
+		__atomic_compare_exchange_n(&generation, &gen, now ? now : 1,
+				/* weak = */ 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+	return __atomic_add_fetch(&generation, 1, __ATOMIC_RELAXED);
+} /* generation_next */
+
+/* Record a modification of 'obj' (and thus of all of its ancestors). The
+ * host's shard lock has to be acquired before calling this function. */
+static void
+generation_bump(sdb_store_obj_t *obj)
+{
+	uint64_t gen = generation_next();
+
+	for ( ; obj; obj = obj->parent)
+		__atomic_store_n(&obj->generation, gen, __ATOMIC_RELEASE);
+} /* generation_bump */
+
+static size_t
+usage_index(int type)
+{
+	if (type == SDB_HOST)
+		return 0;
+	else if (type == SDB_SERVICE)
+		return 1;
+	else if (type == SDB_METRIC)
+		return 2;
+	return 3;
+} /* usage_index */
+
+/* Negative values are added as their two's complement. */
+static void
+usage_add(sdb_store_usage_t *usage, int64_t objects, int64_t bytes)
+{
+	__atomic_add_fetch(&usage->objects, (uint64_t)objects, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&usage->bytes, (uint64_t)bytes, __ATOMIC_RELAXED);
+} /* usage_add */
+
+static void
+usage_load(const sdb_store_usage_t *usage, sdb_store_usage_t *res)
+{
+	res->objects = __atomic_load_n(&usage->objects, __ATOMIC_RELAXED);
+	res->bytes = __atomic_load_n(&usage->bytes, __ATOMIC_RELAXED);
+} /* usage_load */
+
+/* Returns the memory used by the dynamically allocated parts of a datum. */
+static size_t
+datum_size(const sdb_data_t *datum)
+{
+	int type = datum->type & 0xff;
+	size_t size = 0, i;
+
+	if (! (datum->type & SDB_TYPE_ARRAY)) {
+		if ((type == SDB_TYPE_STRING) && datum->data.string)
+			size = strlen(datum->data.string) + 1;
+		else if (type == SDB_TYPE_BINARY)
+			size = datum->data.binary.length;
+		else if ((type == SDB_TYPE_REGEX) && datum->data.re.raw)
+			size = strlen(datum->data.re.raw) + 1;
+		return size;
+	}
+
+	size = datum->data.array.length * sdb_data_sizeof(type);
+	for (i = 0; i < datum->data.array.length; ++i) {
+		sdb_data_t v = SDB_DATA_INIT;
+
+		if ((type != SDB_TYPE_STRING) && (type != SDB_TYPE_BINARY)
+				&& (type != SDB_TYPE_REGEX))
+			break;
+		if (! sdb_data_array_get(datum, i, &v))
+			size += datum_size(&v);
+	}
+	return size;
+} /* datum_size */
+
 static int
 store_obj_init(sdb_object_t *obj, va_list ap)
 {
@@ -71,9 +302,16 @@ store_obj_init(sdb_object_t *obj, va_list ap)
 
 	sobj->last_update = va_arg(ap, sdb_time_t);
 	sobj->interval = 0;
-	sobj->backends = NULL;
-	sobj->backends_num = 0;
+	sobj->backends = 0;
 	sobj->parent = NULL;
+	sobj->expiry = NULL;
+	sobj->generation = generation_next();
+
+	sobj->size = obj->type.size;
+	if (obj->name)
+		sobj->size += strlen(obj->name) + 1;
+	usage_add(&type_usage[usage_index(sobj->type)],
+			1, (int64_t)sobj->size);
 	return 0;
 } /* store_obj_init */
 
@@ -81,13 +319,18 @@ static void
 store_obj_destroy(sdb_object_t *obj)
 {
 	sdb_store_obj_t *sobj = STORE_OBJ(obj);
-	size_t i;
-
-	for (i = 0; i < sobj->backends_num; ++i)
-		free(sobj->backends[i]);
-	free(sobj->backends);
-	sobj->backends = NULL;
-	sobj->backends_num = 0;
+	uint64_t backends = sobj->backends;
+	int i;
+
+	/* the size is unset if the object has not been initialized */
+	if (sobj->size) {
+		usage_add(&type_usage[usage_index(sobj->type)],
+				-1, -(int64_t)sobj->size);
+		for (i = 0; backends; ++i, backends >>= 1)
+			if (backends & 1)
+				usage_add(&backend_usage[i], -1, -(int64_t)sobj->size);
+	}
+	sobj->backends = 0;
 
 	// We don't currently keep an extra reference for parent objects to
 	// avoid circular self-references which are not handled correctly by
@@ -115,6 +358,9 @@ sdb_host_init(sdb_object_t *obj, va_list ap)
 	sobj->attributes = sdb_avltree_create();
 	if (! sobj->attributes)
 		return -1;
+
+	sobj->usage.objects = 1;
+	sobj->usage.bytes = sobj->super.size;
 	return 0;
 } /* sdb_host_init */
 
@@ -137,18 +383,9 @@ sdb_host_destroy(sdb_object_t *obj)
 static int
 sdb_service_init(sdb_object_t *obj, va_list ap)
 {
-	sdb_service_t *sobj = SVC(obj);
-	int ret;
-
-	/* this will consume the first argument (type) of ap */
-	ret = store_obj_init(obj, ap);
-	if (ret)
-		return ret;
-
-	sobj->attributes = sdb_avltree_create();
-	if (! sobj->attributes)
-		return -1;
-	return 0;
+	/* this will consume the first argument (type) of ap; the attributes
+	 * are allocated lazily */
+	return store_obj_init(obj, ap);
 } /* sdb_service_init */
 
 static void
@@ -158,9 +395,7 @@ sdb_service_destroy(sdb_object_t *obj)
 	assert(obj);
 
 	store_obj_destroy(obj);
-
-	if (sobj->attributes)
-		sdb_avltree_destroy(sobj->attributes);
+	sdb_attrs_destroy(&sobj->attributes);
 } /* sdb_service_destroy */
 
 static int
@@ -174,10 +409,6 @@ sdb_metric_init(sdb_object_t *obj, va_list ap)
 	if (ret)
 		return ret;
 
-	sobj->attributes = sdb_avltree_create();
-	if (! sobj->attributes)
-		return -1;
-
 	sobj->store.type = sobj->store.id = NULL;
 	return 0;
 } /* sdb_metric_init */
@@ -189,14 +420,12 @@ sdb_metric_destroy(sdb_object_t *obj)
 	assert(obj);
 
 	store_obj_destroy(obj);
-
-	if (sobj->attributes)
-		sdb_avltree_destroy(sobj->attributes);
+	sdb_attrs_destroy(&sobj->attributes);
 
 	if (sobj->store.type)
-		free(sobj->store.type);
+		sdb_intern_release(sobj->store.type);
 	if (sobj->store.id)
-		free(sobj->store.id);
+		sdb_intern_release(sobj->store.id);
 } /* sdb_metric_destroy */
 
 static int
@@ -212,9 +441,16 @@ sdb_attr_init(sdb_object_t *obj, va_list ap)
 		return ret;
 	value = va_arg(ap, const sdb_data_t *);
 
-	if (value)
+	if (value) {
+		size_t size;
+
 		if (sdb_data_copy(&ATTR(obj)->value, value))
 			return -1;
+
+		size = datum_size(&ATTR(obj)->value);
+		STORE_OBJ(obj)->size += size;
+		usage_add(&type_usage[usage_index(SDB_ATTRIBUTE)], 0, (int64_t)size);
+	}
 	return 0;
 } /* sdb_attr_init */
 
@@ -251,75 +487,506 @@ static sdb_type_t sdb_attribute_type = {
 	sdb_attr_destroy
 };
 
+static int
+index_node_init(sdb_object_t *obj, va_list __attribute__((unused)) ap)
+{
+	INDEX_NODE(obj)->tree = sdb_avltree_create();
+	if (! INDEX_NODE(obj)->tree)
+		return -1;
+	return 0;
+} /* index_node_init */
+
+static void
+index_node_destroy(sdb_object_t *obj)
+{
+	sdb_avltree_destroy(INDEX_NODE(obj)->tree);
+} /* index_node_destroy */
+
+static sdb_type_t index_node_type = {
+	sizeof(index_node_t),
+	index_node_init,
+	index_node_destroy
+};
+
+static int
+expiry_init(sdb_object_t *obj, va_list ap)
+{
+	const char *hostname, *parent;
+
+	EXPIRY(obj)->type = va_arg(ap, int);
+	hostname = va_arg(ap, const char *);
+	EXPIRY(obj)->parent_type = va_arg(ap, int);
+	parent = va_arg(ap, const char *);
+
+	EXPIRY(obj)->hostname = sdb_intern(hostname);
+	if (! EXPIRY(obj)->hostname)
+		return -1;
+	if (parent) {
+		EXPIRY(obj)->parent = sdb_intern(parent);
+		if (! EXPIRY(obj)->parent)
+			return -1;
+	}
+	return 0;
+} /* expiry_init */
+
+static void
+expiry_destroy(sdb_object_t *obj)
+{
+	sdb_intern_release(EXPIRY(obj)->hostname);
+	sdb_intern_release(EXPIRY(obj)->parent);
+} /* expiry_destroy */
+
+static sdb_type_t expiry_type = {
+	sizeof(expiry_t),
+	expiry_init,
+	expiry_destroy
+};
+
 /*
  * private helper functions
  */
 
+static void
+shards_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < STORE_MAX_SHARDS; ++i) {
+		shards[i].hosts = NULL;
+		shards[i].index = NULL;
+		memset(shards[i].trigrams, 0, sizeof(shards[i].trigrams));
+		pthread_mutex_init(&shards[i].lock, /* attr = */ NULL);
+	}
+} /* shards_init */
+
+/* FNV-1a hash of the lower-case representation of the name */
+static uint32_t
+shard_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	for ( ; *name; ++name) {
+		h ^= (uint32_t)tolower((unsigned char)*name);
+		h *= 16777619U;
+	}
+	return h;
+} /* shard_hash */
+
+/* Readers don't lock shards; they access the hosts tree from inside an epoch
+ * read-side critical section instead. */
+static store_shard_t *
+get_shard(const char *name)
+{
+	pthread_once(&shards_once, shards_init);
+	return shards + (shard_hash(name) % shards_num);
+} /* get_shard */
+
+/* The hosts tree is created lazily by writers and published atomically. */
+static sdb_avltree_t *
+shard_hosts(store_shard_t *shard)
+{
+	return __atomic_load_n(&shard->hosts, __ATOMIC_ACQUIRE);
+} /* shard_hosts */
+
+/*
+ * lock_shard acquires the write lock on the shard responsible for the
+ * specified (canonicalized) host name and returns that shard.
+ */
+static store_shard_t *
+lock_shard(const char *name)
+{
+	pthread_once(&shards_once, shards_init);
+
+	while (42) {
+		size_t num = shards_num;
+		store_shard_t *shard = shards + (shard_hash(name) % num);
+
+		pthread_mutex_lock(&shard->lock);
+
+		/* the number of shards may only change while all shards are
+		 * locked; retry if we picked a shard based on an outdated value */
+		if (num == shards_num)
+			return shard;
+		pthread_mutex_unlock(&shard->lock);
+	}
+	return NULL;
+} /* lock_shard */
+
+static void
+unlock_shard(store_shard_t *shard)
+{
+	if (shard)
+		pthread_mutex_unlock(&shard->lock);
+} /* unlock_shard */
+
 static sdb_host_t *
-lookup_host(const char *name, bool canonicalize)
+lookup_host(store_shard_t *shard, const char *name)
 {
 	sdb_host_t *host;
+
+	assert(shard && name);
+
+	sdb_epoch_enter();
+	host = HOST(sdb_avltree_lookup(shard_hosts(shard), name));
+	sdb_epoch_exit();
+	return host;
+} /* lookup_host */
+
+static char *
+canonical_name(const char *name)
+{
 	char *cname;
 
 	assert(name);
-	if (! canonicalize)
-		return HOST(sdb_avltree_lookup(hosts, name));
 
-	cname = strdup(name);
-	cname = sdb_plugin_cname(cname);
-	if (! cname) {
+	cname = sdb_plugin_cname(strdup(name));
+	if (! cname)
 		sdb_log(SDB_LOG_ERR, "store: strdup failed");
-		return NULL;
+	return cname;
+} /* canonical_name */
+
+static void
+tree_destroy(void *tree)
+{
+	sdb_avltree_destroy(tree);
+} /* tree_destroy */
+
+static void
+string_release(void *str)
+{
+	sdb_intern_release(str);
+} /* string_release */
+
+/* Replace an interned string which may be accessed by lock-free readers. */
+static void
+publish_string(char **dst, char *str)
+{
+	char *old = *dst;
+
+	__atomic_store_n(dst, str, __ATOMIC_RELEASE);
+	if (old)
+		sdb_epoch_retire(old, string_release);
+} /* publish_string */
+
+static int
+backend_lookup(const char *name)
+{
+	int num = __atomic_load_n(&backend_names_num, __ATOMIC_ACQUIRE);
+	int i;
+
+	for (i = 0; i < num; ++i)
+		if (! strcasecmp(backend_names[i], name))
+			return i;
+	return -1;
+} /* backend_lookup */
+
+/* Returns the ID of the backend with the specified name, registering it if
+ * it's not known yet. */
+static int
+backend_id(const char *name)
+{
+	int id;
+
+	/* plugins usually submit many objects in a row */
+	if ((name == backend_last_name) && (backend_last_id >= 0)
+			&& (! strcasecmp(backend_names[backend_last_id], name)))
+		return backend_last_id;
+
+	id = backend_lookup(name);
+	if (id < 0) {
+		pthread_mutex_lock(&backend_names_lock);
+		id = backend_lookup(name);
+		if ((id < 0) && (backend_names_num < STORE_BACKENDS_MAX)) {
+			backend_names[backend_names_num] = strdup(name);
+			if (backend_names[backend_names_num]) {
+				id = backend_names_num;
+				__atomic_store_n(&backend_names_num, id + 1,
+						__ATOMIC_RELEASE);
+			}
+		}
+		else if (id < 0)
+			sdb_log(SDB_LOG_ERR, "store: Failed to register backend '%s': "
+					"too many backends (maximum: %d)",
+					name, STORE_BACKENDS_MAX);
+		pthread_mutex_unlock(&backend_names_lock);
+		if (id < 0)
+			return -1;
 	}
 
-	host = HOST(sdb_avltree_lookup(hosts, cname));
-	free(cname);
-	return host;
-} /* lookup_host */
+	backend_last_name = name;
+	backend_last_id = id;
+	return id;
+} /* backend_id */
+
+/* Backends are never removed from an object, so lock-free readers may
+ * observe the set of backends either before or after adding a new one. */
+static void
+backends_add(sdb_store_obj_t *obj, uint64_t backends)
+{
+	int i;
+
+	backends &= ~__atomic_load_n(&obj->backends, __ATOMIC_RELAXED);
+	if (! backends)
+		return;
+
+	backends &= ~__atomic_fetch_or(&obj->backends, backends,
+			__ATOMIC_RELEASE);
+	for (i = 0; backends; ++i, backends >>= 1)
+		if (backends & 1)
+			usage_add(&backend_usage[i], 1, (int64_t)obj->size);
+} /* backends_add */
 
 static int
 record_backend(sdb_store_obj_t *obj)
 {
 	const sdb_plugin_info_t *info;
-	char **tmp;
-	size_t i;
+	int id;
 
 	info = sdb_plugin_current();
 	if (! info)
 		return 0;
 
-	for (i = 0; i < obj->backends_num; ++i)
-		if (!strcasecmp(obj->backends[i], info->plugin_name))
-			return 0;
-
-	tmp = realloc(obj->backends,
-			(obj->backends_num + 1) * sizeof(*obj->backends));
-	if (! tmp)
-		return -1;
-
-	obj->backends = tmp;
-	obj->backends[obj->backends_num] = strdup(info->plugin_name);
-	if (! obj->backends[obj->backends_num])
+	id = backend_id(info->plugin_name);
+	if (id < 0)
 		return -1;
 
-	++obj->backends_num;
+	backends_add(obj, (uint64_t)1 << id);
 	return 0;
 } /* record_backend */
 
+int
+sdb_store_backend_id(const char *name)
+{
+	if (! name)
+		return -1;
+	return backend_id(name);
+} /* sdb_store_backend_id */
+
+size_t
+sdb_store_backend_names(uint64_t backends, const char **names)
+{
+	int num = __atomic_load_n(&backend_names_num, __ATOMIC_ACQUIRE);
+	size_t n = 0;
+	int i;
+
+	/* ignore IDs of unknown backends */
+	for (i = 0; backends && (i < num); ++i) {
+		if (! (backends & ((uint64_t)1 << i)))
+			continue;
+		names[n++] = backend_names[i];
+		backends &= ~((uint64_t)1 << i);
+	}
+	return n;
+} /* sdb_store_backend_names */
+
+/*
+ * The name index maps all trigrams (three-character substrings) of the names
+ * of hosts, services, and metrics to the hosts having an object of the
+ * respective type with that name. Trigrams are compared ignoring case.
+ */
+
+/* Add or remove a host to/from the postings of all trigrams of the name of
+ * the specified object. The shard's lock has to be acquired before calling
+ * this function. */
+static int
+names_index_update(store_shard_t *shard, sdb_store_obj_t *host,
+		sdb_store_obj_t *obj, bool add)
+{
+	sdb_avltree_t *trigrams = shard->trigrams[obj->type - 1];
+	const char *name = SDB_OBJ(obj)->name;
+	int status = 0;
+	size_t len, i;
+
+	if (! trigrams)
+		return 0;
+
+	len = strlen(name);
+	for (i = 0; i + 3 <= len; ++i) {
+		char trigram[4];
+		index_node_t *node;
+		sdb_object_t *h;
+
+		strncpy(trigram, name + i, 3);
+		trigram[3] = '\0';
+
+		node = INDEX_NODE(sdb_avltree_lookup(trigrams, trigram));
+		if ((! node) && add) {
+			node = INDEX_NODE(sdb_object_create(trigram, index_node_type));
+			if ((! node) || sdb_avltree_insert(trigrams, SDB_OBJ(node))) {
+				sdb_object_deref(SDB_OBJ(node));
+				status = -1;
+				continue;
+			}
+		}
+		if (! node)
+			continue;
+
+		if (add) {
+			h = sdb_avltree_lookup(node->tree, SDB_OBJ(host)->name);
+			if ((! h) && sdb_avltree_insert(node->tree, SDB_OBJ(host)))
+				status = -1;
+			sdb_object_deref(h);
+		}
+		else {
+			/* the name may include the same trigram multiple times */
+			sdb_avltree_remove(node->tree, SDB_OBJ(host)->name);
+			if (! sdb_avltree_size(node->tree))
+				sdb_avltree_remove(trigrams, trigram);
+		}
+		sdb_object_deref(SDB_OBJ(node));
+	}
+
+	if (status)
+		sdb_log(SDB_LOG_ERR, "store: Failed to add %s '%s' to the name index",
+				SDB_STORE_TYPE_TO_NAME(obj->type), name);
+	return status;
+} /* names_index_update */
+
+/* Add or remove a host and all of its children to/from the name index. The
+ * shard's lock has to be acquired before calling this function. */
+static int
+names_index_populate(store_shard_t *shard, sdb_store_obj_t *host, bool add)
+{
+	sdb_avltree_t *children[] = { HOST(host)->services, HOST(host)->metrics };
+	int status;
+	size_t i;
+
+	status = names_index_update(shard, host, host, add);
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(children); ++i) {
+		sdb_avltree_iter_t *iter = sdb_avltree_get_iter(children[i]);
+
+		while (sdb_avltree_iter_has_next(iter)) {
+			sdb_store_obj_t *obj = STORE_OBJ(sdb_avltree_iter_get_next(iter));
+			if (names_index_update(shard, host, obj, add))
+				status = -1;
+		}
+		sdb_avltree_iter_destroy(iter);
+	}
+	return status;
+} /* names_index_populate */
+
+/* Returns the time at which the specified object expires based on its own
+ * updates or zero if that's not known. */
+static sdb_time_t
+expiry_deadline(sdb_store_obj_t *obj)
+{
+	sdb_time_t deadline = 0;
+
+	if (expiry_ttl)
+		deadline = obj->last_update + expiry_ttl;
+	if (expiry_missed && obj->interval) {
+		sdb_time_t d = obj->last_update
+			+ (sdb_time_t)expiry_missed * obj->interval;
+		if ((! deadline) || (d < deadline))
+			deadline = d;
+	}
+	return deadline;
+} /* expiry_deadline */
+
+/* Schedule an expiry check for the specified object if its deadline is
+ * known. Usually, updates only move the deadline further into the future and
+ * pending checks will take care of that. A new check is scheduled if the
+ * deadline moved closer instead (e.g., once the update interval has become
+ * known) and any previous check will then be ignored. Failing to schedule a
+ * check is not fatal; another attempt will be made on the next update. The
+ * shard's lock has to be acquired before calling this function. */
+static void
+expiry_schedule(sdb_store_obj_t *obj)
+{
+	sdb_store_obj_t *host = obj, *parent = NULL;
+	sdb_object_t *timer;
+	sdb_time_t deadline;
+
+	if (! expiry_wheel)
+		return;
+	deadline = expiry_deadline(obj);
+	if ((! deadline) || (obj->expiry
+				&& (EXPIRY(obj->expiry)->deadline <= deadline)))
+		return;
+
+	while (host->parent)
+		host = host->parent;
+	if ((obj->type == SDB_ATTRIBUTE) && (obj->parent != host))
+		parent = obj->parent;
+
+	timer = sdb_object_create(SDB_OBJ(obj)->name, expiry_type, obj->type,
+			SDB_OBJ(host)->name, parent ? parent->type : 0,
+			parent ? SDB_OBJ(parent)->name : NULL);
+	if (! timer)
+		return;
+	EXPIRY(timer)->deadline = deadline;
+	if (! sdb_timerwheel_add(expiry_wheel, timer, deadline))
+		obj->expiry = timer;
+	sdb_object_deref(timer);
+} /* expiry_schedule */
+
+/* Account for objects added to or removed from the subtree of the host of
+ * 'obj'. The shard's lock has to be acquired before calling this function. */
+static void
+host_usage_add(sdb_store_obj_t *obj, int64_t objects, int64_t bytes)
+{
+	while (obj->parent)
+		obj = obj->parent;
+	assert(obj->type == SDB_HOST);
+	usage_add(&HOST(obj)->usage, objects, bytes);
+} /* host_usage_add */
+
+static sdb_store_obj_t *
+children_lookup(children_t children, const char *name)
+{
+	if (children.attrs)
+		return sdb_attrs_lookup(children.attrs, name);
+	return STORE_OBJ(sdb_avltree_lookup(children.tree, name));
+} /* children_lookup */
+
+static int
+children_insert(children_t children, sdb_store_obj_t *obj)
+{
+	if (children.attrs)
+		return sdb_attrs_insert(children.attrs, obj);
+	return sdb_avltree_insert(children.tree, SDB_OBJ(obj));
+} /* children_insert */
+
 static int
-store_obj(sdb_store_obj_t *parent, sdb_avltree_t *parent_tree,
+children_replace(children_t children, sdb_store_obj_t *obj)
+{
+	if (children.attrs)
+		return sdb_attrs_replace(children.attrs, obj);
+	return sdb_avltree_replace(children.tree, SDB_OBJ(obj));
+} /* children_replace */
+
+static int
+children_remove(children_t children, const char *name)
+{
+	if (children.attrs)
+		return sdb_attrs_remove(children.attrs, name);
+	return sdb_avltree_remove(children.tree, name);
+} /* children_remove */
+
+static void
+children_iter(sdb_attrs_iter_t *iter, children_t children)
+{
+	sdb_attrs_t tree = SDB_ATTRS_INIT;
+
+	tree.tree = children.tree;
+	sdb_attrs_iter_init(iter, children.attrs ? children.attrs : &tree);
+} /* children_iter */
+
+/* 'value' is the initial value of newly created attributes. */
+static int
+store_obj(sdb_store_obj_t *parent, children_t parent_tree,
 		int type, const char *name, sdb_time_t last_update,
-		sdb_store_obj_t **updated_obj)
+		const sdb_data_t *value, sdb_store_obj_t **updated_obj)
 {
 	sdb_store_obj_t *old, *new;
 	int status = 0;
 
-	assert(parent_tree);
+	assert(parent_tree.tree || parent_tree.attrs);
 
 	if (last_update <= 0)
 		last_update = sdb_gettime();
 
-	old = STORE_OBJ(sdb_avltree_lookup(parent_tree, name));
+	old = children_lookup(parent_tree, name);
 	if (old) {
 		if (old->last_update > last_update) {
 			sdb_log(SDB_LOG_DEBUG, "store: Cannot update %s '%s' - "
@@ -336,14 +1003,15 @@ store_obj(sdb_store_obj_t *parent, sdb_avltree_t *parent_tree,
 			status = 1;
 		}
 		else {
+			/* readers don't hold the shard lock */
 			sdb_time_t interval = last_update - old->last_update;
-			old->last_update = last_update;
+			__atomic_store_n(&old->last_update, last_update,
+					__ATOMIC_RELAXED);
 			if (interval) {
 				if (old->interval)
-					old->interval = (sdb_time_t)((0.9 * (double)old->interval)
+					interval = (sdb_time_t)((0.9 * (double)old->interval)
 							+ (0.1 * (double)interval));
-				else
-					old->interval = interval;
+				__atomic_store_n(&old->interval, interval, __ATOMIC_RELAXED);
 			}
 		}
 
@@ -352,9 +1020,8 @@ store_obj(sdb_store_obj_t *parent, sdb_avltree_t *parent_tree,
 	}
 	else {
 		if (type == SDB_ATTRIBUTE) {
-			/* the value will be updated by the caller */
 			new = STORE_OBJ(sdb_object_create(name, sdb_attribute_type,
-						type, last_update, NULL));
+						type, last_update, value));
 		}
 		else {
 			sdb_type_t t;
@@ -367,7 +1034,21 @@ store_obj(sdb_store_obj_t *parent, sdb_avltree_t *parent_tree,
 		}
 
 		if (new) {
-			status = sdb_avltree_insert(parent_tree, SDB_OBJ(new));
+			// Avoid circular self-references which are not handled
+			// correctly by the ref-count based management layer.
+			new->parent = parent;
+
+			/* readers may access the object as soon as it's in the tree */
+			status = children_insert(parent_tree, new);
+
+			if ((! status) && parent)
+				host_usage_add(parent, 1, (int64_t)new->size);
+
+			/* failing to update the index is not fatal */
+			if ((! status) && (type != SDB_ATTRIBUTE)) {
+				sdb_store_obj_t *host = parent ? parent : new;
+				names_index_update(get_shard(SDB_OBJ(host)->name), host, new, 1);
+			}
 
 			/* pass control to the tree or destroy in case of an error */
 			sdb_object_deref(SDB_OBJ(new));
@@ -384,46 +1065,68 @@ store_obj(sdb_store_obj_t *parent, sdb_avltree_t *parent_tree,
 	if (status < 0)
 		return status;
 	assert(new);
-
-	if (new->parent != parent) {
-		// Avoid circular self-references which are not handled
-		// correctly by the ref-count based management layer.
-		//sdb_object_deref(SDB_OBJ(new->parent));
-		//sdb_object_ref(SDB_OBJ(parent));
-		new->parent = parent;
-	}
+	assert(new->parent == parent);
 
 	if (updated_obj)
 		*updated_obj = new;
 
+	if (! status)
+		expiry_schedule(new);
+
 	if (record_backend(new))
 		return -1;
 	return status;
 } /* store_obj */
 
+/*
+ * store_attr updates an attribute. Attribute values are never modified in
+ * place because lock-free readers might be accessing them. Instead, a copy of
+ * the attribute including the new value replaces the old one in the tree.
+ * The current attribute is returned in 'updated_obj'.
+ */
 static int
-store_attr(sdb_store_obj_t *parent, sdb_avltree_t *attributes,
-		const char *key, const sdb_data_t *value, sdb_time_t last_update)
+store_attr(sdb_store_obj_t *parent, children_t attributes,
+		const char *key, const sdb_data_t *value, sdb_time_t last_update,
+		sdb_store_obj_t **updated_obj)
 {
 	sdb_store_obj_t *attr = NULL;
+	sdb_store_obj_t *new;
 	int status;
 
 	status = store_obj(parent, attributes, SDB_ATTRIBUTE,
-			key, last_update, &attr);
+			key, last_update, value, &attr);
 	if (status)
 		return status;
 
-	/* don't update unchanged values */
+	/* don't update unchanged values (including newly created attributes) */
+	assert(attr);
+	if (updated_obj)
+		*updated_obj = attr;
 	if (! sdb_data_cmp(&ATTR(attr)->value, value))
 		return status;
 
-	assert(attr);
-	if (sdb_data_copy(&ATTR(attr)->value, value))
+	new = STORE_OBJ(sdb_object_create(SDB_OBJ(attr)->name, sdb_attribute_type,
+				SDB_ATTRIBUTE, attr->last_update, value));
+	if (! new)
 		return -1;
+
+	new->interval = attr->interval;
+	new->parent = attr->parent;
+	backends_add(new, attr->backends);
+	new->expiry = attr->expiry;
+
+	if (children_replace(attributes, new))
+		status = -1;
+	else {
+		host_usage_add(parent, 0, (int64_t)new->size - (int64_t)attr->size);
+		if (updated_obj)
+			*updated_obj = new;
+	}
+	sdb_object_deref(SDB_OBJ(new));
 	return status;
 } /* store_attr */
 
-/* The host_lock has to be acquired before calling this function. */
+/* The host's shard lock has to be acquired before calling this function. */
 static sdb_avltree_t *
 get_host_children(sdb_host_t *host, int type)
 {
@@ -502,56 +1205,1848 @@ ts_tojson(sdb_timeseries_t *ts, sdb_strbuf_t *buf)
 } /* ts_tojson */
 
 /*
- * public API
+ * The attribute index maps values of selected host attributes to the hosts
+ * having that value. Values are identified by their (unquoted) string
+ * representation. Array values are indexed as a whole and by each of their
+ * elements. Both, value comparison and membership tests of the store match
+ * equal string representations (ignoring case), so looking up a value in the
+ * index returns a superset of all hosts matching an equality or IN
+ * comparison.
  */
 
-void
-sdb_store_clear(void)
+/* This function has to be called from inside an epoch critical section or
+ * with the shard's lock held. */
+static index_node_t *
+index_lookup(store_shard_t *shard, const char *key)
 {
-	sdb_avltree_destroy(hosts);
-	hosts = NULL;
-} /* sdb_store_clear */
+	sdb_object_t *obj;
 
-int
-sdb_store_host(const char *name, sdb_time_t last_update)
+	/* the index is never modified while its nodes are in use */
+	obj = sdb_avltree_lookup(__atomic_load_n(&shard->index, __ATOMIC_ACQUIRE),
+			key);
+	sdb_object_deref(obj);
+	return INDEX_NODE(obj);
+} /* index_lookup */
+
+static int
+index_value(index_node_t *attr, const sdb_data_t *value,
+		sdb_store_obj_t *host, bool add)
 {
-	char *cname = NULL;
+	char str[sdb_data_strlen(value) + 1];
+	index_node_t *v;
 	int status = 0;
 
-	if (! name)
-		return -1;
+	sdb_data_format(value, str, sizeof(str), SDB_UNQUOTED);
 
-	cname = sdb_plugin_cname(strdup(name));
-	if (! cname) {
-		sdb_log(SDB_LOG_ERR, "store: strdup failed");
-		return -1;
+	v = INDEX_NODE(sdb_avltree_lookup(attr->tree, str));
+	if ((! v) && add) {
+		v = INDEX_NODE(sdb_object_create(str, index_node_type));
+		if ((! v) || sdb_avltree_insert(attr->tree, SDB_OBJ(v))) {
+			sdb_object_deref(SDB_OBJ(v));
+			return -1;
+		}
 	}
+	if (! v)
+		return 0;
 
-	pthread_rwlock_wrlock(&host_lock);
-	if (! hosts)
-		if (! (hosts = sdb_avltree_create()))
+	if (add) {
+		sdb_object_t *obj = sdb_avltree_lookup(v->tree, SDB_OBJ(host)->name);
+		if (! obj)
+			status = sdb_avltree_insert(v->tree, SDB_OBJ(host));
+		sdb_object_deref(obj);
+	}
+	else {
+		/* the host may have been removed already if the same string
+		 * representation was used multiple times */
+		sdb_avltree_remove(v->tree, SDB_OBJ(host)->name);
+		if (! sdb_avltree_size(v->tree))
+			sdb_avltree_remove(attr->tree, SDB_OBJ(v)->name);
+	}
+	sdb_object_deref(SDB_OBJ(v));
+	return status;
+} /* index_value */
+
+/* Add or remove a host to/from the index for all string representations of
+ * the specified value. The shard's lock has to be acquired before calling
+ * this function. */
+static int
+index_update(index_node_t *attr, const sdb_data_t *value,
+		sdb_store_obj_t *host, bool add)
+{
+	int status;
+	size_t i;
+
+	if (sdb_data_isnull(value))
+		return 0;
+
+	status = index_value(attr, value, host, add);
+	if (! (value->type & SDB_TYPE_ARRAY))
+		return status;
+
+	for (i = 0; i < value->data.array.length; ++i) {
+		sdb_data_t v = SDB_DATA_INIT;
+
+		if (sdb_data_array_get(value, i, &v))
+			continue;
+		if (index_value(attr, &v, host, add))
+			status = -1;
+	}
+	return status;
+} /* index_update */
+
+/* Add all hosts of the shard to the index of the specified attribute. The
+ * shard's lock has to be acquired before calling this function. */
+static int
+index_populate(store_shard_t *shard, index_node_t *attr)
+{
+	sdb_avltree_iter_t *iter;
+	int status = 0;
+
+	iter = sdb_avltree_get_iter(shard->hosts);
+	while (sdb_avltree_iter_has_next(iter)) {
+		sdb_store_obj_t *host = STORE_OBJ(sdb_avltree_iter_get_next(iter));
+		sdb_store_obj_t *a;
+
+		a = STORE_OBJ(sdb_avltree_lookup(HOST(host)->attributes,
+					SDB_OBJ(attr)->name));
+		if (a && index_update(attr, &ATTR(a)->value, host, 1))
+			status = -1;
+		sdb_object_deref(SDB_OBJ(a));
+	}
+	sdb_avltree_iter_destroy(iter);
+	return status;
+} /* index_populate */
+
+/* The shard's lock has to be acquired before calling this function. */
+static void
+index_clear(store_shard_t *shard)
+{
+	sdb_avltree_iter_t *iter;
+
+	size_t i;
+
+	iter = sdb_avltree_get_iter(shard->index);
+	while (sdb_avltree_iter_has_next(iter))
+		sdb_avltree_clear(INDEX_NODE(sdb_avltree_iter_get_next(iter))->tree);
+	sdb_avltree_iter_destroy(iter);
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(shard->trigrams); ++i)
+		sdb_avltree_clear(shard->trigrams[i]);
+} /* index_clear */
+
+/* Update an attribute of a host and the attribute index. The shard's lock
+ * has to be acquired before calling this function. */
+static int
+store_host_attr(store_shard_t *shard, sdb_store_obj_t *host,
+		sdb_avltree_t *attrs, const char *key, const sdb_data_t *value,
+		sdb_time_t last_update, sdb_store_obj_t **updated_obj)
+{
+	index_node_t *index = index_lookup(shard, key);
+	sdb_store_obj_t *old = NULL;
+	int status;
+
+	if (index)
+		old = STORE_OBJ(sdb_avltree_lookup(attrs, key));
+
+	status = store_attr(host, CHILDREN_TREE(attrs),
+			key, value, last_update, updated_obj);
+
+	if ((! status) && index
+			&& ((! old) || sdb_data_cmp(&ATTR(old)->value, value))) {
+		if (old)
+			index_update(index, &ATTR(old)->value, host, 0);
+		if (index_update(index, value, host, 1))
+			sdb_log(SDB_LOG_ERR, "store: Failed to update index "
+					"for attribute '%s' of host '%s'",
+					key, SDB_OBJ(host)->name);
+	}
+	sdb_object_deref(SDB_OBJ(old));
+	return status;
+} /* store_host_attr */
+
+/* The shard's lock has to be acquired before calling this function. */
+static int
+metric_store(sdb_metric_t *metric, const char *type, const char *id)
+{
+	if ((! metric->store.type) || strcasecmp(metric->store.type, type))
+		publish_string(&metric->store.type, sdb_intern(type));
+	if ((! metric->store.id) || strcasecmp(metric->store.id, id))
+		publish_string(&metric->store.id, sdb_intern(id));
+
+	if ((! metric->store.type) || (! metric->store.id)) {
+		publish_string(&metric->store.type, NULL);
+		publish_string(&metric->store.id, NULL);
+		return -1;
+	}
+	return 0;
+} /* metric_store */
+
+/*
+ * Expired objects are removed from their parent's tree and from all indexes.
+ * Removing a service or metric leaves its host in the posting lists of the
+ * name index since other objects of the host may share the same trigrams.
+ * Index lookups re-check all candidates, so that only affects selectivity
+ * until the host itself is removed.
+ */
+
+static children_t
+get_children(sdb_store_obj_t *parent, int type)
+{
+	if (parent->type == SDB_HOST)
+		return CHILDREN_TREE(get_host_children(HOST(parent), type));
+	if (type != SDB_ATTRIBUTE)
+		return CHILDREN_NONE;
+	if (parent->type == SDB_SERVICE)
+		return CHILDREN_ATTRS(&SVC(parent)->attributes);
+	if (parent->type == SDB_METRIC)
+		return CHILDREN_ATTRS(&METRIC(parent)->attributes);
+	return CHILDREN_NONE;
+} /* get_children */
+
+/* Returns the tree holding objects of the specified type of a host, either
+ * directly or below the host's child 'parent' (if specified). A reference to
+ * the parent object (or the host) is stored in 'parent_obj'. The shard's lock
+ * has to be acquired before calling this function. */
+static children_t
+lookup_tree(store_shard_t *shard, const char *hostname, int type,
+		int parent_type, const char *parent, sdb_store_obj_t **parent_obj)
+{
+	sdb_store_obj_t *host;
+
+	*parent_obj = NULL;
+	if (type == SDB_HOST)
+		return CHILDREN_TREE(shard->hosts);
+
+	host = STORE_OBJ(lookup_host(shard, hostname));
+	if (host && parent) {
+		*parent_obj = STORE_OBJ(sdb_avltree_lookup(
+					get_host_children(HOST(host), parent_type), parent));
+		sdb_object_deref(SDB_OBJ(host));
+	}
+	else
+		*parent_obj = host;
+	return *parent_obj ? get_children(*parent_obj, type) : CHILDREN_NONE;
+} /* lookup_tree */
+
+/* Notify all watchers about a changed object. Changes of attributes and
+ * child objects are reported as updates of the watched parent object. The
+ * lock of the object's shard has to be acquired before calling this
+ * function. */
+static void
+watch_notify(sdb_store_obj_t *obj, int event)
+{
+	size_t i;
+
+	if (! __atomic_load_n(&watchers_num, __ATOMIC_ACQUIRE))
+		return;
+
+	pthread_rwlock_rdlock(&watchers_lock);
+	for (i = 0; i < watchers_num; ++i) {
+		sdb_store_obj_t *o = obj;
+		int ev = event;
+
+		while (o && (o->type != watchers[i].type)) {
+			o = o->parent;
+			ev = SDB_STORE_UPDATED;
+		}
+		if (o)
+			watchers[i].cb(o, ev, watchers[i].user_data);
+	}
+	pthread_rwlock_unlock(&watchers_lock);
+} /* watch_notify */
+
+/* Apply an update while holding the lock of the host's shard. 'host' is the
+ * host referenced by the update or NULL if it does not exist (yet). */
+static int
+store_apply(store_shard_t *shard, sdb_host_t *host, const char *cname,
+		const store_update_t *u)
+{
+	sdb_store_obj_t *obj = NULL;
+	sdb_avltree_t *tree;
+	int status;
+
+	if (u->type == SDB_HOST) {
+		if (! shard->hosts) {
+			sdb_avltree_t *hosts = sdb_avltree_create();
+			if (! hosts)
+				return -1;
+			__atomic_store_n(&shard->hosts, hosts, __ATOMIC_RELEASE);
+		}
+		status = store_obj(NULL, CHILDREN_TREE(shard->hosts), SDB_HOST,
+				cname, u->last_update, NULL, &obj);
+	}
+	else if ((u->type == SDB_ATTRIBUTE) && (u->parent_type == SDB_HOST)) {
+		tree = get_host_children(host, SDB_ATTRIBUTE);
+		if (! tree) {
+			sdb_log(SDB_LOG_ERR, "store: Failed to store attribute '%s' - "
+					"host '%s' not found", u->name, u->hostname);
+			return -1;
+		}
+		status = store_host_attr(shard, STORE_OBJ(host), tree,
+				u->name, u->value, u->last_update, &obj);
+	}
+	else if (u->type == SDB_ATTRIBUTE) {
+		sdb_store_obj_t *parent;
+
+		tree = get_host_children(host, u->parent_type);
+		if (! tree) {
+			sdb_log(SDB_LOG_ERR, "store: Failed to store attribute '%s' "
+					"for %s '%s' - host '%s' not found", u->name,
+					SDB_STORE_TYPE_TO_NAME(u->parent_type), u->parent,
+					u->hostname);
+			return -1;
+		}
+		parent = STORE_OBJ(sdb_avltree_lookup(tree, u->parent));
+		if (! parent) {
+			sdb_log(SDB_LOG_ERR, "store: Failed to store attribute '%s' - "
+					"%s '%s/%s' not found", u->name,
+					SDB_STORE_TYPE_TO_NAME(u->parent_type),
+					u->hostname, u->parent);
+			return -1;
+		}
+		status = store_attr(parent, get_children(parent, SDB_ATTRIBUTE),
+				u->name, u->value, u->last_update, &obj);
+		sdb_object_deref(SDB_OBJ(parent));
+	}
+	else {
+		tree = get_host_children(host, u->type);
+		if (! tree) {
+			sdb_log(SDB_LOG_ERR, "store: Failed to store %s '%s' - "
+					"host '%s' not found", SDB_STORE_TYPE_TO_NAME(u->type),
+					u->name, u->hostname);
+			return -1;
+		}
+		status = store_obj(STORE_OBJ(host), CHILDREN_TREE(tree), u->type,
+				u->name, u->last_update, NULL, &obj);
+		if ((! status) && u->store)
+			status = metric_store(METRIC(obj), u->store->type, u->store->id);
+	}
+
+	if (! status) {
+		generation_bump(obj);
+		sdb_store_journal_update(obj);
+		watch_notify(obj, SDB_STORE_UPDATED);
+	}
+	return status;
+} /* store_apply */
+
+/* Pass an update on to all store writer plugins. */
+static int
+store_forward(const store_update_t *u)
+{
+	if (u->type == SDB_HOST)
+		return sdb_plugin_store_host(u->name, u->last_update);
+	if (u->type == SDB_SERVICE)
+		return sdb_plugin_store_service(u->hostname, u->name, u->last_update);
+	if (u->type == SDB_METRIC)
+		return sdb_plugin_store_metric(u->hostname, u->name,
+				u->store, u->last_update);
+	if (u->parent_type == SDB_SERVICE)
+		return sdb_plugin_store_service_attribute(u->hostname, u->parent,
+				u->name, u->value, u->last_update);
+	if (u->parent_type == SDB_METRIC)
+		return sdb_plugin_store_metric_attribute(u->hostname, u->parent,
+				u->name, u->value, u->last_update);
+	return sdb_plugin_store_attribute(u->hostname,
+			u->name, u->value, u->last_update);
+} /* store_forward */
+
+static int
+store_update(const store_update_t *u)
+{
+	store_shard_t *shard;
+	sdb_host_t *host = NULL;
+	char *cname;
+	int status;
+
+	cname = canonical_name(u->hostname);
+	if (! cname)
+		return -1;
+
+	shard = lock_shard(cname);
+	if (u->type != SDB_HOST)
+		host = lookup_host(shard, cname);
+	status = store_apply(shard, host, cname, u);
+	sdb_object_deref(SDB_OBJ(host));
+	unlock_shard(shard);
+	free(cname);
+
+	if (store_forward(u))
+		status = -1;
+	return status;
+} /* store_update */
+
+/*
+ * store batches
+ */
+
+static char *
+batch_strdup(sdb_store_batch_t *batch, const char *str)
+{
+	batch_chunk_t *chunk = batch->strings;
+	size_t len = strlen(str) + 1;
+	char *copy;
+
+	if ((! chunk) || (chunk->size - chunk->used < len)) {
+		size_t size = len > BATCH_CHUNK_SIZE ? len : BATCH_CHUNK_SIZE;
+
+		chunk = malloc(sizeof(*chunk) + size);
+		if (! chunk)
+			return NULL;
+		chunk->used = 0;
+		chunk->size = size;
+		chunk->next = batch->strings;
+		batch->strings = chunk;
+	}
+
+	copy = chunk->data + chunk->used;
+	memcpy(copy, str, len);
+	chunk->used += len;
+	return copy;
+} /* batch_strdup */
+
+static void
+batch_destroy(sdb_store_batch_t *batch)
+{
+	size_t i;
+
+	for (i = 0; i < batch->updates_num; ++i)
+		sdb_data_free_datum(&batch->updates[i].value);
+	free(batch->updates);
+
+	while (batch->strings) {
+		batch_chunk_t *chunk = batch->strings;
+		batch->strings = chunk->next;
+		free(chunk);
+	}
+	free(batch);
+} /* batch_destroy */
+
+static int
+batch_add(sdb_store_batch_t *batch, const store_update_t *u)
+{
+	batch_update_t *update;
+
+	if (batch->updates_num >= batch->updates_size) {
+		size_t size = batch->updates_size ? 2 * batch->updates_size : 64;
+		batch_update_t *updates;
+
+		updates = realloc(batch->updates, size * sizeof(*updates));
+		if (! updates)
+			return -1;
+		batch->updates = updates;
+		batch->updates_size = size;
+	}
+
+	update = batch->updates + batch->updates_num;
+	memset(update, 0, sizeof(*update));
+	update->u = *u;
+	update->u.value = NULL;
+	update->u.store = NULL;
+	update->seq = batch->updates_num;
+
+	/* backends usually report all objects of a host in a row */
+	if (batch->updates_num
+			&& (! strcmp(update[-1].u.hostname, u->hostname)))
+		update->u.hostname = update[-1].u.hostname;
+	else
+		update->u.hostname = batch_strdup(batch, u->hostname);
+	update->u.name = batch_strdup(batch, u->name);
+	if (u->parent)
+		update->u.parent = batch_strdup(batch, u->parent);
+	if ((! update->u.hostname) || (! update->u.name)
+			|| (u->parent && (! update->u.parent)))
+		return -1;
+
+	if (u->value && sdb_data_copy(&update->value, u->value))
+		return -1;
+	if (u->store) {
+		update->store.type = batch_strdup(batch, u->store->type);
+		update->store.id = batch_strdup(batch, u->store->id);
+		if ((! update->store.type) || (! update->store.id)) {
+			sdb_data_free_datum(&update->value);
+			return -1;
+		}
+	}
+
+	++batch->updates_num;
+	return 0;
+} /* batch_add */
+
+static int
+batch_cmp_hostname(const void *a, const void *b)
+{
+	const batch_update_t *u1 = a, *u2 = b;
+	int diff;
+
+	diff = strcmp(u1->u.hostname, u2->u.hostname);
+	if (diff)
+		return diff;
+	return u1->seq < u2->seq ? -1 : u1->seq > u2->seq;
+} /* batch_cmp_hostname */
+
+/* Parents have to be updated before their children. */
+static int
+batch_depth(const store_update_t *u)
+{
+	if (u->type == SDB_HOST)
+		return 0;
+	if ((u->type == SDB_ATTRIBUTE) && (u->parent_type != SDB_HOST))
+		return 2;
+	return 1;
+} /* batch_depth */
+
+static int
+batch_cmp_cname(const char *n1, const char *n2)
+{
+	if ((! n1) || (! n2))
+		return (n1 != NULL) - (n2 != NULL);
+	return strcasecmp(n1, n2);
+} /* batch_cmp_cname */
+
+/* Sort updates by host, depth, and name, in the order used by the
+ * respective trees. Updates of the same object retain their order. */
+static int
+batch_cmp(const void *a, const void *b)
+{
+	const batch_update_t *u1 = a, *u2 = b;
+	int diff;
+
+	diff = batch_cmp_cname(u1->cname, u2->cname);
+	if (diff)
+		return diff;
+	diff = batch_depth(&u1->u) - batch_depth(&u2->u);
+	if (diff)
+		return diff;
+	if (u1->u.parent && u2->u.parent) {
+		diff = u1->u.parent_type - u2->u.parent_type;
+		if (! diff)
+			diff = strcasecmp(u1->u.parent, u2->u.parent);
+		if (diff)
+			return diff;
+	}
+	diff = u1->u.type - u2->u.type;
+	if (! diff)
+		diff = strcasecmp(u1->u.name, u2->u.name);
+	if (diff)
+		return diff;
+	return u1->seq < u2->seq ? -1 : u1->seq > u2->seq;
+} /* batch_cmp */
+
+/* Canonicalize the host name of all updates, once per distinct name. */
+static void
+batch_canonicalize(sdb_store_batch_t *batch)
+{
+	size_t i;
+
+	qsort(batch->updates, batch->updates_num, sizeof(*batch->updates),
+			batch_cmp_hostname);
+	for (i = 0; i < batch->updates_num; ++i) {
+		batch_update_t *update = batch->updates + i;
+		char *cname;
+
+		if (i && (! strcmp(update[-1].u.hostname, update->u.hostname))) {
+			update->cname = update[-1].cname;
+			continue;
+		}
+
+		cname = canonical_name(update->u.hostname);
+		update->cname = cname ? batch_strdup(batch, cname) : NULL;
+		free(cname);
+	}
+} /* batch_canonicalize */
+
+/* Apply all updates of a host, starting at index 'start'. Returns the index
+ * of the first update of the next host. */
+static size_t
+batch_apply_host(sdb_store_batch_t *batch, size_t start, int *status)
+{
+	batch_update_t *updates = batch->updates;
+	const char *cname = updates[start].cname;
+	store_shard_t *shard;
+	sdb_host_t *host;
+	size_t end, i;
+
+	for (end = start + 1; end < batch->updates_num; ++end)
+		if (batch_cmp_cname(cname, updates[end].cname))
+			break;
+
+	if (! cname) {
+		/* canonicalizing the host name failed */
+		*status = -1;
+		return end;
+	}
+
+	shard = lock_shard(cname);
+	host = lookup_host(shard, cname);
+	for (i = start; i < end; ++i) {
+		store_update_t u = updates[i].u;
+
+		if (u.type == SDB_ATTRIBUTE)
+			u.value = &updates[i].value;
+		if (updates[i].store.type)
+			u.store = &updates[i].store;
+
+		if (store_apply(shard, host, updates[i].cname, &u) < 0)
+			*status = -1;
+
+		if (u.type == SDB_HOST) {
+			/* the host might have been created just now */
+			sdb_object_deref(SDB_OBJ(host));
+			host = lookup_host(shard, cname);
+		}
+	}
+	sdb_object_deref(SDB_OBJ(host));
+	unlock_shard(shard);
+	return end;
+} /* batch_apply_host */
+
+/* Returns the latest deadline of the specified object and all of its
+ * children. The shard's lock has to be acquired before calling this
+ * function. */
+static sdb_time_t
+expiry_deadline_all(sdb_store_obj_t *obj)
+{
+	int types[] = { SDB_SERVICE, SDB_METRIC, SDB_ATTRIBUTE };
+	sdb_time_t deadline = expiry_deadline(obj);
+	size_t i;
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(types); ++i) {
+		sdb_attrs_iter_t iter;
+
+		children_iter(&iter, get_children(obj, types[i]));
+		while (sdb_attrs_iter_has_next(&iter)) {
+			sdb_time_t d = expiry_deadline_all(sdb_attrs_iter_get_next(&iter));
+			if (d > deadline)
+				deadline = d;
+		}
+		sdb_attrs_iter_finish(&iter);
+	}
+	return deadline;
+} /* expiry_deadline_all */
+
+/* Schedule expiry checks for an object and all of its children. The shard's
+ * lock has to be acquired before calling this function. */
+static void
+expiry_schedule_all(sdb_store_obj_t *obj)
+{
+	int types[] = { SDB_SERVICE, SDB_METRIC, SDB_ATTRIBUTE };
+	size_t i;
+
+	expiry_schedule(obj);
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(types); ++i) {
+		sdb_attrs_iter_t iter;
+
+		children_iter(&iter, get_children(obj, types[i]));
+		while (sdb_attrs_iter_has_next(&iter))
+			expiry_schedule_all(sdb_attrs_iter_get_next(&iter));
+		sdb_attrs_iter_finish(&iter);
+	}
+} /* expiry_schedule_all */
+
+/* The shard's lock has to be acquired before calling this function. */
+static void
+subtree_usage(sdb_store_obj_t *obj, sdb_store_usage_t *usage)
+{
+	int types[] = { SDB_SERVICE, SDB_METRIC, SDB_ATTRIBUTE };
+	size_t i;
+
+	++usage->objects;
+	usage->bytes += obj->size;
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(types); ++i) {
+		sdb_attrs_iter_t iter;
+
+		children_iter(&iter, get_children(obj, types[i]));
+		while (sdb_attrs_iter_has_next(&iter))
+			subtree_usage(sdb_attrs_iter_get_next(&iter), usage);
+		sdb_attrs_iter_finish(&iter);
+	}
+} /* subtree_usage */
+
+/* The shard's lock has to be acquired before calling this function. */
+static void
+expiry_remove(store_shard_t *shard, children_t tree, sdb_store_obj_t *obj)
+{
+	if (obj->type == SDB_HOST) {
+		sdb_avltree_iter_t *iter = sdb_avltree_get_iter(shard->index);
+
+		while (sdb_avltree_iter_has_next(iter)) {
+			index_node_t *attr = INDEX_NODE(sdb_avltree_iter_get_next(iter));
+			sdb_store_obj_t *a;
+
+			a = STORE_OBJ(sdb_avltree_lookup(HOST(obj)->attributes,
+						SDB_OBJ(attr)->name));
+			if (a)
+				index_update(attr, &ATTR(a)->value, obj, 0);
+			sdb_object_deref(SDB_OBJ(a));
+		}
+		sdb_avltree_iter_destroy(iter);
+
+		names_index_populate(shard, obj, 0);
+	}
+	else if ((obj->type == SDB_ATTRIBUTE) && (obj->parent->type == SDB_HOST)) {
+		index_node_t *attr = index_lookup(shard, SDB_OBJ(obj)->name);
+		if (attr)
+			index_update(attr, &ATTR(obj)->value, obj->parent, 0);
+	}
+
+	if (obj->type != SDB_HOST) {
+		sdb_store_usage_t usage = { 0, 0 };
+		subtree_usage(obj, &usage);
+		host_usage_add(obj->parent,
+				-(int64_t)usage.objects, -(int64_t)usage.bytes);
+	}
+
+	sdb_log(SDB_LOG_DEBUG, "store: Removing expired %s '%s'",
+			SDB_STORE_TYPE_TO_NAME(obj->type), SDB_OBJ(obj)->name);
+	generation_bump(obj->parent);
+	children_remove(tree, SDB_OBJ(obj)->name);
+} /* expiry_remove */
+
+/* Check the object referenced by the specified timer and remove it if it
+ * expired or schedule another check else. Returns true if the object has
+ * been removed. */
+static bool
+expiry_check(expiry_t *timer, sdb_time_t now)
+{
+	store_shard_t *shard;
+	sdb_store_obj_t *parent = NULL, *obj = NULL;
+	children_t tree;
+	bool removed = 0;
+
+	shard = lock_shard(timer->hostname);
+	tree = lookup_tree(shard, timer->hostname, timer->type,
+			timer->parent_type, timer->parent, &parent);
+	obj = children_lookup(tree, SDB_OBJ(timer)->name);
+
+	/* ignore objects which have been removed or re-created in the meantime
+	 * (in which case they have a timer of their own) */
+	if (obj && (obj->expiry == SDB_OBJ(timer))) {
+		sdb_time_t deadline = expiry_deadline_all(obj);
+
+		if (deadline > now) {
+			timer->deadline = deadline;
+			if (sdb_timerwheel_add(expiry_wheel, SDB_OBJ(timer), deadline))
+				obj->expiry = NULL;
+		}
+		else if (deadline) {
+			sdb_store_journal_remove(obj);
+			watch_notify(obj, SDB_STORE_EXPIRED);
+			expiry_remove(shard, tree, obj);
+			removed = 1;
+		}
+		else
+			obj->expiry = NULL;
+	}
+	unlock_shard(shard);
+
+	sdb_object_deref(SDB_OBJ(obj));
+	sdb_object_deref(SDB_OBJ(parent));
+	return removed;
+} /* expiry_check */
+
+static void
+trigrams_add_literal(const char *lit, size_t len,
+		char (*trigrams)[4], size_t *num)
+{
+	size_t i;
+
+	for (i = 0; i + 3 <= len; ++i) {
+		strncpy(trigrams[*num], lit + i, 3);
+		trigrams[*num][3] = '\0';
+		++(*num);
+	}
+} /* trigrams_add_literal */
+
+/* Skip a bracket expression, returning a pointer to the first character
+ * following it. */
+static const char *
+regex_skip_bracket(const char *p)
+{
+	assert(*p == '[');
+	++p;
+	if (*p == '^')
+		++p;
+	if (*p == ']')
+		++p;
+
+	while (*p && (*p != ']')) {
+		/* character classes, collating symbols, equivalence classes */
+		if ((*p == '[') && ((p[1] == ':') || (p[1] == '.') || (p[1] == '='))) {
+			char delim = p[1];
+
+			p += 2;
+			while (*p && (! ((*p == delim) && (p[1] == ']'))))
+				++p;
+			if (*p)
+				p += 2;
+			continue;
+		}
+		++p;
+	}
+	return *p ? p + 1 : p;
+} /* regex_skip_bracket */
+
+/* Skip a parenthesized sub-expression, returning a pointer to the first
+ * character following it. */
+static const char *
+regex_skip_group(const char *p)
+{
+	int depth = 0;
+
+	while (*p) {
+		if (*p == '\\') {
+			p += p[1] ? 2 : 1;
+			continue;
+		}
+		if (*p == '[') {
+			p = regex_skip_bracket(p);
+			continue;
+		}
+
+		if (*p == '(')
+			++depth;
+		else if ((*p == ')') && (! --depth))
+			return p + 1;
+		++p;
+	}
+	return p;
+} /* regex_skip_group */
+
+/*
+ * regex_trigrams determines trigrams which are part of any string matching the
+ * specified POSIX extended regular expression. They are derived from literal
+ * strings which are not subject to any alternation or optional repetition.
+ * 'trigrams' has to provide space for at least strlen(re) entries. Returns
+ * the number of trigrams or a negative value if no literal strings could be
+ * determined reliably.
+ */
+static int
+regex_trigrams(const char *re, char (*trigrams)[4])
+{
+	char lit[strlen(re) + 1];
+	size_t lit_len = 0, num = 0;
+	const char *p = re;
+
+	while (*p) {
+		if (*p == '\\') {
+			/* GNU extensions (\w, \b, ...) and back-references */
+			if ((! p[1]) || isalnum((unsigned char)p[1])) {
+				trigrams_add_literal(lit, lit_len, trigrams, &num);
+				lit_len = 0;
+				p += p[1] ? 2 : 1;
+				continue;
+			}
+			lit[lit_len] = p[1];
+			++lit_len;
+			p += 2;
+		}
+		else if ((*p == '*') || (*p == '?') || (*p == '{')) {
+			/* the previous atom is optional */
+			if (lit_len)
+				--lit_len;
+			trigrams_add_literal(lit, lit_len, trigrams, &num);
+			lit_len = 0;
+
+			if (*p == '{')
+				while (*p && (*p != '}'))
+					++p;
+			if (*p)
+				++p;
+		}
+		else if (*p == '+') {
+			/* the previous atom is required but may be repeated */
+			trigrams_add_literal(lit, lit_len, trigrams, &num);
+			if (lit_len) {
+				lit[0] = lit[lit_len - 1];
+				lit_len = 1;
+			}
+			++p;
+		}
+		else if (*p == '|') {
+			/* alternation on the top-level; sub-expressions are skipped */
+			return -1;
+		}
+		else if ((*p == '(') || (*p == '[') || (*p == '.')
+				|| (*p == '^') || (*p == '$') || (*p == ')')) {
+			trigrams_add_literal(lit, lit_len, trigrams, &num);
+			lit_len = 0;
+
+			if (*p == '(')
+				p = regex_skip_group(p);
+			else if (*p == '[')
+				p = regex_skip_bracket(p);
+			else
+				++p;
+		}
+		else {
+			lit[lit_len] = *p;
+			++lit_len;
+			++p;
+		}
+	}
+
+	trigrams_add_literal(lit, lit_len, trigrams, &num);
+	return num ? (int)num : -1;
+} /* regex_trigrams */
+
+/*
+ * A host merge iterates over hosts in name order by merging sorted sequences
+ * of hosts (e.g., the hosts of all shards) using a binary heap of tree
+ * iterators. Each iterator operates on the version of its tree at the time
+ * it was added to the merge, so no locks are required. The same host may be
+ * returned multiple times (in a row) if it's included in multiple trees.
+ */
+typedef struct {
+	sdb_avltree_iter_t **heap;
+	size_t heap_len;
+	size_t heap_size;
+
+	/* temporary trees owned by the merge */
+	sdb_avltree_t **trees;
+	size_t trees_num;
+} host_merge_t;
+#define HOST_MERGE_INIT { NULL, 0, 0, NULL, 0 }
+
+static int
+merge_cmp(host_merge_t *m, size_t i1, size_t i2)
+{
+	return strcasecmp(sdb_avltree_iter_peek_next(m->heap[i1])->name,
+			sdb_avltree_iter_peek_next(m->heap[i2])->name);
+} /* merge_cmp */
+
+static void
+merge_sift_down(host_merge_t *m, size_t i)
+{
+	while (42) {
+		size_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+		sdb_avltree_iter_t *tmp;
+
+		if ((l < m->heap_len) && (merge_cmp(m, l, min) < 0))
+			min = l;
+		if ((r < m->heap_len) && (merge_cmp(m, r, min) < 0))
+			min = r;
+		if (min == i)
+			break;
+
+		tmp = m->heap[i];
+		m->heap[i] = m->heap[min];
+		m->heap[min] = tmp;
+		i = min;
+	}
+} /* merge_sift_down */
+
+static void
+merge_destroy(host_merge_t *m)
+{
+	size_t i;
+
+	for (i = 0; i < m->heap_len; ++i)
+		sdb_avltree_iter_destroy(m->heap[i]);
+	free(m->heap);
+	m->heap = NULL;
+	m->heap_len = m->heap_size = 0;
+
+	for (i = 0; i < m->trees_num; ++i)
+		sdb_avltree_destroy(m->trees[i]);
+	free(m->trees);
+	m->trees = NULL;
+	m->trees_num = 0;
+} /* merge_destroy */
+
+/* Add a tree of hosts to the merge. All trees have to be added before
+ * calling merge_start. This function has to be called from inside an epoch
+ * critical section. */
+static int
+merge_add(host_merge_t *m, sdb_avltree_t *hosts)
+{
+	sdb_avltree_iter_t *iter;
+
+	if (! sdb_avltree_size(hosts))
+		return 0;
+
+	if (m->heap_len >= m->heap_size) {
+		size_t size = m->heap_size ? 2 * m->heap_size : STORE_MAX_SHARDS;
+		sdb_avltree_iter_t **tmp = realloc(m->heap, size * sizeof(*tmp));
+
+		if (! tmp)
+			return -1;
+		m->heap = tmp;
+		m->heap_size = size;
+	}
+
+	iter = sdb_avltree_get_iter(hosts);
+	if (! iter)
+		return -1;
+	if (! sdb_avltree_iter_has_next(iter)) {
+		sdb_avltree_iter_destroy(iter);
+		return 0;
+	}
+
+	m->heap[m->heap_len] = iter;
+	++m->heap_len;
+	return 0;
+} /* merge_add */
+
+static void
+merge_start(host_merge_t *m)
+{
+	size_t i;
+
+	for (i = m->heap_len; i > 0; --i)
+		merge_sift_down(m, i - 1);
+} /* merge_start */
+
+/* Add the hosts of all shards to the merge. This function has to be called
+ * from inside an epoch critical section. */
+static int
+merge_add_all(host_merge_t *m)
+{
+	size_t num, i;
+
+	pthread_once(&shards_once, shards_init);
+
+	/* hosts only ever live in the first 'shards_num' shards */
+	num = shards_num;
+	for (i = 0; i < num; ++i) {
+		if (merge_add(m, shard_hosts(&shards[i]))) {
+			sdb_log(SDB_LOG_ERR, "store: Failed to create iterator "
+					"for shard %zu", i);
+			return -1;
+		}
+	}
+	return 0;
+} /* merge_add_all */
+
+/* Add the hosts having the specified value of an indexed attribute in any
+ * shard to the merge. */
+static int
+merge_add_indexed(host_merge_t *m, const char *key, const sdb_data_t *value)
+{
+	char str[sdb_data_strlen(value) + 1];
+	size_t num, i;
+
+	if (sdb_data_isnull(value))
+		return 0;
+	sdb_data_format(value, str, sizeof(str), SDB_UNQUOTED);
+
+	num = shards_num;
+	for (i = 0; i < num; ++i) {
+		index_node_t *attr = index_lookup(&shards[i], key);
+		sdb_object_t *v;
+		int status;
+
+		if (! attr)
+			continue;
+
+		v = sdb_avltree_lookup(attr->tree, str);
+		if (! v)
+			continue;
+		status = merge_add(m, INDEX_NODE(v)->tree);
+		sdb_object_deref(v);
+		if (status)
+			return -1;
+	}
+	return 0;
+} /* merge_add_indexed */
+
+/* Add the hosts having objects of the specified type whose names include all
+ * of the specified trigrams to the merge. */
+static int
+merge_add_trigrams(host_merge_t *m, int type, char (*trigrams)[4], size_t num)
+{
+	sdb_avltree_t *result, **tmp;
+	size_t i;
+
+	tmp = realloc(m->trees, (m->trees_num + 1) * sizeof(*tmp));
+	if (! tmp)
+		return -1;
+	m->trees = tmp;
+
+	/* the intersection of the posting lists of all trigrams */
+	result = sdb_avltree_create();
+	if (! result)
+		return -1;
+	m->trees[m->trees_num] = result;
+	++m->trees_num;
+
+	for (i = 0; i < shards_num; ++i) {
+		sdb_avltree_t *index, *postings[num];
+		sdb_avltree_iter_t *iter;
+		size_t min = 0, j;
+
+		index = __atomic_load_n(&shards[i].trigrams[type - 1],
+				__ATOMIC_ACQUIRE);
+		if (! index)
+			continue;
+
+		for (j = 0; j < num; ++j) {
+			sdb_object_t *node = sdb_avltree_lookup(index, trigrams[j]);
+			if (! node)
+				break;
+			/* the index is never modified while its nodes are in use */
+			postings[j] = INDEX_NODE(node)->tree;
+			sdb_object_deref(node);
+
+			if (sdb_avltree_size(postings[j]) < sdb_avltree_size(postings[min]))
+				min = j;
+		}
+		if (j < num)
+			continue;
+
+		iter = sdb_avltree_get_iter(postings[min]);
+		while (sdb_avltree_iter_has_next(iter)) {
+			sdb_object_t *host = sdb_avltree_iter_get_next(iter);
+
+			for (j = 0; j < num; ++j) {
+				sdb_object_t *obj;
+
+				if (j == min)
+					continue;
+				obj = sdb_avltree_lookup(postings[j], host->name);
+				sdb_object_deref(obj);
+				if (! obj)
+					break;
+			}
+			if ((j == num) && sdb_avltree_insert(result, host)) {
+				sdb_avltree_iter_destroy(iter);
+				return -1;
+			}
+		}
+		sdb_avltree_iter_destroy(iter);
+	}
+	return merge_add(m, result);
+} /* merge_add_trigrams */
+
+/* Add the hosts with the specified names (a string or an array of strings)
+ * to the merge. This function has to be called from inside an epoch critical
+ * section. */
+static int
+merge_add_names(host_merge_t *m, const sdb_data_t *names)
+{
+	sdb_avltree_t *result, **tmp;
+	char * const *values = &names->data.string;
+	size_t len = 1, i;
+
+	if (names->type & SDB_TYPE_ARRAY) {
+		values = names->data.array.values;
+		len = names->data.array.length;
+	}
+
+	tmp = realloc(m->trees, (m->trees_num + 1) * sizeof(*tmp));
+	if (! tmp)
+		return -1;
+	m->trees = tmp;
+
+	result = sdb_avltree_create();
+	if (! result)
+		return -1;
+	m->trees[m->trees_num] = result;
+	++m->trees_num;
+
+	for (i = 0; i < len; ++i) {
+		sdb_object_t *host, *dup;
+		int status = 0;
+
+		if (! values[i])
+			continue;
+		host = SDB_OBJ(lookup_host(get_shard(values[i]), values[i]));
+		if (! host)
+			continue;
+
+		/* names are compared case-insensitively */
+		dup = sdb_avltree_lookup(result, host->name);
+		if (! dup)
+			status = sdb_avltree_insert(result, host);
+		sdb_object_deref(dup);
+		sdb_object_deref(host);
+		if (status)
+			return -1;
+	}
+	return merge_add(m, result);
+} /* merge_add_names */
+
+/* Determine the constant names of a comparison of object names (which may be
+ * resolved using point lookups). */
+static bool
+index_name_operands(sdb_store_matcher_t *m, const sdb_data_t **names)
+{
+	sdb_store_expr_t *field = CMP_M(m)->left;
+	sdb_store_expr_t *cnst = CMP_M(m)->right;
+
+	if ((! field) || (! cnst))
+		return 0;
+	if ((m->type == MATCHER_EQ) && (field->type != FIELD_VALUE)) {
+		cnst = CMP_M(m)->left;
+		field = CMP_M(m)->right;
+	}
+	if ((field->type != FIELD_VALUE)
+			|| (field->data.data.integer != SDB_FIELD_NAME) || cnst->type)
+		return 0;
+	if ((m->type == MATCHER_EQ) && (cnst->data.type != SDB_TYPE_STRING))
+		return 0;
+	if ((m->type == MATCHER_IN)
+			&& (cnst->data.type != (SDB_TYPE_ARRAY | SDB_TYPE_STRING)))
+		return 0;
+
+	*names = &cnst->data;
+	return 1;
+} /* index_name_operands */
+
+/* Determine the attribute key and the constant value of an indexable
+ * comparison. */
+static bool
+index_cmp_operands(sdb_store_matcher_t *m, const char **key,
+		const sdb_data_t **value)
+{
+	sdb_store_expr_t *attr = CMP_M(m)->left;
+	sdb_store_expr_t *cnst = CMP_M(m)->right;
+
+	if ((! attr) || (! cnst))
+		return 0;
+	if ((m->type == MATCHER_EQ) && (attr->type != ATTR_VALUE)) {
+		cnst = CMP_M(m)->left;
+		attr = CMP_M(m)->right;
+	}
+	if ((attr->type != ATTR_VALUE) || cnst->type)
+		return 0;
+	if ((m->type == MATCHER_IN) && (! (cnst->data.type & SDB_TYPE_ARRAY)))
+		return 0;
+
+	/* all shards share the same set of indexed attributes */
+	if (! index_lookup(&shards[0], attr->data.data.string))
+		return 0;
+
+	*key = attr->data.data.string;
+	*value = &cnst->data;
+	return 1;
+} /* index_cmp_operands */
+
+/*
+ * index_plan checks whether the indexes (or point lookups of host names) may
+ * be used to determine all hosts matching the specified matcher. If so, it
+ * returns true and adds the candidate hosts to the merge (unless 'merge' is
+ * NULL). Nothing is added to the merge if it returns false. Candidates still
+ * have to be checked against the matcher. This function has to be called
+ * from inside an epoch critical section.
+ */
+static bool
+index_plan(int type, sdb_store_matcher_t *m, host_merge_t *merge,
+		int *status)
+{
+	const sdb_data_t *value = NULL;
+	const char *key = NULL;
+	size_t i;
+
+	if (! m)
+		return 0;
+
+	switch (m->type) {
+		case MATCHER_AND:
+			/* any of the operands restricts the result; planning the left
+			 * operand doesn't add anything to the merge if it fails */
+			if (index_plan(type, OP_M(m)->left, merge, status))
+				return 1;
+			return index_plan(type, OP_M(m)->right, merge, status);
+
+		case MATCHER_OR:
+			if ((! index_plan(type, OP_M(m)->left, NULL, status))
+					|| (! index_plan(type, OP_M(m)->right, NULL, status)))
+				return 0;
+			if (merge) {
+				index_plan(type, OP_M(m)->left, merge, status);
+				index_plan(type, OP_M(m)->right, merge, status);
+			}
+			return 1;
+
+		case MATCHER_REGEX:
+			{
+				sdb_store_expr_t *field = CMP_M(m)->left;
+				sdb_store_expr_t *re = CMP_M(m)->right;
+				const char *raw;
+				int num;
+
+				if ((! __atomic_load_n(&names_indexed, __ATOMIC_ACQUIRE))
+						|| (! field) || (! re)
+						|| (field->type != FIELD_VALUE)
+						|| (field->data.data.integer != SDB_FIELD_NAME)
+						|| re->type || (re->data.type != SDB_TYPE_REGEX))
+					return 0;
+
+				raw = re->data.data.re.raw;
+				{
+					char trigrams[strlen(raw) + 1][4];
+
+					num = regex_trigrams(raw, trigrams);
+					if (num <= 0)
+						return 0;
+					if (merge && merge_add_trigrams(merge, type,
+								trigrams, (size_t)num))
+						*status = -1;
+				}
+			}
+			return 1;
+
+		case MATCHER_EQ:
+		case MATCHER_IN:
+			/* the attribute index covers host attributes only */
+			if (type != SDB_HOST)
+				return 0;
+
+			/* hosts are looked up by name directly */
+			if (index_name_operands(m, &value)) {
+				if (merge && merge_add_names(merge, value))
+					*status = -1;
+				return 1;
+			}
+
+			if (! index_cmp_operands(m, &key, &value))
+				return 0;
+			if (! merge)
+				return 1;
+
+			if (m->type == MATCHER_EQ) {
+				if (merge_add_indexed(merge, key, value))
+					*status = -1;
+				return 1;
+			}
+
+			for (i = 0; i < value->data.array.length; ++i) {
+				sdb_data_t v = SDB_DATA_INIT;
+
+				if (sdb_data_array_get(value, i, &v))
+					continue;
+				if (merge_add_indexed(merge, key, &v))
+					*status = -1;
+			}
+			return 1;
+	}
+	return 0;
+} /* index_plan */
+
+static sdb_store_obj_t *
+merge_next(host_merge_t *m)
+{
+	sdb_store_obj_t *host;
+
+	if (! m->heap_len)
+		return NULL;
+
+	host = STORE_OBJ(sdb_avltree_iter_get_next(m->heap[0]));
+	if (! sdb_avltree_iter_has_next(m->heap[0])) {
+		sdb_avltree_iter_destroy(m->heap[0]);
+		--m->heap_len;
+		m->heap[0] = m->heap[m->heap_len];
+	}
+	merge_sift_down(m, 0);
+	return host;
+} /* merge_next */
+
+/* This function has to be called from inside an epoch critical section.
+ * 'm' is the compiled matcher, 'f' the compiled filter. */
+static int
+scan_host(sdb_store_obj_t *host, int type,
+		sdb_store_prog_t *m, sdb_store_prog_t *f,
+		sdb_store_matcher_t *filter,
+		sdb_store_lookup_cb cb, void *user_data)
+{
+	sdb_avltree_iter_t *iter = NULL;
+	int status = 0;
+
+	if (! sdb_store_prog_matches(f, host))
+		return 0;
+
+	if (type == SDB_SERVICE)
+		iter = sdb_avltree_get_iter(HOST(host)->services);
+	else if (type == SDB_METRIC)
+		iter = sdb_avltree_get_iter(HOST(host)->metrics);
+
+	if (iter) {
+		while (sdb_avltree_iter_has_next(iter)) {
+			sdb_store_obj_t *obj;
+			obj = STORE_OBJ(sdb_avltree_iter_get_next(iter));
+			assert(obj);
+
+			if (sdb_store_prog_matches(m, obj)) {
+				if (cb(obj, filter, user_data)) {
+					sdb_log(SDB_LOG_ERR, "store: Callback returned "
+							"an error while scanning");
+					status = -1;
+					break;
+				}
+			}
+		}
+	}
+	else if (sdb_store_prog_matches(m, host)) {
+		if (cb(host, filter, user_data)) {
+			sdb_log(SDB_LOG_ERR, "store: Callback returned "
+					"an error while scanning");
+			status = -1;
+		}
+	}
+
+	sdb_avltree_iter_destroy(iter);
+	return status;
+} /* scan_host */
+
+/*
+ * public API
+ */
+
+void
+sdb_store_clear(void)
+{
+	size_t i;
+
+	pthread_once(&shards_once, shards_init);
+	for (i = 0; i < STORE_MAX_SHARDS; ++i) {
+		sdb_avltree_t *hosts;
+
+		pthread_mutex_lock(&shards[i].lock);
+		hosts = shards[i].hosts;
+		__atomic_store_n(&shards[i].hosts, NULL, __ATOMIC_RELEASE);
+		index_clear(&shards[i]);
+		pthread_mutex_unlock(&shards[i].lock);
+
+		sdb_epoch_retire(hosts, tree_destroy);
+	}
+} /* sdb_store_clear */
+
+int
+sdb_store_set_shards(size_t num)
+{
+	int status = 0;
+	size_t i;
+
+	if ((! num) || (num > STORE_MAX_SHARDS)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_once(&shards_once, shards_init);
+	for (i = 0; i < STORE_MAX_SHARDS; ++i)
+		pthread_mutex_lock(&shards[i].lock);
+
+	if (num != shards_num) {
+		for (i = 0; i < shards_num; ++i) {
+			if (sdb_avltree_size(shards[i].hosts)) {
+				errno = EBUSY;
+				status = -1;
+				break;
+			}
+		}
+	}
+	if (! status)
+		shards_num = num;
+
+	for (i = 0; i < STORE_MAX_SHARDS; ++i)
+		pthread_mutex_unlock(&shards[i].lock);
+	return status;
+} /* sdb_store_set_shards */
+
+int
+sdb_store_index_attribute(const char *key)
+{
+	int status = 0;
+	size_t i;
+
+	if (! key)
+		return -1;
+
+	pthread_once(&shards_once, shards_init);
+	for (i = 0; i < STORE_MAX_SHARDS; ++i)
+		pthread_mutex_lock(&shards[i].lock);
+
+	/* all shards share the same set of indexed attributes */
+	if (index_lookup(&shards[0], key)) {
+		for (i = 0; i < STORE_MAX_SHARDS; ++i)
+			pthread_mutex_unlock(&shards[i].lock);
+		return 0;
+	}
+
+	for (i = 0; i < STORE_MAX_SHARDS; ++i) {
+		store_shard_t *shard = shards + i;
+		index_node_t *attr;
+
+		if (! shard->index) {
+			sdb_avltree_t *index = sdb_avltree_create();
+			if (! index) {
+				status = -1;
+				break;
+			}
+			__atomic_store_n(&shard->index, index, __ATOMIC_RELEASE);
+		}
+
+		attr = INDEX_NODE(sdb_object_create(key, index_node_type));
+		if ((! attr) || index_populate(shard, attr)
+				|| sdb_avltree_insert(shard->index, SDB_OBJ(attr))) {
+			sdb_object_deref(SDB_OBJ(attr));
+			status = -1;
+			break;
+		}
+		sdb_object_deref(SDB_OBJ(attr));
+	}
+
+	if (status) {
+		/* don't leave behind partial indexes */
+		for (i = 0; i < STORE_MAX_SHARDS; ++i)
+			sdb_avltree_remove(shards[i].index, key);
+		sdb_log(SDB_LOG_ERR, "store: Failed to create index "
+				"for attribute '%s'", key);
+	}
+
+	for (i = 0; i < STORE_MAX_SHARDS; ++i)
+		pthread_mutex_unlock(&shards[i].lock);
+	return status;
+} /* sdb_store_index_attribute */
+
+int
+sdb_store_index_names(void)
+{
+	int status = 0;
+	size_t i, j;
+
+	pthread_once(&shards_once, shards_init);
+	for (i = 0; i < STORE_MAX_SHARDS; ++i)
+		pthread_mutex_lock(&shards[i].lock);
+
+	for (i = 0; (i < STORE_MAX_SHARDS) && (! names_indexed); ++i) {
+		store_shard_t *shard = shards + i;
+		sdb_avltree_iter_t *iter;
+
+		for (j = 0; j < SDB_STATIC_ARRAY_LEN(shard->trigrams); ++j) {
+			sdb_avltree_t *trigrams;
+
+			if (shard->trigrams[j])
+				continue;
+			if (! (trigrams = sdb_avltree_create())) {
+				status = -1;
+				break;
+			}
+			__atomic_store_n(&shard->trigrams[j], trigrams, __ATOMIC_RELEASE);
+		}
+		if (status)
+			break;
+
+		iter = sdb_avltree_get_iter(shard->hosts);
+		while (sdb_avltree_iter_has_next(iter)) {
+			sdb_store_obj_t *host = STORE_OBJ(sdb_avltree_iter_get_next(iter));
+			if (names_index_populate(shard, host, 1))
+				status = -1;
+		}
+		sdb_avltree_iter_destroy(iter);
+		if (status)
+			break;
+	}
+
+	if (status) {
+		/* don't leave behind a partial index */
+		for (i = 0; i < STORE_MAX_SHARDS; ++i) {
+			for (j = 0; j < SDB_STATIC_ARRAY_LEN(shards[i].trigrams); ++j) {
+				sdb_avltree_t *trigrams = shards[i].trigrams[j];
+
+				__atomic_store_n(&shards[i].trigrams[j], NULL,
+						__ATOMIC_RELEASE);
+				sdb_epoch_retire(trigrams, tree_destroy);
+			}
+		}
+		sdb_log(SDB_LOG_ERR, "store: Failed to create name index");
+	}
+	else
+		__atomic_store_n(&names_indexed, 1, __ATOMIC_RELEASE);
+
+	for (i = 0; i < STORE_MAX_SHARDS; ++i)
+		pthread_mutex_unlock(&shards[i].lock);
+	return status;
+} /* sdb_store_index_names */
+
+int
+sdb_store_set_expiry(int missed, sdb_time_t ttl)
+{
+	int status = 0;
+	size_t i;
+
+	if (missed < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_once(&shards_once, shards_init);
+	for (i = 0; i < STORE_MAX_SHARDS; ++i)
+		pthread_mutex_lock(&shards[i].lock);
+
+	if ((missed || ttl) && (! expiry_wheel)) {
+		sdb_timerwheel_t *wheel;
+
+		wheel = sdb_timerwheel_create(SDB_INTERVAL_SECOND, sdb_gettime());
+		if (wheel)
+			__atomic_store_n(&expiry_wheel, wheel, __ATOMIC_RELEASE);
+		else
 			status = -1;
+	}
+
+	if (! status) {
+		expiry_missed = missed;
+		expiry_ttl = ttl;
+
+		/* objects are scheduled on update; make sure to pick up
+		 * objects which are no longer updated as well */
+		for (i = 0; (i < shards_num) && (missed || ttl); ++i) {
+			sdb_avltree_iter_t *iter = sdb_avltree_get_iter(shards[i].hosts);
+			while (sdb_avltree_iter_has_next(iter))
+				expiry_schedule_all(STORE_OBJ(sdb_avltree_iter_get_next(iter)));
+			sdb_avltree_iter_destroy(iter);
+		}
+	}
+	else
+		sdb_log(SDB_LOG_ERR, "store: Failed to set up object expiry");
+
+	for (i = 0; i < STORE_MAX_SHARDS; ++i)
+		pthread_mutex_unlock(&shards[i].lock);
+	return status;
+} /* sdb_store_set_expiry */
+
+int
+sdb_store_expire(sdb_time_t now)
+{
+	sdb_timerwheel_t *wheel;
+	sdb_llist_t *expired;
+	sdb_object_t *timer;
+	int removed = 0;
+
+	wheel = __atomic_load_n(&expiry_wheel, __ATOMIC_ACQUIRE);
+	if (! wheel)
+		return 0;
+
+	expired = sdb_llist_create();
+	if (! expired)
+		return -1;
+
+	if (sdb_timerwheel_advance(wheel, now, expired) < 0) {
+		sdb_llist_destroy(expired);
+		return -1;
+	}
+
+	while ((timer = sdb_llist_shift(expired))) {
+		if (expiry_check(EXPIRY(timer), now))
+			++removed;
+		sdb_object_deref(timer);
+	}
+	sdb_llist_destroy(expired);
+
+	if (removed)
+		sdb_log(SDB_LOG_INFO, "store: Removed %d expired object%s",
+				removed, removed == 1 ? "" : "s");
+	return removed;
+} /* sdb_store_expire */
+
+int
+sdb_store_get_usage(int type, sdb_store_usage_t *usage)
+{
+	if (((type != SDB_HOST) && (type != SDB_SERVICE) && (type != SDB_METRIC)
+				&& (type != SDB_ATTRIBUTE)) || (! usage))
+		return -1;
+
+	usage_load(&type_usage[usage_index(type)], usage);
+	return 0;
+} /* sdb_store_get_usage */
+
+int
+sdb_store_get_backend_usage(const char *backend, sdb_store_usage_t *usage)
+{
+	int id;
+
+	if ((! backend) || (! usage))
+		return -1;
+
+	id = backend_lookup(backend);
+	if (id < 0)
+		return -1;
+	usage_load(&backend_usage[id], usage);
+	return 0;
+} /* sdb_store_get_backend_usage */
+
+int
+sdb_store_get_host_usage(const char *name, sdb_store_usage_t *usage)
+{
+	sdb_store_obj_t *host;
+
+	if ((! name) || (! usage))
+		return -1;
+
+	host = sdb_store_get_host(name);
+	if (! host)
+		return -1;
+	usage_load(&HOST(host)->usage, usage);
+	sdb_object_deref(SDB_OBJ(host));
+	return 0;
+} /* sdb_store_get_host_usage */
+
+typedef struct {
+	sdb_store_obj_t *host;
+	uint64_t bytes;
+} host_usage_t;
+
+static int
+host_usage_cmp(const void *a, const void *b)
+{
+	const host_usage_t *h1 = a, *h2 = b;
+
+	if (h1->bytes != h2->bytes)
+		return h1->bytes > h2->bytes ? -1 : 1;
+	return strcasecmp(SDB_OBJ(h1->host)->name, SDB_OBJ(h2->host)->name);
+} /* host_usage_cmp */
+
+ssize_t
+sdb_store_get_hosts_by_usage(sdb_store_obj_t ***hosts)
+{
+	host_usage_t *usage = NULL;
+	size_t num = 0, len = 0, i;
+
+	if (! hosts)
+		return -1;
+
+	pthread_once(&shards_once, shards_init);
+	for (i = 0; i < shards_num; ++i) {
+		sdb_avltree_iter_t *iter = sdb_avltree_get_iter(shard_hosts(shards + i));
+
+		while (sdb_avltree_iter_has_next(iter)) {
+			sdb_host_t *host = HOST(sdb_avltree_iter_get_next(iter));
+
+			if (num >= len) {
+				host_usage_t *tmp;
+
+				len = len ? 2 * len : 64;
+				tmp = realloc(usage, len * sizeof(*usage));
+				if (! tmp) {
+					sdb_avltree_iter_destroy(iter);
+					free(usage);
+					return -1;
+				}
+				usage = tmp;
+			}
+
+			/* the usage may change concurrently, so sort by a copy */
+			usage[num].host = STORE_OBJ(host);
+			usage[num].bytes = __atomic_load_n(&host->usage.bytes,
+					__ATOMIC_RELAXED);
+			++num;
+		}
+		sdb_avltree_iter_destroy(iter);
+	}
 
-	if (! status)
-		status = store_obj(NULL, hosts, SDB_HOST, cname, last_update, NULL);
-	pthread_rwlock_unlock(&host_lock);
+	if (num)
+		qsort(usage, num, sizeof(*usage), host_usage_cmp);
+
+	*hosts = calloc(num ? num : 1, sizeof(**hosts));
+	if (! *hosts) {
+		free(usage);
+		return -1;
+	}
+	for (i = 0; i < num; ++i)
+		(*hosts)[i] = usage[i].host;
+	free(usage);
+	return (ssize_t)num;
+} /* sdb_store_get_hosts_by_usage */
+
+int
+sdb_store_restore(const sdb_store_snapshot_obj_t *obj)
+{
+	store_shard_t *shard;
+	sdb_store_obj_t *parent = NULL, *new = NULL;
+	children_t tree;
+	int status = 0;
+
+	if ((! obj) || (! obj->hostname) || (! obj->name))
+		return -1;
+	if ((obj->type == SDB_ATTRIBUTE) && (! obj->value))
+		return -1;
+
+	shard = lock_shard(obj->hostname);
+	if ((obj->type == SDB_HOST) && (! shard->hosts)) {
+		sdb_avltree_t *hosts = sdb_avltree_create();
+		if (hosts)
+			__atomic_store_n(&shard->hosts, hosts, __ATOMIC_RELEASE);
+	}
 
-	if (sdb_plugin_store_host(name, last_update))
+	tree = lookup_tree(shard, obj->hostname, obj->type,
+			obj->parent_type, obj->parent, &parent);
+	if ((! tree.tree) && (! tree.attrs)) {
+		sdb_log(SDB_LOG_ERR, "store: Failed to restore %s '%s' - "
+				"parent object of host '%s' not found",
+				SDB_STORE_TYPE_TO_NAME(obj->type), obj->name, obj->hostname);
 		status = -1;
+	}
+	else if ((obj->type == SDB_ATTRIBUTE) && (parent->type == SDB_HOST))
+		status = store_host_attr(shard, parent, tree.tree, obj->name,
+				obj->value, obj->last_update, &new);
+	else if (obj->type == SDB_ATTRIBUTE)
+		status = store_attr(parent, tree, obj->name,
+				obj->value, obj->last_update, &new);
+	else
+		status = store_obj(parent, tree, obj->type, obj->name,
+				obj->last_update, NULL, &new);
+
+	if ((! status) && new) {
+		__atomic_store_n(&new->interval, obj->interval, __ATOMIC_RELAXED);
+		backends_add(new, obj->backends);
+		if ((obj->type == SDB_METRIC) && obj->store_type && obj->store_id)
+			status = metric_store(METRIC(new),
+					obj->store_type, obj->store_id);
+		/* the deadline may have moved closer now that the interval
+		 * is known */
+		expiry_schedule(new);
+		sdb_store_journal_update(new);
+	}
+	unlock_shard(shard);
 
-	free(cname);
-	return status;
+	sdb_object_deref(SDB_OBJ(parent));
+	return status < 0 ? status : 0;
+} /* sdb_store_restore */
+
+int
+sdb_store_restore_remove(const sdb_store_snapshot_obj_t *obj)
+{
+	store_shard_t *shard;
+	sdb_store_obj_t *parent = NULL, *old;
+	children_t tree;
+
+	if ((! obj) || (! obj->hostname) || (! obj->name))
+		return -1;
+
+	shard = lock_shard(obj->hostname);
+	tree = lookup_tree(shard, obj->hostname, obj->type,
+			obj->parent_type, obj->parent, &parent);
+	old = children_lookup(tree, obj->name);
+	if (old && (old->last_update <= obj->last_update))
+		expiry_remove(shard, tree, old);
+	unlock_shard(shard);
+
+	sdb_object_deref(SDB_OBJ(old));
+	sdb_object_deref(SDB_OBJ(parent));
+	return 0;
+} /* sdb_store_restore_remove */
+
+int
+sdb_store_host(const char *name, sdb_time_t last_update)
+{
+	store_update_t u = STORE_UPDATE_INIT;
+
+	if (! name)
+		return -1;
+
+	u.type = SDB_HOST;
+	u.hostname = u.name = name;
+	u.last_update = last_update;
+	return store_update(&u);
 } /* sdb_store_host */
 
 bool
 sdb_store_has_host(const char *name)
 {
-	sdb_host_t *host;
-
-	if (! name)
-		return NULL;
+	sdb_store_obj_t *host;
 
-	host = lookup_host(name, /* canonicalize = */ 0);
+	host = sdb_store_get_host(name);
 	sdb_object_deref(SDB_OBJ(host));
 	return host != NULL;
 } /* sdb_store_has_host */
@@ -564,7 +3059,7 @@ sdb_store_get_host(const char *name)
 	if (! name)
 		return NULL;
 
-	host = lookup_host(name, /* canonicalize = */ 0);
+	host = lookup_host(get_shard(name), name);
 	if (! host)
 		return NULL;
 
@@ -576,121 +3071,60 @@ sdb_store_attribute(const char *hostname,
 		const char *key, const sdb_data_t *value,
 		sdb_time_t last_update)
 {
-	sdb_host_t *host;
-	sdb_avltree_t *attrs;
-	int status = 0;
+	store_update_t u = STORE_UPDATE_INIT;
 
 	if ((! hostname) || (! key))
 		return -1;
 
-	pthread_rwlock_wrlock(&host_lock);
-	host = lookup_host(hostname, /* canonicalize = */ 1);
-	attrs = get_host_children(host, SDB_ATTRIBUTE);
-	if (! attrs) {
-		sdb_log(SDB_LOG_ERR, "store: Failed to store attribute '%s' - "
-				"host '%s' not found", key, hostname);
-		status = -1;
-	}
-
-	if (! status)
-		status = store_attr(STORE_OBJ(host), attrs, key, value, last_update);
-
-	sdb_object_deref(SDB_OBJ(host));
-	pthread_rwlock_unlock(&host_lock);
-
-	if (sdb_plugin_store_attribute(hostname, key, value, last_update))
-		status = -1;
-	return status;
+	u.type = SDB_ATTRIBUTE;
+	u.parent_type = SDB_HOST;
+	u.hostname = hostname;
+	u.name = key;
+	u.value = value;
+	u.last_update = last_update;
+	return store_update(&u);
 } /* sdb_store_attribute */
 
 int
 sdb_store_service(const char *hostname, const char *name,
 		sdb_time_t last_update)
 {
-	sdb_host_t *host;
-	sdb_avltree_t *services;
-
-	int status = 0;
+	store_update_t u = STORE_UPDATE_INIT;
 
 	if ((! hostname) || (! name))
 		return -1;
 
-	pthread_rwlock_wrlock(&host_lock);
-	host = lookup_host(hostname, /* canonicalize = */ 1);
-	services = get_host_children(host, SDB_SERVICE);
-	if (! services) {
-		sdb_log(SDB_LOG_ERR, "store: Failed to store service '%s' - "
-				"host '%s' not found", name, hostname);
-		status = -1;
-	}
-
-	if (! status)
-		status = store_obj(STORE_OBJ(host), services, SDB_SERVICE,
-				name, last_update, NULL);
-
-	sdb_object_deref(SDB_OBJ(host));
-	pthread_rwlock_unlock(&host_lock);
-
-	if (sdb_plugin_store_service(hostname, name, last_update))
-		status = -1;
-	return status;
+	u.type = SDB_SERVICE;
+	u.hostname = hostname;
+	u.name = name;
+	u.last_update = last_update;
+	return store_update(&u);
 } /* sdb_store_service */
 
 int
 sdb_store_service_attr(const char *hostname, const char *service,
 		const char *key, const sdb_data_t *value, sdb_time_t last_update)
 {
-	sdb_host_t *host;
-	sdb_service_t *svc;
-	sdb_avltree_t *services;
-	int status = 0;
+	store_update_t u = STORE_UPDATE_INIT;
 
 	if ((! hostname) || (! service) || (! key))
 		return -1;
 
-	pthread_rwlock_wrlock(&host_lock);
-	host = lookup_host(hostname, /* canonicalize = */ 1);
-	services = get_host_children(host, SDB_SERVICE);
-	sdb_object_deref(SDB_OBJ(host));
-	if (! services) {
-		sdb_log(SDB_LOG_ERR, "store: Failed to store attribute '%s' "
-				"for service '%s' - host '%ss' not found",
-				key, service, hostname);
-		pthread_rwlock_unlock(&host_lock);
-		return -1;
-	}
-
-	svc = SVC(sdb_avltree_lookup(services, service));
-	if (! svc) {
-		sdb_log(SDB_LOG_ERR, "store: Failed to store attribute '%s' - "
-				"service '%s/%s' not found", key, hostname, service);
-		status = -1;
-	}
-
-	if (! status)
-		status = store_attr(STORE_OBJ(svc), svc->attributes,
-				key, value, last_update);
-
-	sdb_object_deref(SDB_OBJ(svc));
-	pthread_rwlock_unlock(&host_lock);
-
-	if (sdb_plugin_store_service_attribute(hostname, service,
-				key, value, last_update))
-		status = -1;
-	return status;
+	u.type = SDB_ATTRIBUTE;
+	u.parent_type = SDB_SERVICE;
+	u.hostname = hostname;
+	u.parent = service;
+	u.name = key;
+	u.value = value;
+	u.last_update = last_update;
+	return store_update(&u);
 } /* sdb_store_service_attr */
 
 int
 sdb_store_metric(const char *hostname, const char *name,
 		sdb_metric_store_t *store, sdb_time_t last_update)
 {
-	sdb_store_obj_t *obj = NULL;
-	sdb_host_t *host;
-	sdb_metric_t *metric;
-
-	sdb_avltree_t *metrics;
-
-	int status = 0;
+	store_update_t u = STORE_UPDATE_INIT;
 
 	if ((! hostname) || (! name))
 		return -1;
@@ -702,97 +3136,183 @@ sdb_store_metric(const char *hostname, const char *name,
 			store = NULL;
 	}
 
-	pthread_rwlock_wrlock(&host_lock);
-	host = lookup_host(hostname, /* canonicalize = */ 1);
-	metrics = get_host_children(host, SDB_METRIC);
-	if (! metrics) {
-		sdb_log(SDB_LOG_ERR, "store: Failed to store metric '%s' - "
-				"host '%s' not found", name, hostname);
-		status = -1;
-	}
+	u.type = SDB_METRIC;
+	u.hostname = hostname;
+	u.name = name;
+	u.store = store;
+	u.last_update = last_update;
+	return store_update(&u);
+} /* sdb_store_metric */
 
-	if (! status)
-		status = store_obj(STORE_OBJ(host), metrics, SDB_METRIC,
-				name, last_update, &obj);
-	sdb_object_deref(SDB_OBJ(host));
+int
+sdb_store_metric_attr(const char *hostname, const char *metric,
+		const char *key, const sdb_data_t *value, sdb_time_t last_update)
+{
+	store_update_t u = STORE_UPDATE_INIT;
 
-	if (status || (! store)) {
-		pthread_rwlock_unlock(&host_lock);
-		return status;
-	}
+	if ((! hostname) || (! metric) || (! key))
+		return -1;
 
-	assert(obj);
-	metric = METRIC(obj);
+	u.type = SDB_ATTRIBUTE;
+	u.parent_type = SDB_METRIC;
+	u.hostname = hostname;
+	u.parent = metric;
+	u.name = key;
+	u.value = value;
+	u.last_update = last_update;
+	return store_update(&u);
+} /* sdb_store_metric_attr */
 
-	if ((! metric->store.type) || strcasecmp(metric->store.type, store->type)) {
-		if (metric->store.type)
-			free(metric->store.type);
-		metric->store.type = strdup(store->type);
-	}
-	if ((! metric->store.id) || strcasecmp(metric->store.id, store->id)) {
-		if (metric->store.id)
-			free(metric->store.id);
-		metric->store.id = strdup(store->id);
-	}
+sdb_store_batch_t *
+sdb_store_batch_begin(void)
+{
+	return calloc(1, sizeof(sdb_store_batch_t));
+} /* sdb_store_batch_begin */
 
-	if ((! metric->store.type) || (! metric->store.id)) {
-		if (metric->store.type)
-			free(metric->store.type);
-		if (metric->store.id)
-			free(metric->store.id);
-		metric->store.type = metric->store.id = NULL;
-		status = -1;
-	}
-	pthread_rwlock_unlock(&host_lock);
+int
+sdb_store_batch_host(sdb_store_batch_t *batch, const char *name,
+		sdb_time_t last_update)
+{
+	store_update_t u = STORE_UPDATE_INIT;
 
-	if (sdb_plugin_store_metric(hostname, name, store, last_update))
-		status = -1;
-	return status;
-} /* sdb_store_metric */
+	if ((! batch) || (! name))
+		return -1;
+
+	u.type = SDB_HOST;
+	u.hostname = u.name = name;
+	u.last_update = last_update;
+	return batch_add(batch, &u);
+} /* sdb_store_batch_host */
 
 int
-sdb_store_metric_attr(const char *hostname, const char *metric,
+sdb_store_batch_attribute(sdb_store_batch_t *batch, const char *hostname,
 		const char *key, const sdb_data_t *value, sdb_time_t last_update)
 {
-	sdb_avltree_t *metrics;
-	sdb_host_t *host;
-	sdb_metric_t *m;
-	int status = 0;
+	store_update_t u = STORE_UPDATE_INIT;
 
-	if ((! hostname) || (! metric) || (! key))
+	if ((! batch) || (! hostname) || (! key) || (! value))
 		return -1;
 
-	pthread_rwlock_wrlock(&host_lock);
-	host = lookup_host(hostname, /* canonicalize = */ 1);
-	metrics = get_host_children(host, SDB_METRIC);
-	sdb_object_deref(SDB_OBJ(host));
-	if (! metrics) {
-		sdb_log(SDB_LOG_ERR, "store: Failed to store attribute '%s' "
-				"for metric '%s' - host '%s' not found",
-				key, metric, hostname);
-		pthread_rwlock_unlock(&host_lock);
+	u.type = SDB_ATTRIBUTE;
+	u.parent_type = SDB_HOST;
+	u.hostname = hostname;
+	u.name = key;
+	u.value = value;
+	u.last_update = last_update;
+	return batch_add(batch, &u);
+} /* sdb_store_batch_attribute */
+
+int
+sdb_store_batch_service(sdb_store_batch_t *batch, const char *hostname,
+		const char *name, sdb_time_t last_update)
+{
+	store_update_t u = STORE_UPDATE_INIT;
+
+	if ((! batch) || (! hostname) || (! name))
 		return -1;
-	}
 
-	m = METRIC(sdb_avltree_lookup(metrics, metric));
-	if (! m) {
-		sdb_log(SDB_LOG_ERR, "store: Failed to store attribute '%s' - "
-				"metric '%s/%s' not found", key, hostname, metric);
-		status = -1;
+	u.type = SDB_SERVICE;
+	u.hostname = hostname;
+	u.name = name;
+	u.last_update = last_update;
+	return batch_add(batch, &u);
+} /* sdb_store_batch_service */
+
+int
+sdb_store_batch_service_attr(sdb_store_batch_t *batch, const char *hostname,
+		const char *service, const char *key, const sdb_data_t *value,
+		sdb_time_t last_update)
+{
+	store_update_t u = STORE_UPDATE_INIT;
+
+	if ((! batch) || (! hostname) || (! service) || (! key) || (! value))
+		return -1;
+
+	u.type = SDB_ATTRIBUTE;
+	u.parent_type = SDB_SERVICE;
+	u.hostname = hostname;
+	u.parent = service;
+	u.name = key;
+	u.value = value;
+	u.last_update = last_update;
+	return batch_add(batch, &u);
+} /* sdb_store_batch_service_attr */
+
+int
+sdb_store_batch_metric(sdb_store_batch_t *batch, const char *hostname,
+		const char *name, sdb_metric_store_t *store, sdb_time_t last_update)
+{
+	store_update_t u = STORE_UPDATE_INIT;
+
+	if ((! batch) || (! hostname) || (! name))
+		return -1;
+
+	if (store) {
+		if ((store->type != NULL) != (store->id != NULL))
+			return -1;
+		else if (! store->type)
+			store = NULL;
 	}
 
-	if (! status)
-		status = store_attr(STORE_OBJ(m), m->attributes,
-				key, value, last_update);
+	u.type = SDB_METRIC;
+	u.hostname = hostname;
+	u.name = name;
+	u.store = store;
+	u.last_update = last_update;
+	return batch_add(batch, &u);
+} /* sdb_store_batch_metric */
 
-	sdb_object_deref(SDB_OBJ(m));
-	pthread_rwlock_unlock(&host_lock);
+int
+sdb_store_batch_metric_attr(sdb_store_batch_t *batch, const char *hostname,
+		const char *metric, const char *key, const sdb_data_t *value,
+		sdb_time_t last_update)
+{
+	store_update_t u = STORE_UPDATE_INIT;
 
-	if (sdb_plugin_store_metric_attribute(hostname, metric,
-				key, value, last_update))
-		status = -1;
+	if ((! batch) || (! hostname) || (! metric) || (! key) || (! value))
+		return -1;
+
+	u.type = SDB_ATTRIBUTE;
+	u.parent_type = SDB_METRIC;
+	u.hostname = hostname;
+	u.parent = metric;
+	u.name = key;
+	u.value = value;
+	u.last_update = last_update;
+	return batch_add(batch, &u);
+} /* sdb_store_batch_metric_attr */
+
+int
+sdb_store_batch_commit(sdb_store_batch_t *batch)
+{
+	size_t i;
+	int status = 0;
+
+	if (! batch)
+		return -1;
+
+	batch_canonicalize(batch);
+	qsort(batch->updates, batch->updates_num, sizeof(*batch->updates),
+			batch_cmp);
+
+	i = 0;
+	while (i < batch->updates_num)
+		i = batch_apply_host(batch, i, &status);
+
+	for (i = 0; i < batch->updates_num; ++i) {
+		store_update_t u = batch->updates[i].u;
+
+		if (u.type == SDB_ATTRIBUTE)
+			u.value = &batch->updates[i].value;
+		if (batch->updates[i].store.type)
+			u.store = &batch->updates[i].store;
+		if (store_forward(&u))
+			status = -1;
+	}
+
+	batch_destroy(batch);
 	return status;
-} /* sdb_store_metric_attr */
+} /* sdb_store_batch_commit */
 
 sdb_store_obj_t *
 sdb_store_get_child(sdb_store_obj_t *host, int type, const char *name)
@@ -815,20 +3335,28 @@ sdb_store_fetch_timeseries(const char *hostname, const char *metric,
 	sdb_avltree_t *metrics;
 	sdb_host_t *host;
 	sdb_metric_t *m;
+	char *cname;
 
+	const char *st_type, *st_id;
 	sdb_timeseries_t *ts;
 
 	if ((! hostname) || (! metric) || (! opts) || (! buf))
 		return -1;
 
-	pthread_rwlock_rdlock(&host_lock);
-	host = lookup_host(hostname, /* canonicalize = */ 1);
+	if (! (cname = canonical_name(hostname)))
+		return -1;
+
+	/* the metric's store strings may be replaced concurrently */
+	sdb_epoch_enter();
+
+	host = lookup_host(get_shard(cname), cname);
+	free(cname);
 	metrics = get_host_children(host, SDB_METRIC);
 	sdb_object_deref(SDB_OBJ(host));
 	if (! metrics) {
 		sdb_log(SDB_LOG_ERR, "store: Failed to fetch time-series '%s/%s' "
 				"- host '%s' not found", hostname, metric, hostname);
-		pthread_rwlock_unlock(&host_lock);
+		sdb_epoch_exit();
 		return -1;
 	}
 
@@ -836,25 +3364,29 @@ sdb_store_fetch_timeseries(const char *hostname, const char *metric,
 	if (! m) {
 		sdb_log(SDB_LOG_ERR, "store: Failed to fetch time-series '%s/%s' "
 				"- metric '%s' not found", hostname, metric, metric);
-		pthread_rwlock_unlock(&host_lock);
+		sdb_epoch_exit();
 		return -1;
 	}
 
-	if ((! m->store.type) || (! m->store.id)) {
+	st_type = __atomic_load_n(&m->store.type, __ATOMIC_ACQUIRE);
+	st_id = __atomic_load_n(&m->store.id, __ATOMIC_ACQUIRE);
+	sdb_object_deref(SDB_OBJ(m));
+
+	if ((! st_type) || (! st_id)) {
 		sdb_log(SDB_LOG_ERR, "store: Failed to fetch time-series '%s/%s' "
 				"- no data-store configured for the stored metric",
 				hostname, metric);
-		pthread_rwlock_unlock(&host_lock);
+		sdb_epoch_exit();
 		return -1;
 	}
 
 	{
-		char type[strlen(m->store.type) + 1];
-		char id[strlen(m->store.id) + 1];
+		char type[strlen(st_type) + 1];
+		char id[strlen(st_id) + 1];
 
-		strncpy(type, m->store.type, sizeof(type));
-		strncpy(id, m->store.id, sizeof(id));
-		pthread_rwlock_unlock(&host_lock);
+		strncpy(type, st_type, sizeof(type));
+		strncpy(id, st_id, sizeof(id));
+		sdb_epoch_exit();
 
 		ts = sdb_plugin_fetch_timeseries(type, id, opts);
 		if (! ts) {
@@ -887,23 +3419,29 @@ sdb_store_get_field(sdb_store_obj_t *obj, int field, sdb_data_t *res)
 			break;
 		case SDB_FIELD_LAST_UPDATE:
 			tmp.type = SDB_TYPE_DATETIME;
-			tmp.data.datetime = obj->last_update;
+			tmp.data.datetime = STORE_OBJ_LAST_UPDATE(obj);
 			break;
 		case SDB_FIELD_AGE:
 			tmp.type = SDB_TYPE_DATETIME;
-			tmp.data.datetime = sdb_gettime() - obj->last_update;
+			tmp.data.datetime = sdb_gettime() - STORE_OBJ_LAST_UPDATE(obj);
 			break;
 		case SDB_FIELD_INTERVAL:
 			tmp.type = SDB_TYPE_DATETIME;
-			tmp.data.datetime = obj->interval;
+			tmp.data.datetime = STORE_OBJ_INTERVAL(obj);
 			break;
 		case SDB_FIELD_BACKEND:
 			if (! res)
 				return 0;
-			tmp.type = SDB_TYPE_ARRAY | SDB_TYPE_STRING;
-			tmp.data.array.length = obj->backends_num;
-			tmp.data.array.values = obj->backends;
-			return sdb_data_copy(res, &tmp);
+			{
+				const char *names[STORE_BACKENDS_MAX];
+
+				tmp.type = SDB_TYPE_ARRAY | SDB_TYPE_STRING;
+				tmp.data.array.length = sdb_store_backend_names(
+						STORE_OBJ_BACKENDS(obj), names);
+				tmp.data.array.values = tmp.data.array.length
+					? names : NULL;
+				return sdb_data_copy(res, &tmp);
+			}
 		case SDB_FIELD_VALUE:
 			if (obj->type != SDB_ATTRIBUTE)
 				return -1;
@@ -920,46 +3458,103 @@ sdb_store_get_field(sdb_store_obj_t *obj, int field, sdb_data_t *res)
 	return 0;
 } /* sdb_store_get_field */
 
+uint64_t
+sdb_store_get_generation(sdb_store_obj_t *obj)
+{
+	if (! obj)
+		return 0;
+	return __atomic_load_n(&obj->generation, __ATOMIC_ACQUIRE);
+} /* sdb_store_get_generation */
+
 int
 sdb_store_get_attr(sdb_store_obj_t *obj, const char *name, sdb_data_t *res,
 		sdb_store_matcher_t *filter)
 {
-	sdb_avltree_t *tree = NULL;
-	sdb_store_obj_t *attr;
+	const sdb_data_t *value;
+	int status = 0;
 
-	if ((! obj) || (! name))
-		return -1;
+	sdb_epoch_enter();
+	value = sdb_store_get_attr_ref(obj, name, filter);
+	if (! value)
+		status = -1;
+	else if (res)
+		sdb_data_copy(res, value);
+	sdb_epoch_exit();
+	return status;
+} /* sdb_store_get_attr */
 
-	if (obj->type == SDB_HOST)
-		tree = HOST(obj)->attributes;
-	else if (obj->type == SDB_SERVICE)
-		tree = SVC(obj)->attributes;
-	else if (obj->type == SDB_METRIC)
-		tree = METRIC(obj)->attributes;
+const sdb_data_t *
+sdb_store_get_attr_ref(sdb_store_obj_t *obj, const char *name,
+		sdb_store_matcher_t *filter)
+{
+	sdb_store_obj_t *attr;
 
-	if (! tree)
-		return -1;
+	if ((! obj) || (! name) || (obj->type == SDB_ATTRIBUTE))
+		return NULL;
 
-	attr = STORE_OBJ(sdb_avltree_lookup(tree, name));
+	attr = children_lookup(get_children(obj, SDB_ATTRIBUTE), name);
 	if (! attr)
-		return -1;
+		return NULL;
+
 	if (filter && (! sdb_store_matcher_matches(filter, attr, NULL))) {
 		sdb_object_deref(SDB_OBJ(attr));
-		return -1;
+		return NULL;
 	}
 
 	assert(STORE_OBJ(attr)->type == SDB_ATTRIBUTE);
-	if (res)
-		sdb_data_copy(res, &ATTR(attr)->value);
+	/* replaced or removed attributes are released only once no reader may
+	 * access them any longer, so the caller's critical section keeps the
+	 * value alive after dropping the reference */
 	sdb_object_deref(SDB_OBJ(attr));
+	return &ATTR(attr)->value;
+} /* sdb_store_get_attr_ref */
+
+int
+sdb_store_get_field_ref(sdb_store_obj_t *obj, int field, sdb_data_t *res,
+		bool *owned)
+{
+	sdb_data_t tmp = SDB_DATA_INIT;
+
+	*owned = 0;
+	if (! obj)
+		return -1;
+
+	if (field == SDB_FIELD_NAME) {
+		res->type = SDB_TYPE_STRING;
+		res->data.string = SDB_OBJ(obj)->name;
+		return 0;
+	}
+	if ((field == SDB_FIELD_VALUE) && (obj->type == SDB_ATTRIBUTE)) {
+		*res = ATTR(obj)->value;
+		return 0;
+	}
+
+	if (sdb_store_get_field(obj, field, &tmp))
+		return -1;
+	*res = tmp;
+	*owned = 1;
 	return 0;
-} /* sdb_store_get_attr */
+} /* sdb_store_get_field_ref */
+
+void
+sdb_store_view_begin(void)
+{
+	sdb_mvcc_snapshot_begin();
+} /* sdb_store_view_begin */
+
+void
+sdb_store_view_end(void)
+{
+	sdb_mvcc_snapshot_end();
+} /* sdb_store_view_end */
 
 int
 sdb_store_scan(int type, sdb_store_matcher_t *m, sdb_store_matcher_t *filter,
 		sdb_store_lookup_cb cb, void *user_data)
 {
-	sdb_avltree_iter_t *host_iter = NULL;
+	host_merge_t merge = HOST_MERGE_INIT;
+	sdb_store_obj_t *host, *prev = NULL;
+	sdb_store_prog_t *prog, *filter_prog;
 	int status = 0;
 
 	if (! cb)
@@ -970,63 +3565,103 @@ sdb_store_scan(int type, sdb_store_matcher_t *m, sdb_store_matcher_t *filter,
 		return -1;
 	}
 
-	pthread_rwlock_rdlock(&host_lock);
-
-	if (hosts) {
-		host_iter = sdb_avltree_get_iter(hosts);
-		if (! host_iter)
-			status = -1;
+	/* the matcher is evaluated for each candidate object */
+	prog = sdb_store_matcher_compile(m, filter);
+	filter_prog = sdb_store_matcher_compile(filter, NULL);
+	if ((! prog) || (! filter_prog)) {
+		sdb_store_prog_destroy(prog);
+		sdb_store_prog_destroy(filter_prog);
+		return -1;
 	}
 
-	/* has_next returns false if the iterator is NULL */
-	while (sdb_avltree_iter_has_next(host_iter)) {
-		sdb_store_obj_t *host;
-		sdb_avltree_iter_t *iter = NULL;
-
-		host = STORE_OBJ(sdb_avltree_iter_get_next(host_iter));
-		assert(host);
+	/* all objects accessed while scanning remain valid
+	 * until we release the view */
+	pthread_once(&shards_once, shards_init);
+	sdb_store_view_begin();
+
+	/* use the indexes to determine candidate hosts if possible */
+	if (! index_plan(type, m, &merge, &status))
+		status = merge_add_all(&merge);
+	if (status) {
+		merge_destroy(&merge);
+		sdb_store_view_end();
+		sdb_store_prog_destroy(prog);
+		sdb_store_prog_destroy(filter_prog);
+		return -1;
+	}
+	merge_start(&merge);
 
-		if (! sdb_store_matcher_matches(filter, host, NULL))
+	while ((host = merge_next(&merge)) != NULL) {
+		/* skip hosts included in multiple candidate sets */
+		if (host == prev)
 			continue;
+		prev = host;
 
-		if (type == SDB_SERVICE)
-			iter = sdb_avltree_get_iter(HOST(host)->services);
-		else if (type == SDB_METRIC)
-			iter = sdb_avltree_get_iter(HOST(host)->metrics);
-
-		if (iter) {
-			while (sdb_avltree_iter_has_next(iter)) {
-				sdb_store_obj_t *obj;
-				obj = STORE_OBJ(sdb_avltree_iter_get_next(iter));
-				assert(obj);
-
-				if (sdb_store_matcher_matches(m, obj, filter)) {
-					if (cb(obj, filter, user_data)) {
-						sdb_log(SDB_LOG_ERR, "store: Callback returned "
-								"an error while scanning");
-						status = -1;
-						break;
-					}
-				}
-			}
-		}
-		else if (sdb_store_matcher_matches(m, host, filter)) {
-			if (cb(host, filter, user_data)) {
-				sdb_log(SDB_LOG_ERR, "store: Callback returned "
-						"an error while scanning");
-				status = -1;
-			}
-		}
-
-		sdb_avltree_iter_destroy(iter);
+		status = scan_host(host, type, prog, filter_prog, filter,
+				cb, user_data);
 		if (status)
 			break;
 	}
 
-	sdb_avltree_iter_destroy(host_iter);
-	pthread_rwlock_unlock(&host_lock);
+	merge_destroy(&merge);
+	sdb_store_view_end();
+	sdb_store_prog_destroy(prog);
+	sdb_store_prog_destroy(filter_prog);
 	return status;
 } /* sdb_store_scan */
 
+int
+sdb_store_watch(int type, sdb_store_watch_cb cb, sdb_object_t *user_data)
+{
+	watcher_t *w;
+
+	if (((type != SDB_HOST) && (type != SDB_SERVICE) && (type != SDB_METRIC))
+			|| (! cb))
+		return -1;
+
+	pthread_rwlock_wrlock(&watchers_lock);
+	w = realloc(watchers, (watchers_num + 1) * sizeof(*watchers));
+	if (! w) {
+		char errbuf[1024];
+		pthread_rwlock_unlock(&watchers_lock);
+		sdb_log(SDB_LOG_ERR, "store: Failed to register watcher: %s",
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		return -1;
+	}
+	watchers = w;
+	watchers[watchers_num].type = type;
+	watchers[watchers_num].cb = cb;
+	watchers[watchers_num].user_data = user_data;
+	sdb_object_ref(user_data);
+	__atomic_store_n(&watchers_num, watchers_num + 1, __ATOMIC_RELEASE);
+	pthread_rwlock_unlock(&watchers_lock);
+	return 0;
+} /* sdb_store_watch */
+
+int
+sdb_store_unwatch(sdb_store_watch_cb cb, sdb_object_t *user_data)
+{
+	bool found = 0;
+	size_t i;
+
+	pthread_rwlock_wrlock(&watchers_lock);
+	for (i = 0; i < watchers_num; ++i) {
+		if ((watchers[i].cb != cb) || (watchers[i].user_data != user_data))
+			continue;
+
+		memmove(watchers + i, watchers + i + 1,
+				(watchers_num - i - 1) * sizeof(*watchers));
+		__atomic_store_n(&watchers_num, watchers_num - 1, __ATOMIC_RELEASE);
+		found = 1;
+		break;
+	}
+	pthread_rwlock_unlock(&watchers_lock);
+
+	if (! found)
+		return -1;
+	sdb_object_deref(user_data);
+	return 0;
+} /* sdb_store_unwatch */
+
 /* vim: set tw=78 sw=4 ts=4 noexpandtab : */
 
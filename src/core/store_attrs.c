@@ -0,0 +1,381 @@
+/*
+ * SysDB - src/core/store_attrs.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * This module implements the compact storage of the attributes of services
+ * and metrics (see sdb_attrs_t).
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "core/store-private.h"
+#include "utils/epoch.h"
+#include "utils/slab.h"
+
+#include <assert.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/*
+ * private helper functions
+ */
+
+/* Returns the current array. Writers have to use this function. */
+#define ARRAY(attrs) \
+	((sdb_attr_array_t *)__atomic_load_n(&(attrs)->array.ptr, __ATOMIC_ACQUIRE))
+
+#define ARRAY_SIZE(len) \
+	(sizeof(sdb_attr_array_t) + (len) * sizeof(sdb_store_obj_t *))
+
+static sdb_attr_array_t *
+array_create(size_t len)
+{
+	sdb_attr_array_t *array = sdb_slab_alloc(ARRAY_SIZE(len));
+
+	if (array)
+		array->len = len;
+	return array;
+} /* array_create */
+
+/* Release all attributes of the array and the array itself. */
+static void
+array_release(void *ptr)
+{
+	sdb_attr_array_t *array = ptr;
+	size_t i;
+
+	for (i = 0; i < array->len; ++i)
+		sdb_object_deref(SDB_OBJ(array->attrs[i]));
+	sdb_slab_free(array, ARRAY_SIZE(array->len));
+} /* array_release */
+
+/* Returns the index of the named attribute or the index at which it would
+ * have to be inserted. */
+static size_t
+array_find(sdb_attr_array_t *array, const char *name, bool *found)
+{
+	size_t lo = 0, hi = array ? array->len : 0;
+
+	*found = 0;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int diff = strcasecmp(SDB_OBJ(array->attrs[mid])->name, name);
+
+		if (! diff) {
+			*found = 1;
+			return mid;
+		}
+		if (diff < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+} /* array_find */
+
+/* Make a new version of the array visible to readers. The new array owns a
+ * reference to each of its attributes. */
+static void
+array_publish(sdb_attrs_t *attrs, sdb_attr_array_t *array)
+{
+	sdb_attr_array_t *old = ARRAY(attrs);
+	size_t i;
+
+	if (array)
+		for (i = 0; i < array->len; ++i)
+			sdb_object_ref(SDB_OBJ(array->attrs[i]));
+
+	sdb_mvcc_store(&attrs->array, array, /* old_aux = */ 0);
+	if (old)
+		sdb_epoch_retire(old, array_release);
+} /* array_publish */
+
+/* Move all attributes to a tree. Readers which still see the array keep
+ * using it; all others will find the tree. */
+static int
+array_promote(sdb_attrs_t *attrs)
+{
+	sdb_attr_array_t *array = ARRAY(attrs);
+	sdb_avltree_t *tree = sdb_avltree_create();
+	size_t i;
+
+	if (! tree)
+		return -1;
+
+	for (i = 0; array && (i < array->len); ++i) {
+		if (sdb_avltree_insert(tree, SDB_OBJ(array->attrs[i]))) {
+			sdb_avltree_destroy(tree);
+			return -1;
+		}
+	}
+
+	__atomic_store_n(&attrs->tree, tree, __ATOMIC_RELEASE);
+	array_publish(attrs, NULL);
+	return 0;
+} /* array_promote */
+
+/*
+ * private API
+ */
+
+void
+sdb_attrs_destroy(sdb_attrs_t *attrs)
+{
+	if (! attrs)
+		return;
+
+	if (ARRAY(attrs))
+		array_release(ARRAY(attrs));
+	sdb_mvcc_clear(&attrs->array);
+	if (attrs->tree)
+		sdb_avltree_destroy(attrs->tree);
+	attrs->array.ptr = NULL;
+	attrs->tree = NULL;
+} /* sdb_attrs_destroy */
+
+size_t
+sdb_attrs_size(sdb_attrs_t *attrs)
+{
+	sdb_attr_array_t *array;
+	size_t size;
+
+	if (! attrs)
+		return 0;
+
+	sdb_epoch_enter();
+	array = sdb_mvcc_load(&attrs->array, NULL);
+	if (array)
+		size = array->len;
+	else
+		size = sdb_avltree_size(__atomic_load_n(&attrs->tree,
+					__ATOMIC_ACQUIRE));
+	sdb_epoch_exit();
+	return size;
+} /* sdb_attrs_size */
+
+sdb_store_obj_t *
+sdb_attrs_lookup(sdb_attrs_t *attrs, const char *name)
+{
+	sdb_store_obj_t *attr = NULL;
+	sdb_attr_array_t *array;
+
+	if ((! attrs) || (! name))
+		return NULL;
+
+	sdb_epoch_enter();
+	array = sdb_mvcc_load(&attrs->array, NULL);
+	if (array) {
+		bool found;
+		size_t i = array_find(array, name, &found);
+
+		if (found) {
+			attr = array->attrs[i];
+			sdb_object_ref(SDB_OBJ(attr));
+		}
+	}
+	else
+		attr = STORE_OBJ(sdb_avltree_lookup(__atomic_load_n(&attrs->tree,
+						__ATOMIC_ACQUIRE), name));
+	sdb_epoch_exit();
+	return attr;
+} /* sdb_attrs_lookup */
+
+int
+sdb_attrs_insert(sdb_attrs_t *attrs, sdb_store_obj_t *attr)
+{
+	sdb_attr_array_t *old, *new;
+	size_t len, i;
+	bool found;
+
+	if ((! attrs) || (! attr))
+		return -1;
+
+	if (attrs->tree)
+		return sdb_avltree_insert(attrs->tree, SDB_OBJ(attr));
+
+	old = ARRAY(attrs);
+	i = array_find(old, SDB_OBJ(attr)->name, &found);
+	if (found)
+		return -1;
+
+	len = old ? old->len : 0;
+	if (len >= STORE_ATTRS_INLINE) {
+		if (array_promote(attrs))
+			return -1;
+		return sdb_avltree_insert(attrs->tree, SDB_OBJ(attr));
+	}
+
+	new = array_create(len + 1);
+	if (! new)
+		return -1;
+	if (i)
+		memcpy(new->attrs, old->attrs, i * sizeof(*new->attrs));
+	new->attrs[i] = attr;
+	if (i < len)
+		memcpy(new->attrs + i + 1, old->attrs + i,
+				(len - i) * sizeof(*new->attrs));
+	array_publish(attrs, new);
+	return 0;
+} /* sdb_attrs_insert */
+
+int
+sdb_attrs_replace(sdb_attrs_t *attrs, sdb_store_obj_t *attr)
+{
+	sdb_attr_array_t *old, *new;
+	size_t i;
+	bool found;
+
+	if ((! attrs) || (! attr))
+		return -1;
+
+	if (attrs->tree)
+		return sdb_avltree_replace(attrs->tree, SDB_OBJ(attr));
+
+	old = ARRAY(attrs);
+	i = array_find(old, SDB_OBJ(attr)->name, &found);
+	if (! found)
+		return -1;
+
+	new = array_create(old->len);
+	if (! new)
+		return -1;
+	memcpy(new->attrs, old->attrs, new->len * sizeof(*new->attrs));
+	new->attrs[i] = attr;
+	array_publish(attrs, new);
+	return 0;
+} /* sdb_attrs_replace */
+
+int
+sdb_attrs_remove(sdb_attrs_t *attrs, const char *name)
+{
+	sdb_attr_array_t *old, *new = NULL;
+	size_t i;
+	bool found;
+
+	if ((! attrs) || (! name))
+		return -1;
+
+	if (attrs->tree)
+		return sdb_avltree_remove(attrs->tree, name);
+
+	old = ARRAY(attrs);
+	i = array_find(old, name, &found);
+	if (! found)
+		return -1;
+
+	if (old->len > 1) {
+		new = array_create(old->len - 1);
+		if (! new)
+			return -1;
+		memcpy(new->attrs, old->attrs, i * sizeof(*new->attrs));
+		memcpy(new->attrs + i, old->attrs + i + 1,
+				(new->len - i) * sizeof(*new->attrs));
+	}
+	array_publish(attrs, new);
+	return 0;
+} /* sdb_attrs_remove */
+
+void
+sdb_attrs_iter_init(sdb_attrs_iter_t *iter, sdb_attrs_t *attrs)
+{
+	assert(iter);
+
+	iter->tree = NULL;
+	iter->array = NULL;
+	iter->idx = 0;
+
+	/* the array remains valid until the iterator is finished */
+	sdb_epoch_enter();
+	if (! attrs)
+		return;
+
+	iter->array = sdb_mvcc_load(&attrs->array, NULL);
+	if (! iter->array)
+		iter->tree = sdb_avltree_get_iter(__atomic_load_n(&attrs->tree,
+					__ATOMIC_ACQUIRE));
+} /* sdb_attrs_iter_init */
+
+bool
+sdb_attrs_iter_has_next(sdb_attrs_iter_t *iter)
+{
+	if (iter->array)
+		return iter->idx < iter->array->len;
+	return sdb_avltree_iter_has_next(iter->tree);
+} /* sdb_attrs_iter_has_next */
+
+sdb_store_obj_t *
+sdb_attrs_iter_get_next(sdb_attrs_iter_t *iter)
+{
+	if (iter->array)
+		return iter->idx < iter->array->len
+			? iter->array->attrs[iter->idx++] : NULL;
+	return STORE_OBJ(sdb_avltree_iter_get_next(iter->tree));
+} /* sdb_attrs_iter_get_next */
+
+sdb_store_obj_t *
+sdb_attrs_iter_peek_next(sdb_attrs_iter_t *iter)
+{
+	if (iter->array)
+		return iter->idx < iter->array->len
+			? iter->array->attrs[iter->idx] : NULL;
+	return STORE_OBJ(sdb_avltree_iter_peek_next(iter->tree));
+} /* sdb_attrs_iter_peek_next */
+
+void
+sdb_attrs_iter_finish(sdb_attrs_iter_t *iter)
+{
+	if (iter->tree)
+		sdb_avltree_iter_destroy(iter->tree);
+	iter->tree = NULL;
+	iter->array = NULL;
+	sdb_epoch_exit();
+} /* sdb_attrs_iter_finish */
+
+void
+sdb_store_attrs_iter(sdb_attrs_iter_t *iter, sdb_store_obj_t *obj)
+{
+	sdb_attrs_t host_attrs = SDB_ATTRS_INIT;
+
+	if (obj && (obj->type == SDB_HOST)) {
+		/* hosts always store their attributes in a tree */
+		host_attrs.tree = HOST(obj)->attributes;
+		sdb_attrs_iter_init(iter, &host_attrs);
+	}
+	else if (obj && (obj->type == SDB_SERVICE))
+		sdb_attrs_iter_init(iter, &SVC(obj)->attributes);
+	else if (obj && (obj->type == SDB_METRIC))
+		sdb_attrs_iter_init(iter, &METRIC(obj)->attributes);
+	else
+		sdb_attrs_iter_init(iter, NULL);
+} /* sdb_store_attrs_iter */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -37,6 +37,7 @@
 #include "core/store-private.h"
 #include "core/data.h"
 #include "core/object.h"
+#include "utils/epoch.h"
 
 #include <assert.h>
 #include <stdlib.h>
@@ -51,10 +52,13 @@ struct sdb_store_expr_iter {
 	sdb_store_obj_t *obj;
 	sdb_store_expr_t *expr;
 
-	sdb_avltree_iter_t *tree;
+	/* child objects, if 'children' is set */
+	sdb_attrs_iter_t iter;
+	bool children;
 
 	sdb_data_t array;
 	size_t array_idx;
+	const char *backends[STORE_BACKENDS_MAX];
 
 	sdb_store_matcher_t *filter;
 };
@@ -210,29 +214,61 @@ sdb_store_expr_constvalue(const sdb_data_t *value)
 int
 sdb_store_expr_eval(sdb_store_expr_t *expr, sdb_store_obj_t *obj,
 		sdb_data_t *res, sdb_store_matcher_t *filter)
+{
+	sdb_data_t v = SDB_DATA_INIT;
+	bool owned = 0;
+	int status;
+
+	if ((! expr) || (! res))
+		return -1;
+
+	sdb_epoch_enter();
+	status = sdb_store_expr_eval_ref(expr, obj, &v, &owned, filter);
+	if ((! status) && owned)
+		*res = v;
+	else if (! status)
+		status = sdb_data_copy(res, &v);
+	sdb_epoch_exit();
+	return status;
+} /* sdb_store_expr_eval */
+
+int
+sdb_store_expr_eval_ref(sdb_store_expr_t *expr, sdb_store_obj_t *obj,
+		sdb_data_t *res, bool *owned, sdb_store_matcher_t *filter)
 {
 	sdb_data_t v1 = SDB_DATA_INIT, v2 = SDB_DATA_INIT;
+	bool owned1 = 0, owned2 = 0;
 	int status = 0;
 
-	if ((! expr) || (! res))
+	if ((! expr) || (! res) || (! owned))
 		return -1;
 
+	*owned = 0;
+	if (! expr->type) {
+		*res = expr->data;
+		return 0;
+	}
+
 	if (filter && obj && (! sdb_store_matcher_matches(filter, obj, NULL)))
 		obj = NULL; /* this object does not exist */
 
-	if (! expr->type)
-		return sdb_data_copy(res, &expr->data);
-	else if (expr->type == FIELD_VALUE)
-		return sdb_store_get_field(obj, (int)expr->data.data.integer, res);
+	if (expr->type == FIELD_VALUE)
+		return sdb_store_get_field_ref(obj, (int)expr->data.data.integer,
+				res, owned);
 	else if (expr->type == ATTR_VALUE) {
-		status = sdb_store_get_attr(obj, expr->data.data.string, res, filter);
-		if ((status < 0) && obj) {
+		const sdb_data_t *value;
+
+		if (! obj)
+			return -1;
+		value = sdb_store_get_attr_ref(obj, expr->data.data.string, filter);
+		if (value)
+			*res = *value;
+		else {
 			/* attribute does not exist => NULL */
-			status = 0;
 			res->type = SDB_TYPE_STRING;
 			res->data.string = NULL;
 		}
-		return status;
+		return 0;
 	}
 	else if (expr->type == TYPED_EXPR) {
 		int typ = (int)expr->data.data.integer;
@@ -244,22 +280,27 @@ sdb_store_expr_eval(sdb_store_expr_t *expr, sdb_store_obj_t *obj,
 				return -1;
 			obj = obj->parent;
 		}
-		return sdb_store_expr_eval(expr->left, obj, res, filter);
+		return sdb_store_expr_eval_ref(expr->left, obj, res, owned, filter);
 	}
 
-	if (sdb_store_expr_eval(expr->left, obj, &v1, filter))
+	if (sdb_store_expr_eval_ref(expr->left, obj, &v1, &owned1, filter))
 		return -1;
-	if (sdb_store_expr_eval(expr->right, obj, &v2, filter)) {
-		sdb_data_free_datum(&v1);
+	if (sdb_store_expr_eval_ref(expr->right, obj, &v2, &owned2, filter)) {
+		if (owned1)
+			sdb_data_free_datum(&v1);
 		return -1;
 	}
 
 	if (sdb_data_expr_eval(expr->type, &v1, &v2, res))
 		status = -1;
-	sdb_data_free_datum(&v1);
-	sdb_data_free_datum(&v2);
+	else
+		*owned = 1;
+	if (owned1)
+		sdb_data_free_datum(&v1);
+	if (owned2)
+		sdb_data_free_datum(&v2);
 	return status;
-} /* sdb_store_expr_eval */
+} /* sdb_store_expr_eval_ref */
 
 bool
 sdb_store_expr_iterable(sdb_store_expr_t *expr, int context)
@@ -304,8 +345,9 @@ sdb_store_expr_iter(sdb_store_expr_t *expr, sdb_store_obj_t *obj,
 		sdb_store_matcher_t *filter)
 {
 	sdb_store_expr_iter_t *iter;
-	sdb_avltree_iter_t *tree = NULL;
+	sdb_attrs_t tree = SDB_ATTRS_INIT;
 	sdb_data_t array = SDB_DATA_INIT;
+	bool backends = 0, children = 0;
 
 	if (! expr)
 		return NULL;
@@ -313,32 +355,25 @@ sdb_store_expr_iter(sdb_store_expr_t *expr, sdb_store_obj_t *obj,
 	if (expr->type == TYPED_EXPR) {
 		if (! obj)
 			return NULL;
-		if (obj->type == SDB_HOST) {
+		if (expr->data.data.integer == SDB_ATTRIBUTE)
+			children = obj->type != SDB_ATTRIBUTE;
+		else if (obj->type == SDB_HOST) {
+			/* hosts store their services and metrics in trees */
 			if (expr->data.data.integer == SDB_SERVICE)
-				tree = sdb_avltree_get_iter(HOST(obj)->services);
+				tree.tree = HOST(obj)->services;
 			else if (expr->data.data.integer == SDB_METRIC)
-				tree = sdb_avltree_get_iter(HOST(obj)->metrics);
-			else if (expr->data.data.integer == SDB_ATTRIBUTE)
-				tree = sdb_avltree_get_iter(HOST(obj)->attributes);
-		}
-		else if (obj->type == SDB_SERVICE) {
-			if (expr->data.data.integer == SDB_ATTRIBUTE)
-				tree = sdb_avltree_get_iter(SVC(obj)->attributes);
-		}
-		else if (obj->type == SDB_METRIC) {
-			if (expr->data.data.integer == SDB_ATTRIBUTE)
-				tree = sdb_avltree_get_iter(METRIC(obj)->attributes);
+				tree.tree = HOST(obj)->metrics;
+			children = tree.tree != NULL;
 		}
 	}
 	else if (expr->type == FIELD_VALUE) {
 		if (! obj)
 			return NULL;
 		if (expr->data.data.integer == SDB_FIELD_BACKEND) {
-			/* while scanning the store, we hold a read lock, so it's safe to
-			 * access the data without copying */
+			/* the names are resolved once the iterator has been
+			 * allocated */
 			array.type = SDB_TYPE_ARRAY | SDB_TYPE_STRING;
-			array.data.array.length = obj->backends_num;
-			array.data.array.values = obj->backends;
+			backends = 1;
 		}
 	}
 	else if (! expr->type) {
@@ -348,20 +383,32 @@ sdb_store_expr_iter(sdb_store_expr_t *expr, sdb_store_obj_t *obj,
 	else
 		return NULL;
 
-	if ((! tree) && (array.type == SDB_TYPE_NULL))
+	if ((! children) && (array.type == SDB_TYPE_NULL))
 		return NULL;
 
 	iter = calloc(1, sizeof(*iter));
 	if (! iter)
 		return NULL;
 
+	if (backends) {
+		array.data.array.length = sdb_store_backend_names(
+				STORE_OBJ_BACKENDS(obj), iter->backends);
+		array.data.array.values = iter->backends;
+	}
+
+	sdb_epoch_enter();
+
 	sdb_object_ref(SDB_OBJ(obj));
 	sdb_object_ref(SDB_OBJ(expr));
 	sdb_object_ref(SDB_OBJ(filter));
 
 	iter->obj = obj;
 	iter->expr = expr;
-	iter->tree = tree;
+	iter->children = children;
+	if (children && (expr->data.data.integer == SDB_ATTRIBUTE))
+		sdb_store_attrs_iter(&iter->iter, obj);
+	else if (children)
+		sdb_attrs_iter_init(&iter->iter, &tree);
 	iter->array = array;
 	iter->filter = filter;
 	return iter;
@@ -375,9 +422,9 @@ sdb_store_expr_iter_destroy(sdb_store_expr_iter_t *iter)
 	if (! iter)
 		return;
 
-	if (iter->tree)
-		sdb_avltree_iter_destroy(iter->tree);
-	iter->tree = NULL;
+	if (iter->children)
+		sdb_attrs_iter_finish(&iter->iter);
+	iter->children = 0;
 
 	iter->array = null;
 	iter->array_idx = 0;
@@ -386,6 +433,7 @@ sdb_store_expr_iter_destroy(sdb_store_expr_iter_t *iter)
 	sdb_object_deref(SDB_OBJ(iter->expr));
 	sdb_object_deref(SDB_OBJ(iter->filter));
 	free(iter);
+	sdb_epoch_exit();
 } /* sdb_store_expr_iter_destroy */
 
 bool
@@ -394,19 +442,19 @@ sdb_store_expr_iter_has_next(sdb_store_expr_iter_t *iter)
 	if (! iter)
 		return 0;
 
-	if (iter->tree) {
+	if (iter->children) {
 		/* this function may be called before get_next,
 		 * so we'll have to apply filters here as well */
 		if (iter->filter) {
 			sdb_store_obj_t *child;
-			while ((child = STORE_OBJ(sdb_avltree_iter_peek_next(iter->tree)))) {
+			while ((child = sdb_attrs_iter_peek_next(&iter->iter))) {
 				if (sdb_store_matcher_matches(iter->filter, child, NULL))
 					break;
-				(void)sdb_avltree_iter_get_next(iter->tree);
+				(void)sdb_attrs_iter_get_next(&iter->iter);
 			}
 		}
 
-		return sdb_avltree_iter_has_next(iter->tree);
+		return sdb_attrs_iter_has_next(&iter->iter);
 	}
 
 	return iter->array_idx < iter->array.data.array.length;
@@ -422,11 +470,11 @@ sdb_store_expr_iter_get_next(sdb_store_expr_iter_t *iter)
 	if (! iter)
 		return null;
 
-	if (iter->tree) {
+	if (iter->children) {
 		sdb_store_obj_t *child;
 
 		while (42) {
-			child = STORE_OBJ(sdb_avltree_iter_get_next(iter->tree));
+			child = sdb_attrs_iter_get_next(&iter->iter);
 			if (! child)
 				break;
 			if (iter->filter
@@ -440,10 +488,10 @@ sdb_store_expr_iter_get_next(sdb_store_expr_iter_t *iter)
 
 		/* Skip over any filtered objects */
 		if (iter->filter) {
-			while ((child = STORE_OBJ(sdb_avltree_iter_peek_next(iter->tree)))) {
+			while ((child = sdb_attrs_iter_peek_next(&iter->iter))) {
 				if (sdb_store_matcher_matches(iter->filter, child, NULL))
 					break;
-				(void)sdb_avltree_iter_get_next(iter->tree);
+				(void)sdb_attrs_iter_get_next(&iter->iter);
 			}
 		}
 
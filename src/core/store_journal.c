@@ -0,0 +1,750 @@
+/*
+ * SysDB - src/core/store_journal.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module implements the journal of store updates.
+ *
+ * The journal records the state of each object after it has been updated
+ * (and the removal of expired objects) rather than the update itself, such
+ * that replaying a record is idempotent and records may safely overlap with
+ * the snapshot they are replayed on top of. A journal file starts with a
+ * magic string and the version of the format, followed by a sequence of
+ * records using the same framing as snapshots. Each record starts with a
+ * checksum of its data, which is used to detect incomplete records after a
+ * crash. Objects are encoded the same way as in snapshots (see
+ * store_snapshot.c). Backend IDs are specific to the process writing the
+ * journal; a backend record mapping the ID to the backend's name precedes
+ * the first object referencing it.
+ *
+ * Records are collected in memory and written to disk by a background
+ * thread, which syncs them in batches ("group commit").
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "sysdb.h"
+#include "core/store-private.h"
+#include "utils/error.h"
+#include "utils/proto.h"
+
+#include <errno.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * private data types
+ */
+
+#define JOURNAL_MAGIC "SysDBjn"
+#define JOURNAL_MAGIC_LEN sizeof(JOURNAL_MAGIC)
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_LEN (JOURNAL_MAGIC_LEN + sizeof(uint32_t))
+
+/* record header and checksum */
+#define RECORD_HEADER_LEN (3 * sizeof(uint32_t))
+
+/* writers block if this many bytes are waiting to be written */
+#define JOURNAL_MAX_PENDING (4 * 1024 * 1024)
+
+enum {
+	JOURNAL_BACKEND = 1,
+	JOURNAL_UPDATE  = 2,
+	JOURNAL_REMOVE  = 3,
+};
+
+typedef struct {
+	char *data;
+	size_t len;
+	size_t size;
+} journal_buf_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	/* wakes up the writer thread */
+	pthread_cond_t pending_cond;
+	/* signals written records */
+	pthread_cond_t commit_cond;
+
+	/* accessed without holding the lock as a fast-path check */
+	bool active;
+
+	char *filename;
+	int fd;
+	sdb_time_t commit_interval;
+	pthread_t thread;
+	bool stop;
+
+	/* records are appended to one buffer while the other one is written */
+	journal_buf_t bufs[2];
+	int current;
+
+	/* byte counts of all appended and all written records */
+	uint64_t appended;
+	uint64_t committed;
+	bool sync_requested;
+	int error;
+
+	/* backends recorded in the current file */
+	uint64_t backends;
+	/* whether the previous file is covered by a pending snapshot */
+	bool checkpoint;
+} journal_t;
+
+static journal_t journal = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	/* active = */ 0, NULL, -1, 0, 0, 0,
+	{ { NULL, 0, 0 }, { NULL, 0, 0 } }, 0,
+	0, 0, 0, 0, 0, 0,
+};
+
+/*
+ * private helper functions
+ */
+
+/* FNV-1a hash of the record data */
+static uint32_t
+checksum(const char *buf, size_t len)
+{
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		h ^= (unsigned char)buf[i];
+		h *= 16777619U;
+	}
+	return h;
+} /* checksum */
+
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if ((n < 0) && (errno == EINTR))
+			continue;
+		if (n < 0)
+			return -1;
+		buf += n;
+		len -= (size_t)n;
+	}
+	return 0;
+} /* write_all */
+
+/* Open the journal file for appending records, creating it if necessary. */
+static int
+journal_open_file(const char *filename)
+{
+	char header[JOURNAL_HEADER_LEN];
+	struct stat st;
+	int fd;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if ((fd < 0) || fstat(fd, &st)) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "store: Failed to open journal '%s': %s",
+				filename, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	if (st.st_size)
+		return fd;
+
+	memcpy(header, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN);
+	sdb_proto_marshal_int32(header + JOURNAL_MAGIC_LEN,
+			sizeof(uint32_t), JOURNAL_VERSION);
+	if (write_all(fd, header, sizeof(header)) || fsync(fd)) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "store: Failed to write journal '%s': %s",
+				filename, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		close(fd);
+		return -1;
+	}
+	return fd;
+} /* journal_open_file */
+
+/* Reserve space for a record with 'len' bytes of data in the current buffer.
+ * The journal's lock has to be acquired before calling this function. */
+static char *
+journal_reserve(journal_t *j, size_t len)
+{
+	journal_buf_t *buf = j->bufs + j->current;
+
+	len += RECORD_HEADER_LEN;
+	if (buf->len + len > buf->size) {
+		size_t size = buf->size ? buf->size : 4096;
+		char *data;
+
+		while (size < buf->len + len)
+			size *= 2;
+		if (! (data = realloc(buf->data, size)))
+			return NULL;
+		buf->data = data;
+		buf->size = size;
+	}
+	return buf->data + buf->len;
+} /* journal_reserve */
+
+/* Finish a record whose data has been written to the space reserved by
+ * journal_reserve. */
+static void
+journal_finish(journal_t *j, char *rec, uint32_t code, size_t len)
+{
+	journal_buf_t *buf = j->bufs + j->current;
+	bool wakeup = buf->len == 0;
+
+	sdb_proto_marshal_int32(rec, sizeof(uint32_t), code);
+	sdb_proto_marshal_int32(rec + sizeof(uint32_t), sizeof(uint32_t),
+			(uint32_t)(len + sizeof(uint32_t)));
+	sdb_proto_marshal_int32(rec + 2 * sizeof(uint32_t), sizeof(uint32_t),
+			checksum(rec + RECORD_HEADER_LEN, len));
+
+	len += RECORD_HEADER_LEN;
+	buf->len += len;
+	j->appended += len;
+
+	/* the writer thread collects further records for a while after
+	 * being woken up; don't interrupt it unless the buffer is full */
+	if (wakeup || (buf->len >= JOURNAL_MAX_PENDING))
+		pthread_cond_signal(&j->pending_cond);
+} /* journal_finish */
+
+/* Record the names of all backends not yet known to the current journal
+ * file. The journal's lock has to be acquired before calling this
+ * function. */
+static int
+journal_add_backends(journal_t *j, uint64_t backends)
+{
+	int i;
+
+	backends &= ~j->backends;
+	for (i = 0; backends && (i < STORE_BACKENDS_MAX); ++i) {
+		const char *names[STORE_BACKENDS_MAX];
+		size_t len;
+		char *rec;
+
+		if (! (backends & ((uint64_t)1 << i)))
+			continue;
+		backends &= ~((uint64_t)1 << i);
+		if (sdb_store_backend_names((uint64_t)1 << i, names) != 1)
+			continue;
+
+		len = sizeof(uint32_t) + strlen(names[0]) + 1;
+		if (! (rec = journal_reserve(j, len)))
+			return -1;
+		sdb_proto_marshal_int32(rec + RECORD_HEADER_LEN,
+				sizeof(uint32_t), (uint32_t)i);
+		memcpy(rec + RECORD_HEADER_LEN + sizeof(uint32_t),
+				names[0], strlen(names[0]) + 1);
+		journal_finish(j, rec, JOURNAL_BACKEND, len);
+		j->backends |= (uint64_t)1 << i;
+	}
+	return 0;
+} /* journal_add_backends */
+
+static void
+journal_add(journal_t *j, uint32_t code, sdb_store_obj_t *obj)
+{
+	ssize_t len;
+	char *rec;
+
+	if (! __atomic_load_n(&j->active, __ATOMIC_ACQUIRE))
+		return;
+
+	pthread_mutex_lock(&j->lock);
+	/* don't let the journal grow without bounds if the disk can't keep up */
+	while (j->active && (j->bufs[j->current].len >= JOURNAL_MAX_PENDING))
+		pthread_cond_wait(&j->commit_cond, &j->lock);
+	if (! j->active) {
+		pthread_mutex_unlock(&j->lock);
+		return;
+	}
+
+	len = sdb_store_snapshot_marshal(NULL, 0, obj, ~(uint64_t)0);
+	if ((len < 0) || journal_add_backends(j, STORE_OBJ_BACKENDS(obj))
+			|| (! (rec = journal_reserve(j, (size_t)len)))) {
+		sdb_log(SDB_LOG_ERR, "store: Failed to record %s '%s' in journal",
+				SDB_STORE_TYPE_TO_NAME(obj->type), SDB_OBJ(obj)->name);
+		j->error = -1;
+		pthread_mutex_unlock(&j->lock);
+		return;
+	}
+
+	sdb_store_snapshot_marshal(rec + RECORD_HEADER_LEN, (size_t)len,
+			obj, ~(uint64_t)0);
+	journal_finish(j, rec, code, (size_t)len);
+	pthread_mutex_unlock(&j->lock);
+} /* journal_add */
+
+/* Wait until all records have been written. The journal's lock has to be
+ * acquired before calling this function. */
+static void
+journal_wait(journal_t *j)
+{
+	uint64_t target = j->appended;
+
+	if (j->committed >= target)
+		return;
+
+	j->sync_requested = 1;
+	pthread_cond_signal(&j->pending_cond);
+	while (j->committed < target)
+		pthread_cond_wait(&j->commit_cond, &j->lock);
+} /* journal_wait */
+
+static void *
+journal_writer(void *arg)
+{
+	journal_t *j = arg;
+
+	pthread_mutex_lock(&j->lock);
+	while (42) {
+		journal_buf_t *buf;
+		uint64_t target;
+		int fd, status = 0;
+
+		while ((! j->bufs[j->current].len) && (! j->stop))
+			pthread_cond_wait(&j->pending_cond, &j->lock);
+		if (! j->bufs[j->current].len)
+			break;
+
+		/* group commit: collect further records before syncing them */
+		if (j->commit_interval > 0) {
+			struct timespec abstime;
+			sdb_time_t deadline = sdb_gettime() + j->commit_interval;
+
+			abstime.tv_sec = (time_t)SDB_TIME_TO_SECS(deadline);
+			abstime.tv_nsec = (long)(deadline % SECS_TO_SDB_TIME(1));
+			while ((! j->stop) && (! j->sync_requested)
+					&& (j->bufs[j->current].len < JOURNAL_MAX_PENDING))
+				if (pthread_cond_timedwait(&j->pending_cond,
+							&j->lock, &abstime) == ETIMEDOUT)
+					break;
+		}
+
+		buf = j->bufs + j->current;
+		j->current = 1 - j->current;
+		j->sync_requested = 0;
+		target = j->appended;
+		fd = j->fd;
+		/* let writers blocked on a full buffer continue */
+		pthread_cond_broadcast(&j->commit_cond);
+		pthread_mutex_unlock(&j->lock);
+
+		if (write_all(fd, buf->data, buf->len) || fdatasync(fd))
+			status = errno;
+
+		pthread_mutex_lock(&j->lock);
+		if (status) {
+			char errbuf[1024];
+			sdb_log(SDB_LOG_ERR, "store: Failed to write journal '%s': %s",
+					j->filename, sdb_strerror(status, errbuf, sizeof(errbuf)));
+			j->error = -1;
+		}
+		buf->len = 0;
+		j->committed = target;
+		pthread_cond_broadcast(&j->commit_cond);
+	}
+	pthread_mutex_unlock(&j->lock);
+	return NULL;
+} /* journal_writer */
+
+static char *
+journal_old_filename(const char *filename)
+{
+	size_t len = strlen(filename) + 3;
+	char *old = malloc(len);
+
+	if (old)
+		snprintf(old, len, "%s.1", filename);
+	return old;
+} /* journal_old_filename */
+
+/* Replay all records of a journal file. Incomplete records at the end of the
+ * file are removed such that new records may be appended. */
+static int
+journal_replay_file(const char *filename)
+{
+	int backends[STORE_BACKENDS_MAX];
+	uint64_t records = 0, failed = 0;
+	const char *buf;
+	size_t len, pos;
+	struct stat st;
+	uint32_t version = 0;
+	void *map;
+	int fd, i;
+
+	fd = open(filename, O_RDWR);
+	if ((fd < 0) && (errno == ENOENT))
+		return 0;
+	if ((fd < 0) || fstat(fd, &st)) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "store: Failed to open journal '%s': %s",
+				filename, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	len = (size_t)st.st_size;
+	if (len < JOURNAL_HEADER_LEN) {
+		/* the journal has been created but its header has not been
+		 * written completely; start over */
+		if (len && ftruncate(fd, 0))
+			sdb_log(SDB_LOG_WARNING, "store: Failed to reset journal '%s'",
+					filename);
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "store: Failed to map journal '%s': %s",
+				filename, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		close(fd);
+		return -1;
+	}
+	posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+	buf = map;
+
+	sdb_proto_unmarshal_int32(buf + JOURNAL_MAGIC_LEN,
+			len - JOURNAL_MAGIC_LEN, &version);
+	if (memcmp(buf, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN)
+			|| (version != JOURNAL_VERSION)) {
+		sdb_log(SDB_LOG_ERR, "store: Invalid journal '%s'", filename);
+		munmap(map, len);
+		close(fd);
+		return -1;
+	}
+
+	for (i = 0; i < STORE_BACKENDS_MAX; ++i)
+		backends[i] = -1;
+
+	pos = JOURNAL_HEADER_LEN;
+	while (pos < len) {
+		const char *rec = buf + pos;
+		uint32_t code = 0, rec_len = 0, sum = 0;
+
+		if ((len - pos < RECORD_HEADER_LEN)
+				|| (sdb_proto_unmarshal_header(rec, len - pos,
+						&code, &rec_len) < 0)
+				|| (rec_len < sizeof(uint32_t))
+				|| (len - pos - 2 * sizeof(uint32_t) < (size_t)rec_len))
+			break;
+		sdb_proto_unmarshal_int32(rec + 2 * sizeof(uint32_t),
+				sizeof(uint32_t), &sum);
+		rec_len -= (uint32_t)sizeof(uint32_t);
+		rec += RECORD_HEADER_LEN;
+		if (sum != checksum(rec, rec_len))
+			break;
+
+		if (code == JOURNAL_BACKEND) {
+			uint32_t id = 0;
+
+			sdb_proto_unmarshal_int32(rec, rec_len, &id);
+			if ((rec_len > sizeof(id)) && (id < STORE_BACKENDS_MAX)
+					&& (rec[rec_len - 1] == '\0'))
+				backends[id] = sdb_store_backend_id(rec + sizeof(id));
+		}
+		else if ((code == JOURNAL_UPDATE) || (code == JOURNAL_REMOVE)) {
+			sdb_store_snapshot_obj_t obj;
+			sdb_data_t value = SDB_DATA_INIT;
+			ssize_t n;
+			int status = -1;
+
+			n = sdb_store_snapshot_unmarshal(rec, rec_len,
+					backends, &obj, &value);
+			if ((n >= 0) && ((size_t)n == rec_len))
+				status = code == JOURNAL_UPDATE
+					? sdb_store_restore(&obj)
+					: sdb_store_restore_remove(&obj);
+			sdb_data_free_datum(&value);
+
+			++records;
+			if (status)
+				++failed;
+		}
+		/* else: ignore unknown records */
+
+		pos += RECORD_HEADER_LEN + rec_len;
+	}
+	munmap(map, len);
+
+	if (pos < len) {
+		sdb_log(SDB_LOG_WARNING, "store: Discarding incomplete record "
+				"at offset %zu of journal '%s'", pos, filename);
+		if (ftruncate(fd, (off_t)pos)) {
+			char errbuf[1024];
+			sdb_log(SDB_LOG_ERR, "store: Failed to truncate journal '%s': %s",
+					filename, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+			close(fd);
+			return -1;
+		}
+	}
+	close(fd);
+
+	if (failed)
+		sdb_log(SDB_LOG_WARNING, "store: Failed to replay %"PRIu64" of "
+				"%"PRIu64" records from journal '%s'",
+				failed, records, filename);
+	sdb_log(SDB_LOG_INFO, "store: Replayed %"PRIu64" records from "
+			"journal '%s'", records - failed, filename);
+	return 0;
+} /* journal_replay_file */
+
+/*
+ * private API
+ */
+
+void
+sdb_store_journal_update(sdb_store_obj_t *obj)
+{
+	if (obj)
+		journal_add(&journal, JOURNAL_UPDATE, obj);
+} /* sdb_store_journal_update */
+
+void
+sdb_store_journal_remove(sdb_store_obj_t *obj)
+{
+	if (obj)
+		journal_add(&journal, JOURNAL_REMOVE, obj);
+} /* sdb_store_journal_remove */
+
+int
+sdb_store_journal_checkpoint(void)
+{
+	journal_t *j = &journal;
+	char *old;
+	int status = 0;
+
+	if (! __atomic_load_n(&j->active, __ATOMIC_ACQUIRE))
+		return 0;
+
+	pthread_mutex_lock(&j->lock);
+	if (! j->active) {
+		pthread_mutex_unlock(&j->lock);
+		return 0;
+	}
+
+	old = journal_old_filename(j->filename);
+	if (! old) {
+		pthread_mutex_unlock(&j->lock);
+		return -1;
+	}
+
+	/* A previous journal is left behind if writing a snapshot failed. It's
+	 * still required in that case and updates will continue to be added to
+	 * the current journal until the next snapshot is complete. */
+	if (access(old, F_OK)) {
+		int fd;
+
+		journal_wait(j);
+		if (rename(j->filename, old)) {
+			char errbuf[1024];
+			sdb_log(SDB_LOG_ERR, "store: Failed to rename journal '%s': %s",
+					j->filename, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+			status = -1;
+		}
+		else if ((fd = journal_open_file(j->filename)) < 0) {
+			/* continue using the old journal */
+			if (rename(old, j->filename))
+				sdb_log(SDB_LOG_ERR, "store: Failed to restore journal '%s'",
+						j->filename);
+			status = -1;
+		}
+		else {
+			close(j->fd);
+			j->fd = fd;
+			j->backends = 0;
+		}
+	}
+
+	j->checkpoint = status == 0;
+	pthread_mutex_unlock(&j->lock);
+	free(old);
+	return status;
+} /* sdb_store_journal_checkpoint */
+
+void
+sdb_store_journal_checkpoint_done(bool success)
+{
+	journal_t *j = &journal;
+	char *old;
+
+	pthread_mutex_lock(&j->lock);
+	if (j->active && j->checkpoint && success) {
+		old = journal_old_filename(j->filename);
+		if (old && unlink(old) && (errno != ENOENT)) {
+			char errbuf[1024];
+			sdb_log(SDB_LOG_WARNING, "store: Failed to remove journal '%s': "
+					"%s", old, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		}
+		free(old);
+	}
+	j->checkpoint = 0;
+	pthread_mutex_unlock(&j->lock);
+} /* sdb_store_journal_checkpoint_done */
+
+/*
+ * public API
+ */
+
+int
+sdb_store_journal_replay(const char *filename)
+{
+	char *old;
+	int status;
+
+	if (! filename)
+		return -1;
+
+	if (! (old = journal_old_filename(filename)))
+		return -1;
+	status = journal_replay_file(old);
+	free(old);
+	if (status)
+		return status;
+	return journal_replay_file(filename);
+} /* sdb_store_journal_replay */
+
+int
+sdb_store_journal_open(const char *filename, sdb_time_t commit_interval)
+{
+	journal_t *j = &journal;
+	int fd;
+
+	if (! filename)
+		return -1;
+
+	pthread_mutex_lock(&j->lock);
+	if (j->active) {
+		sdb_log(SDB_LOG_ERR, "store: Journal '%s' is already open",
+				j->filename);
+		pthread_mutex_unlock(&j->lock);
+		return -1;
+	}
+
+	if ((fd = journal_open_file(filename)) < 0) {
+		pthread_mutex_unlock(&j->lock);
+		return -1;
+	}
+
+	j->filename = strdup(filename);
+	j->fd = fd;
+	j->commit_interval = commit_interval;
+	j->stop = 0;
+	j->appended = j->committed = 0;
+	j->sync_requested = 0;
+	j->error = 0;
+	j->backends = 0;
+	j->checkpoint = 0;
+
+	if ((! j->filename) || pthread_create(&j->thread, /* attr = */ NULL,
+				journal_writer, j)) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "store: Failed to start journal writer: %s",
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		free(j->filename);
+		j->filename = NULL;
+		close(fd);
+		j->fd = -1;
+		pthread_mutex_unlock(&j->lock);
+		return -1;
+	}
+
+	__atomic_store_n(&j->active, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&j->lock);
+	return 0;
+} /* sdb_store_journal_open */
+
+int
+sdb_store_journal_sync(void)
+{
+	journal_t *j = &journal;
+	int status;
+
+	pthread_mutex_lock(&j->lock);
+	if (j->active)
+		journal_wait(j);
+	status = j->error;
+	j->error = 0;
+	pthread_mutex_unlock(&j->lock);
+	return status;
+} /* sdb_store_journal_sync */
+
+void
+sdb_store_journal_close(void)
+{
+	journal_t *j = &journal;
+	int i;
+
+	pthread_mutex_lock(&j->lock);
+	if (! j->active) {
+		pthread_mutex_unlock(&j->lock);
+		return;
+	}
+
+	/* the writer thread writes all pending records before exiting */
+	__atomic_store_n(&j->active, 0, __ATOMIC_RELEASE);
+	j->stop = 1;
+	pthread_cond_broadcast(&j->pending_cond);
+	pthread_cond_broadcast(&j->commit_cond);
+	pthread_mutex_unlock(&j->lock);
+
+	pthread_join(j->thread, NULL);
+
+	pthread_mutex_lock(&j->lock);
+	close(j->fd);
+	j->fd = -1;
+	free(j->filename);
+	j->filename = NULL;
+	for (i = 0; i < 2; ++i) {
+		free(j->bufs[i].data);
+		j->bufs[i].data = NULL;
+		j->bufs[i].len = j->bufs[i].size = 0;
+	}
+	pthread_mutex_unlock(&j->lock);
+} /* sdb_store_journal_close */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
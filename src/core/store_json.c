@@ -35,11 +35,13 @@
 
 #include "sysdb.h"
 #include "core/store-private.h"
+#include "utils/epoch.h"
 #include "utils/error.h"
 
 #include <assert.h>
 
 #include <ctype.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -99,7 +101,8 @@ json_emit(sdb_store_json_formatter_t *f, sdb_store_obj_t *obj)
 	char time_str[64];
 	char interval_str[64];
 	char name[2 * strlen(SDB_OBJ(obj)->name) + 3];
-	size_t i;
+	const char *backends[STORE_BACKENDS_MAX];
+	size_t backends_num, i;
 
 	assert(f && obj);
 
@@ -141,22 +144,26 @@ json_emit(sdb_store_json_formatter_t *f, sdb_store_obj_t *obj)
 
 	/* TODO: make time and interval formats configurable */
 	if (! sdb_strftime(time_str, sizeof(time_str),
-				"%F %T %z", obj->last_update))
+				"%F %T %z", STORE_OBJ_LAST_UPDATE(obj)))
 		snprintf(time_str, sizeof(time_str), "<error>");
 	time_str[sizeof(time_str) - 1] = '\0';
 
 	if (! sdb_strfinterval(interval_str, sizeof(interval_str),
-				obj->interval))
+				STORE_OBJ_INTERVAL(obj)))
 		snprintf(interval_str, sizeof(interval_str), "<error>");
 	interval_str[sizeof(interval_str) - 1] = '\0';
 
+	if (f->flags & SDB_WANT_GENERATION)
+		sdb_strbuf_append(f->buf, "\"generation\": %"PRIu64", ",
+				sdb_store_get_generation(obj));
 	sdb_strbuf_append(f->buf, "\"last_update\": \"%s\", "
 			"\"update_interval\": \"%s\", \"backends\": [",
 			time_str, interval_str);
 
-	for (i = 0; i < obj->backends_num; ++i) {
-		sdb_strbuf_append(f->buf, "\"%s\"", obj->backends[i]);
-		if (i < obj->backends_num - 1)
+	backends_num = sdb_store_backend_names(STORE_OBJ_BACKENDS(obj), backends);
+	for (i = 0; i < backends_num; ++i) {
+		sdb_strbuf_append(f->buf, "\"%s\"", backends[i]);
+		if (i < backends_num - 1)
 			sdb_strbuf_append(f->buf, ",");
 	}
 	sdb_strbuf_append(f->buf, "]");
@@ -266,26 +273,35 @@ int
 sdb_store_json_emit_full(sdb_store_json_formatter_t *f, sdb_store_obj_t *obj,
 		sdb_store_matcher_t *filter)
 {
-	sdb_avltree_t *trees[] = { NULL, NULL, NULL };
+	sdb_avltree_t *trees[] = { NULL, NULL };
+	sdb_attrs_iter_t attrs;
+	sdb_store_obj_t *child;
 	size_t i;
 
 	if (sdb_store_json_emit(f, obj))
 		return -1;
 
 	if (obj->type == SDB_HOST) {
-		trees[0] = HOST(obj)->attributes;
-		trees[1] = HOST(obj)->metrics;
-		trees[2] = HOST(obj)->services;
+		trees[0] = HOST(obj)->metrics;
+		trees[1] = HOST(obj)->services;
 	}
-	else if (obj->type == SDB_SERVICE)
-		trees[0] = SVC(obj)->attributes;
-	else if (obj->type == SDB_METRIC)
-		trees[0] = METRIC(obj)->attributes;
 	else if (obj->type == SDB_ATTRIBUTE)
 		return 0;
-	else
+	else if ((obj->type != SDB_SERVICE) && (obj->type != SDB_METRIC))
 		return -1;
 
+	sdb_store_attrs_iter(&attrs, obj);
+	while ((child = sdb_attrs_iter_get_next(&attrs))) {
+		if (filter && (! sdb_store_matcher_matches(filter, child, NULL)))
+			continue;
+
+		if (sdb_store_json_emit_full(f, child, filter)) {
+			sdb_attrs_iter_finish(&attrs);
+			return -1;
+		}
+	}
+	sdb_attrs_iter_finish(&attrs);
+
 	for (i = 0; i < SDB_STATIC_ARRAY_LEN(trees); ++i) {
 		sdb_avltree_iter_t *iter;
 
@@ -294,7 +310,6 @@ sdb_store_json_emit_full(sdb_store_json_formatter_t *f, sdb_store_obj_t *obj,
 
 		iter = sdb_avltree_get_iter(trees[i]);
 		while (sdb_avltree_iter_has_next(iter)) {
-			sdb_store_obj_t *child;
 			child = STORE_OBJ(sdb_avltree_iter_get_next(iter));
 
 			if (filter && (! sdb_store_matcher_matches(filter, child, NULL)))
@@ -339,5 +354,73 @@ sdb_store_json_finish(sdb_store_json_formatter_t *f)
 	return 0;
 } /* sdb_store_json_finish */
 
+int
+sdb_store_stats_tojson(sdb_strbuf_t *buf, size_t max_hosts)
+{
+	int types[] = { SDB_HOST, SDB_SERVICE, SDB_METRIC, SDB_ATTRIBUTE };
+	const char *backends[STORE_BACKENDS_MAX];
+	sdb_store_usage_t usage, total = { 0, 0 };
+	sdb_store_obj_t **hosts = NULL;
+	size_t backends_num, i;
+	ssize_t hosts_num;
+
+	if (! buf)
+		return -1;
+
+	sdb_strbuf_append(buf, "{\"types\": {");
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(types); ++i) {
+		sdb_store_get_usage(types[i], &usage);
+		sdb_strbuf_append(buf, "%s\"%s\": {\"objects\": %"PRIu64", "
+				"\"bytes\": %"PRIu64"}", i ? ", " : "",
+				SDB_STORE_TYPE_TO_NAME(types[i]),
+				usage.objects, usage.bytes);
+		total.objects += usage.objects;
+		total.bytes += usage.bytes;
+	}
+	sdb_strbuf_append(buf, "}, \"total\": {\"objects\": %"PRIu64", "
+			"\"bytes\": %"PRIu64"}, \"backends\": [",
+			total.objects, total.bytes);
+
+	backends_num = sdb_store_backend_names(~(uint64_t)0, backends);
+	for (i = 0; i < backends_num; ++i) {
+		char name[2 * strlen(backends[i]) + 3];
+
+		if (sdb_store_get_backend_usage(backends[i], &usage))
+			continue;
+		escape_string(backends[i], name);
+		sdb_strbuf_append(buf, "%s{\"name\": %s, \"objects\": %"PRIu64", "
+				"\"bytes\": %"PRIu64"}", i ? ", " : "",
+				name, usage.objects, usage.bytes);
+	}
+	sdb_strbuf_append(buf, "], \"hosts\": [");
+
+	/* all hosts remain valid until we leave the critical section */
+	sdb_epoch_enter();
+	hosts_num = sdb_store_get_hosts_by_usage(&hosts);
+	if (hosts_num < 0) {
+		sdb_epoch_exit();
+		return -1;
+	}
+	if (max_hosts && ((size_t)hosts_num > max_hosts))
+		hosts_num = (ssize_t)max_hosts;
+	for (i = 0; i < (size_t)hosts_num; ++i) {
+		char name[2 * strlen(SDB_OBJ(hosts[i])->name) + 3];
+
+		usage.objects = __atomic_load_n(&HOST(hosts[i])->usage.objects,
+				__ATOMIC_RELAXED);
+		usage.bytes = __atomic_load_n(&HOST(hosts[i])->usage.bytes,
+				__ATOMIC_RELAXED);
+		escape_string(SDB_OBJ(hosts[i])->name, name);
+		sdb_strbuf_append(buf, "%s{\"name\": %s, \"objects\": %"PRIu64", "
+				"\"bytes\": %"PRIu64"}", i ? ", " : "",
+				name, usage.objects, usage.bytes);
+	}
+	sdb_epoch_exit();
+	free(hosts);
+
+	sdb_strbuf_append(buf, "]}");
+	return 0;
+} /* sdb_store_stats_tojson */
+
 /* vim: set tw=78 sw=4 ts=4 noexpandtab : */
 
@@ -27,8 +27,9 @@
 
 /*
  * This module implements operators which may be used to select contents of
- * the store by matching various attributes of the stored objects. For now, a
- * simple full table scan is supported only.
+ * the store by matching various attributes of the stored objects. Objects are
+ * selected using a full table scan unless the store is able to determine a
+ * set of candidates using an index (see sdb_store_index_attribute).
  */
 
 #if HAVE_CONFIG_H
@@ -38,51 +39,181 @@
 #include "sysdb.h"
 #include "core/store-private.h"
 #include "core/object.h"
+#include "utils/epoch.h"
 #include "utils/error.h"
 
 #include <assert.h>
 
-#include <sys/types.h>
-#include <regex.h>
-
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <limits.h>
+#include <math.h>
 
+/*
+ * Operands are evaluated by reference (see sdb_store_expr_eval_ref); only
+ * computed values are owned by the caller. Matchers are always executed from
+ * inside an epoch critical section (see sdb_store_matcher_matches).
+ */
 static int
 expr_eval2(sdb_store_expr_t *e1, sdb_data_t *v1,
-		sdb_store_expr_t *e2, sdb_data_t *v2,
+		sdb_store_expr_t *e2, sdb_data_t *v2, bool owned[2],
 		sdb_store_obj_t *obj, sdb_store_matcher_t *filter)
 {
-	if (e1->type) {
-		if (sdb_store_expr_eval(e1, obj, v1, filter))
-			return -1;
-	}
-	else
-		*v1 = e1->data;
-	if (e2->type) {
-		if (sdb_store_expr_eval(e2, obj, v2, filter)) {
-			if (e1->type)
-				sdb_data_free_datum(v1);
-			return -1;
-		}
+	if (sdb_store_expr_eval_ref(e1, obj, v1, &owned[0], filter))
+		return -1;
+	if (sdb_store_expr_eval_ref(e2, obj, v2, &owned[1], filter)) {
+		if (owned[0])
+			sdb_data_free_datum(v1);
+		return -1;
 	}
-	else
-		*v2 = e2->data;
 	return 0;
 } /* expr_eval2 */
 
 static void
-expr_free_datum2(sdb_store_expr_t *e1, sdb_data_t *v1,
-		sdb_store_expr_t *e2, sdb_data_t *v2)
+expr_free_datum2(sdb_data_t *v1, sdb_data_t *v2, bool owned[2])
 {
-	if (e1->type)
+	if (owned[0])
 		sdb_data_free_datum(v1);
-	if (e2->type)
+	if (owned[1])
 		sdb_data_free_datum(v2);
 } /* expr_free_datum2 */
 
+/*
+ * in sets
+ *
+ * Constant arrays of IN matchers are sorted once when creating the matcher,
+ * such that values may be looked up using binary search rather than the
+ * linear search of sdb_data_inarray.
+ */
+
+static int
+cmp_int(const void *a, const void *b)
+{
+	int64_t i1 = *(const int64_t *)a, i2 = *(const int64_t *)b;
+	return (i1 > i2) - (i1 < i2);
+} /* cmp_int */
+
+static int
+cmp_dec(const void *a, const void *b)
+{
+	double d1 = *(const double *)a, d2 = *(const double *)b;
+	return (d1 > d2) - (d1 < d2);
+} /* cmp_dec */
+
+static int
+cmp_str(const void *a, const void *b)
+{
+	return strcasecmp(*(const char * const *)a, *(const char * const *)b);
+} /* cmp_str */
+
+/* Returns the size and the comparison function of array elements of the
+ * specified type (if supported by in sets). */
+static size_t
+in_set_elem(int type, int (**cmp)(const void *, const void *))
+{
+	switch (type & 0xff) {
+		case SDB_TYPE_INTEGER:
+			*cmp = cmp_int;
+			return sizeof(int64_t);
+		case SDB_TYPE_DECIMAL:
+			*cmp = cmp_dec;
+			return sizeof(double);
+		case SDB_TYPE_STRING:
+			*cmp = cmp_str;
+			return sizeof(char *);
+	}
+	return 0;
+} /* in_set_elem */
+
+/* Create a sorted copy of a constant array. */
+static int
+in_set_init(sdb_data_t *set, const sdb_data_t *array)
+{
+	int (*cmp)(const void *, const void *) = NULL;
+	size_t size, len, i;
+
+	if (! (array->type & SDB_TYPE_ARRAY))
+		return -1;
+	if ((! array->data.array.values) && array->data.array.length)
+		return -1;
+	size = in_set_elem(array->type, &cmp);
+	if ((! size) || (! cmp))
+		return -1;
+
+	if ((array->type & 0xff) == SDB_TYPE_STRING) {
+		char **v = array->data.array.values;
+		for (i = 0; i < array->data.array.length; ++i)
+			if (! v[i])
+				return -1;
+	}
+
+	if (sdb_data_copy(set, array))
+		return -1;
+
+	len = set->data.array.length;
+	if ((set->type & 0xff) == SDB_TYPE_DECIMAL) {
+		/* NaN never compares equal to anything */
+		double *v = set->data.array.values;
+		size_t j = 0;
+
+		for (i = 0; i < len; ++i)
+			if (! isnan(v[i]))
+				v[j++] = v[i];
+		len = set->data.array.length = j;
+	}
+
+	if (len)
+		qsort(set->data.array.values, len, size, cmp);
+	return 0;
+} /* in_set_init */
+
+/* Returns true if the value (or all elements of an array value) are included
+ * in the set. This behaves the same as sdb_data_inarray; in particular, an
+ * empty array is included in any set of the same type. */
+static int
+in_set_contains(const sdb_data_t *set, const sdb_data_t *value)
+{
+	int (*cmp)(const void *, const void *) = NULL;
+	const char *values;
+	size_t size, length, i;
+
+	if (sdb_data_isnull(value))
+		return 0;
+	if ((value->type & 0xff) != (set->type & 0xff))
+		return 0;
+
+	size = in_set_elem(set->type, &cmp);
+	if ((! size) || (! cmp))
+		return 0;
+	if (value->type & SDB_TYPE_ARRAY) {
+		values = value->data.array.values;
+		length = value->data.array.length;
+	}
+	else {
+		values = (const char *)&value->data;
+		length = 1;
+	}
+
+	for (i = 0; i < length; ++i) {
+		const void *v = values + i * size;
+
+		if (((set->type & 0xff) == SDB_TYPE_STRING)
+				&& (! *(const char * const *)v))
+			return 0;
+		/* NaN compares equal to anything in cmp_dec but never matches */
+		if (((set->type & 0xff) == SDB_TYPE_DECIMAL)
+				&& isnan(*(const double *)v))
+			return 0;
+		if ((! set->data.array.length)
+				|| (! bsearch(v, set->data.array.values,
+						set->data.array.length, size, cmp)))
+			return 0;
+	}
+	return 1;
+} /* in_set_contains */
+
 /*
  * matcher implementations
  */
@@ -119,37 +250,59 @@ match_cmp_value(int op, sdb_data_t *v1, sdb_data_t *v2, bool strcmp_fallback)
 	return 0;
 } /* match_cmp_value */
 
+/*
+ * match_regex_compiled:
+ * Match a value against a compiled regex. String values are matched as is
+ * unless they contain any characters which would be escaped when formatting
+ * them.
+ */
 static int
-match_regex_value(int op, sdb_data_t *v, sdb_data_t *re)
+match_regex_compiled(int op, sdb_data_t *v, const sdb_store_regex_t *re)
 {
-	char value[sdb_data_strlen(v) + 1];
 	int status = 0;
 
 	assert((op == MATCHER_REGEX)
 			|| (op == MATCHER_NREGEX));
 
-	if (sdb_data_isnull(v) || sdb_data_isnull(re))
+	if (sdb_data_isnull(v) || (! sdb_store_regex_valid(re)))
 		return 0;
 
-	if (re->type == SDB_TYPE_STRING) {
-		sdb_data_t tmp = SDB_DATA_INIT;
+	if ((v->type == SDB_TYPE_STRING)
+			&& (! strpbrk(v->data.string, "\\\""))) {
+		if (*v->data.string)
+			status = sdb_store_regex_exec(re, v->data.string);
+	}
+	else {
+		char value[sdb_data_strlen(v) + 1];
+		if (sdb_data_format(v, value, sizeof(value), SDB_UNQUOTED))
+			status = sdb_store_regex_exec(re, value);
+	}
 
-		if (sdb_data_parse(re->data.string, SDB_TYPE_REGEX, &tmp))
-			return 0;
+	if (op == MATCHER_NREGEX)
+		return !status;
+	return status;
+} /* match_regex_compiled */
 
-		sdb_data_free_datum(re);
-		*re = tmp;
-	}
-	else if (re->type != SDB_TYPE_REGEX)
+static int
+match_regex_value(int op, sdb_data_t *v, sdb_data_t *re)
+{
+	const char *pattern;
+	int status;
+
+	if (sdb_data_isnull(v) || sdb_data_isnull(re))
 		return 0;
 
-	if (! sdb_data_format(v, value, sizeof(value), SDB_UNQUOTED))
-		status = 0;
-	else if (! regexec(&re->data.re.regex, value, 0, NULL, 0))
-		status = 1;
+	if (re->type == SDB_TYPE_STRING)
+		pattern = re->data.string;
+	else if (re->type == SDB_TYPE_REGEX)
+		pattern = re->data.re.raw;
+	else
+		return 0;
 
-	if (op == MATCHER_NREGEX)
-		return !status;
+	/* cached regexes are valid until leaving the critical section */
+	sdb_epoch_enter();
+	status = match_regex_compiled(op, v, sdb_store_regex_lookup(pattern));
+	sdb_epoch_exit();
 	return status;
 } /* match_regex_value */
 
@@ -231,6 +384,7 @@ match_cmp(sdb_store_matcher_t *m, sdb_store_obj_t *obj,
 	sdb_store_expr_t *e1 = CMP_M(m)->left;
 	sdb_store_expr_t *e2 = CMP_M(m)->right;
 	sdb_data_t v1 = SDB_DATA_INIT, v2 = SDB_DATA_INIT;
+	bool owned[2];
 	int status;
 
 	assert((m->type == MATCHER_LT)
@@ -241,13 +395,13 @@ match_cmp(sdb_store_matcher_t *m, sdb_store_obj_t *obj,
 			|| (m->type == MATCHER_GT));
 	assert(e1 && e2);
 
-	if (expr_eval2(e1, &v1, e2, &v2, obj, filter))
+	if (expr_eval2(e1, &v1, e2, &v2, owned, obj, filter))
 		return 0;
 
 	status = match_cmp_value(m->type, &v1, &v2,
 			(e1->data_type) < 0 || (e2->data_type < 0));
 
-	expr_free_datum2(e1, &v1, e2, &v2);
+	expr_free_datum2(&v1, &v2, owned);
 	return status;
 } /* match_cmp */
 
@@ -256,19 +410,22 @@ match_in(sdb_store_matcher_t *m, sdb_store_obj_t *obj,
 		sdb_store_matcher_t *filter)
 {
 	sdb_data_t value = SDB_DATA_INIT, array = SDB_DATA_INIT;
+	bool owned[2];
 	int status = 1;
 
 	assert((m->type == MATCHER_IN) || (m->type == MATCHER_NIN));
 	assert(CMP_M(m)->left && CMP_M(m)->right);
 
 	if (expr_eval2(CMP_M(m)->left, &value,
-				CMP_M(m)->right, &array, obj, filter))
-		status = 0;
+				CMP_M(m)->right, &array, owned, obj, filter))
+		return m->type == MATCHER_NIN;
 
-	if (status)
+	if (IN_M(m)->set.type & SDB_TYPE_ARRAY)
+		status = in_set_contains(&IN_M(m)->set, &value);
+	else
 		status = sdb_data_inarray(&value, &array);
 
-	expr_free_datum2(CMP_M(m)->left, &value, CMP_M(m)->right, &array);
+	expr_free_datum2(&value, &array, owned);
 	if (m->type == MATCHER_NIN)
 		return !status;
 	return status;
@@ -279,18 +436,20 @@ match_regex(sdb_store_matcher_t *m, sdb_store_obj_t *obj,
 		sdb_store_matcher_t *filter)
 {
 	sdb_data_t regex = SDB_DATA_INIT, v = SDB_DATA_INIT;
+	bool owned[2];
 	int status = 0;
 
 	assert((m->type == MATCHER_REGEX)
 			|| (m->type == MATCHER_NREGEX));
 	assert(CMP_M(m)->left && CMP_M(m)->right);
 
-	if (expr_eval2(CMP_M(m)->left, &v, CMP_M(m)->right, &regex, obj, filter))
+	if (expr_eval2(CMP_M(m)->left, &v, CMP_M(m)->right, &regex,
+				owned, obj, filter))
 		return 0;
 
 	status = match_regex_value(m->type, &v, &regex);
 
-	expr_free_datum2(CMP_M(m)->left, &v, CMP_M(m)->right, &regex);
+	expr_free_datum2(&v, &regex, owned);
 	return status;
 } /* match_regex */
 
@@ -299,25 +458,22 @@ match_isnull(sdb_store_matcher_t *m, sdb_store_obj_t *obj,
 		sdb_store_matcher_t *filter)
 {
 	sdb_data_t v = SDB_DATA_INIT;
+	bool owned = 0;
 	int status;
 
 	assert((m->type == MATCHER_ISNULL) || (m->type == MATCHER_ISNNULL));
 
-	if (ISNULL_M(m)->expr->type) {
-		/* TODO: this might hide real errors;
-		 * improve error reporting and propagation */
-		if (sdb_store_expr_eval(ISNULL_M(m)->expr, obj, &v, filter))
-			return 1;
-	}
-	else
-		v = ISNULL_M(m)->expr->data;
+	/* TODO: this might hide real errors;
+	 * improve error reporting and propagation */
+	if (sdb_store_expr_eval_ref(ISNULL_M(m)->expr, obj, &v, &owned, filter))
+		return 1;
 
 	if (sdb_data_isnull(&v))
 		status = 1;
 	else
 		status = 0;
 
-	if (ISNULL_M(m)->expr->type)
+	if (owned)
 		sdb_data_free_datum(&v);
 	if (m->type == MATCHER_ISNNULL)
 		return !status;
@@ -428,6 +584,29 @@ cmp_matcher_destroy(sdb_object_t *obj)
 	sdb_object_deref(SDB_OBJ(CMP_M(obj)->right));
 } /* cmp_matcher_destroy */
 
+static int
+in_matcher_init(sdb_object_t *obj, va_list ap)
+{
+	sdb_store_expr_t *right;
+	sdb_data_t null = SDB_DATA_INIT;
+
+	IN_M(obj)->set = null;
+	if (cmp_matcher_init(obj, ap))
+		return -1;
+
+	right = CMP_M(obj)->right;
+	if ((! right->type) && in_set_init(&IN_M(obj)->set, &right->data))
+		IN_M(obj)->set = null; /* fall back to sdb_data_inarray */
+	return 0;
+} /* in_matcher_init */
+
+static void
+in_matcher_destroy(sdb_object_t *obj)
+{
+	cmp_matcher_destroy(obj);
+	sdb_data_free_datum(&IN_M(obj)->set);
+} /* in_matcher_destroy */
+
 static int
 uop_matcher_init(sdb_object_t *obj, va_list ap)
 {
@@ -493,12 +672,440 @@ static sdb_type_t cmp_type = {
 	/* destroy = */ cmp_matcher_destroy,
 };
 
+static sdb_type_t in_type = {
+	/* size = */ sizeof(in_matcher_t),
+	/* init = */ in_matcher_init,
+	/* destroy = */ in_matcher_destroy,
+};
+
 static sdb_type_t isnull_type = {
 	/* size = */ sizeof(isnull_matcher_t),
 	/* init = */ isnull_matcher_init,
 	/* destroy = */ isnull_matcher_destroy,
 };
 
+/*
+ * matcher programs
+ *
+ * A matcher tree may be compiled into a flat program which is executed by a
+ * simple interpreter loop rather than by recursively dispatching through the
+ * 'matchers' table. Expressions are evaluated into registers; leaf values
+ * (constants, object names, fields, and attribute values) are borrowed rather
+ * than copied. Each register is consumed by exactly one instruction. Logical
+ * operators are implemented using conditional jumps operating on a single
+ * boolean result. Anything the compiler does not know about (e.g., ANY / ALL)
+ * falls back to the generic implementation.
+ */
+
+enum {
+	/* load a value into 'dst' */
+	OP_CONST = 0,   /* constant value 'ptr' (borrowed) */
+	OP_NAME,        /* object name (borrowed) */
+	OP_FIELD,       /* field 'arg' */
+	OP_ATTR,        /* value of attribute 'ptr' */
+	OP_EVAL,        /* generic evaluation of expression 'ptr' */
+	OP_ARITH,       /* 'a' <arg> 'b' */
+
+	/* compute the boolean result */
+	OP_CMP,         /* 'a' <arg> 'b' */
+	OP_IN,          /* 'a' [NOT] IN 'b' or set 'ptr' (if non-NULL) */
+	OP_REGEX,       /* 'a' =~ / !~ 'b' or regex 'ptr' (if non-NULL) */
+	OP_ISNULL,      /* 'a' IS [NOT] NULL */
+	OP_MATCH,       /* generic evaluation of matcher 'ptr' */
+	OP_NOT,
+
+	/* jump to 'arg' if the result is false / true */
+	OP_JF,
+	OP_JT,
+};
+
+/* 'ptr' references an sdb_store_regex_t owned by the program */
+#define INSN_OWNS_REGEX (1 << 0)
+/* use strcmp for comparing values of different types */
+#define INSN_STRCMP (1 << 1)
+
+typedef struct {
+	uint8_t code;
+	uint8_t flags;
+	/* registers */
+	uint16_t dst, a, b;
+	/* load from the object's context of this type (if non-zero) */
+	int16_t ctx;
+	int arg;
+	void *ptr;
+} prog_insn_t;
+
+struct sdb_store_prog {
+	prog_insn_t *insns;
+	size_t insns_num;
+	size_t regs_num;
+
+	sdb_store_matcher_t *m;
+	sdb_store_matcher_t *filter;
+
+	/* compiled version of the filter */
+	sdb_store_prog_t *filter_prog;
+};
+
+typedef struct {
+	sdb_data_t d;
+	bool owned;
+	bool err;
+} prog_reg_t;
+
+typedef struct {
+	sdb_store_prog_t *prog;
+	size_t insns_size;
+	size_t regs;
+} compiler_t;
+
+static int
+emit(compiler_t *c, int code, int dst, int a, int b, int arg, void *ptr)
+{
+	prog_insn_t *i;
+
+	if (c->prog->insns_num >= c->insns_size) {
+		size_t size = c->insns_size ? 2 * c->insns_size : 16;
+
+		i = realloc(c->prog->insns, size * sizeof(*i));
+		if (! i)
+			return -1;
+		c->prog->insns = i;
+		c->insns_size = size;
+	}
+
+	i = c->prog->insns + c->prog->insns_num;
+	memset(i, 0, sizeof(*i));
+	i->code = (uint8_t)code;
+	i->dst = (uint16_t)dst;
+	i->a = (uint16_t)a;
+	i->b = (uint16_t)b;
+	i->arg = arg;
+	i->ptr = ptr;
+	return (int)c->prog->insns_num++;
+} /* emit */
+
+static int
+reg_alloc(compiler_t *c)
+{
+	int r = (int)c->regs++;
+
+	if (c->regs > UINT16_MAX)
+		return -1;
+	if (c->regs > c->prog->regs_num)
+		c->prog->regs_num = c->regs;
+	return r;
+} /* reg_alloc */
+
+/* Compile an expression into a register and return the register's index. */
+static int
+compile_expr(compiler_t *c, sdb_store_expr_t *e, int ctx)
+{
+	int r, a, b, i;
+
+	r = reg_alloc(c);
+	if (r < 0)
+		return -1;
+
+	if (! e->type)
+		i = emit(c, OP_CONST, r, 0, 0, 0, &e->data);
+	else if ((e->type == FIELD_VALUE)
+			&& (e->data.data.integer == SDB_FIELD_NAME))
+		i = emit(c, OP_NAME, r, 0, 0, 0, NULL);
+	else if (e->type == FIELD_VALUE)
+		i = emit(c, OP_FIELD, r, 0, 0, (int)e->data.data.integer, NULL);
+	else if (e->type == ATTR_VALUE)
+		i = emit(c, OP_ATTR, r, 0, 0, 0, e->data.data.string);
+	else if ((e->type == TYPED_EXPR) && (! ctx)
+			&& ((e->left->type == FIELD_VALUE)
+				|| (e->left->type == ATTR_VALUE))) {
+		/* load the value from the referenced object instead */
+		c->regs = (size_t)r;
+		return compile_expr(c, e->left, (int)e->data.data.integer);
+	}
+	else if ((e->type > 0) && (! ctx)) {
+		a = compile_expr(c, e->left, ctx);
+		b = compile_expr(c, e->right, ctx);
+		if ((a < 0) || (b < 0))
+			return -1;
+		i = emit(c, OP_ARITH, r, a, b, e->type, NULL);
+		c->regs = (size_t)r + 1;
+	}
+	else
+		i = emit(c, OP_EVAL, r, 0, 0, 0, e);
+
+	if (i < 0)
+		return -1;
+	c->prog->insns[i].ctx = (int16_t)ctx;
+	return r;
+} /* compile_expr */
+
+/* Compile a constant operand of a regex matcher. Returns NULL if the
+ * pattern has to be evaluated at runtime. */
+static sdb_store_regex_t *
+compile_regex(sdb_store_expr_t *e)
+{
+	sdb_store_regex_t *re;
+	const char *pattern = NULL;
+
+	if ((! e->type) && (e->data.type == SDB_TYPE_STRING))
+		pattern = e->data.data.string;
+	else if ((! e->type) && (e->data.type == SDB_TYPE_REGEX))
+		pattern = e->data.data.re.raw;
+	if (! pattern)
+		return NULL;
+
+	re = sdb_store_regex_create(pattern);
+	if (! sdb_store_regex_valid(re)) {
+		/* this will fail at runtime again */
+		sdb_store_regex_destroy(re);
+		return NULL;
+	}
+	return re;
+} /* compile_regex */
+
+static int
+compile_matcher(compiler_t *c, sdb_store_matcher_t *m)
+{
+	sdb_store_regex_t *re = NULL;
+	sdb_data_t *set = NULL;
+	size_t regs = c->regs;
+	int a, b = 0, i;
+
+	if (! m)
+		return 0;
+
+	switch (m->type) {
+		case MATCHER_AND:
+		case MATCHER_OR:
+			if (compile_matcher(c, OP_M(m)->left))
+				return -1;
+			i = emit(c, (m->type == MATCHER_AND) ? OP_JF : OP_JT,
+					0, 0, 0, 0, NULL);
+			if ((i < 0) || compile_matcher(c, OP_M(m)->right))
+				return -1;
+			c->prog->insns[i].arg = (int)c->prog->insns_num;
+			return 0;
+
+		case MATCHER_NOT:
+			if (compile_matcher(c, UOP_M(m)->op))
+				return -1;
+			return (emit(c, OP_NOT, 0, 0, 0, 0, NULL) < 0) ? -1 : 0;
+
+		case MATCHER_LT:
+		case MATCHER_LE:
+		case MATCHER_EQ:
+		case MATCHER_NE:
+		case MATCHER_GE:
+		case MATCHER_GT:
+		case MATCHER_IN:
+		case MATCHER_NIN:
+		case MATCHER_REGEX:
+		case MATCHER_NREGEX:
+			if ((! CMP_M(m)->left) || (! CMP_M(m)->right))
+				break;
+			a = compile_expr(c, CMP_M(m)->left, 0);
+			if ((m->type == MATCHER_REGEX) || (m->type == MATCHER_NREGEX))
+				re = compile_regex(CMP_M(m)->right);
+			else if (((m->type == MATCHER_IN) || (m->type == MATCHER_NIN))
+					&& (IN_M(m)->set.type & SDB_TYPE_ARRAY))
+				set = &IN_M(m)->set;
+			if ((! re) && (! set))
+				b = compile_expr(c, CMP_M(m)->right, 0);
+			if ((a < 0) || (b < 0)) {
+				sdb_store_regex_destroy(re);
+				return -1;
+			}
+
+			if ((m->type == MATCHER_IN) || (m->type == MATCHER_NIN))
+				i = emit(c, OP_IN, 0, a, b, m->type, set);
+			else if ((m->type == MATCHER_REGEX)
+					|| (m->type == MATCHER_NREGEX))
+				i = emit(c, OP_REGEX, 0, a, b, m->type, re);
+			else
+				i = emit(c, OP_CMP, 0, a, b, m->type, NULL);
+			if (i < 0) {
+				sdb_store_regex_destroy(re);
+				return -1;
+			}
+			if (re)
+				c->prog->insns[i].flags = INSN_OWNS_REGEX;
+			if ((CMP_M(m)->left->data_type < 0)
+					|| (CMP_M(m)->right->data_type < 0))
+				c->prog->insns[i].flags |= INSN_STRCMP;
+			c->regs = regs;
+			return 0;
+
+		case MATCHER_ISNULL:
+		case MATCHER_ISNNULL:
+			a = compile_expr(c, ISNULL_M(m)->expr, 0);
+			if ((a < 0) || (emit(c, OP_ISNULL, 0, a, 0, m->type, NULL) < 0))
+				return -1;
+			c->regs = regs;
+			return 0;
+	}
+
+	/* ANY, ALL, and anything else */
+	return (emit(c, OP_MATCH, 0, 0, 0, 0, m) < 0) ? -1 : 0;
+} /* compile_matcher */
+
+/* Determine the object referenced by a typed expression the same way
+ * sdb_store_expr_eval does. */
+static sdb_store_obj_t *
+prog_context(sdb_store_obj_t *obj, int type, sdb_store_matcher_t *filter)
+{
+	if (type == obj->type)
+		return obj;
+	/* we support self-references and { service, metric } -> host */
+	if ((type != SDB_HOST)
+			|| ((obj->type != SDB_SERVICE) && (obj->type != SDB_METRIC)))
+		return NULL;
+
+	obj = obj->parent;
+	if (filter && (! sdb_store_matcher_matches(filter, obj, NULL)))
+		return NULL;
+	return obj;
+} /* prog_context */
+
+static void
+reg_release(prog_reg_t *r)
+{
+	if (r->owned)
+		sdb_data_free_datum(&r->d);
+} /* reg_release */
+
+static int
+prog_exec(sdb_store_prog_t *prog, sdb_store_obj_t *obj)
+{
+	const sdb_data_t null = SDB_DATA_INIT;
+	prog_reg_t regs[prog->regs_num + 1];
+	int status = 1;
+	size_t pc;
+
+	for (pc = 0; pc < prog->insns_num; ++pc) {
+		const prog_insn_t *i = prog->insns + pc;
+		prog_reg_t *dst = regs + i->dst;
+		prog_reg_t *a = regs + i->a;
+		prog_reg_t *b = regs + i->b;
+		const sdb_data_t *value;
+		sdb_store_obj_t *o = obj;
+
+		if (i->ctx)
+			o = prog_context(obj, i->ctx, prog->filter);
+
+		switch (i->code) {
+			case OP_CONST:
+				dst->d = *(sdb_data_t *)i->ptr;
+				dst->owned = dst->err = 0;
+				break;
+			case OP_NAME:
+				dst->owned = 0;
+				dst->err = o == NULL;
+				if (o) {
+					dst->d.type = SDB_TYPE_STRING;
+					dst->d.data.string = SDB_OBJ(o)->name;
+				}
+				break;
+			case OP_FIELD:
+				dst->d = null;
+				dst->err = sdb_store_get_field_ref(o, i->arg,
+						&dst->d, &dst->owned) != 0;
+				break;
+			case OP_ATTR:
+				value = sdb_store_get_attr_ref(o, i->ptr, prog->filter);
+				dst->owned = 0;
+				dst->err = 0;
+				if (value)
+					dst->d = *value;
+				else {
+					/* attribute does not exist => NULL */
+					dst->d.type = SDB_TYPE_STRING;
+					dst->d.data.string = NULL;
+					dst->err = o == NULL;
+				}
+				break;
+			case OP_EVAL:
+				dst->d = null;
+				dst->err = sdb_store_expr_eval_ref((sdb_store_expr_t *)i->ptr,
+						o, &dst->d, &dst->owned, prog->filter) != 0;
+				break;
+			case OP_ARITH:
+				dst->d = null;
+				dst->owned = 0;
+				dst->err = a->err || b->err
+					|| sdb_data_expr_eval(i->arg, &a->d, &b->d, &dst->d);
+				if (! dst->err)
+					dst->owned = 1;
+				reg_release(a);
+				reg_release(b);
+				break;
+
+			case OP_CMP:
+				status = 0;
+				if ((! a->err) && (! b->err))
+					status = match_cmp_value(i->arg, &a->d, &b->d,
+							(i->flags & INSN_STRCMP) != 0);
+				reg_release(a);
+				reg_release(b);
+				break;
+			case OP_IN:
+				status = 0;
+				if (i->ptr) {
+					if (! a->err)
+						status = in_set_contains(i->ptr, &a->d);
+				}
+				else if ((! a->err) && (! b->err))
+					status = sdb_data_inarray(&a->d, &b->d);
+				if (i->arg == MATCHER_NIN)
+					status = !status;
+				reg_release(a);
+				if (! i->ptr)
+					reg_release(b);
+				break;
+			case OP_REGEX:
+				status = 0;
+				if (i->ptr) {
+					if (! a->err)
+						status = match_regex_compiled(i->arg, &a->d, i->ptr);
+					reg_release(a);
+					break;
+				}
+				if ((! a->err) && (! b->err))
+					status = match_regex_value(i->arg, &a->d, &b->d);
+				reg_release(a);
+				reg_release(b);
+				break;
+			case OP_ISNULL:
+				/* evaluation errors always match (see match_isnull) */
+				if (a->err)
+					status = 1;
+				else if (i->arg == MATCHER_ISNNULL)
+					status = ! sdb_data_isnull(&a->d);
+				else
+					status = sdb_data_isnull(&a->d);
+				reg_release(a);
+				break;
+			case OP_MATCH:
+				status = sdb_store_matcher_matches(
+						(sdb_store_matcher_t *)i->ptr, obj, prog->filter);
+				break;
+			case OP_NOT:
+				status = !status;
+				break;
+
+			case OP_JF:
+				if (! status)
+					pc = (size_t)i->arg - 1;
+				break;
+			case OP_JT:
+				if (status)
+					pc = (size_t)i->arg - 1;
+				break;
+		}
+	}
+	return status;
+} /* prog_exec */
+
 /*
  * public API
  */
@@ -588,14 +1195,14 @@ sdb_store_gt_matcher(sdb_store_expr_t *left, sdb_store_expr_t *right)
 sdb_store_matcher_t *
 sdb_store_in_matcher(sdb_store_expr_t *left, sdb_store_expr_t *right)
 {
-	return M(sdb_object_create("in-matcher", cmp_type,
+	return M(sdb_object_create("in-matcher", in_type,
 				MATCHER_IN, left, right));
 } /* sdb_store_in_matcher */
 
 sdb_store_matcher_t *
 sdb_store_nin_matcher(sdb_store_expr_t *left, sdb_store_expr_t *right)
 {
-	return M(sdb_object_create("not-in-matcher", cmp_type,
+	return M(sdb_object_create("not-in-matcher", in_type,
 				MATCHER_NIN, left, right));
 } /* sdb_store_in_matcher */
 
@@ -734,6 +1341,8 @@ int
 sdb_store_matcher_matches(sdb_store_matcher_t *m, sdb_store_obj_t *obj,
 		sdb_store_matcher_t *filter)
 {
+	int status;
+
 	if (filter && (! sdb_store_matcher_matches(filter, obj, NULL)))
 		return 0;
 
@@ -744,8 +1353,84 @@ sdb_store_matcher_matches(sdb_store_matcher_t *m, sdb_store_obj_t *obj,
 	if ((m->type < 0) || ((size_t)m->type >= SDB_STATIC_ARRAY_LEN(matchers)))
 		return 0;
 
-	return matchers[m->type](m, obj, filter);
+	/* values are evaluated by reference (see expr_eval2) */
+	sdb_epoch_enter();
+	status = matchers[m->type](m, obj, filter);
+	sdb_epoch_exit();
+	return status;
 } /* sdb_store_matcher_matches */
 
+sdb_store_prog_t *
+sdb_store_matcher_compile(sdb_store_matcher_t *m, sdb_store_matcher_t *filter)
+{
+	compiler_t c = { NULL, 0, 0 };
+
+	c.prog = calloc(1, sizeof(*c.prog));
+	if (! c.prog)
+		return NULL;
+
+	if (filter) {
+		c.prog->filter_prog = sdb_store_matcher_compile(filter, NULL);
+		if (! c.prog->filter_prog) {
+			free(c.prog);
+			return NULL;
+		}
+	}
+
+	sdb_object_ref(SDB_OBJ(m));
+	sdb_object_ref(SDB_OBJ(filter));
+	c.prog->m = m;
+	c.prog->filter = filter;
+
+	if (compile_matcher(&c, m)) {
+		sdb_log(SDB_LOG_ERR, "store: Failed to compile matcher");
+		sdb_store_prog_destroy(c.prog);
+		return NULL;
+	}
+	return c.prog;
+} /* sdb_store_matcher_compile */
+
+int
+sdb_store_prog_matches(sdb_store_prog_t *prog, sdb_store_obj_t *obj)
+{
+	int status;
+
+	if (! prog)
+		return 0;
+
+	if (prog->filter_prog
+			&& (! sdb_store_prog_matches(prog->filter_prog, obj)))
+		return 0;
+
+	/* "NULL" always matches */
+	if ((! prog->m) || (! obj))
+		return 1;
+
+	sdb_epoch_enter();
+	status = prog_exec(prog, obj);
+	sdb_epoch_exit();
+	return status;
+} /* sdb_store_prog_matches */
+
+void
+sdb_store_prog_destroy(sdb_store_prog_t *prog)
+{
+	size_t i;
+
+	if (! prog)
+		return;
+
+	for (i = 0; i < prog->insns_num; ++i) {
+		if (prog->insns[i].flags & INSN_OWNS_REGEX)
+			sdb_store_regex_destroy(prog->insns[i].ptr);
+	}
+	free(prog->insns);
+
+	sdb_store_prog_destroy(prog->filter_prog);
+	sdb_object_deref(SDB_OBJ(prog->m));
+	sdb_object_deref(SDB_OBJ(prog->filter));
+	free(prog);
+} /* sdb_store_prog_destroy */
+
 /* vim: set tw=78 sw=4 ts=4 noexpandtab : */
 
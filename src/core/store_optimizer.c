@@ -0,0 +1,566 @@
+/*
+ * SysDB - src/core/store_optimizer.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module implements a simple optimizer for store matchers. Matchers are
+ * rewritten bottom-up into equivalent matchers: constant operands are
+ * evaluated once, double negations are dropped, and the operands of chains
+ * of AND and OR operators are ordered such that cheap and selective
+ * operands are evaluated first. Costs and selectivities are rough estimates
+ * based on the type of each operand and on the number of stored objects.
+ * Since matchers do not have any side-effects, the order of evaluation does
+ * not affect the result.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "sysdb.h"
+#include "core/store-private.h"
+#include "utils/error.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+/*
+ * private data types
+ */
+
+typedef struct {
+	/* number of objects by type */
+	double hosts;
+	double services;
+	double metrics;
+	double attributes;
+} stats_t;
+
+typedef struct {
+	/* estimated cost of evaluating a matcher for a single object */
+	double cost;
+	/* estimated fraction of objects matched */
+	double sel;
+	/* 1 (0) if the matcher always (never) matches, -1 else */
+	int constant;
+} estimate_t;
+
+/* constant matchers never access the object they are applied to */
+static sdb_store_obj_t constant_obj;
+
+/*
+ * private helper functions
+ */
+
+static double
+objects(const stats_t *stats, int type)
+{
+	double n = 0;
+
+	if (type == SDB_HOST)
+		n = stats->hosts;
+	else if (type == SDB_SERVICE)
+		n = stats->services;
+	else if (type == SDB_METRIC)
+		n = stats->metrics;
+	else if (type == SDB_ATTRIBUTE)
+		n = stats->attributes;
+	return (n < 1) ? 1 : n;
+} /* objects */
+
+/* Estimate the number of values an iterator expression yields for an object
+ * of the specified type (see sdb_store_expr_iter). */
+static double
+iter_len(const stats_t *stats, int context, sdb_store_expr_t *iter)
+{
+	if (! iter->type)
+		return (double)iter->data.data.array.length;
+	if (iter->type == FIELD_VALUE)
+		return 1; /* backends */
+	if (iter->data.data.integer == SDB_ATTRIBUTE) {
+		double parents = stats->hosts + stats->services + stats->metrics;
+		return stats->attributes / ((parents < 1) ? 1 : parents);
+	}
+	if (context != SDB_HOST)
+		return 1;
+	return objects(stats, (int)iter->data.data.integer)
+		/ objects(stats, SDB_HOST);
+} /* iter_len */
+
+static double
+expr_cost(sdb_store_expr_t *e)
+{
+	if (! e)
+		return 0;
+	if (! e->type)
+		return 0;
+	if (e->type == FIELD_VALUE) {
+		if (e->data.data.integer == SDB_FIELD_BACKEND)
+			return 4;
+		return 1;
+	}
+	if (e->type == ATTR_VALUE)
+		return 5;
+	if (e->type == TYPED_EXPR)
+		return 1 + expr_cost(e->left);
+	return 2 + expr_cost(e->left) + expr_cost(e->right);
+} /* expr_cost */
+
+/* Returns the selectivity of an equality comparison. */
+static double
+eq_sel(const stats_t *stats, int context,
+		sdb_store_expr_t *e1, sdb_store_expr_t *e2)
+{
+	if (e1 && (! e2->type) && (e1->type == FIELD_VALUE)
+			&& (e1->data.data.integer == SDB_FIELD_NAME)
+			&& (context > 0))
+		/* names are unique (more or less) */
+		return 1 / objects(stats, context);
+	return .1;
+} /* eq_sel */
+
+static void
+estimate(const stats_t *stats, int context, sdb_store_matcher_t *m,
+		estimate_t *est)
+{
+	sdb_store_expr_t *left = NULL, *right = NULL;
+	double sel;
+
+	est->constant = -1;
+	if ((m->type >= MATCHER_LT) || (m->type == MATCHER_IN)
+			|| (m->type == MATCHER_NIN)) {
+		left = CMP_M(m)->left;
+		right = CMP_M(m)->right;
+		est->cost = 1 + expr_cost(left) + expr_cost(right);
+	}
+
+	switch (m->type) {
+		case MATCHER_ANY:
+		case MATCHER_ALL:
+			{
+				double n = iter_len(stats, context, ITER_M(m)->iter);
+				estimate_t inner;
+
+				estimate(stats, context, ITER_M(m)->m, &inner);
+				est->cost = 5 + expr_cost(ITER_M(m)->iter)
+					+ n * (inner.cost + 2);
+				if (m->type == MATCHER_ANY)
+					est->sel = 1 - pow(1 - inner.sel, n);
+				else
+					est->sel = pow(inner.sel, n);
+			}
+			break;
+
+		case MATCHER_IN:
+		case MATCHER_NIN:
+			sel = .1;
+			if ((! right->type) && (right->data.type & SDB_TYPE_ARRAY)) {
+				double n = (double)right->data.data.array.length;
+				est->cost += n / 4;
+				sel = n * eq_sel(stats, context, left, right);
+			}
+			if (sel > 1)
+				sel = 1;
+			est->sel = (m->type == MATCHER_IN) ? sel : 1 - sel;
+			break;
+
+		case MATCHER_ISNULL:
+		case MATCHER_ISNNULL:
+			est->cost = 1 + expr_cost(ISNULL_M(m)->expr);
+			est->sel = (m->type == MATCHER_ISNULL) ? .1 : .9;
+			break;
+
+		case MATCHER_EQ:
+			est->sel = eq_sel(stats, context, left, right);
+			break;
+		case MATCHER_NE:
+			est->sel = 1 - eq_sel(stats, context, left, right);
+			break;
+		case MATCHER_REGEX:
+			est->cost += 10;
+			est->sel = .25;
+			break;
+		case MATCHER_NREGEX:
+			est->cost += 10;
+			est->sel = .75;
+			break;
+
+		default:
+			/* <, <=, >=, > */
+			est->sel = 1. / 3;
+			break;
+	}
+} /* estimate */
+
+static sdb_store_matcher_t *
+constant(bool value)
+{
+	sdb_data_t one = { SDB_TYPE_INTEGER, { .integer = 1 } };
+	sdb_store_expr_t *e = sdb_store_expr_constvalue(&one);
+	sdb_store_matcher_t *m;
+
+	if (! e)
+		return NULL;
+	if (value)
+		m = sdb_store_isnnull_matcher(e);
+	else
+		m = sdb_store_isnull_matcher(e);
+	sdb_object_deref(SDB_OBJ(e));
+	return m;
+} /* constant */
+
+/* Fold all operators on constant values. Returns a new reference. */
+static sdb_store_expr_t *
+fold_expr(sdb_store_expr_t *e)
+{
+	sdb_store_expr_t *left, *right, *folded;
+
+	if ((! e) || (e->type <= 0)) {
+		sdb_object_ref(SDB_OBJ(e));
+		return e;
+	}
+
+	left = fold_expr(e->left);
+	right = fold_expr(e->right);
+	if ((! left) || (! right)) {
+		sdb_object_deref(SDB_OBJ(left));
+		sdb_object_deref(SDB_OBJ(right));
+		return NULL;
+	}
+
+	if ((left == e->left) && (right == e->right)
+			&& (left->type || right->type)) {
+		folded = e;
+		sdb_object_ref(SDB_OBJ(e));
+	}
+	else
+		folded = sdb_store_expr_create(e->type, left, right);
+
+	sdb_object_deref(SDB_OBJ(left));
+	sdb_object_deref(SDB_OBJ(right));
+	return folded;
+} /* fold_expr */
+
+static sdb_store_matcher_t *
+cmp_matcher(int type, sdb_store_expr_t *left, sdb_store_expr_t *right)
+{
+	switch (type) {
+		case MATCHER_IN: return sdb_store_in_matcher(left, right);
+		case MATCHER_NIN: return sdb_store_nin_matcher(left, right);
+		case MATCHER_LT: return sdb_store_lt_matcher(left, right);
+		case MATCHER_LE: return sdb_store_le_matcher(left, right);
+		case MATCHER_EQ: return sdb_store_eq_matcher(left, right);
+		case MATCHER_NE: return sdb_store_ne_matcher(left, right);
+		case MATCHER_GE: return sdb_store_ge_matcher(left, right);
+		case MATCHER_GT: return sdb_store_gt_matcher(left, right);
+		case MATCHER_REGEX: return sdb_store_regex_matcher(left, right);
+		case MATCHER_NREGEX: return sdb_store_nregex_matcher(left, right);
+	}
+	return NULL;
+} /* cmp_matcher */
+
+/* Optimize a comparison or a NULL check. Returns a new reference. */
+static sdb_store_matcher_t *
+optimize_cmp(const stats_t *stats, int context, sdb_store_matcher_t *m,
+		estimate_t *est)
+{
+	sdb_store_expr_t *left, *right = NULL;
+	sdb_store_matcher_t *opt;
+	bool is_const;
+
+	if ((m->type == MATCHER_ISNULL) || (m->type == MATCHER_ISNNULL)) {
+		left = fold_expr(ISNULL_M(m)->expr);
+		if (! left)
+			return NULL;
+		if (left == ISNULL_M(m)->expr) {
+			opt = m;
+			sdb_object_ref(SDB_OBJ(m));
+		}
+		else if (m->type == MATCHER_ISNULL)
+			opt = sdb_store_isnull_matcher(left);
+		else
+			opt = sdb_store_isnnull_matcher(left);
+		is_const = ! left->type;
+	}
+	else {
+		left = fold_expr(CMP_M(m)->left);
+		right = fold_expr(CMP_M(m)->right);
+		if ((! left) || (! right)) {
+			sdb_object_deref(SDB_OBJ(left));
+			sdb_object_deref(SDB_OBJ(right));
+			return NULL;
+		}
+		if ((left == CMP_M(m)->left) && (right == CMP_M(m)->right)) {
+			opt = m;
+			sdb_object_ref(SDB_OBJ(m));
+		}
+		else
+			opt = cmp_matcher(m->type, left, right);
+		is_const = (! left->type) && (! right->type);
+	}
+	sdb_object_deref(SDB_OBJ(left));
+	sdb_object_deref(SDB_OBJ(right));
+	if (! opt)
+		return NULL;
+
+	estimate(stats, context, opt, est);
+	if (is_const) {
+		est->constant = !! sdb_store_matcher_matches(opt, &constant_obj, NULL);
+		est->cost = 0;
+		est->sel = est->constant;
+	}
+	return opt;
+} /* optimize_cmp */
+
+static sdb_store_matcher_t *
+optimize(const stats_t *stats, int context, sdb_store_matcher_t *m,
+		estimate_t *est);
+
+/* Collect the optimized operands of a chain of AND or OR operators. */
+static int
+collect(const stats_t *stats, int context, int type, sdb_store_matcher_t *m,
+		sdb_store_matcher_t ***ops, estimate_t **ests, size_t *num)
+{
+	sdb_store_matcher_t **tmp_ops;
+	estimate_t *tmp_ests;
+
+	if (m->type == type) {
+		if (collect(stats, context, type, OP_M(m)->left, ops, ests, num))
+			return -1;
+		return collect(stats, context, type, OP_M(m)->right, ops, ests, num);
+	}
+
+	tmp_ops = realloc(*ops, (*num + 1) * sizeof(**ops));
+	if (! tmp_ops)
+		return -1;
+	*ops = tmp_ops;
+	tmp_ests = realloc(*ests, (*num + 1) * sizeof(**ests));
+	if (! tmp_ests)
+		return -1;
+	*ests = tmp_ests;
+
+	(*ops)[*num] = optimize(stats, context, m, *ests + *num);
+	if (! (*ops)[*num])
+		return -1;
+	++(*num);
+	return 0;
+} /* collect */
+
+/* The rank of an operand: operands with a lower rank are evaluated first.
+ * Operands of AND should be cheap and likely to fail, operands of OR should
+ * be cheap and likely to succeed. */
+static double
+rank(int type, const estimate_t *est)
+{
+	double p = (type == MATCHER_AND) ? 1 - est->sel : est->sel;
+
+	if (p <= 0)
+		return HUGE_VAL;
+	return est->cost / p;
+} /* rank */
+
+static sdb_store_matcher_t *
+optimize_logical(const stats_t *stats, int context, sdb_store_matcher_t *m,
+		estimate_t *est)
+{
+	sdb_store_matcher_t **ops = NULL, *opt = NULL;
+	estimate_t *ests = NULL;
+	/* AND is short-circuited by false operands, OR by true operands */
+	int stop = (m->type == MATCHER_OR);
+	size_t num = 0, n, i, j;
+	double pass = 1;
+
+	if (collect(stats, context, m->type, m, &ops, &ests, &num))
+		goto done;
+
+	for (i = 0; i < num; ++i) {
+		if (ests[i].constant == stop) {
+			opt = constant(stop);
+			est->cost = 0;
+			est->sel = stop;
+			est->constant = stop;
+			goto done;
+		}
+	}
+
+	/* drop operands which do not affect the result */
+	for (i = n = 0; i < num; ++i) {
+		if (ests[i].constant == ! stop) {
+			sdb_object_deref(SDB_OBJ(ops[i]));
+			continue;
+		}
+		ops[n] = ops[i];
+		ests[n] = ests[i];
+		++n;
+	}
+	num = n;
+
+	if (! num) {
+		opt = constant(! stop);
+		est->cost = 0;
+		est->sel = ! stop;
+		est->constant = ! stop;
+		goto done;
+	}
+
+	/* insertion sort; this keeps the original order of equal operands */
+	for (i = 1; i < num; ++i) {
+		sdb_store_matcher_t *o = ops[i];
+		estimate_t e = ests[i];
+
+		for (j = i; (j > 0) && (rank(m->type, ests + j - 1)
+					> rank(m->type, &e)); --j) {
+			ops[j] = ops[j - 1];
+			ests[j] = ests[j - 1];
+		}
+		ops[j] = o;
+		ests[j] = e;
+	}
+
+	est->cost = 0;
+	est->constant = -1;
+	opt = ops[0];
+	ops[0] = NULL;
+	for (i = 0; i < num; ++i) {
+		double p = (m->type == MATCHER_AND) ? ests[i].sel : 1 - ests[i].sel;
+
+		est->cost += pass * ests[i].cost;
+		pass *= p;
+
+		if (i) {
+			sdb_store_matcher_t *tmp;
+
+			if (m->type == MATCHER_AND)
+				tmp = sdb_store_con_matcher(opt, ops[i]);
+			else
+				tmp = sdb_store_dis_matcher(opt, ops[i]);
+			sdb_object_deref(SDB_OBJ(opt));
+			sdb_object_deref(SDB_OBJ(ops[i]));
+			ops[i] = NULL;
+			opt = tmp;
+			if (! opt)
+				break;
+		}
+	}
+	est->sel = (m->type == MATCHER_AND) ? pass : 1 - pass;
+
+done:
+	for (i = 0; i < num; ++i)
+		sdb_object_deref(SDB_OBJ(ops[i]));
+	free(ops);
+	free(ests);
+	return opt;
+} /* optimize_logical */
+
+/* Returns a new reference to the optimized matcher. */
+static sdb_store_matcher_t *
+optimize(const stats_t *stats, int context, sdb_store_matcher_t *m,
+		estimate_t *est)
+{
+	sdb_store_matcher_t *op, *opt;
+
+	switch (m->type) {
+		case MATCHER_AND:
+		case MATCHER_OR:
+			return optimize_logical(stats, context, m, est);
+
+		case MATCHER_NOT:
+			if (UOP_M(m)->op->type == MATCHER_NOT) {
+				/* NOT NOT x => x */
+				return optimize(stats, context,
+						UOP_M(UOP_M(m)->op)->op, est);
+			}
+
+			op = optimize(stats, context, UOP_M(m)->op, est);
+			if (! op)
+				return NULL;
+			est->sel = 1 - est->sel;
+			if (est->constant >= 0) {
+				est->constant = ! est->constant;
+				opt = constant(est->constant);
+			}
+			else if (op->type == MATCHER_NOT) {
+				opt = UOP_M(op)->op;
+				sdb_object_ref(SDB_OBJ(opt));
+			}
+			else if (op == UOP_M(m)->op) {
+				opt = m;
+				sdb_object_ref(SDB_OBJ(m));
+			}
+			else
+				opt = sdb_store_inv_matcher(op);
+			sdb_object_deref(SDB_OBJ(op));
+			return opt;
+
+		case MATCHER_ANY:
+		case MATCHER_ALL:
+			estimate(stats, context, m, est);
+			sdb_object_ref(SDB_OBJ(m));
+			return m;
+	}
+
+	if ((m->type < MATCHER_IN) || (MATCHER_NREGEX < m->type)) {
+		/* unknown matcher; leave it alone */
+		est->cost = 1;
+		est->sel = .5;
+		est->constant = -1;
+		sdb_object_ref(SDB_OBJ(m));
+		return m;
+	}
+	return optimize_cmp(stats, context, m, est);
+} /* optimize */
+
+/*
+ * public API
+ */
+
+sdb_store_matcher_t *
+sdb_store_matcher_optimize(sdb_store_matcher_t *m, int context)
+{
+	sdb_store_usage_t usage;
+	sdb_store_matcher_t *opt;
+	stats_t stats = { 0, 0, 0, 0 };
+	estimate_t est;
+
+	if (! m)
+		return NULL;
+
+	if (! sdb_store_get_usage(SDB_HOST, &usage))
+		stats.hosts = (double)usage.objects;
+	if (! sdb_store_get_usage(SDB_SERVICE, &usage))
+		stats.services = (double)usage.objects;
+	if (! sdb_store_get_usage(SDB_METRIC, &usage))
+		stats.metrics = (double)usage.objects;
+	if (! sdb_store_get_usage(SDB_ATTRIBUTE, &usage))
+		stats.attributes = (double)usage.objects;
+
+	opt = optimize(&stats, context, m, &est);
+	if (! opt)
+		sdb_log(SDB_LOG_ERR, "store: Failed to optimize matcher");
+	return opt;
+} /* sdb_store_matcher_optimize */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
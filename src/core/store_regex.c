@@ -0,0 +1,362 @@
+/*
+ * SysDB - src/core/store_regex.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module implements the regular expressions used by the =~ and !~
+ * matchers. Patterns consisting of literal characters only (optionally
+ * anchored at the start and / or the end) are matched using plain
+ * (case-insensitive) string comparison. For all other patterns, the leading
+ * literal characters, which have to be present in any matching value, are
+ * used to reject values before invoking the regex engine.
+ *
+ * Patterns which are only known at runtime (e.g., when matching against
+ * attribute values) are compiled once and stored in a bounded cache.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "sysdb.h"
+#include "core/store-private.h"
+#include "utils/epoch.h"
+#include "utils/error.h"
+#include "utils/hashindex.h"
+
+#include <sys/types.h>
+#include <regex.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The cache is a set-associative table (see the cname cache in plugin.c):
+ * each pattern may only be stored in one of REGEX_WAYS slots determined by
+ * its hash. */
+#define REGEX_WAYS 4
+#define REGEX_SETS 64
+
+struct sdb_store_regex {
+	char *pattern;
+	regex_t regex;
+	/* false if the pattern failed to compile */
+	bool valid;
+
+	/* leading literal characters (lower-case) */
+	char *literal;
+	size_t literal_len;
+	/* the pattern consists of the literal only */
+	bool literal_only;
+	bool anchor_start;
+	bool anchor_end;
+};
+
+typedef struct {
+	sdb_store_regex_t *re;
+	uint32_t hash;
+	unsigned long last_used;
+} regex_entry_t;
+
+/*
+ * private variables
+ */
+
+static struct {
+	pthread_mutex_t set_locks[REGEX_SETS];
+	unsigned long clock[REGEX_SETS];
+	regex_entry_t entries[REGEX_SETS * REGEX_WAYS];
+} regex_cache;
+static pthread_once_t regex_cache_once = PTHREAD_ONCE_INIT;
+
+/*
+ * private helper functions
+ */
+
+static void
+regex_cache_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < REGEX_SETS; ++i)
+		pthread_mutex_init(&regex_cache.set_locks[i], /* attr = */ NULL);
+} /* regex_cache_init */
+
+static void
+regex_destroy(void *re)
+{
+	sdb_store_regex_destroy(re);
+} /* regex_destroy */
+
+static char
+fold(char c)
+{
+	if ((c >= 'A') && (c <= 'Z'))
+		return (char)(c - 'A' + 'a');
+	return c;
+} /* fold */
+
+/* Returns true if 'c' matches itself only (in an extended, case-insensitive
+ * POSIX regex). Non-ASCII characters are excluded because their case-folding
+ * depends on the locale. */
+static bool
+is_literal(char c)
+{
+	if ((c < 0x20) || (c > 0x7e))
+		return 0;
+	return strchr(".[]()*+?{}|^$\\", c) == NULL;
+} /* is_literal */
+
+static bool
+is_quantifier(char c)
+{
+	return (c == '*') || (c == '+') || (c == '?') || (c == '{');
+} /* is_quantifier */
+
+/* Determine the leading literal characters of the pattern. They are
+ * required to be present in any matching value unless the pattern contains
+ * alternatives. */
+static int
+analyze(sdb_store_regex_t *re)
+{
+	const char *p = re->pattern;
+	size_t len = 0, i;
+
+	if (strchr(p, '|'))
+		return 0;
+
+	if (*p == '^') {
+		re->anchor_start = 1;
+		++p;
+	}
+	while (is_literal(p[len]))
+		++len;
+
+	if (! p[len]) {
+		re->literal_only = 1;
+	}
+	else if ((p[len] == '$') && (! p[len + 1])) {
+		re->literal_only = 1;
+		re->anchor_end = 1;
+	}
+	else if (is_quantifier(p[len]) && len) {
+		/* the last character is optional or repeated */
+		--len;
+	}
+
+	if (! len) {
+		/* e.g., the empty pattern; leave it to the regex engine */
+		re->literal_only = 0;
+		return 0;
+	}
+
+	re->literal = malloc(len + 1);
+	if (! re->literal)
+		return -1;
+	for (i = 0; i < len; ++i)
+		re->literal[i] = fold(p[i]);
+	re->literal[len] = '\0';
+	re->literal_len = len;
+	return 0;
+} /* analyze */
+
+/* Returns true if 'lit' (folded) matches the first 'len' characters of
+ * 'value' ignoring case. */
+static bool
+prefix_matches(const char *value, const char *lit, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		if (fold(value[i]) != lit[i])
+			return 0;
+	return 1;
+} /* prefix_matches */
+
+/* Returns the first position of 'lit' in 'value' (ignoring case) or NULL. */
+static const char *
+find_literal(const char *value, size_t value_len, const char *lit, size_t len)
+{
+	size_t i;
+
+	if (value_len < len)
+		return NULL;
+	for (i = 0; i <= value_len - len; ++i)
+		if ((fold(value[i]) == lit[0]) && prefix_matches(value + i, lit, len))
+			return value + i;
+	return NULL;
+} /* find_literal */
+
+/*
+ * private API
+ */
+
+sdb_store_regex_t *
+sdb_store_regex_create(const char *pattern)
+{
+	sdb_store_regex_t *re;
+
+	if (! pattern)
+		return NULL;
+
+	re = calloc(1, sizeof(*re));
+	if (! re)
+		return NULL;
+	re->pattern = strdup(pattern);
+	if ((! re->pattern) || analyze(re)) {
+		sdb_store_regex_destroy(re);
+		return NULL;
+	}
+
+	if (regcomp(&re->regex, pattern, REG_EXTENDED | REG_ICASE | REG_NOSUB)) {
+		sdb_log(SDB_LOG_ERR, "core: Failed to compile regular "
+				"expression '%s'", pattern);
+		return re;
+	}
+	re->valid = 1;
+	return re;
+} /* sdb_store_regex_create */
+
+void
+sdb_store_regex_destroy(sdb_store_regex_t *re)
+{
+	if (! re)
+		return;
+
+	if (re->valid)
+		regfree(&re->regex);
+	if (re->literal)
+		free(re->literal);
+	if (re->pattern)
+		free(re->pattern);
+	free(re);
+} /* sdb_store_regex_destroy */
+
+bool
+sdb_store_regex_valid(const sdb_store_regex_t *re)
+{
+	return re && re->valid;
+} /* sdb_store_regex_valid */
+
+const sdb_store_regex_t *
+sdb_store_regex_lookup(const char *pattern)
+{
+	sdb_store_regex_t *re = NULL;
+	regex_entry_t *set, *victim = NULL;
+	pthread_mutex_t *lock;
+	uint32_t hash;
+	size_t i, s;
+
+	if (! pattern)
+		return NULL;
+
+	pthread_once(&regex_cache_once, regex_cache_init);
+
+	hash = sdb_hashindex_hash(pattern);
+	s = hash & (REGEX_SETS - 1);
+	set = regex_cache.entries + s * REGEX_WAYS;
+	lock = &regex_cache.set_locks[s];
+
+	pthread_mutex_lock(lock);
+	for (i = 0; i < REGEX_WAYS; ++i) {
+		regex_entry_t *e = set + i;
+
+		if (e->re && (e->hash == hash) && (! strcmp(e->re->pattern, pattern))) {
+			e->last_used = ++regex_cache.clock[s];
+			re = e->re;
+			break;
+		}
+	}
+	pthread_mutex_unlock(lock);
+
+	if (! re) {
+		/* compile outside of the lock; concurrent misses may compile the
+		 * same pattern more than once */
+		sdb_store_regex_t *new = sdb_store_regex_create(pattern);
+		if (! new)
+			return NULL;
+
+		pthread_mutex_lock(lock);
+		for (i = 0; i < REGEX_WAYS; ++i) {
+			regex_entry_t *e = set + i;
+
+			if ((! e->re) || ((e->hash == hash)
+						&& (! strcmp(e->re->pattern, pattern)))) {
+				victim = e;
+				break;
+			}
+			/* else: evict the least recently used entry */
+			if ((! victim) || (e->last_used < victim->last_used))
+				victim = e;
+		}
+		/* concurrent readers may still use the old entry */
+		if (victim->re)
+			sdb_epoch_retire(victim->re, regex_destroy);
+		victim->re = new;
+		victim->hash = hash;
+		victim->last_used = ++regex_cache.clock[s];
+		pthread_mutex_unlock(lock);
+		re = new;
+	}
+
+	if (! re->valid)
+		return NULL;
+	return re;
+} /* sdb_store_regex_lookup */
+
+bool
+sdb_store_regex_exec(const sdb_store_regex_t *re, const char *value)
+{
+	size_t len;
+
+	if ((! re) || (! re->valid) || (! value))
+		return 0;
+
+	if (re->literal_len) {
+		len = strlen(value);
+		if (re->anchor_start) {
+			if ((len < re->literal_len)
+					|| (! prefix_matches(value, re->literal, re->literal_len)))
+				return 0;
+			if (re->literal_only)
+				return (! re->anchor_end) || (len == re->literal_len);
+		}
+		else if (re->literal_only && re->anchor_end) {
+			return (len >= re->literal_len)
+				&& prefix_matches(value + len - re->literal_len,
+						re->literal, re->literal_len);
+		}
+		else if (! find_literal(value, len, re->literal, re->literal_len))
+			return 0;
+		else if (re->literal_only)
+			return 1;
+	}
+
+	return ! regexec(&re->regex, value, 0, NULL, 0);
+} /* sdb_store_regex_exec */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,624 @@
+/*
+ * SysDB - src/core/store_snapshot.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module implements binary snapshots of the store.
+ *
+ * A snapshot file starts with a magic string and the version of the format,
+ * followed by a sequence of records. Records use the same framing as network
+ * messages (see utils/proto.h): a 32-bit record type and the length of the
+ * record data. Objects are encoded in the wire format of the respective
+ * store commands, prefixed by their update interval and their set of
+ * backends. Backends are referred to by their position in the list of
+ * backend records preceding all objects. Parents are written before their
+ * children. The final record holds the number of objects and is used to
+ * detect incomplete snapshots.
+ *
+ * Writing a snapshot starts a new store journal (see store_journal.c).
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "sysdb.h"
+#include "core/store-private.h"
+#include "utils/error.h"
+#include "utils/proto.h"
+
+#include <assert.h>
+#include <errno.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * private data types
+ */
+
+#define SNAPSHOT_MAGIC "SysDBss"
+#define SNAPSHOT_MAGIC_LEN sizeof(SNAPSHOT_MAGIC)
+#define SNAPSHOT_VERSION 1
+
+#define RECORD_HEADER_LEN (2 * sizeof(uint32_t))
+
+enum {
+	SNAPSHOT_BACKEND = 1,
+	SNAPSHOT_OBJECT  = 2,
+	SNAPSHOT_END     = 3,
+};
+
+typedef struct {
+	FILE *fh;
+
+	/* record buffer (including space for the record header) */
+	char *buf;
+	size_t buf_size;
+
+	uint64_t backends_mask;
+	uint64_t objects;
+} writer_t;
+#define WRITER_INIT { NULL, NULL, 0, 0, 0 }
+
+typedef struct {
+	/* maps backends of the snapshot to backend IDs */
+	int backends[STORE_BACKENDS_MAX];
+	int backends_num;
+
+	uint64_t objects;
+} reader_t;
+
+/*
+ * private helper functions
+ */
+
+/* Make sure the record buffer can hold a record of the specified length and
+ * return a pointer to the start of the record data. */
+static char *
+writer_reserve(writer_t *w, size_t len)
+{
+	len += RECORD_HEADER_LEN;
+	if (len > w->buf_size) {
+		char *buf = realloc(w->buf, len);
+		if (! buf)
+			return NULL;
+		w->buf = buf;
+		w->buf_size = len;
+	}
+	return w->buf + RECORD_HEADER_LEN;
+} /* writer_reserve */
+
+static int
+writer_flush(writer_t *w, uint32_t code, size_t len)
+{
+	sdb_proto_marshal_int32(w->buf, RECORD_HEADER_LEN, code);
+	sdb_proto_marshal_int32(w->buf + sizeof(uint32_t),
+			RECORD_HEADER_LEN - sizeof(uint32_t), (uint32_t)len);
+
+	len += RECORD_HEADER_LEN;
+	if (fwrite(w->buf, 1, len, w->fh) != len)
+		return -1;
+	return 0;
+} /* writer_flush */
+
+static int
+write_string(writer_t *w, uint32_t code, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *buf;
+
+	if (! (buf = writer_reserve(w, len)))
+		return -1;
+	memcpy(buf, str, len);
+	return writer_flush(w, code, len);
+} /* write_string */
+
+static int
+write_end(writer_t *w)
+{
+	sdb_data_t objects = { SDB_TYPE_INTEGER, { .integer = 0 } };
+	ssize_t len;
+	char *buf;
+
+	objects.data.integer = (int64_t)w->objects;
+	len = sdb_proto_marshal_data(NULL, 0, &objects);
+	if ((len < 0) || (! (buf = writer_reserve(w, (size_t)len))))
+		return -1;
+	sdb_proto_marshal_data(buf, (size_t)len, &objects);
+	return writer_flush(w, SNAPSHOT_END, (size_t)len);
+} /* write_end */
+
+/* Encode an object in the wire format of the respective store command. This
+ * function has to be called from inside an epoch critical section. */
+static ssize_t
+marshal_obj(char *buf, size_t buf_len, sdb_store_obj_t *obj,
+		const char *hostname)
+{
+	if (obj->type == SDB_HOST) {
+		sdb_proto_host_t host = {
+			STORE_OBJ_LAST_UPDATE(obj), SDB_OBJ(obj)->name
+		};
+		return sdb_proto_marshal_host(buf, buf_len, &host);
+	}
+	else if (obj->type == SDB_SERVICE) {
+		sdb_proto_service_t svc = {
+			STORE_OBJ_LAST_UPDATE(obj), hostname, SDB_OBJ(obj)->name
+		};
+		return sdb_proto_marshal_service(buf, buf_len, &svc);
+	}
+	else if (obj->type == SDB_METRIC) {
+		sdb_proto_metric_t metric = {
+			STORE_OBJ_LAST_UPDATE(obj), hostname, SDB_OBJ(obj)->name,
+			__atomic_load_n(&METRIC(obj)->store.type, __ATOMIC_ACQUIRE),
+			__atomic_load_n(&METRIC(obj)->store.id, __ATOMIC_ACQUIRE),
+		};
+		return sdb_proto_marshal_metric(buf, buf_len, &metric);
+	}
+	else if (obj->type == SDB_ATTRIBUTE) {
+		sdb_proto_attribute_t attr = SDB_PROTO_ATTRIBUTE_INIT;
+
+		attr.last_update = STORE_OBJ_LAST_UPDATE(obj);
+		attr.parent_type = obj->parent->type;
+		attr.hostname = hostname;
+		attr.parent = SDB_OBJ(obj->parent)->name;
+		attr.key = SDB_OBJ(obj)->name;
+		attr.value = ATTR(obj)->value;
+		return sdb_proto_marshal_attribute(buf, buf_len, &attr);
+	}
+	return -1;
+} /* marshal_obj */
+
+static int
+write_obj(writer_t *w, sdb_store_obj_t *obj)
+{
+	ssize_t len;
+	char *buf;
+
+	len = sdb_store_snapshot_marshal(NULL, 0, obj, w->backends_mask);
+	if (len < 0) {
+		sdb_log(SDB_LOG_ERR, "store: Failed to encode %s '%s' for snapshot",
+				SDB_STORE_TYPE_TO_NAME(obj->type), SDB_OBJ(obj)->name);
+		return -1;
+	}
+
+	if (! (buf = writer_reserve(w, (size_t)len)))
+		return -1;
+	sdb_store_snapshot_marshal(buf, (size_t)len, obj, w->backends_mask);
+
+	++w->objects;
+	return writer_flush(w, SNAPSHOT_OBJECT, (size_t)len);
+} /* write_obj */
+
+static int
+write_attrs(writer_t *w, sdb_store_obj_t *obj)
+{
+	sdb_attrs_iter_t iter;
+	int status = 0;
+
+	sdb_store_attrs_iter(&iter, obj);
+	while (sdb_attrs_iter_has_next(&iter) && (! status))
+		status = write_obj(w, sdb_attrs_iter_get_next(&iter));
+	sdb_attrs_iter_finish(&iter);
+	return status;
+} /* write_attrs */
+
+/* sdb_store_lookup_cb writing a host and all of its children */
+static int
+write_host(sdb_store_obj_t *host,
+		sdb_store_matcher_t __attribute__((unused)) *filter, void *user_data)
+{
+	writer_t *w = user_data;
+	sdb_avltree_iter_t *iter;
+	int status;
+
+	if ((status = write_obj(w, host))
+			|| (status = write_attrs(w, host)))
+		return status;
+
+	iter = sdb_avltree_get_iter(HOST(host)->services);
+	while (sdb_avltree_iter_has_next(iter) && (! status)) {
+		sdb_store_obj_t *svc = STORE_OBJ(sdb_avltree_iter_get_next(iter));
+		if (! (status = write_obj(w, svc)))
+			status = write_attrs(w, svc);
+	}
+	sdb_avltree_iter_destroy(iter);
+
+	iter = sdb_avltree_get_iter(HOST(host)->metrics);
+	while (sdb_avltree_iter_has_next(iter) && (! status)) {
+		sdb_store_obj_t *m = STORE_OBJ(sdb_avltree_iter_get_next(iter));
+		if (! (status = write_obj(w, m)))
+			status = write_attrs(w, m);
+	}
+	sdb_avltree_iter_destroy(iter);
+	return status;
+} /* write_host */
+
+static int
+read_backend(reader_t *r, const char *buf, size_t len)
+{
+	if ((! len) || (buf[len - 1] != '\0'))
+		return -1;
+
+	/* backends beyond the maximum cannot be referenced by any object */
+	if (r->backends_num >= STORE_BACKENDS_MAX)
+		return 0;
+	r->backends[r->backends_num] = sdb_store_backend_id(buf);
+	++r->backends_num;
+	return 0;
+} /* read_backend */
+
+static int
+read_obj(reader_t *r, const char *buf, size_t len)
+{
+	sdb_store_snapshot_obj_t obj;
+	sdb_data_t value = SDB_DATA_INIT;
+	ssize_t n;
+	int status = -1;
+
+	n = sdb_store_snapshot_unmarshal(buf, len, r->backends, &obj, &value);
+	if ((n >= 0) && ((size_t)n == len))
+		status = sdb_store_restore(&obj);
+	sdb_data_free_datum(&value);
+	if (! status)
+		++r->objects;
+	return status;
+} /* read_obj */
+
+/* Returns 1 when reaching the end of the snapshot. */
+static int
+read_end(reader_t *r, const char *buf, size_t len)
+{
+	sdb_data_t objects = SDB_DATA_INIT;
+
+	if ((sdb_proto_unmarshal_data(buf, len, &objects) < 0)
+			|| (objects.type != SDB_TYPE_INTEGER))
+		return -1;
+	if ((uint64_t)objects.data.integer != r->objects) {
+		sdb_log(SDB_LOG_WARNING, "store: Restored %"PRIu64" of %"PRIu64
+				" objects from snapshot", r->objects,
+				(uint64_t)objects.data.integer);
+	}
+	return 1;
+} /* read_end */
+
+static int
+read_snapshot(reader_t *r, const char *buf, size_t len)
+{
+	uint32_t version = 0;
+	int status = 0;
+
+	if ((len < SNAPSHOT_MAGIC_LEN + sizeof(version))
+			|| memcmp(buf, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN)) {
+		sdb_log(SDB_LOG_ERR, "store: Invalid snapshot file");
+		return -1;
+	}
+	buf += SNAPSHOT_MAGIC_LEN; len -= SNAPSHOT_MAGIC_LEN;
+
+	buf += sdb_proto_unmarshal_int32(buf, len, &version);
+	len -= sizeof(version);
+	if (version != SNAPSHOT_VERSION) {
+		sdb_log(SDB_LOG_ERR, "store: Unsupported snapshot version %"PRIu32,
+				version);
+		return -1;
+	}
+
+	while (! status) {
+		uint32_t code = 0, rec_len = 0;
+
+		if ((sdb_proto_unmarshal_header(buf, len, &code, &rec_len) < 0)
+				|| (len - RECORD_HEADER_LEN < (size_t)rec_len)) {
+			sdb_log(SDB_LOG_ERR, "store: Incomplete snapshot "
+					"(%"PRIu64" objects restored)", r->objects);
+			return -1;
+		}
+		buf += RECORD_HEADER_LEN; len -= RECORD_HEADER_LEN;
+
+		if (code == SNAPSHOT_BACKEND)
+			status = read_backend(r, buf, rec_len);
+		else if (code == SNAPSHOT_OBJECT) {
+			/* skip objects which cannot be restored */
+			if (read_obj(r, buf, rec_len))
+				sdb_log(SDB_LOG_WARNING, "store: Skipping invalid object "
+						"in snapshot");
+		}
+		else if (code == SNAPSHOT_END)
+			status = read_end(r, buf, rec_len);
+		/* else: ignore unknown records */
+
+		buf += rec_len; len -= rec_len;
+	}
+	return status < 0 ? status : 0;
+} /* read_snapshot */
+
+/*
+ * private API
+ */
+
+ssize_t
+sdb_store_snapshot_marshal(char *buf, size_t buf_len,
+		sdb_store_obj_t *obj, uint64_t backends_mask)
+{
+	sdb_data_t interval = { SDB_TYPE_DATETIME, { .datetime = 0 } };
+	sdb_data_t backends = { SDB_TYPE_INTEGER, { .integer = 0 } };
+	sdb_store_obj_t *host = obj;
+	ssize_t n, meta_len, obj_len;
+	size_t len;
+
+	if (! obj)
+		return -1;
+	while (host->parent)
+		host = host->parent;
+
+	interval.data.datetime = STORE_OBJ_INTERVAL(obj);
+	backends.data.integer = (int64_t)(STORE_OBJ_BACKENDS(obj)
+			& backends_mask);
+
+	meta_len = sdb_proto_marshal_data(NULL, 0, &interval)
+		+ sdb_proto_marshal_data(NULL, 0, &backends);
+	obj_len = marshal_obj(NULL, 0, obj, SDB_OBJ(host)->name);
+	if (obj_len < 0)
+		return -1;
+
+	len = (size_t)(meta_len + obj_len);
+	if (buf_len < len)
+		return (ssize_t)len;
+
+	n = sdb_proto_marshal_data(buf, len, &interval);
+	n += sdb_proto_marshal_data(buf + n, len - (size_t)n, &backends);
+	marshal_obj(buf + n, len - (size_t)n, obj, SDB_OBJ(host)->name);
+	return (ssize_t)len;
+} /* sdb_store_snapshot_marshal */
+
+ssize_t
+sdb_store_snapshot_unmarshal(const char *buf, size_t len,
+		const int *backend_ids, sdb_store_snapshot_obj_t *obj,
+		sdb_data_t *value)
+{
+	sdb_data_t interval = SDB_DATA_INIT, backends = SDB_DATA_INIT;
+	sdb_proto_attribute_t attr = SDB_PROTO_ATTRIBUTE_INIT;
+	uint32_t type = 0;
+	ssize_t l = 0, n;
+	int i;
+
+	memset(obj, 0, sizeof(*obj));
+
+	if ((n = sdb_proto_unmarshal_data(buf, len, &interval)) < 0)
+		return -1;
+	buf += n; len -= (size_t)n; l += n;
+	if ((n = sdb_proto_unmarshal_data(buf, len, &backends)) < 0)
+		return -1;
+	buf += n; len -= (size_t)n; l += n;
+	if ((interval.type != SDB_TYPE_DATETIME)
+			|| (backends.type != SDB_TYPE_INTEGER))
+		return -1;
+
+	obj->interval = interval.data.datetime;
+	for (i = 0; i < STORE_BACKENDS_MAX; ++i)
+		if ((backends.data.integer & ((int64_t)1 << i))
+				&& (backend_ids[i] >= 0))
+			obj->backends |= (uint64_t)1 << backend_ids[i];
+
+	if (sdb_proto_unmarshal_int32(buf, len, &type) < 0)
+		return -1;
+
+	if (type == SDB_HOST) {
+		sdb_proto_host_t host = SDB_PROTO_HOST_INIT;
+		n = sdb_proto_unmarshal_host(buf, len, &host);
+		obj->last_update = host.last_update;
+		obj->hostname = obj->name = host.name;
+	}
+	else if (type == SDB_SERVICE) {
+		sdb_proto_service_t svc = SDB_PROTO_SERVICE_INIT;
+		n = sdb_proto_unmarshal_service(buf, len, &svc);
+		obj->last_update = svc.last_update;
+		obj->hostname = svc.hostname;
+		obj->name = svc.name;
+	}
+	else if (type == SDB_METRIC) {
+		sdb_proto_metric_t metric = SDB_PROTO_METRIC_INIT;
+		n = sdb_proto_unmarshal_metric(buf, len, &metric);
+		obj->last_update = metric.last_update;
+		obj->hostname = metric.hostname;
+		obj->name = metric.name;
+		obj->store_type = metric.store_type;
+		obj->store_id = metric.store_id;
+	}
+	else {
+		n = sdb_proto_unmarshal_attribute(buf, len, &attr);
+		obj->last_update = attr.last_update;
+		if (attr.parent_type == SDB_HOST)
+			obj->hostname = attr.parent;
+		else {
+			obj->hostname = attr.hostname;
+			obj->parent_type = attr.parent_type;
+			obj->parent = attr.parent;
+		}
+		obj->name = attr.key;
+		*value = attr.value;
+		obj->value = value;
+		type = SDB_ATTRIBUTE;
+	}
+
+	if (n < 0) {
+		sdb_data_free_datum(&attr.value);
+		return -1;
+	}
+	obj->type = (int)type;
+	return l + n;
+} /* sdb_store_snapshot_unmarshal */
+
+/*
+ * public API
+ */
+
+int
+sdb_store_snapshot_write(const char *filename)
+{
+	writer_t w = WRITER_INIT;
+	const char *backends[STORE_BACKENDS_MAX];
+	char version[sizeof(uint32_t)];
+	char tmp[1024];
+	size_t backends_num, i;
+	int fd, journal, status = 0;
+
+	if (! filename)
+		return -1;
+
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", filename)
+			>= sizeof(tmp)) {
+		sdb_log(SDB_LOG_ERR, "store: Snapshot filename '%s' too long",
+				filename);
+		return -1;
+	}
+
+	fd = mkstemp(tmp);
+	if ((fd < 0) || (! (w.fh = fdopen(fd, "w")))) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "store: Failed to create snapshot file '%s': %s",
+				tmp, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp);
+		}
+		return -1;
+	}
+
+	/* start a new journal; the previous one may be removed once the snapshot
+	 * is complete since the snapshot covers all updates recorded in it */
+	journal = sdb_store_journal_checkpoint();
+
+	/* backend IDs are assigned in order of registration; backends
+	 * registered while writing the snapshot will not be included */
+	backends_num = sdb_store_backend_names(~(uint64_t)0, backends);
+	w.backends_mask = backends_num < 64
+		? ((uint64_t)1 << backends_num) - 1 : ~(uint64_t)0;
+
+	sdb_proto_marshal_int32(version, sizeof(version), SNAPSHOT_VERSION);
+	if ((fwrite(SNAPSHOT_MAGIC, 1, SNAPSHOT_MAGIC_LEN, w.fh)
+				!= SNAPSHOT_MAGIC_LEN)
+			|| (fwrite(version, 1, sizeof(version), w.fh) != sizeof(version)))
+		status = -1;
+	for (i = 0; (i < backends_num) && (! status); ++i)
+		status = write_string(&w, SNAPSHOT_BACKEND, backends[i]);
+
+	if (! status)
+		status = sdb_store_scan(SDB_HOST, /* m = */ NULL, /* filter = */ NULL,
+				write_host, &w);
+	if (! status)
+		status = write_end(&w);
+
+	if ((! status) && (fflush(w.fh) || fsync(fileno(w.fh))))
+		status = -1;
+	if (fclose(w.fh))
+		status = -1;
+	if ((! status) && rename(tmp, filename))
+		status = -1;
+	free(w.buf);
+
+	if (! journal)
+		sdb_store_journal_checkpoint_done(status == 0);
+
+	if (status) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "store: Failed to write snapshot '%s': %s",
+				filename, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		unlink(tmp);
+		return -1;
+	}
+
+	sdb_log(SDB_LOG_DEBUG, "store: Wrote %"PRIu64" objects to snapshot '%s'",
+			w.objects, filename);
+	return 0;
+} /* sdb_store_snapshot_write */
+
+int
+sdb_store_snapshot_load(const char *filename)
+{
+	reader_t r;
+	struct stat st;
+	void *map;
+	int fd, status, i;
+
+	if (! filename)
+		return -1;
+
+	for (i = 0; i < STORE_BACKENDS_MAX; ++i)
+		r.backends[i] = -1;
+	r.backends_num = 0;
+	r.objects = 0;
+
+	fd = open(filename, O_RDONLY);
+	if ((fd < 0) && (errno == ENOENT)) {
+		sdb_log(SDB_LOG_INFO, "store: No snapshot found at '%s'", filename);
+		return 0;
+	}
+	if ((fd < 0) || fstat(fd, &st)) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "store: Failed to open snapshot '%s': %s",
+				filename, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	if (! st.st_size) {
+		sdb_log(SDB_LOG_ERR, "store: Invalid snapshot '%s': empty file",
+				filename);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "store: Failed to map snapshot '%s': %s",
+				filename, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		return -1;
+	}
+	posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+
+	status = read_snapshot(&r, map, (size_t)st.st_size);
+	munmap(map, (size_t)st.st_size);
+
+	if (status) {
+		sdb_log(SDB_LOG_ERR, "store: Failed to load snapshot '%s'", filename);
+		return -1;
+	}
+	sdb_log(SDB_LOG_INFO, "store: Restored %"PRIu64" objects from "
+			"snapshot '%s'", r.objects, filename);
+	return 0;
+} /* sdb_store_snapshot_load */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
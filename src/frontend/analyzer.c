@@ -348,6 +348,25 @@ analyze_matcher(int context, int parent_type,
 	return 0;
 } /* analyze_matcher */
 
+/* Replace the node's matcher with an optimized version. */
+static int
+optimize_matcher(int context, conn_matcher_t *node, sdb_strbuf_t *errbuf)
+{
+	sdb_store_matcher_t *m;
+
+	if ((! node) || (! node->matcher))
+		return 0;
+
+	m = sdb_store_matcher_optimize(node->matcher, context);
+	if (! m) {
+		sdb_strbuf_sprintf(errbuf, "Failed to optimize matcher");
+		return -1;
+	}
+	sdb_object_deref(SDB_OBJ(node->matcher));
+	node->matcher = m;
+	return 0;
+} /* optimize_matcher */
+
 /*
  * public API
  */
@@ -356,6 +375,7 @@ int
 sdb_fe_analyze(sdb_conn_node_t *node, sdb_strbuf_t *errbuf)
 {
 	sdb_store_matcher_t *m = NULL, *filter = NULL;
+	conn_matcher_t *m_node = NULL, *filter_node = NULL;
 	int context = -1;
 	int status = 0;
 
@@ -377,18 +397,23 @@ sdb_fe_analyze(sdb_conn_node_t *node, sdb_strbuf_t *errbuf)
 		}
 		if (fetch->filter)
 			filter = fetch->filter->matcher;
+		filter_node = fetch->filter;
 		context = fetch->type;
 	}
 	else if (node->cmd == SDB_CONNECTION_LIST) {
 		if (CONN_LIST(node)->filter)
 			filter = CONN_LIST(node)->filter->matcher;
+		filter_node = CONN_LIST(node)->filter;
 		context = CONN_LIST(node)->type;
 	}
-	else if (node->cmd == SDB_CONNECTION_LOOKUP) {
+	else if ((node->cmd == SDB_CONNECTION_LOOKUP)
+			|| (node->cmd == SDB_CONNECTION_WATCH)) {
 		if (CONN_LOOKUP(node)->matcher)
 			m = CONN_LOOKUP(node)->matcher->matcher;
 		if (CONN_LOOKUP(node)->filter)
 			filter = CONN_LOOKUP(node)->filter->matcher;
+		m_node = CONN_LOOKUP(node)->matcher;
+		filter_node = CONN_LOOKUP(node)->filter;
 		context = CONN_LOOKUP(node)->type;
 	}
 	else if ((node->cmd == SDB_CONNECTION_STORE_HOST)
@@ -417,7 +442,14 @@ sdb_fe_analyze(sdb_conn_node_t *node, sdb_strbuf_t *errbuf)
 		status = -1;
 	if (analyze_matcher(-1, -1, filter, errbuf))
 		status = -1;
-	return status;
+	if (status)
+		return status;
+
+	/* filters are applied to objects of all types */
+	if (optimize_matcher(context, m_node, errbuf)
+			|| optimize_matcher(-1, filter_node, errbuf))
+		return -1;
+	return 0;
 } /* sdb_fe_analyze */
 
 /* vim: set tw=78 sw=4 ts=4 noexpandtab : */
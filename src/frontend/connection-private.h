@@ -43,6 +43,7 @@
 #include <inttypes.h>
 #include <arpa/inet.h>
 
+#include <pthread.h>
 #include <stdlib.h>
 
 #ifdef __cplusplus
@@ -65,6 +66,9 @@ struct sdb_conn {
 	int (*finish)(sdb_conn_t *);
 	sdb_ssl_session_t *ssl_session;
 
+	/* serializes I/O; WATCH notifications are sent from a separate thread */
+	pthread_mutex_t lock;
+
 	/* read buffer */
 	sdb_strbuf_t *buf;
 
@@ -113,9 +117,14 @@ typedef struct {
 	char *host;
 	char *name; /* NULL for type == SDB_HOST */
 	conn_matcher_t *filter;
+
+	/* only send the object if it changed after the specified generation */
+	bool conditional;
+	uint64_t generation;
 } conn_fetch_t;
 #define CONN_FETCH(obj) ((conn_fetch_t *)(obj))
 
+/* used for LOOKUP and WATCH commands */
 typedef struct {
 	sdb_conn_node_t super;
 	int type;
@@ -32,6 +32,7 @@
 #include "sysdb.h"
 #include "core/object.h"
 #include "core/plugin.h"
+#include "core/store.h"
 #include "frontend/connection-private.h"
 #include "utils/error.h"
 #include "utils/strbuf.h"
@@ -92,6 +93,8 @@ connection_init(sdb_object_t *obj, va_list ap)
 
 	sock_fd = va_arg(ap, int);
 
+	pthread_mutex_init(&conn->lock, /* attr = */ NULL);
+
 	conn->buf = sdb_strbuf_create(/* size = */ 128);
 	if (! conn->buf) {
 		sdb_log(SDB_LOG_ERR, "frontend: Failed to allocate a read buffer "
@@ -192,6 +195,8 @@ connection_destroy(sdb_object_t *obj)
 	conn->buf = NULL;
 	sdb_strbuf_destroy(conn->errbuf);
 	conn->errbuf = NULL;
+
+	pthread_mutex_destroy(&conn->lock);
 } /* connection_destroy */
 
 static sdb_type_t connection_type = {
@@ -309,6 +314,8 @@ command_handle(sdb_conn_t *conn)
 
 	else if (conn->cmd == SDB_CONNECTION_SERVER_VERSION)
 		status = sdb_connection_server_version(conn);
+	else if (conn->cmd == SDB_CONNECTION_SERVER_STATS)
+		status = sdb_connection_server_stats(conn);
 
 	else {
 		sdb_log(SDB_LOG_WARNING, "frontend: Ignoring invalid command %#x",
@@ -382,8 +389,15 @@ connection_read(sdb_conn_t *conn)
 	while (42) {
 		ssize_t status;
 
-		errno = 0;
-		status = conn->read(conn, 1024);
+		pthread_mutex_lock(&conn->lock);
+		errno = EBADF;
+		status = -1;
+		/* the connection may have been closed by another thread */
+		if (conn->fd >= 0) {
+			errno = 0;
+			status = conn->read(conn, 1024);
+		}
+		pthread_mutex_unlock(&conn->lock);
 		if (status < 0) {
 			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
 				break;
@@ -465,6 +479,10 @@ sdb_connection_close(sdb_conn_t *conn)
 	if (! conn)
 		return;
 
+	/* watches keep a reference to the connection */
+	sdb_fe_watch_cancel(conn);
+
+	pthread_mutex_lock(&conn->lock);
 	if (conn->finish)
 		conn->finish(conn);
 	conn->finish = NULL;
@@ -473,6 +491,7 @@ sdb_connection_close(sdb_conn_t *conn)
 	if (conn->fd >= 0)
 		close(conn->fd);
 	conn->fd = -1;
+	pthread_mutex_unlock(&conn->lock);
 } /* sdb_connection_close */
 
 ssize_t
@@ -521,7 +540,13 @@ sdb_connection_send(sdb_conn_t *conn, uint32_t code,
 	if (sdb_proto_marshal(buf, sizeof(buf), code, msg_len, msg) < 0)
 		return -1;
 
-	status = conn->write(conn, buf, sizeof(buf));
+	pthread_mutex_lock(&conn->lock);
+	errno = EBADF;
+	status = -1;
+	/* the connection may have been closed by another thread */
+	if (conn->fd >= 0)
+		status = conn->write(conn, buf, sizeof(buf));
+	pthread_mutex_unlock(&conn->lock);
 	if (status < 0) {
 		char errbuf[1024];
 
@@ -563,5 +588,46 @@ sdb_connection_server_version(sdb_conn_t *conn)
 	return 0;
 } /* sdb_connection_server_version */
 
+int
+sdb_connection_server_stats(sdb_conn_t *conn)
+{
+	uint32_t res_type = htonl(SDB_CONNECTION_SERVER_STATS);
+	uint32_t max_hosts = 0;
+	sdb_strbuf_t *buf;
+
+	if ((! conn) || (conn->cmd != SDB_CONNECTION_SERVER_STATS))
+		return -1;
+
+	if (conn->cmd_len >= sizeof(max_hosts))
+		sdb_proto_unmarshal_int32(SDB_STRBUF_STR(conn->buf), &max_hosts);
+	else if (conn->cmd_len) {
+		sdb_log(SDB_LOG_ERR, "frontend: Invalid command length %d for "
+				"SERVER_STATS command", conn->cmd_len);
+		sdb_strbuf_sprintf(conn->errbuf, "SERVER_STATS: Invalid command "
+				"length %d", conn->cmd_len);
+		return -1;
+	}
+
+	buf = sdb_strbuf_create(1024);
+	if (! buf) {
+		sdb_strbuf_sprintf(conn->errbuf, "Out of memory");
+		return -1;
+	}
+
+	sdb_strbuf_memcpy(buf, &res_type, sizeof(res_type));
+	if (sdb_store_stats_tojson(buf, (size_t)max_hosts)) {
+		sdb_log(SDB_LOG_ERR, "frontend: Failed to serialize "
+				"store statistics to JSON");
+		sdb_strbuf_sprintf(conn->errbuf, "Out of memory");
+		sdb_strbuf_destroy(buf);
+		return -1;
+	}
+
+	sdb_connection_send(conn, SDB_CONNECTION_DATA,
+			(uint32_t)sdb_strbuf_len(buf), sdb_strbuf_string(buf));
+	sdb_strbuf_destroy(buf);
+	return 0;
+} /* sdb_connection_server_stats */
+
 /* vim: set tw=78 sw=4 ts=4 noexpandtab : */
 
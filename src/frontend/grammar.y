@@ -123,12 +123,14 @@ sdb_fe_yyerrorf(YYLTYPE *lval, sdb_fe_yyscan_t scanner, const char *fmt, ...);
 
 %token LAST UPDATE
 
+%token IF NEWER THAN
+
 %token START END
 
 /* NULL token */
 %token NULL_T
 
-%token FETCH LIST LOOKUP STORE TIMESERIES
+%token FETCH LIST LOOKUP STORE TIMESERIES WATCH
 
 %token <str> IDENTIFIER STRING
 
@@ -159,6 +161,7 @@ sdb_fe_yyerrorf(YYLTYPE *lval, sdb_fe_yyscan_t scanner, const char *fmt, ...);
 	lookup_statement
 	store_statement
 	timeseries_statement
+	watch_statement
 	matching_clause
 	filter_clause
 	condition
@@ -176,6 +179,7 @@ sdb_fe_yyerrorf(YYLTYPE *lval, sdb_fe_yyscan_t scanner, const char *fmt, ...);
 %type <data> data
 	interval interval_elem
 	array array_elem_list
+	newer_than_clause
 
 %type <datetime> datetime
 	start_clause end_clause
@@ -276,6 +280,8 @@ statement:
 	|
 	timeseries_statement
 	|
+	watch_statement
+	|
 	/* empty */
 		{
 			$$ = NULL;
@@ -283,30 +289,38 @@ statement:
 	;
 
 /*
- * FETCH <type> <hostname> [FILTER <condition>];
+ * FETCH <type> <hostname> [IF NEWER THAN <generation>] [FILTER <condition>];
  *
  * Retrieve detailed information about a single host.
  */
 fetch_statement:
-	FETCH object_type STRING filter_clause
+	FETCH object_type STRING newer_than_clause filter_clause
 		{
 			$$ = SDB_CONN_NODE(sdb_object_create_dT(/* name = */ NULL,
 						conn_fetch_t, conn_fetch_destroy));
 			CONN_FETCH($$)->type = $2;
 			CONN_FETCH($$)->host = $3;
 			CONN_FETCH($$)->name = NULL;
-			CONN_FETCH($$)->filter = CONN_MATCHER($4);
+			CONN_FETCH($$)->filter = CONN_MATCHER($5);
+			if ($4.type == SDB_TYPE_INTEGER) {
+				CONN_FETCH($$)->conditional = 1;
+				CONN_FETCH($$)->generation = (uint64_t)$4.data.integer;
+			}
 			$$->cmd = SDB_CONNECTION_FETCH;
 		}
 	|
-	FETCH object_type STRING '.' STRING filter_clause
+	FETCH object_type STRING '.' STRING newer_than_clause filter_clause
 		{
 			$$ = SDB_CONN_NODE(sdb_object_create_dT(/* name = */ NULL,
 						conn_fetch_t, conn_fetch_destroy));
 			CONN_FETCH($$)->type = $2;
 			CONN_FETCH($$)->host = $3;
 			CONN_FETCH($$)->name = $5;
-			CONN_FETCH($$)->filter = CONN_MATCHER($6);
+			CONN_FETCH($$)->filter = CONN_MATCHER($7);
+			if ($6.type == SDB_TYPE_INTEGER) {
+				CONN_FETCH($$)->conditional = 1;
+				CONN_FETCH($$)->generation = (uint64_t)$6.data.integer;
+			}
 			$$->cmd = SDB_CONNECTION_FETCH;
 		}
 	;
@@ -344,6 +358,23 @@ lookup_statement:
 		}
 	;
 
+/*
+ * WATCH <type> [MATCHING <condition>] [FILTER <condition>];
+ *
+ * Keeps sending updates about <type> matching condition.
+ */
+watch_statement:
+	WATCH object_type_plural matching_clause filter_clause
+		{
+			$$ = SDB_CONN_NODE(sdb_object_create_dT(/* name = */ NULL,
+						conn_lookup_t, conn_lookup_destroy));
+			CONN_LOOKUP($$)->type = $2;
+			CONN_LOOKUP($$)->matcher = CONN_MATCHER($3);
+			CONN_LOOKUP($$)->filter = CONN_MATCHER($4);
+			$$->cmd = SDB_CONNECTION_WATCH;
+		}
+	;
+
 matching_clause:
 	MATCHING condition { $$ = $2; }
 	|
@@ -354,6 +385,11 @@ filter_clause:
 	|
 	/* empty */ { $$ = NULL; }
 
+newer_than_clause:
+	IF NEWER THAN INTEGER { $$ = $4; }
+	|
+	/* empty */ { $$.type = SDB_TYPE_NULL; }
+
 /*
  * STORE <type> <name>|<host>.<name> [LAST UPDATE <datetime>];
  * STORE METRIC <host>.<name> STORE <type> <id> [LAST UPDATE <datetime>];
@@ -137,7 +137,8 @@ sdb_fe_fetch(sdb_conn_t *conn)
 			conn->cmd_len - sizeof(uint32_t));
 	name[sizeof(name) - 1] = '\0';
 	/* TODO: support other types besides hosts */
-	return sdb_fe_exec_fetch(conn, (int)type, name, NULL, /* filter = */ NULL);
+	return sdb_fe_exec_fetch(conn, (int)type, name, NULL, /* filter = */ NULL,
+			/* newer_than = */ NULL);
 } /* sdb_fe_fetch */
 
 int
@@ -220,8 +221,10 @@ sdb_fe_lookup(sdb_conn_t *conn)
 		status = -1;
 	}
 	else
-		status = sdb_fe_exec_lookup(conn, (int)type, m, /* filter = */ NULL);
-	sdb_object_deref(SDB_OBJ(m));
+		status = sdb_fe_exec_lookup(conn, (int)type,
+				m_node.matcher, /* filter = */ NULL);
+	/* the analyzer may have replaced the matcher */
+	sdb_object_deref(SDB_OBJ(m_node.matcher));
 	return status;
 } /* sdb_fe_lookup */
 
@@ -238,7 +241,9 @@ sdb_fe_exec(sdb_conn_t *conn, sdb_conn_node_t *node)
 			if (CONN_FETCH(node)->filter)
 				filter = CONN_FETCH(node)->filter->matcher;
 			return sdb_fe_exec_fetch(conn, CONN_FETCH(node)->type,
-					CONN_FETCH(node)->host, CONN_FETCH(node)->name, filter);
+					CONN_FETCH(node)->host, CONN_FETCH(node)->name, filter,
+					CONN_FETCH(node)->conditional
+						? &CONN_FETCH(node)->generation : NULL);
 		case SDB_CONNECTION_LIST:
 			if (CONN_LIST(node)->filter)
 				filter = CONN_LIST(node)->filter->matcher;
@@ -250,6 +255,13 @@ sdb_fe_exec(sdb_conn_t *conn, sdb_conn_node_t *node)
 				filter = CONN_LOOKUP(node)->filter->matcher;
 			return sdb_fe_exec_lookup(conn,
 					CONN_LOOKUP(node)->type, m, filter);
+		case SDB_CONNECTION_WATCH:
+			if (CONN_LOOKUP(node)->matcher)
+				m = CONN_LOOKUP(node)->matcher->matcher;
+			if (CONN_LOOKUP(node)->filter)
+				filter = CONN_LOOKUP(node)->filter->matcher;
+			return sdb_fe_exec_watch(conn,
+					CONN_LOOKUP(node)->type, m, filter);
 		case SDB_CONNECTION_STORE_HOST:
 		{
 			conn_store_host_t *n = CONN_STORE_HOST(node);
@@ -294,7 +306,8 @@ sdb_fe_exec(sdb_conn_t *conn, sdb_conn_node_t *node)
 
 int
 sdb_fe_exec_fetch(sdb_conn_t *conn, int type,
-		const char *hostname, const char *name, sdb_store_matcher_t *filter)
+		const char *hostname, const char *name, sdb_store_matcher_t *filter,
+		const uint64_t *newer_than)
 {
 	uint32_t res_type = htonl(SDB_CONNECTION_FETCH);
 
@@ -315,6 +328,9 @@ sdb_fe_exec_fetch(sdb_conn_t *conn, int type,
 	if (type == SDB_HOST)
 		name = hostname;
 
+	/* serialize the object as stored at a single point in time; the view
+	 * is released before sending the reply to a (possibly slow) client */
+	sdb_store_view_begin();
 	host = sdb_store_get_host(hostname);
 	if ((! host) || (filter
 				&& (! sdb_store_matcher_matches(filter, host, NULL)))) {
@@ -322,6 +338,7 @@ sdb_fe_exec_fetch(sdb_conn_t *conn, int type,
 				"host %s not found", SDB_STORE_TYPE_TO_NAME(type),
 				name, hostname);
 		sdb_object_deref(SDB_OBJ(host));
+		sdb_store_view_end();
 		return -1;
 	}
 	if (type == SDB_HOST) {
@@ -337,12 +354,23 @@ sdb_fe_exec_fetch(sdb_conn_t *conn, int type,
 			if (obj)
 				sdb_object_deref(SDB_OBJ(obj));
 			sdb_object_deref(SDB_OBJ(host));
+			sdb_store_view_end();
 			return -1;
 		}
 		sdb_object_deref(SDB_OBJ(host));
 	}
 	host = NULL;
 
+	if (newer_than && (sdb_store_get_generation(obj) <= *newer_than)) {
+		/* the client already knows the current version */
+		const char msg[] = "Not modified";
+		sdb_store_view_end();
+		sdb_connection_send(conn, SDB_CONNECTION_OK,
+				(uint32_t)strlen(msg), msg);
+		sdb_object_deref(SDB_OBJ(obj));
+		return 0;
+	}
+
 	buf = sdb_strbuf_create(1024);
 	if (! buf) {
 		char errbuf[1024];
@@ -353,9 +381,12 @@ sdb_fe_exec_fetch(sdb_conn_t *conn, int type,
 		sdb_strbuf_sprintf(conn->errbuf, "Out of memory");
 		sdb_strbuf_destroy(buf);
 		sdb_object_deref(SDB_OBJ(obj));
+		sdb_store_view_end();
 		return -1;
 	}
-	f = sdb_store_json_formatter(buf, type, /* flags = */ 0);
+	/* include generations if the client uses them */
+	f = sdb_store_json_formatter(buf, type,
+			newer_than ? SDB_WANT_GENERATION : 0);
 	if (! f) {
 		char errbuf[1024];
 		sdb_log(SDB_LOG_ERR, "frontend: Failed to create "
@@ -365,6 +396,7 @@ sdb_fe_exec_fetch(sdb_conn_t *conn, int type,
 		sdb_strbuf_sprintf(conn->errbuf, "Out of memory");
 		sdb_strbuf_destroy(buf);
 		sdb_object_deref(SDB_OBJ(obj));
+		sdb_store_view_end();
 		return -1;
 	}
 
@@ -377,9 +409,11 @@ sdb_fe_exec_fetch(sdb_conn_t *conn, int type,
 		sdb_strbuf_destroy(buf);
 		free(f);
 		sdb_object_deref(SDB_OBJ(obj));
+		sdb_store_view_end();
 		return -1;
 	}
 	sdb_store_json_finish(f);
+	sdb_store_view_end();
 
 	sdb_connection_send(conn, SDB_CONNECTION_DATA,
 			(uint32_t)sdb_strbuf_len(buf), sdb_strbuf_string(buf));
@@ -559,7 +559,9 @@ connection_handler(void *data)
 
 		status = (int)sdb_connection_handle(conn);
 		if (status <= 0) {
-			/* error or EOF -> close connection */
+			/* error or EOF -> close connection; it may still be referenced
+			 * by pending WATCH notifications */
+			sdb_connection_close(conn);
 			sdb_object_deref(SDB_OBJ(conn));
 			continue;
 		}
@@ -633,6 +635,7 @@ socket_handle_incoming(sdb_fe_socket_t *sock,
 					CONN(obj)->fd);
 			/* close the connection */
 			sdb_llist_iter_remove_current(iter);
+			sdb_connection_close(CONN(obj));
 			sdb_object_deref(obj);
 			continue;
 		}
@@ -698,6 +701,8 @@ sdb_fe_sock_create(void)
 void
 sdb_fe_sock_destroy(sdb_fe_socket_t *sock)
 {
+	sdb_llist_iter_t *iter;
+
 	if (! sock)
 		return;
 
@@ -709,8 +714,17 @@ sdb_fe_sock_destroy(sdb_fe_socket_t *sock)
 		close(sock->trigger[TRIGGER_READ]);
 	sock->trigger[TRIGGER_READ] = sock->trigger[TRIGGER_WRITE] = -1;
 
+	/* connections with active watches are referenced elsewhere as well */
+	iter = sdb_llist_get_iter(sock->open_connections);
+	while (sdb_llist_iter_has_next(iter))
+		sdb_connection_close(CONN(sdb_llist_iter_get_next(iter)));
+	sdb_llist_iter_destroy(iter);
+
 	sdb_llist_destroy(sock->open_connections);
 	sock->open_connections = NULL;
+
+	/* closing the connections canceled all of their watches */
+	sdb_fe_watch_shutdown();
 	free(sock);
 } /* sdb_fe_sock_destroy */
 
@@ -0,0 +1,418 @@
+/*
+ * SysDB - src/frontend/watch.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * WATCH commands: change notifications pushed to clients.
+ *
+ * The store reports changes while holding the lock of the respective host.
+ * The callback registered for each WATCH command thus only queues the event.
+ * A single notifier thread evaluates the command's conditions and sends the
+ * serialized objects to the client, serializing with the connection's
+ * handler thread using the connection's lock.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "core/store.h"
+#include "frontend/connection-private.h"
+#include "utils/error.h"
+#include "utils/strbuf.h"
+
+#include <assert.h>
+#include <errno.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+/*
+ * private data types
+ */
+
+typedef struct {
+	sdb_object_t super;
+
+	/* the connection which issued the command; notifications will only be
+	 * sent (and the connection referenced) once the command has been
+	 * acknowledged and until the watch has been canceled */
+	sdb_conn_t *owner;
+	sdb_conn_t *conn;
+
+	int type;
+	sdb_store_matcher_t *matcher;
+	sdb_store_matcher_t *filter;
+} watch_t;
+#define WATCH(obj) ((watch_t *)(obj))
+
+typedef struct watch_event {
+	struct watch_event *next;
+	watch_t *watch;
+	sdb_store_obj_t *obj;
+	int event;
+} watch_event_t;
+
+/* Maximum number of pending notifications. Further events will be dropped
+ * rather than letting slow clients take up unbounded amounts of memory. */
+#define WATCH_QUEUE_MAX 65536
+
+/*
+ * private variables
+ */
+
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  watch_cond = PTHREAD_COND_INITIALIZER;
+
+static watch_t **watches = NULL;
+static size_t    watches_num = 0;
+
+static watch_event_t *queue_head = NULL;
+static watch_event_t *queue_tail = NULL;
+static size_t         queue_len = 0;
+static size_t         queue_dropped = 0;
+
+static bool      notifier_running = 0;
+static bool      notifier_stop = 0;
+static pthread_t notifier;
+
+/*
+ * private helper functions
+ */
+
+static void
+watch_destroy(sdb_object_t *obj)
+{
+	watch_t *w = WATCH(obj);
+
+	assert(! w->conn);
+	sdb_object_deref(SDB_OBJ(w->matcher));
+	sdb_object_deref(SDB_OBJ(w->filter));
+} /* watch_destroy */
+
+/* Store watch callback: queue the event for the notifier thread. Don't log
+ * anything here; log messages may be sent to clients while the store is
+ * locked. */
+static void
+watch_enqueue(sdb_store_obj_t *obj, int event, sdb_object_t *user_data)
+{
+	watch_event_t *ev;
+
+	pthread_mutex_lock(&watch_lock);
+	ev = queue_len < WATCH_QUEUE_MAX ? malloc(sizeof(*ev)) : NULL;
+	if (! ev) {
+		++queue_dropped;
+		pthread_mutex_unlock(&watch_lock);
+		return;
+	}
+
+	ev->next = NULL;
+	ev->watch = WATCH(user_data);
+	ev->obj = obj;
+	ev->event = event;
+
+	sdb_object_ref(SDB_OBJ(ev->watch));
+	sdb_object_ref(SDB_OBJ(ev->obj));
+	if (queue_tail)
+		queue_tail->next = ev;
+	else
+		queue_head = ev;
+	queue_tail = ev;
+	++queue_len;
+	pthread_cond_signal(&watch_cond);
+	pthread_mutex_unlock(&watch_lock);
+} /* watch_enqueue */
+
+static void
+watch_send(sdb_conn_t *conn, watch_t *w, sdb_store_obj_t *obj, int event)
+{
+	uint32_t res_type = htonl(SDB_CONNECTION_WATCH);
+
+	sdb_store_json_formatter_t *f;
+	sdb_strbuf_t *buf;
+
+	if (! sdb_store_matcher_matches(w->matcher, obj, w->filter))
+		return;
+
+	buf = sdb_strbuf_create(1024);
+	if (! buf) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "frontend: Failed to create "
+				"buffer to handle WATCH notification: %s",
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		return;
+	}
+	f = sdb_store_json_formatter(buf, w->type, /* flags = */ 0);
+	if (! f) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "frontend: Failed to create "
+				"JSON formatter to handle WATCH notification: %s",
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		sdb_strbuf_destroy(buf);
+		return;
+	}
+
+	sdb_strbuf_memcpy(buf, &res_type, sizeof(uint32_t));
+	/* the object is serialized the same way as by the FETCH command */
+	sdb_strbuf_append(buf, "{\"event\": \"%s\", \"object\": ",
+			event == SDB_STORE_EXPIRED ? "expired" : "updated");
+	if (sdb_store_json_emit_full(f, obj, w->filter)) {
+		sdb_log(SDB_LOG_ERR, "frontend: Failed to serialize "
+				"%s %s to JSON", SDB_STORE_TYPE_TO_NAME(w->type),
+				SDB_OBJ(obj)->name);
+		sdb_strbuf_destroy(buf);
+		free(f);
+		return;
+	}
+	sdb_store_json_finish(f);
+	sdb_strbuf_append(buf, "}");
+
+	sdb_connection_send(conn, SDB_CONNECTION_DATA,
+			(uint32_t)sdb_strbuf_len(buf), sdb_strbuf_string(buf));
+	sdb_strbuf_destroy(buf);
+	free(f);
+} /* watch_send */
+
+static void *
+watch_notifier(void __attribute__((unused)) *arg)
+{
+	while (42) {
+		watch_event_t *ev;
+		sdb_conn_t *conn;
+		size_t dropped;
+
+		pthread_mutex_lock(&watch_lock);
+		while ((! queue_head) && (! notifier_stop))
+			pthread_cond_wait(&watch_cond, &watch_lock);
+		/* deliver all pending notifications before shutting down */
+		if (! queue_head) {
+			pthread_mutex_unlock(&watch_lock);
+			break;
+		}
+
+		ev = queue_head;
+		queue_head = ev->next;
+		if (! queue_head)
+			queue_tail = NULL;
+		--queue_len;
+
+		dropped = queue_dropped;
+		queue_dropped = 0;
+
+		conn = ev->watch->conn;
+		sdb_object_ref(SDB_OBJ(conn));
+		pthread_mutex_unlock(&watch_lock);
+
+		if (dropped)
+			sdb_log(SDB_LOG_WARNING, "frontend: Dropped %zu WATCH "
+					"notification%s; clients don't keep up with updates",
+					dropped, dropped == 1 ? "" : "s");
+
+		if (conn)
+			watch_send(conn, ev->watch, ev->obj, ev->event);
+
+		sdb_object_deref(SDB_OBJ(conn));
+		sdb_object_deref(SDB_OBJ(ev->watch));
+		sdb_object_deref(SDB_OBJ(ev->obj));
+		free(ev);
+	}
+	return NULL;
+} /* watch_notifier */
+
+/* Register a watch; the watch lock has to be acquired before calling this
+ * function. */
+static int
+watch_register(watch_t *w)
+{
+	watch_t **tmp;
+
+	if (notifier_stop)
+		return -1;
+	if (! notifier_running) {
+		/* joined by sdb_fe_watch_shutdown */
+		if (pthread_create(&notifier, /* attr = */ NULL,
+					watch_notifier, /* arg = */ NULL))
+			return -1;
+		notifier_running = 1;
+	}
+
+	tmp = realloc(watches, (watches_num + 1) * sizeof(*watches));
+	if (! tmp)
+		return -1;
+	watches = tmp;
+	watches[watches_num] = w;
+	++watches_num;
+	sdb_object_ref(SDB_OBJ(w));
+	return 0;
+} /* watch_register */
+
+/* Remove the first watch owned by the specified connection; the watch lock
+ * has to be acquired before calling this function. */
+static watch_t *
+watch_unregister(sdb_conn_t *conn)
+{
+	size_t i;
+
+	for (i = 0; i < watches_num; ++i) {
+		watch_t *w = watches[i];
+
+		if (w->owner != conn)
+			continue;
+
+		memmove(watches + i, watches + i + 1,
+				(watches_num - i - 1) * sizeof(*watches));
+		--watches_num;
+		return w;
+	}
+	return NULL;
+} /* watch_unregister */
+
+/*
+ * public API
+ */
+
+int
+sdb_fe_exec_watch(sdb_conn_t *conn, int type,
+		sdb_store_matcher_t *m, sdb_store_matcher_t *filter)
+{
+	uint32_t res_type = htonl(SDB_CONNECTION_WATCH);
+	watch_t *w;
+	int status;
+
+	w = WATCH(sdb_object_create_dT(/* name = */ NULL,
+				watch_t, watch_destroy));
+	if (! w) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "frontend: Failed to create "
+				"watch to handle WATCH command: %s",
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+
+		sdb_strbuf_sprintf(conn->errbuf, "Out of memory");
+		return -1;
+	}
+	w->owner = conn;
+	w->conn = NULL;
+	w->type = type;
+	w->matcher = m;
+	sdb_object_ref(SDB_OBJ(m));
+	w->filter = filter;
+	sdb_object_ref(SDB_OBJ(filter));
+
+	status = sdb_store_watch(type, watch_enqueue, SDB_OBJ(w));
+	if (! status) {
+		pthread_mutex_lock(&watch_lock);
+		status = watch_register(w);
+		pthread_mutex_unlock(&watch_lock);
+		if (status)
+			sdb_store_unwatch(watch_enqueue, SDB_OBJ(w));
+	}
+	if (status) {
+		sdb_log(SDB_LOG_ERR, "frontend: Failed to register watch for %ss",
+				SDB_STORE_TYPE_TO_NAME(type));
+		sdb_strbuf_sprintf(conn->errbuf, "Failed to watch %ss",
+				SDB_STORE_TYPE_TO_NAME(type));
+		sdb_object_deref(SDB_OBJ(w));
+		return -1;
+	}
+
+	/* acknowledge the command before sending any notifications */
+	sdb_connection_send(conn, SDB_CONNECTION_DATA,
+			(uint32_t)sizeof(res_type), (const char *)&res_type);
+
+	pthread_mutex_lock(&watch_lock);
+	/* the connection might have been closed in the meantime */
+	if (w->owner) {
+		w->conn = conn;
+		sdb_object_ref(SDB_OBJ(conn));
+	}
+	pthread_mutex_unlock(&watch_lock);
+
+	sdb_object_deref(SDB_OBJ(w));
+	return 0;
+} /* sdb_fe_exec_watch */
+
+void
+sdb_fe_watch_cancel(sdb_conn_t *conn)
+{
+	while (42) {
+		sdb_conn_t *c;
+		watch_t *w;
+
+		pthread_mutex_lock(&watch_lock);
+		w = watch_unregister(conn);
+		if (! w) {
+			pthread_mutex_unlock(&watch_lock);
+			break;
+		}
+		c = w->conn;
+		w->owner = w->conn = NULL;
+		pthread_mutex_unlock(&watch_lock);
+
+		/* don't hold the lock: the store might be notifying us right now */
+		sdb_store_unwatch(watch_enqueue, SDB_OBJ(w));
+		sdb_object_deref(SDB_OBJ(w));
+		sdb_object_deref(SDB_OBJ(c));
+	}
+} /* sdb_fe_watch_cancel */
+
+void
+sdb_fe_watch_shutdown(void)
+{
+	watch_event_t *ev;
+
+	pthread_mutex_lock(&watch_lock);
+	if (! notifier_running) {
+		pthread_mutex_unlock(&watch_lock);
+		return;
+	}
+	notifier_stop = 1;
+	pthread_cond_broadcast(&watch_cond);
+	pthread_mutex_unlock(&watch_lock);
+
+	pthread_join(notifier, NULL);
+
+	pthread_mutex_lock(&watch_lock);
+	/* drop events queued by remaining watches after the notifier exited */
+	ev = queue_head;
+	queue_head = queue_tail = NULL;
+	queue_len = 0;
+	notifier_running = 0;
+	notifier_stop = 0;
+	pthread_mutex_unlock(&watch_lock);
+
+	while (ev) {
+		watch_event_t *next = ev->next;
+
+		sdb_object_deref(SDB_OBJ(ev->watch));
+		sdb_object_deref(SDB_OBJ(ev->obj));
+		free(ev);
+		ev = next;
+	}
+} /* sdb_fe_watch_shutdown */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
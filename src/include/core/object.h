@@ -51,6 +51,7 @@ struct sdb_type {
 
 struct sdb_object {
 	sdb_type_t type;
+	/* modified atomically; use sdb_object_ref and sdb_object_deref */
 	int ref_cnt;
 	char *name;
 };
@@ -97,6 +98,9 @@ typedef int (*sdb_object_lookup_cb)(const sdb_object_t *, const void *user_data)
  * callback may be called on objects that were only half-way initialized. The
  * callback has to handle that case correctly.
  *
+ * The name is interned (see utils/intern.h), that is, all objects of the same
+ * name share a single copy of it which must not be modified.
+ *
  * The reference count of the new object will be 1.
  *
  * Returns:
@@ -149,7 +153,8 @@ sdb_object_create_wrapper(const char *name,
  * sdb_object_deref:
  * Dereference the object and free the allocated memory in case the ref-count
  * drops to zero. In case a 'destructor' had been registered with the object,
- * it will be called before freeing the memory.
+ * it will be called before freeing the memory. The reference count is updated
+ * atomically, so references may be released from any thread.
  */
 void
 sdb_object_deref(sdb_object_t *obj);
@@ -157,7 +162,8 @@ sdb_object_deref(sdb_object_t *obj);
 /*
  * sdb_object_ref:
  * Take ownership of the specified object, that is, increment the reference
- * count by one.
+ * count by one. This is safe to be called concurrently as long as the caller
+ * holds a reference to the object.
  */
 void
 sdb_object_ref(sdb_object_t *obj);
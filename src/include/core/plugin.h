@@ -381,10 +381,33 @@ sdb_plugin_collector_loop(sdb_plugin_loop_t *loop);
  * point to dynamically allocated memory and might be freed by the function.
  * The return value will also be dynamically allocated (but it might be
  * unchanged) and has to be freed by the caller.
+ *
+ * Results are cached (see sdb_plugin_set_cname_cache), so the registered
+ * callbacks are not invoked for names which have been canonicalized
+ * recently. The cache is flushed whenever cname callbacks are registered or
+ * unregistered and when reconfiguring plugins.
  */
 char *
 sdb_plugin_cname(char *hostname);
 
+/*
+ * sdb_plugin_set_cname_cache:
+ * Configure the cache of canonicalized hostnames. It holds up to 'size'
+ * names (rounded up to the next power of two). Names changed by any of the
+ * cname callbacks are cached for 'ttl' and names which did not change
+ * (including those which could not be canonicalized) are cached for
+ * 'negative_ttl'. A size or TTL of zero disables the respective caching. The
+ * cache will be flushed. By default, it holds up to 1024 names for five
+ * minutes and unchanged names for one minute.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_plugin_set_cname_cache(size_t size, sdb_time_t ttl,
+		sdb_time_t negative_ttl);
+
 /*
  * sdb_plugin_log:
  * Log the specified message using all registered log callbacks. The message
@@ -137,6 +137,13 @@ struct sdb_store_matcher;
 typedef struct sdb_store_matcher sdb_store_matcher_t;
 #define SDB_STORE_MATCHER(obj) ((sdb_store_matcher_t *)(obj))
 
+/*
+ * A matcher program is the compiled form of a matcher (along with a filter)
+ * which may be evaluated more efficiently (see sdb_store_matcher_compile).
+ */
+struct sdb_store_prog;
+typedef struct sdb_store_prog sdb_store_prog_t;
+
 /*
  * A JSON formatter converts stored objects into the JSON format.
  * See http://www.ietf.org/rfc/rfc4627.txt
@@ -144,6 +151,21 @@ typedef struct sdb_store_matcher sdb_store_matcher_t;
 struct sdb_store_json_formatter;
 typedef struct sdb_store_json_formatter sdb_store_json_formatter_t;
 
+/*
+ * A store batch collects updates to be applied to the store at once.
+ */
+struct sdb_store_batch;
+typedef struct sdb_store_batch sdb_store_batch_t;
+
+/*
+ * A store usage describes the number of stored objects and the approximate
+ * amount of memory used by them (see sdb_store_get_usage).
+ */
+typedef struct {
+	uint64_t objects;
+	uint64_t bytes;
+} sdb_store_usage_t;
+
 /*
  * A store writer describes the interface for plugins implementing a store.
  */
@@ -173,6 +195,217 @@ typedef struct {
 void
 sdb_store_clear(void);
 
+/*
+ * The maximum number of shards supported by the store.
+ */
+#define SDB_STORE_MAX_SHARDS 256
+
+/*
+ * sdb_store_set_shards:
+ * Set the number of shards used to manage hosts in the store. Hosts are
+ * distributed across all shards based on a hash of their canonicalized name
+ * and each shard is protected by its own lock. The number of shards may only
+ * be changed while the store is empty. It defaults to 16 and may not exceed
+ * SDB_STORE_MAX_SHARDS.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else; errno is set to EINVAL for an invalid number of
+ *    shards and to EBUSY if the store is not empty
+ */
+int
+sdb_store_set_shards(size_t num);
+
+/*
+ * sdb_store_index_attribute:
+ * Maintain an index of all values of the specified host attribute. Lookups
+ * matching hosts based on the equality (=) or membership (IN) of that
+ * attribute will then only check the hosts having a matching value instead
+ * of scanning all hosts. Any hosts already in the store will be added to the
+ * index. Indexing an attribute multiple times has no effect.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_store_index_attribute(const char *key);
+
+/*
+ * sdb_store_index_names:
+ * Maintain an index of all trigrams (three-character substrings) of the
+ * names of all hosts, services, and metrics. Lookups matching objects by
+ * their name using a regular expression will then only check objects whose
+ * names include all literal strings required by the regular expression
+ * instead of scanning all objects. Any objects already in the store will be
+ * added to the index.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_store_index_names(void);
+
+/*
+ * sdb_store_set_expiry:
+ * Configure the automatic expiry of stale objects. An object expires once it
+ * missed 'missed' consecutive updates, based on the (moving) average of the
+ * intervals between its previous updates, or once it has not been updated
+ * for 'ttl'. Either criterion may be disabled by setting it to zero. The
+ * update interval of an object is known only after it has been updated at
+ * least twice. Objects are not expired while any of their children are still
+ * current.
+ *
+ * Expired objects are removed by sdb_store_expire.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_store_set_expiry(int missed, sdb_time_t ttl);
+
+/*
+ * sdb_store_expire:
+ * Remove all objects (including their children) which expired by time
+ * 'now'. This function is meant to be called periodically. Its cost is
+ * proportional to the number of objects due to be checked rather than the
+ * size of the store.
+ *
+ * Returns:
+ *  - the number of removed objects
+ *  - a negative value on error
+ */
+int
+sdb_store_expire(sdb_time_t now);
+
+/*
+ * sdb_store_get_usage:
+ * Get the number and memory usage of all stored objects of the specified
+ * type (SDB_HOST, SDB_SERVICE, SDB_METRIC, or SDB_ATTRIBUTE). The usage is
+ * maintained incrementally while creating and destroying objects, so this
+ * is cheap to query. Memory usage is approximate: it includes the objects,
+ * their names, and attribute values, but not the overhead of the trees and
+ * indexes managing them. Names are shared between objects but accounted
+ * for each of them. Removed objects are accounted for until all readers
+ * accessing them are done.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_store_get_usage(int type, sdb_store_usage_t *usage);
+
+/*
+ * sdb_store_get_backend_usage:
+ * Get the number and memory usage of all stored objects provided by the
+ * named backend. Objects provided by multiple backends are accounted for
+ * each of them.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value if the backend is not known
+ */
+int
+sdb_store_get_backend_usage(const char *backend, sdb_store_usage_t *usage);
+
+/*
+ * sdb_store_get_host_usage:
+ * Get the number and memory usage of all objects of the named host,
+ * including the host itself.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value if the host does not exist
+ */
+int
+sdb_store_get_host_usage(const char *name, sdb_store_usage_t *usage);
+
+/*
+ * sdb_store_snapshot_write:
+ * Write a binary snapshot of all objects in the store to the specified file.
+ * The snapshot is written to a temporary file first, which then replaces the
+ * specified file, such that the file always holds a complete snapshot. The
+ * store may be updated concurrently; updates which happen while writing the
+ * snapshot may or may not be included.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_store_snapshot_write(const char *filename);
+
+/*
+ * sdb_store_snapshot_load:
+ * Restore all objects from a snapshot written by sdb_store_snapshot_write.
+ * This includes their update times and intervals as well as the backends
+ * which provided them. Objects which have been updated more recently than
+ * the snapshot are left untouched. A missing file is not considered an
+ * error.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_store_snapshot_load(const char *filename);
+
+/*
+ * sdb_store_journal_replay:
+ * Replay all updates recorded in the specified journal on top of the current
+ * state of the store, usually after loading the latest snapshot. This
+ * includes a journal left behind by an interrupted snapshot (see
+ * sdb_store_journal_open). Incomplete records at the end of the journal
+ * (e.g., after a crash) are discarded. A missing journal is not considered
+ * an error.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_store_journal_replay(const char *filename);
+
+/*
+ * sdb_store_journal_open:
+ * Record all updates of the store in the specified journal. The journal has
+ * to be replayed before appending to it. Records are written and synced to
+ * disk in batches by a background thread at most 'commit_interval' after
+ * they have been added, so updates are not bound to disk latency. Use
+ * sdb_store_journal_sync to wait for all pending records.
+ *
+ * Whenever a snapshot is written, the journal is moved to '<filename>.1'
+ * and a new journal is started. The old journal is removed once the
+ * snapshot is complete.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_store_journal_open(const char *filename, sdb_time_t commit_interval);
+
+/*
+ * sdb_store_journal_sync:
+ * Wait until all updates recorded so far have been written to disk.
+ *
+ * Returns:
+ *  - 0 on success (or if the journal is disabled)
+ *  - a negative value if writing the journal failed
+ */
+int
+sdb_store_journal_sync(void);
+
+/*
+ * sdb_store_journal_close:
+ * Write all pending records and stop recording updates.
+ */
+void
+sdb_store_journal_close(void);
+
 /*
  * sdb_store_host:
  * Add/update a host in the store. If the host, identified by its
@@ -300,6 +533,70 @@ int
 sdb_store_metric_attr(const char *hostname, const char *metric,
 		const char *key, const sdb_data_t *value, sdb_time_t last_update);
 
+/*
+ * sdb_store_batch_begin:
+ * Start a new batch of updates. Updates added to a batch using the
+ * sdb_store_batch_<type> functions are not visible in the store before
+ * committing the batch using sdb_store_batch_commit. Committing a batch
+ * applies all updates of a host while holding the respective lock only once
+ * and is considerably cheaper than applying each update on its own. Updates
+ * of parent objects are applied before updates of their children, so that
+ * the order of updates within a batch does not matter. A batch may only be
+ * used by a single thread at a time.
+ *
+ * Returns:
+ *  - a batch object on success
+ *  - NULL else
+ */
+sdb_store_batch_t *
+sdb_store_batch_begin(void);
+
+/*
+ * sdb_store_batch_host, sdb_store_batch_attribute, sdb_store_batch_service,
+ * sdb_store_batch_service_attr, sdb_store_batch_metric,
+ * sdb_store_batch_metric_attr:
+ * Add an update to a batch. The arguments correspond to those of the
+ * respective sdb_store_<type> function and are copied as needed.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value on error
+ */
+int
+sdb_store_batch_host(sdb_store_batch_t *batch, const char *name,
+		sdb_time_t last_update);
+int
+sdb_store_batch_attribute(sdb_store_batch_t *batch, const char *hostname,
+		const char *key, const sdb_data_t *value, sdb_time_t last_update);
+int
+sdb_store_batch_service(sdb_store_batch_t *batch, const char *hostname,
+		const char *name, sdb_time_t last_update);
+int
+sdb_store_batch_service_attr(sdb_store_batch_t *batch, const char *hostname,
+		const char *service, const char *key, const sdb_data_t *value,
+		sdb_time_t last_update);
+int
+sdb_store_batch_metric(sdb_store_batch_t *batch, const char *hostname,
+		const char *name, sdb_metric_store_t *store, sdb_time_t last_update);
+int
+sdb_store_batch_metric_attr(sdb_store_batch_t *batch, const char *hostname,
+		const char *metric, const char *key, const sdb_data_t *value,
+		sdb_time_t last_update);
+
+/*
+ * sdb_store_batch_commit:
+ * Apply all updates of a batch to the store and destroy the batch. Updates
+ * are applied as if calling the respective sdb_store_<type> function,
+ * except that they may be applied in a different order. Updates older than
+ * the currently stored entries are ignored.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value if any of the updates failed
+ */
+int
+sdb_store_batch_commit(sdb_store_batch_t *batch);
+
 /*
  * sdb_store_fetch_timeseries:
  * Fetch the time-series described by the specified host's metric and
@@ -343,6 +640,19 @@ sdb_store_get_child(sdb_store_obj_t *host, int type, const char *name);
 int
 sdb_store_get_field(sdb_store_obj_t *obj, int field, sdb_data_t *res);
 
+/*
+ * sdb_store_get_generation:
+ * Get the generation of a stored object. The generation is taken from a
+ * store-wide counter whenever the object, or any of its children, is created,
+ * updated, or removed. That is, an object did not change (including its
+ * serialized representation) as long as its generation remains the same.
+ * The counter is initialized from the current time when starting up, such
+ * that generations keep increasing across restarts (unless the system clock
+ * is turned back).
+ */
+uint64_t
+sdb_store_get_generation(sdb_store_obj_t *obj);
+
 /*
  * sdb_store_get_attr:
  * Get the value of a stored object's attribute. The caller is responsible for
@@ -507,7 +817,8 @@ sdb_store_all_matcher(sdb_store_expr_t *iter, sdb_store_matcher_t *m);
  * sdb_store_in_matcher:
  * Creates a matcher which matches if the right value evaluates to an array
  * value and the left value is included in that array. See sdb_data_inarray
- * for more details.
+ * for more details. Constant arrays of integers, decimals, or strings are
+ * sorted once when creating the matcher to speed up the lookups.
  */
 sdb_store_matcher_t *
 sdb_store_in_matcher(sdb_store_expr_t *left, sdb_store_expr_t *right);
@@ -593,6 +904,56 @@ int
 sdb_store_matcher_matches(sdb_store_matcher_t *m, sdb_store_obj_t *obj,
 		sdb_store_matcher_t *filter);
 
+/*
+ * sdb_store_matcher_optimize:
+ * Rewrite the specified matcher into an equivalent matcher which is cheaper
+ * to evaluate for objects of the specified type (or any type if 'context' is
+ * negative): operators on constant values are evaluated once, double
+ * negations are removed, and the operands of AND and OR are ordered by their
+ * estimated cost and selectivity, based on the number of stored objects.
+ *
+ * Returns:
+ *  - the optimized matcher (a new reference, which may be the original
+ *    matcher) on success
+ *  - NULL on error
+ */
+sdb_store_matcher_t *
+sdb_store_matcher_optimize(sdb_store_matcher_t *m, int context);
+
+/*
+ * sdb_store_matcher_compile:
+ * Compile the specified matcher and filter into a program which may be
+ * evaluated repeatedly using sdb_store_prog_matches. Evaluating the program
+ * is equivalent to calling sdb_store_matcher_matches(m, obj, filter) but
+ * avoids most of the overhead of walking the matcher tree and copying
+ * intermediate values. The program keeps references to the matcher and the
+ * filter.
+ *
+ * Returns:
+ *  - a matcher program on success
+ *  - NULL on error
+ */
+sdb_store_prog_t *
+sdb_store_matcher_compile(sdb_store_matcher_t *m, sdb_store_matcher_t *filter);
+
+/*
+ * sdb_store_prog_matches:
+ * Check whether the specified program matches the specified store object.
+ *
+ * Returns:
+ *  - 1 if the object matches
+ *  - 0 else
+ */
+int
+sdb_store_prog_matches(sdb_store_prog_t *prog, sdb_store_obj_t *obj);
+
+/*
+ * sdb_store_prog_destroy:
+ * Destroy a matcher program and release all of its resources.
+ */
+void
+sdb_store_prog_destroy(sdb_store_prog_t *prog);
+
 /*
  * sdb_store_matcher_op_cb:
  * Callback constructing a matcher operator.
@@ -645,6 +1006,23 @@ sdb_store_parse_object_type_plural(const char *name);
 int
 sdb_store_parse_field_name(const char *name);
 
+/*
+ * sdb_store_view_begin, sdb_store_view_end:
+ * Pin the current version of the store or release it again. While holding a
+ * view, all lookups, scans, and iterations done by the calling thread see
+ * the objects, attribute values, and children which were stored when the
+ * view was taken, regardless of any concurrent updates; writers are never
+ * blocked by views. Timestamps, update intervals, and backends of objects are
+ * updated in place, though, and always reflect the most recent update. Views
+ * may be nested and have to be released in the same thread. Any memory
+ * retired while a view is held is released only after the view has been
+ * released. The store must not be updated from a thread holding a view.
+ */
+void
+sdb_store_view_begin(void);
+void
+sdb_store_view_end(void);
+
 /*
  * sdb_store_lookup_cb:
  * Lookup callback. It is called for each matching object when looking up data
@@ -660,7 +1038,9 @@ typedef int (*sdb_store_lookup_cb)(sdb_store_obj_t *obj,
  * function is called for each object in the store matching 'm'. The function
  * performs a full scan of all objects stored in the database. If specified,
  * the filter will be used to preselect objects for further evaluation. See
- * the description of 'sdb_store_matcher_matches' for details.
+ * the description of 'sdb_store_matcher_matches' for details. All objects
+ * are looked up in a single consistent version of the store (see
+ * sdb_store_view_begin), no matter how long the scan takes.
  *
  * Returns:
  *  - 0 on success
@@ -670,11 +1050,59 @@ int
 sdb_store_scan(int type, sdb_store_matcher_t *m, sdb_store_matcher_t *filter,
 		sdb_store_lookup_cb cb, void *user_data);
 
+/*
+ * Events reported to watchers.
+ */
+enum {
+	SDB_STORE_UPDATED = 1, /* the object has been created or updated */
+	SDB_STORE_EXPIRED,     /* the object expired and has been removed */
+};
+
+/*
+ * sdb_store_watch_cb:
+ * Watch callback. It is called for each created, updated, or expired object
+ * of the watched type passing on the event and the specified user-data.
+ * Changes of attributes or child objects are reported as updates of the
+ * watched object they belong to. The callback is invoked while the object's
+ * host is locked: it has to return quickly and it must not update the store.
+ * Take a reference to the object in order to access it later on.
+ */
+typedef void (*sdb_store_watch_cb)(sdb_store_obj_t *obj, int event,
+		sdb_object_t *user_data);
+
+/*
+ * sdb_store_watch:
+ * Register a callback to be notified about changes of objects of the
+ * specified type (host, service, or metric). The store keeps a reference to
+ * the user-data object until the callback is unregistered.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_store_watch(int type, sdb_store_watch_cb cb, sdb_object_t *user_data);
+
+/*
+ * sdb_store_unwatch:
+ * Unregister a callback previously registered using sdb_store_watch with the
+ * same user-data object. Once the function returns, the callback will no
+ * longer be invoked for this registration.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value if no such callback has been registered
+ */
+int
+sdb_store_unwatch(sdb_store_watch_cb cb, sdb_object_t *user_data);
+
 /*
  * Flags for JSON formatting.
  */
 enum {
 	SDB_WANT_ARRAY = 1 << 0,
+	/* include each object's generation (see sdb_store_get_generation) */
+	SDB_WANT_GENERATION = 1 << 1,
 };
 
 /*
@@ -730,6 +1158,20 @@ sdb_store_json_emit_full(sdb_store_json_formatter_t *f, sdb_store_obj_t *obj,
 int
 sdb_store_json_finish(sdb_store_json_formatter_t *f);
 
+/*
+ * sdb_store_stats_tojson:
+ * Serialize the memory usage of the store to JSON and append the result to
+ * the specified buffer. This includes the usage by object type, by backend,
+ * and of the 'max_hosts' hosts using the most memory (all hosts if zero);
+ * see sdb_store_get_usage for details.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_store_stats_tojson(sdb_strbuf_t *buf, size_t max_hosts);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -146,6 +146,18 @@ sdb_connection_ping(sdb_conn_t *conn);
 int
 sdb_connection_server_version(sdb_conn_t *conn);
 
+/*
+ * sdb_connection_server_stats:
+ * Send back statistics about the memory usage of the store to the connected
+ * client (see SDB_CONNECTION_SERVER_STATS).
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_connection_server_stats(sdb_conn_t *conn);
+
 /*
  * sdb_fe_parse:
  * Parse the query text specified in 'query' of length 'len' and return a list
@@ -218,13 +230,19 @@ sdb_fe_store(sdb_conn_t *conn);
  * serialized as JSON, to the client. If specified, only objects matching the
  * filter will be included.
  *
+ * If 'newer_than' is specified, the object will only be sent if its
+ * generation (see sdb_store_get_generation) is greater than the specified
+ * value. Else, a short SDB_CONNECTION_OK message is sent instead. In this
+ * case, the JSON representation includes the generation of each object.
+ *
  * Returns:
  *  - 0 on success
  *  - a negative value else
  */
 int
 sdb_fe_exec_fetch(sdb_conn_t *conn, int type,
-		const char *hostname, const char *name, sdb_store_matcher_t *filter);
+		const char *hostname, const char *name, sdb_store_matcher_t *filter,
+		const uint64_t *newer_than);
 
 /*
  * sdb_fe_exec_list:
@@ -269,6 +287,41 @@ sdb_fe_exec_timeseries(sdb_conn_t *conn,
 		const char *hostname, const char *metric,
 		sdb_timeseries_opts_t *opts);
 
+/*
+ * sdb_fe_exec_watch:
+ * Execute the 'WATCH' command. Acknowledge the command and keep sending each
+ * object of the specified type matching 'm', serialized as JSON, to the
+ * client whenever it is created, updated, or expires. Only those attributes
+ * and child objects matching the filter will be included. The watch is
+ * active until the connection is closed.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_fe_exec_watch(sdb_conn_t *conn, int type,
+		sdb_store_matcher_t *m, sdb_store_matcher_t *filter);
+
+/*
+ * sdb_fe_watch_cancel:
+ * Cancel all watches registered by the specified connection. This is done
+ * automatically when closing the connection.
+ */
+void
+sdb_fe_watch_cancel(sdb_conn_t *conn);
+
+/*
+ * sdb_fe_watch_shutdown:
+ * Stop the thread sending WATCH notifications after it has delivered all
+ * pending notifications and wait for it to terminate. It is started again
+ * when registering the next watch. Connections should be closed before
+ * calling this function; notifications to open connections which are queued
+ * after the thread has terminated are dropped.
+ */
+void
+sdb_fe_watch_shutdown(void);
+
 /*
  * sdb_fe_store_host, sdb_fe_store_service, sdb_fe_store_metric,
  * sdb_fe_store_attribute:
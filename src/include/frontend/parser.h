@@ -82,7 +82,9 @@ sdb_fe_parse_expr(const char *expr, int len, sdb_strbuf_t *errbuf);
 /*
  * sdb_fe_analyze:
  * Analyze a parsed node, checking for semantical errors. Error messages will
- * be written to the string buffer, if provided.
+ * be written to the string buffer, if provided. The node's matchers are
+ * replaced by optimized versions (see sdb_store_matcher_optimize) once they
+ * passed all checks.
  *
  * Returns:
  *  - 0 if the node is semantically correct
@@ -245,6 +245,18 @@ typedef enum {
 	 */
 	SDB_CONNECTION_TIMESERIES,
 
+	/*
+	 * SDB_CONNECTION_WATCH:
+	 * Execute the 'WATCH' command in the server. This command is not yet
+	 * supported on the wire. Use SDB_CONNECTION_QUERY instead. The server
+	 * acknowledges the command with an empty SDB_CONNECTION_DATA message and
+	 * then keeps sending a SDB_CONNECTION_DATA message (using this command
+	 * code as the result type) whenever a matching object is created,
+	 * updated, or expires. Each message contains a JSON object describing the
+	 * event ("updated" or "expired") and the respective object.
+	 */
+	SDB_CONNECTION_WATCH,
+
 	/*
 	 * SDB_CONNECTION_STORE:
 	 * Execute the 'STORE' command in the server. The message body shall
@@ -317,6 +329,25 @@ typedef enum {
 	 * +---------------+---------------+
 	 */
 	SDB_CONNECTION_SERVER_VERSION = 1000,
+
+	/*
+	 * SDB_CONNECTION_SERVER_STATS:
+	 * Retrieve statistics about the memory usage of the store. The server
+	 * replies with SDB_CONNECTION_DATA on success and the statistics encoded
+	 * as a JSON object describing the number of objects and the approximate
+	 * number of bytes used by them by object type, in total, by backend, and
+	 * by host (sorted by bytes, largest first). The number of reported hosts
+	 * may optionally be limited by specifying an unsigned 32-bit integer;
+	 * zero means all hosts.
+	 *
+	 * 0               32              64
+	 * +---------------+---------------+
+	 * | SERVER_STATS  | length        |
+	 * +---------------+---------------+
+	 * | max hosts     |
+	 * +---------------+
+	 */
+	SDB_CONNECTION_SERVER_STATS,
 } sdb_conn_state_t;
 
 #define SDB_CONN_MSGTYPE_TO_STRING(t) \
@@ -328,6 +359,7 @@ typedef enum {
 		: ((t) == SDB_CONNECTION_LIST) ? "LIST" \
 		: ((t) == SDB_CONNECTION_LOOKUP) ? "LOOKUP" \
 		: ((t) == SDB_CONNECTION_TIMESERIES) ? "TIMESERIES" \
+		: ((t) == SDB_CONNECTION_WATCH) ? "WATCH" \
 		: ((t) == SDB_CONNECTION_STORE) ? "STORE" \
 		: "UNKNOWN")
 
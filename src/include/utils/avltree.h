@@ -40,6 +40,11 @@ extern "C" {
  * An AVL tree implements Adelson-Velskii and Landis' self-balancing search
  * tree. It supports search, insert, and delete operations in average and
  * worst-case time-complexity O(log n).
+ *
+ * The tree may be accessed concurrently by multiple threads. Writers are
+ * serialized while lookups and iterators don't take any locks at all: they
+ * operate on a consistent version of the tree which remains valid until the
+ * lookup returns or the iterator is destroyed (see utils/epoch.h).
  */
 struct sdb_avltree;
 typedef struct sdb_avltree sdb_avltree_t;
@@ -83,6 +88,32 @@ sdb_avltree_clear(sdb_avltree_t *tree);
 int
 sdb_avltree_insert(sdb_avltree_t *tree, sdb_object_t *obj);
 
+/*
+ * sdb_avltree_replace:
+ * Replace the object with the same name as the specified object by that
+ * object. The replaced object will be released (the ref-count decremented)
+ * once no reader may access it any longer.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else (e.g., if no such object exists)
+ */
+int
+sdb_avltree_replace(sdb_avltree_t *tree, sdb_object_t *obj);
+
+/*
+ * sdb_avltree_remove:
+ * Remove the object with the specified name from the tree. The object will
+ * be released (the ref-count decremented) once no reader may access it any
+ * longer.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else (e.g., if no such object exists)
+ */
+int
+sdb_avltree_remove(sdb_avltree_t *tree, const char *name);
+
 /*
  * sdb_avltree_lookup:
  * Lookup an object from a tree by name.
@@ -102,6 +133,11 @@ sdb_avltree_lookup(sdb_avltree_t *tree, const char *name);
  * sequence of all nodes.
  *
  * sdb_avltree_iter_get_next returns NULL if there is no next element.
+ *
+ * An iterator operates on the version of the tree at the time it was created;
+ * concurrent updates are not visible to it. It keeps all objects of that
+ * version alive and, thus, should not be kept around for longer than
+ * necessary. It has to be destroyed by the same thread that created it.
  */
 sdb_avltree_iter_t *
 sdb_avltree_get_iter(sdb_avltree_t *tree);
@@ -0,0 +1,144 @@
+/*
+ * SysDB - src/include/utils/btree.h
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SDB_UTILS_BTREE_H
+#define SDB_UTILS_BTREE_H 1
+
+#include "core/object.h"
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A B-tree is an ordered map of objects (keyed by their names) with a wide
+ * fan-out. All objects are stored in the leaves, which, like the inner nodes,
+ * keep their keys in contiguous arrays, and name comparisons mostly operate
+ * on fixed-size, case-folded name prefixes instead of the names themselves.
+ * Compared to the AVL tree (see utils/avltree.h), this requires far fewer
+ * (cache-missing) memory accesses per lookup.
+ *
+ * The B-tree provides the same interface and the same concurrency guarantees
+ * as the AVL tree: writers are serialized while lookups and iterators don't
+ * take any locks. When configured with --enable-btree, the store uses it for
+ * all of its indexes.
+ */
+struct sdb_btree;
+typedef struct sdb_btree sdb_btree_t;
+
+struct sdb_btree_iter;
+typedef struct sdb_btree_iter sdb_btree_iter_t;
+
+/*
+ * sdb_btree_create, sdb_btree_destroy, sdb_btree_clear:
+ * Create, destroy, or clear a B-tree. Destroying or clearing the tree
+ * releases all included objects (decrements the ref-count).
+ */
+sdb_btree_t *
+sdb_btree_create(void);
+void
+sdb_btree_destroy(sdb_btree_t *tree);
+void
+sdb_btree_clear(sdb_btree_t *tree);
+
+/*
+ * sdb_btree_insert, sdb_btree_replace, sdb_btree_remove:
+ * Insert a new, unique object into the tree; replace the object with the same
+ * name; or remove the object with the specified name. Replaced or removed
+ * objects will be released once no reader may access them any longer.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_btree_insert(sdb_btree_t *tree, sdb_object_t *obj);
+int
+sdb_btree_replace(sdb_btree_t *tree, sdb_object_t *obj);
+int
+sdb_btree_remove(sdb_btree_t *tree, const char *name);
+
+/*
+ * sdb_btree_lookup:
+ * Lookup an object from a tree by name. The returned object has its ref-count
+ * incremented.
+ *
+ * Returns:
+ *  - the requested object
+ *  - NULL if no such object exists
+ */
+sdb_object_t *
+sdb_btree_lookup(sdb_btree_t *tree, const char *name);
+
+/*
+ * sdb_btree_get_iter, sdb_btree_iter_has_next, sdb_btree_iter_get_next,
+ * sdb_btree_iter_peek_next, sdb_btree_iter_destroy:
+ * Iterate through all objects of the tree in the order of their names. See
+ * the AVL tree's iterator for details.
+ */
+sdb_btree_iter_t *
+sdb_btree_get_iter(sdb_btree_t *tree);
+void
+sdb_btree_iter_destroy(sdb_btree_iter_t *iter);
+
+bool
+sdb_btree_iter_has_next(sdb_btree_iter_t *iter);
+sdb_object_t *
+sdb_btree_iter_get_next(sdb_btree_iter_t *iter);
+sdb_object_t *
+sdb_btree_iter_peek_next(sdb_btree_iter_t *iter);
+
+/*
+ * sdb_btree_size:
+ * Returns the number of objects in the tree.
+ */
+size_t
+sdb_btree_size(sdb_btree_t *tree);
+
+/*
+ * sdb_btree_valid:
+ * Validate a tree, checking the order of all keys, the fill level of all
+ * nodes and that all leaves are at the same depth. All errors will be
+ * reported through the logging sub-system. This function is mainly intended
+ * for debugging and (unit) testing.
+ *
+ * Returns:
+ *  - true if the tree is valid
+ *  - false else
+ */
+bool
+sdb_btree_valid(sdb_btree_t *tree);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ! SDB_UTILS_BTREE_H */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,85 @@
+/*
+ * SysDB - src/include/utils/epoch.h
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SDB_UTILS_EPOCH_H
+#define SDB_UTILS_EPOCH_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Epoch-based reclamation allows readers to access shared data structures
+ * without taking any locks. Readers announce that they are accessing shared
+ * data by entering a read-side critical section. Writers publish updated
+ * data (e.g., using atomic pointer updates) and hand any memory that might
+ * still be referenced by concurrent readers over to the reclamation system.
+ * That memory is then released only after all readers which might have seen
+ * it have left their critical section.
+ *
+ * Read-side critical sections are tracked per thread and may be nested. They
+ * must be left in the same thread in which they were entered.
+ */
+
+/*
+ * sdb_epoch_enter, sdb_epoch_exit:
+ * Enter or leave a read-side critical section. Any shared data retrieved
+ * while inside a critical section remains valid until the (outermost)
+ * critical section is left.
+ */
+void
+sdb_epoch_enter(void);
+void
+sdb_epoch_exit(void);
+
+/*
+ * sdb_epoch_retire:
+ * Schedule the destruction of the specified data. The 'destructor' will be
+ * called with 'ptr' as its argument once no reader may reference it any
+ * longer. The data must no longer be reachable by any new reader when calling
+ * this function. If no reader is currently inside a critical section, the
+ * data will be destroyed immediately.
+ */
+void
+sdb_epoch_retire(void *ptr, void (*destructor)(void *));
+
+/*
+ * sdb_epoch_synchronize:
+ * Wait for all readers currently inside a critical section to leave it and
+ * destroy all data retired before calling this function. This must not be
+ * called from inside a critical section.
+ */
+void
+sdb_epoch_synchronize(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ! SDB_UTILS_EPOCH_H */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,105 @@
+/*
+ * SysDB - src/include/utils/hashindex.h
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SDB_UTILS_HASHINDEX_H
+#define SDB_UTILS_HASHINDEX_H 1
+
+#include "core/object.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A hash index maps (case-insensitive) names to objects, providing exact
+ * lookups in constant time. It uses open addressing with linear probing and
+ * is meant to be used alongside an ordered map of the same objects (see
+ * utils/avltree.h and utils/btree.h); it doesn't own any of the objects.
+ *
+ * Lookups don't take any locks but have to be done from inside an epoch
+ * critical section (see utils/epoch.h). Modifications have to be serialized
+ * by the caller. Objects removed from the index must not be destroyed before
+ * all readers are done with them.
+ */
+struct sdb_hashindex;
+typedef struct sdb_hashindex sdb_hashindex_t;
+
+/*
+ * sdb_hashindex_create, sdb_hashindex_destroy:
+ * Create or destroy a hash index. The index must not be destroyed while any
+ * reader may still access it.
+ */
+sdb_hashindex_t *
+sdb_hashindex_create(void);
+void
+sdb_hashindex_destroy(sdb_hashindex_t *idx);
+
+/*
+ * sdb_hashindex_insert, sdb_hashindex_replace, sdb_hashindex_remove:
+ * Add an object to the index, replace an indexed object by another one with
+ * the same name, or remove an object from the index.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else (e.g., if the old object is not indexed)
+ */
+int
+sdb_hashindex_insert(sdb_hashindex_t *idx, sdb_object_t *obj);
+int
+sdb_hashindex_replace(sdb_hashindex_t *idx,
+		sdb_object_t *old, sdb_object_t *obj);
+int
+sdb_hashindex_remove(sdb_hashindex_t *idx, sdb_object_t *obj);
+
+/*
+ * sdb_hashindex_lookup:
+ * Lookup an object by name. The object's ref-count is not incremented, that
+ * is, it may only be accessed until the current critical section is left.
+ *
+ * Returns:
+ *  - the requested object
+ *  - NULL if no such object exists
+ */
+sdb_object_t *
+sdb_hashindex_lookup(sdb_hashindex_t *idx, const char *name);
+
+/*
+ * sdb_hashindex_hash:
+ * Returns the hash of the case-folded name.
+ */
+uint32_t
+sdb_hashindex_hash(const char *name);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ! SDB_UTILS_HASHINDEX_H */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,71 @@
+/*
+ * SysDB - src/include/utils/intern.h
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SDB_UTILS_INTERN_H
+#define SDB_UTILS_INTERN_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The string table manages a single, reference counted copy of each distinct
+ * string. Interning the same string multiple times returns the same pointer
+ * such that the strings may be compared for (exact) equality by comparing
+ * pointers. Interned strings must not be modified. All functions are
+ * thread-safe.
+ */
+
+/*
+ * sdb_intern:
+ * Look up the specified string in the string table, adding a copy if it does
+ * not exist yet. The reference count of the interned string is incremented
+ * in either case and has to be released using sdb_intern_release when it's
+ * no longer used.
+ *
+ * Returns:
+ *  - the interned string
+ *  - NULL on error
+ */
+char *
+sdb_intern(const char *str);
+
+/*
+ * sdb_intern_release:
+ * Release a reference to an interned string. The string is removed from the
+ * table and destroyed once the last reference has been released.
+ */
+void
+sdb_intern_release(char *str);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ! SDB_UTILS_INTERN_H */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
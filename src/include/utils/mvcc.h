@@ -0,0 +1,133 @@
+/*
+ * SysDB - src/include/utils/mvcc.h
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SDB_UTILS_MVCC_H
+#define SDB_UTILS_MVCC_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Multi-version concurrency control on top of copy-on-write data structures.
+ * Lock-free data structures (see utils/epoch.h) publish new versions of
+ * their data by atomically updating a pointer. Storing that pointer in an
+ * sdb_mvcc_ptr_t additionally keeps track of previous values for as long as
+ * they are visible to any snapshot.
+ *
+ * A snapshot pins the current version of all versioned pointers: while a
+ * thread holds a snapshot, loading a versioned pointer returns the value it
+ * had when the snapshot was taken, no matter how often it has been updated
+ * since. Snapshots never block writers and writers never block readers;
+ * taking a snapshot only has to wait for updates which are currently being
+ * published.
+ */
+
+struct sdb_mvcc_version;
+typedef struct sdb_mvcc_version sdb_mvcc_version_t;
+
+/*
+ * sdb_mvcc_ptr_t:
+ * A versioned pointer. Writers have to be serialized by the caller. Each
+ * value may be accompanied by a size (or any other auxiliary value) which is
+ * versioned along with it.
+ */
+typedef struct {
+	/* accessed atomically */
+	void *ptr;
+	/* previous values still visible to snapshots, newest first */
+	sdb_mvcc_version_t *old;
+} sdb_mvcc_ptr_t;
+#define SDB_MVCC_PTR_INIT { NULL, NULL }
+
+/*
+ * sdb_mvcc_snapshot_begin, sdb_mvcc_snapshot_end:
+ * Take or release a snapshot. Taking a snapshot enters an epoch critical
+ * section (see sdb_epoch_enter), such that all data visible in the snapshot
+ * remains valid until it is released; note that this defers the reclamation
+ * of any retired data. Snapshots are tracked per thread and may be nested;
+ * nested snapshots share the version of the outermost one. They must be
+ * released in the same thread in which they were taken. Updates done by a
+ * thread while holding a snapshot are visible to that snapshot (this allows
+ * to build temporary data structures while evaluating a query).
+ */
+void
+sdb_mvcc_snapshot_begin(void);
+void
+sdb_mvcc_snapshot_end(void);
+
+/*
+ * sdb_mvcc_snapshot_version:
+ * Returns the version pinned by the calling thread's snapshot or zero if it
+ * does not hold a snapshot.
+ */
+uint64_t
+sdb_mvcc_snapshot_version(void);
+
+/*
+ * sdb_mvcc_load:
+ * Load the value of a versioned pointer as seen by the calling thread, that
+ * is, its current value or the value as of the thread's snapshot. If 'aux'
+ * is not NULL, it has to be initialized with the current auxiliary value by
+ * the caller; it is replaced with the value stored along with the pointer if
+ * an older version is returned. This function has to be called from inside
+ * an epoch critical section.
+ */
+void *
+sdb_mvcc_load(sdb_mvcc_ptr_t *p, size_t *aux);
+
+/*
+ * sdb_mvcc_store:
+ * Publish a new value of a versioned pointer. If any snapshot may still
+ * access the current value, it is kept along with the specified auxiliary
+ * value 'old_aux' which belongs to it. The caller remains responsible for
+ * retiring (see sdb_epoch_retire) the data referenced by the old value. If
+ * memory for the previous value cannot be allocated, the new value is
+ * published anyway and snapshots may observe it.
+ */
+void
+sdb_mvcc_store(sdb_mvcc_ptr_t *p, void *ptr, size_t old_aux);
+
+/*
+ * sdb_mvcc_clear:
+ * Release all previous values of a versioned pointer. This must only be
+ * called when the pointer is no longer accessible to any reader, for
+ * example, when destroying the data structure it's part of.
+ */
+void
+sdb_mvcc_clear(sdb_mvcc_ptr_t *p);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ! SDB_UTILS_MVCC_H */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,79 @@
+/*
+ * SysDB - src/include/utils/slab.h
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SDB_UTILS_SLAB_H
+#define SDB_UTILS_SLAB_H 1
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The slab allocator manages pools of small memory blocks of a number of
+ * size classes. Blocks are carved from large chunks, such that objects
+ * allocated one after another are stored next to each other, and they are
+ * recycled once they have been released. Each thread keeps a small cache of
+ * free blocks for each size class, such that most allocations don't take any
+ * locks. Memory managed by the allocator is never returned to the operating
+ * system. All functions are thread-safe.
+ */
+
+/*
+ * The maximum size of blocks managed in pools. Larger allocations are passed
+ * on to the system's allocator.
+ */
+#define SDB_SLAB_MAX_SIZE 256
+
+/*
+ * sdb_slab_alloc:
+ * Allocate a block of memory of the specified size. The memory is suitably
+ * aligned for any kind of variable but it is not initialized.
+ *
+ * Returns:
+ *  - a pointer to the allocated memory
+ *  - NULL on error
+ */
+void *
+sdb_slab_alloc(size_t size);
+
+/*
+ * sdb_slab_free:
+ * Release a block of memory allocated using sdb_slab_alloc. The size has to
+ * be the same as the one used when allocating the block.
+ */
+void
+sdb_slab_free(void *ptr, size_t size);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ! SDB_UTILS_SLAB_H */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,108 @@
+/*
+ * SysDB - src/include/utils/timerwheel.h
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SDB_UTILS_TIMERWHEEL_H
+#define SDB_UTILS_TIMERWHEEL_H 1
+
+#include "core/object.h"
+#include "core/time.h"
+#include "utils/llist.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A timer wheel schedules objects for expiry at some point in time. It's
+ * organized hierarchically: the first level has one slot per tick (the
+ * resolution of the wheel) while each slot of a higher level covers a full
+ * turn of the level below. Timers are moved to lower levels as time advances,
+ * such that adding a timer and advancing time are both O(1) per timer. Timers
+ * cannot be cancelled; users are expected to check whether an expired object
+ * is still relevant instead.
+ *
+ * All functions are thread-safe.
+ */
+struct sdb_timerwheel;
+typedef struct sdb_timerwheel sdb_timerwheel_t;
+
+/*
+ * sdb_timerwheel_create, sdb_timerwheel_destroy:
+ * Create and destroy a timer wheel with the specified resolution starting at
+ * time 'now'. Destroying the wheel releases all pending objects.
+ *
+ * sdb_timerwheel_create returns NULL on error.
+ */
+sdb_timerwheel_t *
+sdb_timerwheel_create(sdb_time_t resolution, sdb_time_t now);
+void
+sdb_timerwheel_destroy(sdb_timerwheel_t *wheel);
+
+/*
+ * sdb_timerwheel_add:
+ * Schedule an object to expire at the specified time. The wheel takes a
+ * reference to the object. The same object may be added multiple times.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_timerwheel_add(sdb_timerwheel_t *wheel, sdb_object_t *obj,
+		sdb_time_t expires);
+
+/*
+ * sdb_timerwheel_advance:
+ * Advance the wheel to time 'now' and move all objects scheduled to expire
+ * at or before that time (with the precision of the wheel's resolution) to
+ * the specified list. The references held by the wheel are passed on to the
+ * list.
+ *
+ * Returns:
+ *  - the number of expired objects
+ *  - a negative value on error
+ */
+int
+sdb_timerwheel_advance(sdb_timerwheel_t *wheel, sdb_time_t now,
+		sdb_llist_t *expired);
+
+/*
+ * sdb_timerwheel_size:
+ * Returns the number of objects pending in the wheel.
+ */
+size_t
+sdb_timerwheel_size(sdb_timerwheel_t *wheel);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ! SDB_UTILS_TIMERWHEEL_H */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -65,9 +65,12 @@ typedef struct {
 	int metrics_updated;
 	int metrics_failed;
 
+	/* all updates are applied at once after reading all values */
+	sdb_store_batch_t *batch;
+
 	user_data_t *ud;
 } state_t;
-#define STATE_INIT { NULL, 0, 0, 0, NULL }
+#define STATE_INIT { NULL, 0, 0, 0, NULL, NULL }
 
 /*
  * private helper functions
@@ -125,15 +128,13 @@ store_host(state_t *state, const char *hostname, sdb_time_t last_update)
 		return -1;
 	}
 
-	status = sdb_store_host(hostname, last_update);
+	status = sdb_store_batch_host(state->batch, hostname, last_update);
 
 	if (status < 0) {
 		sdb_log(SDB_LOG_ERR, "collectd::unixsock backend: Failed to "
 				"store/update host '%s'.", hostname);
 		return -1;
 	}
-	else if (status > 0) /* value too old */
-		return 0;
 
 	sdb_log(SDB_LOG_DEBUG, "collectd::unixsock backend: Added/updated "
 			"host '%s' (last update timestamp = %"PRIsdbTIME").",
@@ -142,8 +143,8 @@ store_host(state_t *state, const char *hostname, sdb_time_t last_update)
 } /* store_host */
 
 static int
-add_metrics(const char *hostname, char *plugin, char *type,
-		sdb_time_t last_update, user_data_t *ud)
+add_metrics(sdb_store_batch_t *batch, const char *hostname,
+		char *plugin, char *type, sdb_time_t last_update, user_data_t *ud)
 {
 	char  name[strlen(plugin) + strlen(type) + 2];
 	char *plugin_instance, *type_instance;
@@ -161,10 +162,12 @@ add_metrics(const char *hostname, char *plugin, char *type,
 	if (ud->ts_base) {
 		snprintf(metric_id, sizeof(metric_id), "%s/%s/%s.rrd",
 				ud->ts_base, hostname, name);
-		status = sdb_store_metric(hostname, name, &store, last_update);
+		status = sdb_store_batch_metric(batch, hostname, name,
+				&store, last_update);
 	}
 	else
-		status = sdb_store_metric(hostname, name, NULL, last_update);
+		status = sdb_store_batch_metric(batch, hostname, name,
+				NULL, last_update);
 	if (status < 0) {
 		sdb_log(SDB_LOG_ERR, "collectd::unixsock backend: Failed to "
 				"store/update metric '%s/%s'.", hostname, name);
@@ -177,7 +180,7 @@ add_metrics(const char *hostname, char *plugin, char *type,
 		++plugin_instance;
 
 		data.data.string = plugin_instance;
-		sdb_store_metric_attr(hostname, name,
+		sdb_store_batch_metric_attr(batch, hostname, name,
 				"plugin_instance", &data, last_update);
 	}
 
@@ -187,14 +190,16 @@ add_metrics(const char *hostname, char *plugin, char *type,
 		++type_instance;
 
 		data.data.string = type_instance;
-		sdb_store_metric_attr(hostname, name,
+		sdb_store_batch_metric_attr(batch, hostname, name,
 				"type_instance", &data, last_update);
 	}
 
 	data.data.string = plugin;
-	sdb_store_metric_attr(hostname, name, "plugin", &data, last_update);
+	sdb_store_batch_metric_attr(batch, hostname, name,
+			"plugin", &data, last_update);
 	data.data.string = type;
-	sdb_store_metric_attr(hostname, name, "type", &data, last_update);
+	sdb_store_batch_metric_attr(batch, hostname, name,
+			"type", &data, last_update);
 	return 0;
 } /* add_metrics */
 
@@ -244,7 +249,7 @@ get_data(sdb_unixsock_client_t __attribute__((unused)) *client,
 	if (store_host(state, hostname, last_update.data.datetime))
 		return -1;
 
-	if (add_metrics(hostname, plugin, type,
+	if (add_metrics(state->batch, hostname, plugin, type,
 				last_update.data.datetime, state->ud))
 		++state->metrics_failed;
 	else
@@ -288,6 +293,7 @@ sdb_collectd_collect(sdb_object_t *user_data)
 
 	char *endptr = NULL;
 	long int count;
+	int status;
 
 	state_t state = STATE_INIT;
 	sdb_object_wrapper_t state_obj = SDB_OBJECT_WRAPPER_STATIC(&state);
@@ -336,15 +342,27 @@ sdb_collectd_collect(sdb_object_t *user_data)
 		return -1;
 	}
 
-	if (sdb_unixsock_client_process_lines(ud->client, get_data,
-				SDB_OBJ(&state_obj), count, /* delim */ "/",
-				/* column count = */ 3,
-				SDB_TYPE_STRING, SDB_TYPE_STRING, SDB_TYPE_STRING)) {
+	state.batch = sdb_store_batch_begin();
+	if (! state.batch) {
+		sdb_log(SDB_LOG_ERR, "collectd::unixsock backend: Failed to "
+				"allocate store batch.");
+		return -1;
+	}
+
+	status = sdb_unixsock_client_process_lines(ud->client, get_data,
+			SDB_OBJ(&state_obj), count, /* delim */ "/",
+			/* column count = */ 3,
+			SDB_TYPE_STRING, SDB_TYPE_STRING, SDB_TYPE_STRING);
+	if (status)
 		sdb_log(SDB_LOG_ERR, "collectd::unixsock backend: Failed "
 				"to read response from collectd @ %s.",
 				sdb_unixsock_client_path(ud->client));
-		return -1;
-	}
+
+	/* store everything read so far, even in case of an error */
+	if (sdb_store_batch_commit(state.batch))
+		sdb_log(SDB_LOG_ERR, "collectd::unixsock backend: Failed to "
+				"store some of the values from collectd @ %s.",
+				sdb_unixsock_client_path(ud->client));
 
 	if (state.current_host) {
 		sdb_log(SDB_LOG_DEBUG, "collectd::unixsock backend: Added/updated "
@@ -353,7 +371,7 @@ sdb_collectd_collect(sdb_object_t *user_data)
 				state.metrics_failed, state.current_host);
 		free(state.current_host);
 	}
-	return 0;
+	return status ? -1 : 0;
 } /* collect */
 
 static int
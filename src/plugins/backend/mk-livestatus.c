@@ -53,9 +53,9 @@ SDB_PLUGIN_MAGIC;
 
 static int
 sdb_livestatus_get_host(sdb_unixsock_client_t __attribute__((unused)) *client,
-		size_t n, sdb_data_t *data,
-		sdb_object_t __attribute__((unused)) *user_data)
+		size_t n, sdb_data_t *data, sdb_object_t *user_data)
 {
+	sdb_store_batch_t *batch = SDB_OBJ_WRAPPER(user_data)->data;
 	const char *hostname;
 	sdb_time_t timestamp;
 
@@ -68,15 +68,13 @@ sdb_livestatus_get_host(sdb_unixsock_client_t __attribute__((unused)) *client,
 	hostname  = data[0].data.string;
 	timestamp = data[1].data.datetime;
 
-	status = sdb_store_host(hostname, timestamp);
+	status = sdb_store_batch_host(batch, hostname, timestamp);
 
 	if (status < 0) {
 		sdb_log(SDB_LOG_ERR, "MK Livestatus backend: Failed to "
 				"store/update host '%s'.", hostname);
 		return -1;
 	}
-	else if (status > 0) /* value too old */
-		return 0;
 
 	sdb_log(SDB_LOG_DEBUG, "MK Livestatus backend: Added/updated "
 			"host '%s' (last update timestamp = %"PRIsdbTIME").",
@@ -86,9 +84,9 @@ sdb_livestatus_get_host(sdb_unixsock_client_t __attribute__((unused)) *client,
 
 static int
 sdb_livestatus_get_svc(sdb_unixsock_client_t __attribute__((unused)) *client,
-		size_t n, sdb_data_t *data,
-		sdb_object_t __attribute__((unused)) *user_data)
+		size_t n, sdb_data_t *data, sdb_object_t *user_data)
 {
+	sdb_store_batch_t *batch = SDB_OBJ_WRAPPER(user_data)->data;
 	const char *hostname = NULL;
 	const char *svcname = NULL;
 	sdb_time_t timestamp = 0;
@@ -104,15 +102,13 @@ sdb_livestatus_get_svc(sdb_unixsock_client_t __attribute__((unused)) *client,
 	svcname   = data[1].data.string;
 	timestamp = data[2].data.datetime;
 
-	status = sdb_store_service(hostname, svcname, timestamp);
+	status = sdb_store_batch_service(batch, hostname, svcname, timestamp);
 
 	if (status < 0) {
 		sdb_log(SDB_LOG_ERR, "MK Livestatus backend: Failed to "
 				"store/update service '%s / %s'.", hostname, svcname);
 		return -1;
 	}
-	else if (status > 0) /* value too old */
-		return 0;
 
 	sdb_log(SDB_LOG_DEBUG, "MK Livestatus backend: Added/updated "
 			"service '%s / %s' (last update timestamp = %"PRIsdbTIME").",
@@ -120,55 +116,13 @@ sdb_livestatus_get_svc(sdb_unixsock_client_t __attribute__((unused)) *client,
 	return 0;
 } /* sdb_livestatus_get_svc */
 
-/*
- * plugin API
- */
-
-static int
-sdb_livestatus_init(sdb_object_t *user_data)
-{
-	sdb_unixsock_client_t *client;
-
-	if (! user_data)
-		return -1;
-
-	client = SDB_OBJ_WRAPPER(user_data)->data;
-	if (sdb_unixsock_client_connect(client)) {
-		sdb_log(SDB_LOG_ERR, "MK Livestatus backend: "
-				"Failed to connect to livestatus @ %s.",
-				sdb_unixsock_client_path(client));
-		return -1;
-	}
-
-	sdb_log(SDB_LOG_INFO, "MK Livestatus backend: Successfully "
-			"connected to livestatus @ %s.",
-			sdb_unixsock_client_path(client));
-	return 0;
-} /* sdb_livestatus_init */
-
+/* Query all hosts and services, adding them to the specified batch. */
 static int
-sdb_livestatus_shutdown(sdb_object_t *user_data)
+sdb_livestatus_query(sdb_unixsock_client_t *client, sdb_store_batch_t *batch)
 {
-	if (! user_data)
-		return -1;
-
-	sdb_unixsock_client_destroy(SDB_OBJ_WRAPPER(user_data)->data);
-	SDB_OBJ_WRAPPER(user_data)->data = NULL;
-	return 0;
-} /* sdb_livestatus_shutdown */
-
-static int
-sdb_livestatus_collect(sdb_object_t *user_data)
-{
-	sdb_unixsock_client_t *client;
-
+	sdb_object_wrapper_t batch_obj = SDB_OBJECT_WRAPPER_STATIC(batch);
 	int status;
 
-	if (! user_data)
-		return -1;
-
-	client = SDB_OBJ_WRAPPER(user_data)->data;
-
 	status = sdb_unixsock_client_send(client, "GET hosts\r\n"
 			"Columns: name last_check");
 	if (status <= 0) {
@@ -181,7 +135,7 @@ sdb_livestatus_collect(sdb_object_t *user_data)
 	sdb_unixsock_client_shutdown(client, SHUT_WR);
 
 	if (sdb_unixsock_client_process_lines(client, sdb_livestatus_get_host,
-				/* user data */ NULL, /* -> EOF */ -1, /* delim */ ";",
+				SDB_OBJ(&batch_obj), /* -> EOF */ -1, /* delim */ ";",
 				/* column count */ 2, SDB_TYPE_STRING, SDB_TYPE_DATETIME)) {
 		sdb_log(SDB_LOG_ERR, "MK Livestatus backend: Failed to read "
 				"response from livestatus @ %s while reading hosts.",
@@ -211,7 +165,7 @@ sdb_livestatus_collect(sdb_object_t *user_data)
 	sdb_unixsock_client_shutdown(client, SHUT_WR);
 
 	if (sdb_unixsock_client_process_lines(client, sdb_livestatus_get_svc,
-				/* user data */ NULL, /* -> EOF */ -1, /* delim */ ";",
+				SDB_OBJ(&batch_obj), /* -> EOF */ -1, /* delim */ ";",
 				/* column count */ 3, SDB_TYPE_STRING, SDB_TYPE_STRING,
 				SDB_TYPE_DATETIME)) {
 		sdb_log(SDB_LOG_ERR, "MK Livestatus backend: Failed to read "
@@ -230,6 +184,70 @@ sdb_livestatus_collect(sdb_object_t *user_data)
 		return -1;
 	}
 	return 0;
+} /* sdb_livestatus_query */
+
+/*
+ * plugin API
+ */
+
+static int
+sdb_livestatus_init(sdb_object_t *user_data)
+{
+	sdb_unixsock_client_t *client;
+
+	if (! user_data)
+		return -1;
+
+	client = SDB_OBJ_WRAPPER(user_data)->data;
+	if (sdb_unixsock_client_connect(client)) {
+		sdb_log(SDB_LOG_ERR, "MK Livestatus backend: "
+				"Failed to connect to livestatus @ %s.",
+				sdb_unixsock_client_path(client));
+		return -1;
+	}
+
+	sdb_log(SDB_LOG_INFO, "MK Livestatus backend: Successfully "
+			"connected to livestatus @ %s.",
+			sdb_unixsock_client_path(client));
+	return 0;
+} /* sdb_livestatus_init */
+
+static int
+sdb_livestatus_shutdown(sdb_object_t *user_data)
+{
+	if (! user_data)
+		return -1;
+
+	sdb_unixsock_client_destroy(SDB_OBJ_WRAPPER(user_data)->data);
+	SDB_OBJ_WRAPPER(user_data)->data = NULL;
+	return 0;
+} /* sdb_livestatus_shutdown */
+
+static int
+sdb_livestatus_collect(sdb_object_t *user_data)
+{
+	sdb_store_batch_t *batch;
+	int status;
+
+	if (! user_data)
+		return -1;
+
+	batch = sdb_store_batch_begin();
+	if (! batch) {
+		sdb_log(SDB_LOG_ERR, "MK Livestatus backend: Failed to "
+				"allocate store batch.");
+		return -1;
+	}
+
+	status = sdb_livestatus_query(SDB_OBJ_WRAPPER(user_data)->data, batch);
+
+	/* store everything read so far, even in case of an error */
+	if (sdb_store_batch_commit(batch)) {
+		sdb_log(SDB_LOG_ERR, "MK Livestatus backend: Failed to store "
+				"some hosts or services.");
+		status = -1;
+	}
+	return status;
 } /* sdb_livestatus_collect */
 
 static int
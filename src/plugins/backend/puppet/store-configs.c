@@ -47,9 +47,9 @@ SDB_PLUGIN_MAGIC;
 
 static int
 sdb_puppet_stcfg_get_hosts(sdb_dbi_client_t __attribute__((unused)) *client,
-		size_t n, sdb_data_t *data,
-		sdb_object_t __attribute__((unused)) *user_data)
+		size_t n, sdb_data_t *data, sdb_object_t *user_data)
 {
+	sdb_store_batch_t *batch = SDB_OBJ_WRAPPER(user_data)->data;
 	const char *hostname;
 	sdb_time_t timestamp;
 
@@ -62,14 +62,14 @@ sdb_puppet_stcfg_get_hosts(sdb_dbi_client_t __attribute__((unused)) *client,
 	hostname = data[0].data.string;
 	timestamp = data[1].data.datetime;
 
-	status = sdb_store_host(hostname, timestamp);
+	status = sdb_store_batch_host(batch, hostname, timestamp);
 
 	if (status < 0) {
 		sdb_log(SDB_LOG_ERR, "puppet::store-configs backend: Failed to "
 				"store/update host '%s'.", hostname);
 		return -1;
 	}
-	else if (! status)
+	else
 		sdb_log(SDB_LOG_DEBUG, "puppet::store-configs backend: "
 				"Added/updated host '%s' (last update timestamp = "
 				"%"PRIsdbTIME").", hostname, timestamp);
@@ -78,9 +78,9 @@ sdb_puppet_stcfg_get_hosts(sdb_dbi_client_t __attribute__((unused)) *client,
 
 static int
 sdb_puppet_stcfg_get_attrs(sdb_dbi_client_t __attribute__((unused)) *client,
-		size_t n, sdb_data_t *data,
-		sdb_object_t __attribute__((unused)) *user_data)
+		size_t n, sdb_data_t *data, sdb_object_t *user_data)
 {
+	sdb_store_batch_t *batch = SDB_OBJ_WRAPPER(user_data)->data;
 	int status;
 
 	const char *hostname;
@@ -100,7 +100,8 @@ sdb_puppet_stcfg_get_attrs(sdb_dbi_client_t __attribute__((unused)) *client,
 	value.data.string = data[2].data.string;
 	last_update = data[3].data.datetime;
 
-	status = sdb_store_attribute(hostname, key, &value, last_update);
+	status = sdb_store_batch_attribute(batch, hostname,
+			key, &value, last_update);
 
 	if (status < 0) {
 		sdb_log(SDB_LOG_ERR, "puppet::store-configs backend: Failed to "
@@ -112,6 +113,42 @@ sdb_puppet_stcfg_get_attrs(sdb_dbi_client_t __attribute__((unused)) *client,
 	return 0;
 } /* sdb_puppet_stcfg_get_attrs */
 
+/* Query all hosts and their facts, adding them to the specified batch. */
+static int
+sdb_puppet_stcfg_query(sdb_dbi_client_t *client, sdb_store_batch_t *batch)
+{
+	sdb_object_wrapper_t batch_obj = SDB_OBJECT_WRAPPER_STATIC(batch);
+
+	if (sdb_dbi_exec_query(client, "SELECT name, updated_at FROM hosts;",
+				sdb_puppet_stcfg_get_hosts, SDB_OBJ(&batch_obj),
+				/* #columns = */ 2,
+				/* col types = */ SDB_TYPE_STRING, SDB_TYPE_DATETIME)) {
+		sdb_log(SDB_LOG_ERR, "puppet::store-configs backend: Failed to "
+				"retrieve hosts from the storeconfigs DB.");
+		return -1;
+	}
+
+	if (sdb_dbi_exec_query(client, "SELECT "
+					"hosts.name AS hostname, "
+					"fact_names.name AS name, "
+					"fact_values.value AS value, "
+					"fact_values.updated_at AS updated_at "
+				"FROM fact_values "
+				"INNER JOIN hosts "
+					"ON fact_values.host_id = hosts.id "
+				"INNER JOIN fact_names "
+					"ON fact_values.fact_name_id = fact_names.id;",
+				sdb_puppet_stcfg_get_attrs, SDB_OBJ(&batch_obj),
+				/* #columns = */ 4,
+				/* col types = */ SDB_TYPE_STRING, SDB_TYPE_STRING,
+				SDB_TYPE_STRING, SDB_TYPE_DATETIME)) {
+		sdb_log(SDB_LOG_ERR, "puppet::store-configs backend: Failed to "
+				"retrieve host attributes from the storeconfigs DB.");
+		return -1;
+	}
+	return 0;
+} /* sdb_puppet_stcfg_query */
+
 /*
  * plugin API
  */
@@ -151,6 +188,8 @@ static int
 sdb_puppet_stcfg_collect(sdb_object_t *user_data)
 {
 	sdb_dbi_client_t *client;
+	sdb_store_batch_t *batch;
+	int status;
 
 	if (! user_data)
 		return -1;
@@ -162,32 +201,22 @@ sdb_puppet_stcfg_collect(sdb_object_t *user_data)
 		return -1;
 	}
 
-	if (sdb_dbi_exec_query(client, "SELECT name, updated_at FROM hosts;",
-				sdb_puppet_stcfg_get_hosts, NULL, /* #columns = */ 2,
-				/* col types = */ SDB_TYPE_STRING, SDB_TYPE_DATETIME)) {
-		sdb_log(SDB_LOG_ERR, "puppet::store-configs backend: Failed to "
-				"retrieve hosts from the storeconfigs DB.");
+	batch = sdb_store_batch_begin();
+	if (! batch) {
+		sdb_log(SDB_LOG_ERR, "puppet::store-configs backend: "
+				"Failed to allocate store batch.");
 		return -1;
 	}
 
-	if (sdb_dbi_exec_query(client, "SELECT "
-					"hosts.name AS hostname, "
-					"fact_names.name AS name, "
-					"fact_values.value AS value, "
-					"fact_values.updated_at AS updated_at "
-				"FROM fact_values "
-				"INNER JOIN hosts "
-					"ON fact_values.host_id = hosts.id "
-				"INNER JOIN fact_names "
-					"ON fact_values.fact_name_id = fact_names.id;",
-				sdb_puppet_stcfg_get_attrs, NULL, /* #columns = */ 4,
-				/* col types = */ SDB_TYPE_STRING, SDB_TYPE_STRING,
-				SDB_TYPE_STRING, SDB_TYPE_DATETIME)) {
+	status = sdb_puppet_stcfg_query(client, batch);
+
+	/* store everything read so far, even in case of an error */
+	if (sdb_store_batch_commit(batch)) {
 		sdb_log(SDB_LOG_ERR, "puppet::store-configs backend: Failed to "
-				"retrieve host attributes from the storeconfigs DB.");
-		return -1;
+				"store some hosts or host attributes.");
+		status = -1;
 	}
-	return 0;
+	return status;
 } /* sdb_puppet_stcfg_collect */
 
 static int
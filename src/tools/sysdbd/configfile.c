@@ -33,6 +33,7 @@
 
 #include "sysdb.h"
 #include "core/plugin.h"
+#include "core/store.h"
 #include "core/time.h"
 #include "utils/error.h"
 
@@ -64,9 +65,20 @@ enum {
  * private variables
  */
 
+#define DEFAULT_SNAPSHOT_INTERVAL SECS_TO_SDB_TIME(300)
+#define DEFAULT_JOURNAL_COMMIT_INTERVAL DOUBLE_TO_SDB_TIME(0.1)
+
+#define DEFAULT_CNAME_CACHE_SIZE 1024
+#define DEFAULT_CNAME_CACHE_TTL SECS_TO_SDB_TIME(300)
+#define DEFAULT_CNAME_CACHE_NEGATIVE_TTL SECS_TO_SDB_TIME(60)
+
 static sdb_time_t default_interval = 0;
 static char *plugin_dir = NULL;
 
+static size_t cname_cache_size = DEFAULT_CNAME_CACHE_SIZE;
+static sdb_time_t cname_cache_ttl = DEFAULT_CNAME_CACHE_TTL;
+static sdb_time_t cname_cache_negative_ttl = DEFAULT_CNAME_CACHE_NEGATIVE_TTL;
+
 /*
  * private helper functions
  */
@@ -103,6 +115,12 @@ config_get_interval(oconfig_item_t *ci, sdb_time_t *interval)
 daemon_listener_t *listen_addresses = NULL;
 size_t listen_addresses_num = 0;
 
+char *snapshot_filename = NULL;
+sdb_time_t snapshot_interval = DEFAULT_SNAPSHOT_INTERVAL;
+
+char *journal_filename = NULL;
+sdb_time_t journal_commit_interval = DEFAULT_JOURNAL_COMMIT_INTERVAL;
+
 /*
  * token parser
  */
@@ -296,6 +314,215 @@ daemon_configure_plugin(oconfig_item_t *ci)
 	return sdb_plugin_configure(plugin_name, ci);
 } /* daemon_configure_backend */
 
+static int
+daemon_configure_store(oconfig_item_t *ci)
+{
+	bool expiry = 0;
+	int missed = 0;
+	sdb_time_t ttl = 0;
+	int i;
+
+	for (i = 0; i < ci->children_num; ++i) {
+		oconfig_item_t *child = ci->children + i;
+
+		if (! strcasecmp(child->key, "Shards")) {
+			double num = 0.0;
+
+			if (oconfig_get_number(child, &num)) {
+				sdb_log(SDB_LOG_ERR, "config: Shards requires "
+						"a single numeric argument\n"
+						"\tUsage: Shards NUM");
+				return ERR_INVALID_ARG;
+			}
+			if (! ((num >= 1.0) && (num <= SDB_STORE_MAX_SHARDS))) {
+				sdb_log(SDB_LOG_ERR, "config: Invalid number of shards: %f\n"
+						"\tShards has to be between 1 and %d.",
+						num, SDB_STORE_MAX_SHARDS);
+				return ERR_INVALID_ARG;
+			}
+			if (! sdb_store_set_shards((size_t)num))
+				continue;
+
+			if (errno == EBUSY) {
+				sdb_log(SDB_LOG_WARNING, "config: Ignoring new number of "
+						"shards (%zu) -- the value cannot be changed "
+						"while the daemon is running", (size_t)num);
+				continue;
+			}
+			sdb_log(SDB_LOG_ERR, "config: Invalid number of shards: %f",
+					num);
+			return ERR_INVALID_ARG;
+		}
+		else if (! strcasecmp(child->key, "IndexAttribute")) {
+			char *key = NULL;
+
+			if (oconfig_get_string(child, &key)) {
+				sdb_log(SDB_LOG_ERR, "config: IndexAttribute requires "
+						"a single string argument\n"
+						"\tUsage: IndexAttribute KEY");
+				return ERR_INVALID_ARG;
+			}
+			if (sdb_store_index_attribute(key))
+				return -1;
+		}
+		else if (! strcasecmp(child->key, "IndexNames")) {
+			bool enabled = 0;
+
+			if (oconfig_get_boolean(child, &enabled)) {
+				sdb_log(SDB_LOG_ERR, "config: IndexNames requires "
+						"a single boolean argument\n"
+						"\tUsage: IndexNames BOOL");
+				return ERR_INVALID_ARG;
+			}
+			if (enabled && sdb_store_index_names())
+				return -1;
+		}
+		else if (! strcasecmp(child->key, "Snapshot")) {
+			char *filename = NULL;
+
+			if (oconfig_get_string(child, &filename)) {
+				sdb_log(SDB_LOG_ERR, "config: Snapshot requires "
+						"a single string argument\n"
+						"\tUsage: Snapshot FILE");
+				return ERR_INVALID_ARG;
+			}
+			free(snapshot_filename);
+			snapshot_filename = strdup(filename);
+			if (! snapshot_filename) {
+				char buf[1024];
+				sdb_log(SDB_LOG_ERR, "config: Failed to allocate memory: %s",
+						sdb_strerror(errno, buf, sizeof(buf)));
+				return -1;
+			}
+		}
+		else if (! strcasecmp(child->key, "SnapshotInterval")) {
+			double secs = 0.0;
+
+			if (oconfig_get_number(child, &secs) || (secs <= 0.0)) {
+				sdb_log(SDB_LOG_ERR, "config: SnapshotInterval requires "
+						"a single positive numeric argument\n"
+						"\tUsage: SnapshotInterval SECONDS");
+				return ERR_INVALID_ARG;
+			}
+			snapshot_interval = DOUBLE_TO_SDB_TIME(secs);
+		}
+		else if (! strcasecmp(child->key, "Journal")) {
+			char *filename = NULL;
+
+			if (oconfig_get_string(child, &filename)) {
+				sdb_log(SDB_LOG_ERR, "config: Journal requires "
+						"a single string argument\n"
+						"\tUsage: Journal FILE");
+				return ERR_INVALID_ARG;
+			}
+			free(journal_filename);
+			journal_filename = strdup(filename);
+			if (! journal_filename) {
+				char buf[1024];
+				sdb_log(SDB_LOG_ERR, "config: Failed to allocate memory: %s",
+						sdb_strerror(errno, buf, sizeof(buf)));
+				return -1;
+			}
+		}
+		else if (! strcasecmp(child->key, "JournalCommitInterval")) {
+			double secs = 0.0;
+
+			if (oconfig_get_number(child, &secs) || (secs < 0.0)) {
+				sdb_log(SDB_LOG_ERR, "config: JournalCommitInterval requires "
+						"a single non-negative numeric argument\n"
+						"\tUsage: JournalCommitInterval SECONDS");
+				return ERR_INVALID_ARG;
+			}
+			journal_commit_interval = DOUBLE_TO_SDB_TIME(secs);
+		}
+		else if (! strcasecmp(child->key, "ExpireMissedUpdates")) {
+			double num = 0.0;
+
+			if (oconfig_get_number(child, &num) || (num < 0.0)) {
+				sdb_log(SDB_LOG_ERR, "config: ExpireMissedUpdates requires "
+						"a single non-negative numeric argument\n"
+						"\tUsage: ExpireMissedUpdates NUM");
+				return ERR_INVALID_ARG;
+			}
+			missed = (int)num;
+			expiry = 1;
+		}
+		else if (! strcasecmp(child->key, "ExpireAfter")) {
+			double secs = 0.0;
+
+			if (oconfig_get_number(child, &secs) || (secs < 0.0)) {
+				sdb_log(SDB_LOG_ERR, "config: ExpireAfter requires "
+						"a single non-negative numeric argument\n"
+						"\tUsage: ExpireAfter SECONDS");
+				return ERR_INVALID_ARG;
+			}
+			ttl = DOUBLE_TO_SDB_TIME(secs);
+			expiry = 1;
+		}
+		else {
+			sdb_log(SDB_LOG_WARNING, "config: Unknown option '%s' "
+					"inside 'Store' -- see the documentation for "
+					"details.", child->key);
+			continue;
+		}
+	}
+
+	if (expiry && sdb_store_set_expiry(missed, ttl))
+		return -1;
+	return 0;
+} /* daemon_configure_store */
+
+static int
+daemon_configure_cname_cache(oconfig_item_t *ci)
+{
+	int i;
+
+	for (i = 0; i < ci->children_num; ++i) {
+		oconfig_item_t *child = ci->children + i;
+
+		if (! strcasecmp(child->key, "Size")) {
+			double num = 0.0;
+
+			if (oconfig_get_number(child, &num) || (num < 0.0)) {
+				sdb_log(SDB_LOG_ERR, "config: Size requires "
+						"a single non-negative numeric argument\n"
+						"\tUsage: Size NUM");
+				return ERR_INVALID_ARG;
+			}
+			cname_cache_size = (size_t)num;
+		}
+		else if (! strcasecmp(child->key, "TTL")) {
+			double secs = 0.0;
+
+			if (oconfig_get_number(child, &secs) || (secs < 0.0)) {
+				sdb_log(SDB_LOG_ERR, "config: TTL requires "
+						"a single non-negative numeric argument\n"
+						"\tUsage: TTL SECONDS");
+				return ERR_INVALID_ARG;
+			}
+			cname_cache_ttl = DOUBLE_TO_SDB_TIME(secs);
+		}
+		else if (! strcasecmp(child->key, "NegativeTTL")) {
+			double secs = 0.0;
+
+			if (oconfig_get_number(child, &secs) || (secs < 0.0)) {
+				sdb_log(SDB_LOG_ERR, "config: NegativeTTL requires "
+						"a single non-negative numeric argument\n"
+						"\tUsage: NegativeTTL SECONDS");
+				return ERR_INVALID_ARG;
+			}
+			cname_cache_negative_ttl = DOUBLE_TO_SDB_TIME(secs);
+		}
+		else {
+			sdb_log(SDB_LOG_WARNING, "config: Unknown option '%s' "
+					"inside 'CNameCache' -- see the documentation for "
+					"details.", child->key);
+			continue;
+		}
+	}
+	return 0;
+} /* daemon_configure_cname_cache */
+
 static token_parser_t token_parser_list[] = {
 	{ "Listen", daemon_add_listener },
 	{ "Interval", daemon_set_interval },
@@ -304,6 +531,8 @@ static token_parser_t token_parser_list[] = {
 	{ "LoadBackend", daemon_load_backend },
 	{ "Backend", daemon_configure_plugin },
 	{ "Plugin", daemon_configure_plugin },
+	{ "Store", daemon_configure_store },
+	{ "CNameCache", daemon_configure_cname_cache },
 	{ NULL, NULL },
 };
 
@@ -339,6 +568,17 @@ daemon_parse_config(const char *filename)
 	if (! ci)
 		return ERR_PARSE_FAILED;
 
+	/* reset settings which may be omitted on reconfiguration */
+	free(snapshot_filename);
+	snapshot_filename = NULL;
+	snapshot_interval = DEFAULT_SNAPSHOT_INTERVAL;
+	free(journal_filename);
+	journal_filename = NULL;
+	journal_commit_interval = DEFAULT_JOURNAL_COMMIT_INTERVAL;
+	cname_cache_size = DEFAULT_CNAME_CACHE_SIZE;
+	cname_cache_ttl = DEFAULT_CNAME_CACHE_TTL;
+	cname_cache_negative_ttl = DEFAULT_CNAME_CACHE_NEGATIVE_TTL;
+
 	for (i = 0; i < ci->children_num; ++i) {
 		oconfig_item_t *child = ci->children + i;
 		int status = ERR_UNKNOWN_OPTION, j;
@@ -364,6 +604,13 @@ daemon_parse_config(const char *filename)
 	oconfig_free(ci);
 	free(ci);
 
+	if (sdb_plugin_set_cname_cache(cname_cache_size, cname_cache_ttl,
+				cname_cache_negative_ttl)) {
+		sdb_log(SDB_LOG_ERR, "config: Failed to set up the cache of "
+				"canonicalized host names");
+		retval = -1;
+	}
+
 	if (plugin_dir) {
 		free(plugin_dir);
 		plugin_dir = NULL;
@@ -25,6 +25,7 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "core/time.h"
 #include "utils/ssl.h"
 
 #include <unistd.h>
@@ -44,6 +45,14 @@ typedef struct {
 extern daemon_listener_t *listen_addresses;
 extern size_t listen_addresses_num;
 
+/* store snapshot (see the 'Store' block); may be NULL */
+extern char *snapshot_filename;
+extern sdb_time_t snapshot_interval;
+
+/* store journal (see the 'Store' block); may be NULL */
+extern char *journal_filename;
+extern sdb_time_t journal_commit_interval;
+
 void
 daemon_free_listen_addresses(void);
 
@@ -229,11 +229,33 @@ backend_handler(void __attribute__((unused)) *data)
 	return NULL;
 } /* backend_handler */
 
+/* The store maintenance thread shares its lifetime with the backend
+ * thread. */
+static void *
+store_handler(void __attribute__((unused)) *data)
+{
+	sdb_time_t last_snapshot = sdb_gettime();
+
+	while (plugin_main_loop.do_loop) {
+		sdb_time_t now = sdb_gettime();
+
+		sdb_store_expire(now);
+		if (snapshot_filename && (now - last_snapshot >= snapshot_interval)) {
+			sdb_store_snapshot_write(snapshot_filename);
+			last_snapshot = now;
+		}
+		sdb_sleep(SECS_TO_SDB_TIME(1), NULL);
+	}
+	sdb_log(SDB_LOG_INFO, "Shutting down store maintenance thread");
+	return NULL;
+} /* store_handler */
+
 static int
 main_loop(void)
 {
 	sdb_fe_socket_t *sock = sdb_fe_sock_create();
 	pthread_t backend_thread;
+	pthread_t store_thread;
 
 	int status = 0;
 
@@ -244,6 +266,7 @@ main_loop(void)
 		frontend_main_loop.do_loop = 1;
 
 		memset(&backend_thread, 0, sizeof(backend_thread));
+		memset(&store_thread, 0, sizeof(store_thread));
 		if (pthread_create(&backend_thread, /* attr = */ NULL,
 					backend_handler, /* arg = */ NULL)) {
 			char buf[1024];
@@ -254,6 +277,16 @@ main_loop(void)
 			break;
 		}
 
+		if (pthread_create(&store_thread, /* attr = */ NULL,
+					store_handler, /* arg = */ NULL)) {
+			char buf[1024];
+			sdb_log(SDB_LOG_ERR, "Failed to create store maintenance thread: "
+					"%s", sdb_strerror(errno, buf, sizeof(buf)));
+
+			plugin_main_loop.do_loop = 0;
+			break;
+		}
+
 		for (i = 0; i < listen_addresses_num; ++i) {
 			if (sdb_fe_sock_add_listener(sock, listen_addresses[i].address,
 						&listen_addresses[i].ssl_opts)) {
@@ -280,6 +313,8 @@ main_loop(void)
 		 * and make the thread shut down faster */
 		pthread_kill(backend_thread, SIGINT);
 		pthread_join(backend_thread, NULL);
+		pthread_kill(store_thread, SIGINT);
+		pthread_join(store_thread, NULL);
 
 		if (! reconfigure)
 			break;
@@ -298,6 +333,8 @@ main_loop(void)
 	frontend_main_loop.do_loop = 0;
 	pthread_kill(backend_thread, SIGINT);
 	pthread_join(backend_thread, NULL);
+	pthread_kill(store_thread, SIGINT);
+	pthread_join(store_thread, NULL);
 
 	sdb_fe_sock_destroy(sock);
 	return status;
@@ -368,6 +405,18 @@ main(int argc, char **argv)
 		if (daemonize())
 			exit(1);
 
+	/* restore the previous state of the store before
+	 * accepting any client connections */
+	if (snapshot_filename)
+		sdb_store_snapshot_load(snapshot_filename);
+	if (journal_filename) {
+		/* the journal is opened only once; changing it requires a restart */
+		if (sdb_store_journal_replay(journal_filename)
+				|| sdb_store_journal_open(journal_filename,
+					journal_commit_interval))
+			exit(1);
+	}
+
 	if (sdb_ssl_init())
 		exit(1);
 	sdb_plugin_init_all();
@@ -390,6 +439,11 @@ main(int argc, char **argv)
 
 	status = main_loop();
 
+	/* all backends have been stopped */
+	if (snapshot_filename)
+		sdb_store_snapshot_write(snapshot_filename);
+	sdb_store_journal_close();
+
 	sdb_log(SDB_LOG_INFO, "Shutting down SysDB daemon "SDB_VERSION_STRING
 			SDB_VERSION_EXTRA" (pid %i)", (int)getpid());
 	sdb_plugin_shutdown_all();
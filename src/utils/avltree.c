@@ -31,7 +31,11 @@
 
 #include "sysdb.h"
 #include "utils/avltree.h"
+#include "utils/epoch.h"
 #include "utils/error.h"
+#include "utils/hashindex.h"
+#include "utils/mvcc.h"
+#include "utils/slab.h"
 
 #include <assert.h>
 
@@ -39,6 +43,18 @@
 #include <string.h>
 #include <pthread.h>
 
+/*
+ * The tree is a persistent (copy-on-write) AVL tree: nodes are never modified
+ * once they have been published. Instead, writers create copies of all nodes
+ * on the path from the root to the modified node and publish the new version
+ * of the tree by atomically updating the root pointer. Replaced nodes are
+ * destroyed using epoch-based reclamation (see utils/epoch.h) once no reader
+ * may access them any longer. That way, readers may traverse the tree without
+ * taking any locks. Writers are serialized by a per-tree lock. The root is a
+ * versioned pointer (see utils/mvcc.h), such that readers holding a snapshot
+ * see the version of the tree which was current when taking the snapshot.
+ */
+
 /*
  * private data types
  */
@@ -49,11 +65,13 @@ typedef struct node node_t;
 struct node {
 	sdb_object_t *obj;
 
-	node_t *parent;
 	node_t *left;
 	node_t *right;
 
 	size_t height;
+
+	/* the write operation which created this node (see tree->gen) */
+	unsigned long gen;
 };
 
 #define NODE_NAME(n) ((n) && (n)->obj ? (n)->obj->name : "<nil>")
@@ -64,216 +82,545 @@ struct node {
 #define BALANCE(n) \
 	((n) ? (int)NODE_HEIGHT((n)->left) - (int)NODE_HEIGHT((n)->right) : 0)
 
+/* The height of an AVL tree is less than 1.44 * log2(n + 2), that is, this
+ * is sufficient for any tree we'll ever be able to store in memory. */
+#define MAX_HEIGHT 64
+
+/* trees with at least this many objects use a hash index for lookups */
+#define HASH_MIN_SIZE 16
+
 struct sdb_avltree {
-	pthread_rwlock_t lock;
+	/* serializes writers; readers don't take any locks */
+	pthread_mutex_t lock;
 
-	node_t *root;
+	/* accessed atomically; the root is versioned along with the size */
+	sdb_mvcc_ptr_t root;
 	size_t size;
+
+	/* sequence number of the current write operation */
+	unsigned long gen;
+
+	/* exact lookups of the current version; created once the tree has
+	 * grown large enough and accessed atomically */
+	sdb_hashindex_t *hash;
 };
 
 struct sdb_avltree_iter {
-	sdb_avltree_t *tree;
-	node_t *node;
+	/* nodes still to be visited; the next node is on top */
+	node_t *stack[MAX_HEIGHT];
+	size_t depth;
 };
 
+/* nodes replaced by a single write operation */
+typedef struct {
+	sdb_avltree_t *tree;
+	node_t *nodes[3 * MAX_HEIGHT];
+	size_t nodes_num;
+	/* object removed from the tree */
+	sdb_object_t *released;
+	int status;
+} update_t;
+#define UPDATE_INIT(tree) { (tree), { NULL }, 0, NULL, 0 }
+
+/* published nodes and objects to be released once all readers are done with
+ * them */
+typedef struct {
+	sdb_object_t *released;
+	size_t nodes_num;
+	node_t *nodes[];
+} retired_t;
+
 /*
  * private helper functions
  */
 
+/* object names are interned, so equal names are usually identical */
+static int
+name_cmp(const char *n1, const char *n2)
+{
+	if (n1 == n2)
+		return 0;
+	return strcasecmp(n1, n2);
+} /* name_cmp */
+
+/* nodes are allocated from the slab allocator */
+static void
+node_free(node_t *n)
+{
+	sdb_slab_free(n, sizeof(*n));
+} /* node_free */
+
 static void
 node_destroy(node_t *n)
 {
 	sdb_object_deref(n->obj);
 	n->obj = NULL;
-	n->parent = n->left = n->right = NULL;
-	free(n);
+	n->left = n->right = NULL;
+	node_free(n);
 } /* node_destroy */
 
 static node_t *
-node_create(sdb_object_t *obj)
+node_create(update_t *u, sdb_object_t *obj, node_t *left, node_t *right)
 {
-	node_t *n = malloc(sizeof(*n));
-	if (! n)
+	node_t *n = sdb_slab_alloc(sizeof(*n));
+	if (! n) {
+		u->status = -1;
 		return NULL;
+	}
 
-	sdb_object_ref(obj);
 	n->obj = obj;
-	n->parent = n->left = n->right = NULL;
-	n->height = 1;
+	n->left = left;
+	n->right = right;
+	n->height = CALC_HEIGHT(n);
+	n->gen = u->tree->gen;
 	return n;
 } /* node_create */
 
+/* Mark the node as replaced. Nodes created during the current operation have
+ * never been published and may be destroyed immediately. Others have to wait
+ * for all readers. The object is now owned by the replacing node. */
+static void
+node_replaced(update_t *u, node_t *n)
+{
+	if (n->gen == u->tree->gen) {
+		node_free(n);
+		return;
+	}
+	assert(u->nodes_num < SDB_STATIC_ARRAY_LEN(u->nodes));
+	u->nodes[u->nodes_num] = n;
+	++u->nodes_num;
+} /* node_replaced */
+
+static void
+retired_destroy(void *r)
+{
+	retired_t *retired = r;
+	size_t i;
+
+	for (i = 0; i < retired->nodes_num; ++i)
+		node_free(retired->nodes[i]);
+	sdb_object_deref(retired->released);
+	free(retired);
+} /* retired_destroy */
+
+/* destroy a whole (sub-)tree, releasing all objects */
+static void
+subtree_destroy(void *p)
+{
+	node_t *n = p;
+
+	while (n) {
+		node_t *right = n->right;
+		subtree_destroy(n->left);
+		node_destroy(n);
+		n = right;
+	}
+} /* subtree_destroy */
+
+/* The tree lock has to be acquired before calling this function. */
+static void
+tree_publish(sdb_avltree_t *tree, node_t *root, update_t *u)
+{
+	retired_t *retired;
+
+	sdb_mvcc_store(&tree->root, root,
+			__atomic_load_n(&tree->size, __ATOMIC_RELAXED));
+
+	if ((! u->nodes_num) && (! u->released))
+		return;
+
+	retired = malloc(sizeof(*retired) + u->nodes_num * sizeof(node_t *));
+	if (! retired) {
+		size_t i;
+
+		/* we can't hand over the nodes to the reclamation system, so wait
+		 * for all readers instead */
+		sdb_epoch_synchronize();
+		for (i = 0; i < u->nodes_num; ++i)
+			node_free(u->nodes[i]);
+		sdb_object_deref(u->released);
+		return;
+	}
+
+	retired->released = u->released;
+	retired->nodes_num = u->nodes_num;
+	memcpy(retired->nodes, u->nodes, u->nodes_num * sizeof(node_t *));
+	sdb_epoch_retire(retired, retired_destroy);
+} /* tree_publish */
+
+/* Create a new balanced node from the specified object and sub-trees whose
+ * heights differ by at most two. Any nodes which are no longer needed are
+ * marked as replaced. */
 static node_t *
-node_next(node_t *n)
+node_balance(update_t *u, sdb_object_t *obj, node_t *l, node_t *r)
 {
-	node_t *next;
+	node_t *n1, *n2;
+
+	if (u->status)
+		return NULL;
+
+	if (NODE_HEIGHT(l) > NODE_HEIGHT(r) + 1) {
+		if (NODE_HEIGHT(l->left) >= NODE_HEIGHT(l->right)) {
+			/* single right rotation */
+			n2 = node_create(u, obj, l->right, r);
+			n1 = n2 ? node_create(u, l->obj, l->left, n2) : NULL;
+		}
+		else {
+			/* double rotation: left-right */
+			node_t *lr = l->right;
+			node_t *n3;
+
+			n2 = node_create(u, l->obj, l->left, lr->left);
+			n3 = n2 ? node_create(u, obj, lr->right, r) : NULL;
+			n1 = n3 ? node_create(u, lr->obj, n2, n3) : NULL;
+			if (n1)
+				node_replaced(u, lr);
+			else if (n3)
+				node_free(n3);
+		}
+		if (n1)
+			node_replaced(u, l);
+		else if (n2)
+			node_free(n2);
+		return n1;
+	}
+
+	if (NODE_HEIGHT(r) > NODE_HEIGHT(l) + 1) {
+		if (NODE_HEIGHT(r->right) >= NODE_HEIGHT(r->left)) {
+			/* single left rotation */
+			n2 = node_create(u, obj, l, r->left);
+			n1 = n2 ? node_create(u, r->obj, n2, r->right) : NULL;
+		}
+		else {
+			/* double rotation: right-left */
+			node_t *rl = r->left;
+			node_t *n3;
+
+			n2 = node_create(u, r->obj, rl->right, r->right);
+			n3 = n2 ? node_create(u, obj, l, rl->left) : NULL;
+			n1 = n3 ? node_create(u, rl->obj, n3, n2) : NULL;
+			if (n1)
+				node_replaced(u, rl);
+			else if (n3)
+				node_free(n3);
+		}
+		if (n1)
+			node_replaced(u, r);
+		else if (n2)
+			node_free(n2);
+		return n1;
+	}
+
+	return node_create(u, obj, l, r);
+} /* node_balance */
+
+/* Destroy all nodes of a sub-tree which have been created during the current
+ * operation (after an error occurred). */
+static void
+node_discard(update_t *u, node_t *n)
+{
+	if ((! n) || (n->gen != u->tree->gen))
+		return;
+
+	node_discard(u, n->left);
+	node_discard(u, n->right);
+	node_free(n);
+} /* node_discard */
+
+/* Insert an object into the sub-tree rooted at 'n' and return the root of the
+ * new version of that sub-tree. On error, u->status is set to a negative
+ * value and the original sub-tree is left unmodified. */
+static node_t *
+node_insert(update_t *u, node_t *n, sdb_object_t *obj)
+{
+	node_t *child, *new;
+	int diff;
 
 	if (! n)
+		return node_create(u, obj, NULL, NULL);
+
+	diff = name_cmp(obj->name, n->obj->name);
+	if (! diff) {
+		u->status = -1;
+		return NULL;
+	}
+
+	child = node_insert(u, diff < 0 ? n->left : n->right, obj);
+	if (! child)
 		return NULL;
 
-	/* descend into the right tree */
-	if (n->right) {
-		next = n->right;
-		while (next->left)
-			next = next->left;
-		return next;
+	if (diff < 0)
+		new = node_balance(u, n->obj, child, n->right);
+	else
+		new = node_balance(u, n->obj, n->left, child);
+
+	if (! new) {
+		node_discard(u, child);
+		return NULL;
 	}
+	node_replaced(u, n);
+	return new;
+} /* node_insert */
+
+/* Replace the object with the same name as 'obj' in the sub-tree rooted at
+ * 'n' and return the root of the new version of that sub-tree. */
+static node_t *
+node_replace(update_t *u, node_t *n, sdb_object_t *obj)
+{
+	node_t *child = NULL, *new;
+	int diff;
 
-	/* visit the parent if we're in its left tree */
-	if (n->parent && (n->parent->left == n))
-		return n->parent;
+	if (! n) {
+		u->status = -1;
+		return NULL;
+	}
 
-	/* find the parent of the sibling sub-tree on the right */
-	next = n->parent;
-	next = NULL;
-	while (n->parent && (n->parent->right == n)) {
-		n = n->parent;
-		next = n;
+	diff = name_cmp(obj->name, n->obj->name);
+	if (diff) {
+		child = node_replace(u, diff < 0 ? n->left : n->right, obj);
+		if (! child)
+			return NULL;
 	}
-	if (next)
-		next = next->parent;
-	return next;
-} /* node_next */
 
+	if (! diff)
+		new = node_create(u, obj, n->left, n->right);
+	else if (diff < 0)
+		new = node_create(u, n->obj, child, n->right);
+	else
+		new = node_create(u, n->obj, n->left, child);
+
+	if (! new) {
+		node_discard(u, child);
+		return NULL;
+	}
+	if (! diff)
+		u->released = n->obj;
+	node_replaced(u, n);
+	return new;
+} /* node_replace */
+
+/* Remove the left-most node from the sub-tree rooted at 'n' and return the
+ * root of the new version of that sub-tree. The removed node's object is
+ * returned in 'obj'. */
 static node_t *
-node_smallest(sdb_avltree_t *tree)
+node_remove_min(update_t *u, node_t *n, sdb_object_t **obj)
 {
-	node_t *n;
+	node_t *child, *new;
+
+	if (! n->left) {
+		/* 'n' may be freed by node_replaced */
+		child = n->right;
+		*obj = n->obj;
+		node_replaced(u, n);
+		return child;
+	}
 
-	if (! tree)
+	child = node_remove_min(u, n->left, obj);
+	if (u->status)
 		return NULL;
 
-	n = tree->root;
-	while (n && n->left)
-		n = n->left;
-	return n;
-} /* node_smallest */
+	new = node_balance(u, n->obj, child, n->right);
+	if (! new) {
+		node_discard(u, child);
+		return NULL;
+	}
+	node_replaced(u, n);
+	return new;
+} /* node_remove_min */
 
-static void
-tree_clear(sdb_avltree_t *tree)
+/* Remove the object with the specified name from the sub-tree rooted at 'n'
+ * and return the root of the new version of that sub-tree (which may be
+ * NULL). On error, u->status is set to a negative value. */
+static node_t *
+node_remove(update_t *u, node_t *n, const char *name)
 {
-	node_t *n;
+	node_t *child, *new;
+	int diff;
 
-	if ((! tree) || (! tree->root))
-		return;
+	if (! n) {
+		u->status = -1;
+		return NULL;
+	}
 
-	/* do a depth-first iteration and delete the leafs */
-	n = tree->root;
-	while (n) {
-		node_t *tmp;
+	diff = name_cmp(name, n->obj->name);
+	if (! diff) {
+		sdb_object_t *obj = NULL;
 
-		if (n->left) {
-			n = n->left;
-			continue;
-		}
-		else if (n->right) {
-			n = n->right;
-			continue;
+		u->released = n->obj;
+		if ((! n->left) || (! n->right)) {
+			child = n->left ? n->left : n->right;
+			node_replaced(u, n);
+			return child;
 		}
 
-		tmp = n->parent;
-		if (tmp) {
-			if (tmp->left == n)
-				tmp->left = NULL;
-			else
-				tmp->right = NULL;
-		}
+		/* replace the node by its successor */
+		child = node_remove_min(u, n->right, &obj);
+		if (u->status)
+			return NULL;
+		new = node_balance(u, obj, n->left, child);
+	}
+	else {
+		child = node_remove(u, diff < 0 ? n->left : n->right, name);
+		if (u->status)
+			return NULL;
 
-		node_destroy(n);
-		n = tmp;
+		if (diff < 0)
+			new = node_balance(u, n->obj, child, n->right);
+		else
+			new = node_balance(u, n->obj, n->left, child);
 	}
 
-	tree->root = NULL;
-	tree->size = 0;
-} /* tree_clear */
+	if (! new) {
+		node_discard(u, child);
+		return NULL;
+	}
+	node_replaced(u, n);
+	return new;
+} /* node_remove */
+
+/* Returns the current root. Writers have to use this function. */
+static node_t *
+tree_root(sdb_avltree_t *tree)
+{
+	return __atomic_load_n(&tree->root.ptr, __ATOMIC_ACQUIRE);
+} /* tree_root */
+
+/* Returns the root (and size) of the version of the tree visible to the
+ * calling thread. This function has to be called from inside an epoch
+ * critical section. */
+static node_t *
+tree_view(sdb_avltree_t *tree, size_t *size)
+{
+	if (size)
+		*size = __atomic_load_n(&tree->size, __ATOMIC_RELAXED);
+	return sdb_mvcc_load(&tree->root, size);
+} /* tree_view */
 
-/* Switch node 'n' with its right child, making 'n'
- * the new left child of that node. */
 static void
-rotate_left(sdb_avltree_t *tree, node_t *n)
+hash_destroy(void *hash)
 {
-	node_t *n2 = n->right;
-	node_t *c = n2->left;
+	sdb_hashindex_destroy(hash);
+} /* hash_destroy */
 
-	n2->parent = n->parent;
-	if (! n2->parent)
-		tree->root = n2;
-	else if (n2->parent->left == n)
-		n2->parent->left = n2;
-	else
-		n2->parent->right = n2;
+/* Drop the hash index, e.g., if it could not be updated. Lookups then search
+ * the tree instead. The tree lock has to be acquired before calling this
+ * function. */
+static void
+tree_drop_hash(sdb_avltree_t *tree)
+{
+	sdb_hashindex_t *hash = tree->hash;
 
-	n2->left = n;
-	n->parent = n2;
+	if (! hash)
+		return;
 
-	n->right = c;
-	if (c)
-		c->parent = n;
+	__atomic_store_n(&tree->hash, NULL, __ATOMIC_RELEASE);
+	sdb_epoch_retire(hash, hash_destroy);
+} /* tree_drop_hash */
 
-	n->height = CALC_HEIGHT(n);
-	n2->height = CALC_HEIGHT(n2);
-} /* rotate_left */
+static int
+hash_populate(sdb_hashindex_t *hash, node_t *n)
+{
+	while (n) {
+		if (hash_populate(hash, n->left))
+			return -1;
+		if (sdb_hashindex_insert(hash, n->obj))
+			return -1;
+		n = n->right;
+	}
+	return 0;
+} /* hash_populate */
 
-/* Switch node 'n' with its left child, making 'n'
- * the new right child of that node. */
+/* Add the object to the hash index or create the index if the tree has grown
+ * large enough. The tree lock has to be acquired before calling this
+ * function. */
 static void
-rotate_right(sdb_avltree_t *tree, node_t *n)
+tree_hash_insert(sdb_avltree_t *tree, sdb_object_t *obj)
 {
-	node_t *n2 = n->left;
-	node_t *c = n2->right;
+	sdb_hashindex_t *hash;
 
-	n2->parent = n->parent;
-	if (! n2->parent)
-		tree->root = n2;
-	else if (n2->parent->left == n)
-		n2->parent->left = n2;
-	else
-		n2->parent->right = n2;
+	if (tree->hash) {
+		if (sdb_hashindex_insert(tree->hash, obj))
+			tree_drop_hash(tree);
+		return;
+	}
 
-	n2->right = n;
-	n->parent = n2;
+	if (tree->size < HASH_MIN_SIZE)
+		return;
+
+	hash = sdb_hashindex_create();
+	if (! hash)
+		return;
+	if (hash_populate(hash, tree_root(tree))) {
+		sdb_hashindex_destroy(hash);
+		return;
+	}
+	__atomic_store_n(&tree->hash, hash, __ATOMIC_RELEASE);
+} /* tree_hash_insert */
 
-	n->left = c;
-	if (c)
-		c->parent = n;
+static void
+tree_clear(sdb_avltree_t *tree)
+{
+	node_t *root;
 
-	n->height = CALC_HEIGHT(n);
-	n2->height = CALC_HEIGHT(n2);
-} /* rotate_right */
+	tree_drop_hash(tree);
+
+	root = tree_root(tree);
+	sdb_mvcc_store(&tree->root, NULL,
+			__atomic_load_n(&tree->size, __ATOMIC_RELAXED));
+	__atomic_store_n(&tree->size, 0, __ATOMIC_RELAXED);
+
+	sdb_epoch_retire(root, subtree_destroy);
+} /* tree_clear */
 
-/* Rebalance a tree starting at node 'n' towards the root;
- * also, update the node heights all the way up to the root. */
 static void
-rebalance(sdb_avltree_t *tree, node_t *n)
+iter_push_left(sdb_avltree_iter_t *iter, node_t *n)
 {
-	for ( ; n; n = n->parent) {
-		int bf = BALANCE(n);
+	for ( ; n; n = n->left) {
+		assert(iter->depth < MAX_HEIGHT);
+		iter->stack[iter->depth] = n;
+		++iter->depth;
+	}
+} /* iter_push_left */
 
-		if (bf == 0)
-			return;
+static bool
+node_valid(node_t *n, node_t **prev, size_t *size)
+{
+	bool status = 1;
+	int bf;
 
-		if ((-1 <= bf) && (bf <= 1)) {
-			n->height = CALC_HEIGHT(n);
-			continue;
-		}
+	if (! n)
+		return 1;
 
-		assert((-2 <= bf) && (bf <= 2));
+	if (! node_valid(n->left, prev, size))
+		status = 0;
 
-		if (bf == 2) {
-			if (BALANCE(n->left) == -1)
-				rotate_left(tree, n->left);
-			rotate_right(tree, n);
-		}
-		else {
-			if (BALANCE(n->right) == 1)
-				rotate_right(tree, n->right);
-			rotate_left(tree, n);
-		}
+	bf = BALANCE(n);
+	if ((bf < -1) || (1 < bf)) {
+		sdb_log(SDB_LOG_ERR, "avltree: Unbalanced node '%s' (bf=%i)",
+				NODE_NAME(n), bf);
+		status = 0;
+	}
 
-		/* n was moved downwards; get back to the previous level */
-		n = n->parent;
+	if (CALC_HEIGHT(n) != n->height) {
+		sdb_log(SDB_LOG_ERR, "avltree: Unexpected height for node '%s': "
+				"%zu; expected: %zu", NODE_NAME(n), n->height,
+				CALC_HEIGHT(n));
+		status = 0;
 	}
-} /* rebalance */
+
+	if (*prev && (strcasecmp(NODE_NAME(*prev), NODE_NAME(n)) >= 0)) {
+		sdb_log(SDB_LOG_ERR, "avltree: Unexpected order of nodes: "
+				"'%s' before '%s'", NODE_NAME(*prev), NODE_NAME(n));
+		status = 0;
+	}
+
+	*prev = n;
+	++(*size);
+
+	if (! node_valid(n->right, prev, size))
+		status = 0;
+	return status;
+} /* node_valid */
 
 /*
  * public API
@@ -288,10 +635,12 @@ sdb_avltree_create(void)
 	if (! tree)
 		return NULL;
 
-	pthread_rwlock_init(&tree->lock, /* attr = */ NULL);
+	pthread_mutex_init(&tree->lock, /* attr = */ NULL);
 
-	tree->root = NULL;
+	tree->root = (sdb_mvcc_ptr_t)SDB_MVCC_PTR_INIT;
 	tree->size = 0;
+	tree->gen = 0;
+	tree->hash = NULL;
 	return tree;
 } /* sdb_avltree_create */
 
@@ -301,10 +650,11 @@ sdb_avltree_destroy(sdb_avltree_t *tree)
 	if (! tree)
 		return;
 
-	pthread_rwlock_wrlock(&tree->lock);
+	pthread_mutex_lock(&tree->lock);
 	tree_clear(tree);
-	pthread_rwlock_unlock(&tree->lock);
-	pthread_rwlock_destroy(&tree->lock);
+	sdb_mvcc_clear(&tree->root);
+	pthread_mutex_unlock(&tree->lock);
+	pthread_mutex_destroy(&tree->lock);
 	free(tree);
 } /* sdb_avltree_destroy */
 
@@ -314,85 +664,123 @@ sdb_avltree_clear(sdb_avltree_t *tree)
 	if (! tree)
 		return;
 
-	pthread_rwlock_wrlock(&tree->lock);
+	pthread_mutex_lock(&tree->lock);
 	tree_clear(tree);
-	pthread_rwlock_unlock(&tree->lock);
+	pthread_mutex_unlock(&tree->lock);
 } /* sdb_avltree_clear */
 
 int
 sdb_avltree_insert(sdb_avltree_t *tree, sdb_object_t *obj)
 {
-	node_t *parent;
-	node_t *n;
+	update_t u = UPDATE_INIT(tree);
+	node_t *root;
 
-	int diff = -1;
+	if ((! tree) || (! obj))
+		return -1;
 
-	if (! tree)
+	pthread_mutex_lock(&tree->lock);
+	++tree->gen;
+
+	root = node_insert(&u, tree_root(tree), obj);
+	if (! root) {
+		pthread_mutex_unlock(&tree->lock);
 		return -1;
+	}
 
-	n = node_create(obj);
-	if (! n)
+	sdb_object_ref(obj);
+	tree_publish(tree, root, &u);
+	__atomic_add_fetch(&tree->size, 1, __ATOMIC_RELAXED);
+	tree_hash_insert(tree, obj);
+
+	pthread_mutex_unlock(&tree->lock);
+	return 0;
+} /* sdb_avltree_insert */
+
+int
+sdb_avltree_replace(sdb_avltree_t *tree, sdb_object_t *obj)
+{
+	update_t u = UPDATE_INIT(tree);
+	node_t *root;
+
+	if ((! tree) || (! obj))
 		return -1;
 
-	pthread_rwlock_wrlock(&tree->lock);
+	pthread_mutex_lock(&tree->lock);
+	++tree->gen;
 
-	if (! tree->root) {
-		tree->root = n;
-		tree->size = 1;
-		pthread_rwlock_unlock(&tree->lock);
-		return 0;
+	root = node_replace(&u, tree_root(tree), obj);
+	if (! root) {
+		pthread_mutex_unlock(&tree->lock);
+		return -1;
 	}
 
-	parent = tree->root;
-	while (42) {
-		assert(parent);
+	sdb_object_ref(obj);
+	/* the replaced object must no longer be reachable through the hash
+	 * index once it's retired */
+	if (tree->hash && sdb_hashindex_replace(tree->hash, u.released, obj))
+		tree_drop_hash(tree);
+	tree_publish(tree, root, &u);
+
+	pthread_mutex_unlock(&tree->lock);
+	return 0;
+} /* sdb_avltree_replace */
 
-		diff = strcasecmp(obj->name, parent->obj->name);
-		if (! diff) {
-			node_destroy(n);
-			pthread_rwlock_unlock(&tree->lock);
-			return -1;
-		}
+int
+sdb_avltree_remove(sdb_avltree_t *tree, const char *name)
+{
+	update_t u = UPDATE_INIT(tree);
+	node_t *root;
 
-		if (diff < 0) {
-			if (! parent->left) {
-				parent->left = n;
-				break;
-			}
-			parent = parent->left;
-		}
-		else {
-			if (! parent->right) {
-				parent->right = n;
-				break;
-			}
-			parent = parent->right;
-		}
+	if ((! tree) || (! name))
+		return -1;
+
+	pthread_mutex_lock(&tree->lock);
+	++tree->gen;
+
+	root = node_remove(&u, tree_root(tree), name);
+	if (u.status) {
+		pthread_mutex_unlock(&tree->lock);
+		return -1;
 	}
 
-	n->parent = parent;
-	++tree->size;
+	if (tree->hash && sdb_hashindex_remove(tree->hash, u.released))
+		tree_drop_hash(tree);
+	tree_publish(tree, root, &u);
+	__atomic_sub_fetch(&tree->size, 1, __ATOMIC_RELAXED);
 
-	rebalance(tree, parent);
-	pthread_rwlock_unlock(&tree->lock);
+	pthread_mutex_unlock(&tree->lock);
 	return 0;
-} /* sdb_avltree_insert */
+} /* sdb_avltree_remove */
 
 sdb_object_t *
 sdb_avltree_lookup(sdb_avltree_t *tree, const char *name)
 {
+	sdb_object_t *obj = NULL;
+	sdb_hashindex_t *hash;
 	node_t *n;
 
-	if (! tree)
+	if ((! tree) || (! name))
 		return NULL;
 
-	n = tree->root;
+	sdb_epoch_enter();
+	/* the hash index only covers the current version */
+	hash = sdb_mvcc_snapshot_version()
+		? NULL : __atomic_load_n(&tree->hash, __ATOMIC_ACQUIRE);
+	if (hash) {
+		obj = sdb_hashindex_lookup(hash, name);
+		sdb_object_ref(obj);
+		sdb_epoch_exit();
+		return obj;
+	}
+
+	n = tree_view(tree, NULL);
 	while (n) {
-		int diff = strcasecmp(n->obj->name, name);
+		int diff = name_cmp(n->obj->name, name);
 
 		if (! diff) {
-			sdb_object_ref(n->obj);
-			return n->obj;
+			obj = n->obj;
+			sdb_object_ref(obj);
+			break;
 		}
 
 		if (diff < 0)
@@ -400,8 +788,9 @@ sdb_avltree_lookup(sdb_avltree_t *tree, const char *name)
 		else
 			n = n->left;
 	}
-	return NULL;
-} /* sdb_avltree_lookup_by_name */
+	sdb_epoch_exit();
+	return obj;
+} /* sdb_avltree_lookup */
 
 sdb_avltree_iter_t *
 sdb_avltree_get_iter(sdb_avltree_t *tree)
@@ -415,12 +804,12 @@ sdb_avltree_get_iter(sdb_avltree_t *tree)
 	if (! iter)
 		return NULL;
 
-	pthread_rwlock_rdlock(&tree->lock);
-
-	iter->tree = tree;
-	iter->node = node_smallest(tree);
+	/* the iterator operates on the current version of the tree which
+	 * remains valid until the iterator is destroyed */
+	sdb_epoch_enter();
 
-	pthread_rwlock_unlock(&tree->lock);
+	iter->depth = 0;
+	iter_push_left(iter, tree_view(tree, NULL));
 	return iter;
 } /* sdb_avltree_get_iter */
 
@@ -430,9 +819,9 @@ sdb_avltree_iter_destroy(sdb_avltree_iter_t *iter)
 	if (! iter)
 		return;
 
-	iter->tree = NULL;
-	iter->node = NULL;
+	iter->depth = 0;
 	free(iter);
+	sdb_epoch_exit();
 } /* sdb_avltree_iter_destroy */
 
 bool
@@ -441,7 +830,7 @@ sdb_avltree_iter_has_next(sdb_avltree_iter_t *iter)
 	if (! iter)
 		return 0;
 
-	return iter->node != NULL;
+	return iter->depth > 0;
 } /* sdb_avltree_iter_has_next */
 
 sdb_object_t *
@@ -449,76 +838,69 @@ sdb_avltree_iter_get_next(sdb_avltree_iter_t *iter)
 {
 	node_t *n;
 
-	if (! iter)
+	if ((! iter) || (! iter->depth))
 		return NULL;
 
-	n = iter->node;
-	iter->node = node_next(iter->node);
-	return n ? n->obj : NULL;
+	--iter->depth;
+	n = iter->stack[iter->depth];
+	iter_push_left(iter, n->right);
+	return n->obj;
 } /* sdb_avltree_iter_get_next */
 
 sdb_object_t *
 sdb_avltree_iter_peek_next(sdb_avltree_iter_t *iter)
 {
-	if ((! iter) || (! iter->node))
+	if ((! iter) || (! iter->depth))
 		return NULL;
-	return iter->node->obj;
+	return iter->stack[iter->depth - 1]->obj;
 } /* sdb_avltree_iter_peek_next */
 
 size_t
 sdb_avltree_size(sdb_avltree_t *tree)
 {
-	return tree ? tree->size : 0;
+	size_t size = 0;
+
+	/* snapshots don't leave their critical section while active */
+	if (tree)
+		tree_view(tree, &size);
+	return size;
 } /* sdb_avltree_size */
 
 bool
 sdb_avltree_valid(sdb_avltree_t *tree)
 {
-	node_t *n;
-
-	bool status = 1;
+	sdb_avltree_iter_t *iter;
+	sdb_hashindex_t *hash;
+	node_t *prev = NULL;
+	bool status;
 	size_t size = 0;
 
 	if (! tree)
 		return 1;
 
-	for (n = node_smallest(tree); n; n = node_next(n)) {
-		int bf = BALANCE(n);
-
-		if ((bf < -1) || (1 < bf)) {
-			sdb_log(SDB_LOG_ERR, "avltree: Unbalanced node '%s' (bf=%i)",
-					NODE_NAME(n), bf);
-			status = 0;
-		}
+	sdb_epoch_enter();
+	status = node_valid(tree_root(tree), &prev, &size);
+	sdb_epoch_exit();
 
-		if (NODE_HEIGHT(n) != n->height) {
-			sdb_log(SDB_LOG_ERR, "avltree: Unexpected height for node '%s': "
-					"%zu; expected: %zu", NODE_NAME(n), n->height,
-					NODE_HEIGHT(n));
-			status = 0;
-		}
+	if (size != sdb_avltree_size(tree)) {
+		sdb_log(SDB_LOG_ERR, "avltree: Invalid size %zu; expected: %zu",
+				sdb_avltree_size(tree), size);
+		status = 0;
+	}
 
-		if (n->parent && (n->parent->left != n) && (n->parent->right != n)) {
-			sdb_log(SDB_LOG_ERR, "avltree: Invalid child nodes for parent of "
-					"node '%s': {left: %s, right: %s}; expected: %s",
-					NODE_NAME(n), NODE_NAME(n->parent->left),
-					NODE_NAME(n->parent->right), NODE_NAME(n));
+	/* all objects have to be accessible through the hash index; the
+	 * iterator keeps the current version of the tree and index alive */
+	iter = sdb_avltree_get_iter(tree);
+	hash = __atomic_load_n(&tree->hash, __ATOMIC_ACQUIRE);
+	while (hash && sdb_avltree_iter_has_next(iter)) {
+		sdb_object_t *obj = sdb_avltree_iter_get_next(iter);
+		if (sdb_hashindex_lookup(hash, obj->name) != obj) {
+			sdb_log(SDB_LOG_ERR, "avltree: Object '%s' missing from "
+					"hash index", obj->name);
 			status = 0;
 		}
-		if ((! n->parent) && (n != tree->root)) {
-			sdb_log(SDB_LOG_ERR, "avltree: Non-root node '%s' does not "
-					"have a parent", NODE_NAME(n));
-			status = 0;
-		}
-
-		++size;
-	}
-
-	if (size != tree->size) {
-		sdb_log(SDB_LOG_ERR, "avltree: Invalid size %zu; expected: %zu",
-				tree->size, size);
-		status = 0;
 	}
+	sdb_avltree_iter_destroy(iter);
 	return status;
 } /* sdb_avltree_valid */
 
@@ -0,0 +1,1082 @@
+/*
+ * SysDB - src/utils/btree.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "sysdb.h"
+#include "utils/btree.h"
+#include "utils/epoch.h"
+#include "utils/error.h"
+#include "utils/hashindex.h"
+#include "utils/mvcc.h"
+#include "utils/slab.h"
+
+#include <assert.h>
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+
+/*
+ * The tree is a persistent (copy-on-write) B+tree: all objects are stored in
+ * the leaves and each inner node stores the smallest object of each of its
+ * children. Like the AVL tree, nodes are never modified once they have been
+ * published. Writers create copies of all nodes on the path from the root to
+ * the modified leaf (and of their siblings, if they need to be merged) and
+ * publish them by atomically updating the (versioned) root pointer. Replaced
+ * nodes are destroyed using epoch-based reclamation (see utils/epoch.h) and
+ * readers holding a snapshot (see utils/mvcc.h) keep seeing the version of
+ * the tree which was current when taking the snapshot. Since nodes
+ * are copied anyway, each node is allocated with exactly the required
+ * number of entries.
+ *
+ * Along with each object, a node stores the first KEY_LEN characters of its
+ * name, folded to lower-case and packed into an integer (see key_of), such
+ * that comparing two keys yields the same result as strcasecmp() on the
+ * respective prefixes. Most comparisons thus don't have to access the
+ * names at all.
+ */
+
+/*
+ * private data types
+ */
+
+/* maximum number of entries per node */
+#define ORDER 32
+/* minimum number of entries per node except the root */
+#define MIN_ENTRIES (ORDER / 2)
+
+/* Each non-root node has at least MIN_ENTRIES entries, that is, this is
+ * sufficient for any tree we'll ever be able to store in memory. */
+#define MAX_HEIGHT 16
+
+#define KEY_LEN sizeof(uint64_t)
+
+/* trees with at least this many objects use a hash index for lookups */
+#define HASH_MIN_SIZE 16
+
+struct node;
+typedef struct node node_t;
+
+struct node {
+	/* the write operation which created this node (see tree->gen) */
+	unsigned long gen;
+
+	bool leaf;
+	/* superseded by another node created by the same write operation */
+	bool dead;
+
+	size_t num;
+
+	/* case-folded name prefixes (see key_of) */
+	uint64_t *keys;
+	/* leaves: the stored objects; inner nodes: each child's first object */
+	sdb_object_t **objs;
+	/* inner nodes only */
+	node_t **children;
+};
+
+#define NODE_SIZE(leaf, num) (sizeof(node_t) + (num) * (sizeof(uint64_t) \
+			+ sizeof(sdb_object_t *) + ((leaf) ? 0 : sizeof(node_t *))))
+
+/* an entry of a node while building a new one */
+typedef struct {
+	uint64_t key;
+	sdb_object_t *obj;
+	node_t *child;
+} entry_t;
+
+struct sdb_btree {
+	/* serializes writers; readers don't take any locks */
+	pthread_mutex_t lock;
+
+	/* accessed atomically; the root is versioned along with the size */
+	sdb_mvcc_ptr_t root;
+	size_t size;
+
+	/* sequence number of the current write operation */
+	unsigned long gen;
+
+	/* exact lookups of the current version; created once the tree has
+	 * grown large enough and accessed atomically */
+	sdb_hashindex_t *hash;
+};
+
+struct sdb_btree_iter {
+	/* the path to the next object and the index of the next entry on each
+	 * level; the top-most node is a leaf */
+	node_t *nodes[MAX_HEIGHT];
+	size_t idx[MAX_HEIGHT];
+	size_t depth;
+};
+
+/* nodes created and replaced by a single write operation */
+typedef struct {
+	sdb_btree_t *tree;
+	node_t *created[4 * MAX_HEIGHT];
+	size_t created_num;
+	node_t *replaced[2 * MAX_HEIGHT + 1];
+	size_t replaced_num;
+	/* object removed from the tree */
+	sdb_object_t *released;
+	int status;
+} update_t;
+#define UPDATE_INIT(tree) { (tree), { NULL }, 0, { NULL }, 0, NULL, 0 }
+
+/* published nodes and objects to be released once all readers are done with
+ * them */
+typedef struct {
+	sdb_object_t *released;
+	size_t nodes_num;
+	node_t *nodes[];
+} retired_t;
+
+/*
+ * private helper functions
+ */
+
+static uint64_t
+key_of(const char *name)
+{
+	uint64_t key = 0;
+	size_t i;
+
+	for (i = 0; i < KEY_LEN; ++i) {
+		key <<= 8;
+		if (*name) {
+			key |= (unsigned char)tolower((unsigned char)*name);
+			++name;
+		}
+	}
+	return key;
+} /* key_of */
+
+static int
+key_cmp(uint64_t k1, const char *n1, uint64_t k2, const char *n2)
+{
+	if (k1 != k2)
+		return k1 < k2 ? -1 : 1;
+	/* both names are shorter than KEY_LEN characters */
+	if (! (k1 & 0xff))
+		return 0;
+	/* object names are interned, so equal names are usually identical */
+	if (n1 == n2)
+		return 0;
+	return strcasecmp(n1 + KEY_LEN, n2 + KEY_LEN);
+} /* key_cmp */
+
+/* Returns the index of the last entry less than or equal to the specified
+ * name or -1 if there is no such entry. 'found' is set if they are equal. */
+static int
+node_search(node_t *n, uint64_t key, const char *name, bool *found)
+{
+	int lo = 0, hi = (int)n->num - 1;
+	int idx = -1;
+
+	*found = 0;
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+		int diff = key_cmp(n->keys[mid], n->objs[mid]->name, key, name);
+
+		if (! diff) {
+			*found = 1;
+			return mid;
+		}
+		if (diff < 0) {
+			idx = mid;
+			lo = mid + 1;
+		}
+		else
+			hi = mid - 1;
+	}
+	return idx;
+} /* node_search */
+
+static void
+node_free(node_t *n)
+{
+	sdb_slab_free(n, NODE_SIZE(n->leaf, n->num));
+} /* node_free */
+
+static node_t *
+node_create(update_t *u, bool leaf, const entry_t *ents, size_t num)
+{
+	node_t *n;
+	size_t i;
+
+	if (u->status)
+		return NULL;
+
+	n = sdb_slab_alloc(NODE_SIZE(leaf, num));
+	if (! n) {
+		u->status = -1;
+		return NULL;
+	}
+
+	n->gen = u->tree->gen;
+	n->leaf = leaf;
+	n->dead = 0;
+	n->num = num;
+	n->keys = (uint64_t *)(n + 1);
+	n->objs = (sdb_object_t **)(n->keys + num);
+	n->children = leaf ? NULL : (node_t **)(n->objs + num);
+
+	for (i = 0; i < num; ++i) {
+		n->keys[i] = ents[i].key;
+		n->objs[i] = ents[i].obj;
+		if (! leaf)
+			n->children[i] = ents[i].child;
+	}
+
+	assert(u->created_num < SDB_STATIC_ARRAY_LEN(u->created));
+	u->created[u->created_num] = n;
+	++u->created_num;
+	return n;
+} /* node_create */
+
+/* Mark the node as replaced. Nodes created during the current operation have
+ * never been published and will be destroyed once the operation finished.
+ * Others have to wait for all readers. */
+static void
+node_replaced(update_t *u, node_t *n)
+{
+	if (n->gen == u->tree->gen) {
+		n->dead = 1;
+		return;
+	}
+	assert(u->replaced_num < SDB_STATIC_ARRAY_LEN(u->replaced));
+	u->replaced[u->replaced_num] = n;
+	++u->replaced_num;
+} /* node_replaced */
+
+static size_t
+entries_get(node_t *n, entry_t *ents)
+{
+	size_t i;
+
+	for (i = 0; i < n->num; ++i) {
+		ents[i].key = n->keys[i];
+		ents[i].obj = n->objs[i];
+		ents[i].child = n->leaf ? NULL : n->children[i];
+	}
+	return n->num;
+} /* entries_get */
+
+static void
+entries_insert(entry_t *ents, size_t *num, size_t idx, const entry_t *e)
+{
+	memmove(ents + idx + 1, ents + idx, (*num - idx) * sizeof(*ents));
+	ents[idx] = *e;
+	++(*num);
+} /* entries_insert */
+
+static void
+entries_remove(entry_t *ents, size_t *num, size_t idx)
+{
+	--(*num);
+	memmove(ents + idx, ents + idx + 1, (*num - idx) * sizeof(*ents));
+} /* entries_remove */
+
+/* Set an inner node's entry to refer to the specified child. */
+static void
+entry_set_child(entry_t *e, node_t *child)
+{
+	e->key = child->keys[0];
+	e->obj = child->objs[0];
+	e->child = child;
+} /* entry_set_child */
+
+/* Create one or, if there are too many entries, two new nodes. */
+static void
+node_split(update_t *u, bool leaf, const entry_t *ents, size_t num,
+		node_t *res[2])
+{
+	size_t half = num / 2;
+
+	res[1] = NULL;
+	if (num <= ORDER) {
+		res[0] = node_create(u, leaf, ents, num);
+		return;
+	}
+
+	res[0] = node_create(u, leaf, ents, half);
+	res[1] = node_create(u, leaf, ents + half, num - half);
+} /* node_split */
+
+static void
+retired_destroy(void *r)
+{
+	retired_t *retired = r;
+	size_t i;
+
+	for (i = 0; i < retired->nodes_num; ++i)
+		node_free(retired->nodes[i]);
+	sdb_object_deref(retired->released);
+	free(retired);
+} /* retired_destroy */
+
+/* destroy a whole (sub-)tree, releasing all objects */
+static void
+subtree_destroy(void *p)
+{
+	node_t *n = p;
+	size_t i;
+
+	if (! n)
+		return;
+
+	for (i = 0; i < n->num; ++i) {
+		if (n->leaf)
+			sdb_object_deref(n->objs[i]);
+		else
+			subtree_destroy(n->children[i]);
+	}
+	node_free(n);
+} /* subtree_destroy */
+
+/* Returns the current root. Writers have to use this function. */
+static node_t *
+tree_root(sdb_btree_t *tree)
+{
+	return __atomic_load_n(&tree->root.ptr, __ATOMIC_ACQUIRE);
+} /* tree_root */
+
+/* Returns the root (and size) of the version of the tree visible to the
+ * calling thread. This function has to be called from inside an epoch
+ * critical section. */
+static node_t *
+tree_view(sdb_btree_t *tree, size_t *size)
+{
+	if (size)
+		*size = __atomic_load_n(&tree->size, __ATOMIC_RELAXED);
+	return sdb_mvcc_load(&tree->root, size);
+} /* tree_view */
+
+/* Publish the new version of the tree or, in case of an error, destroy all
+ * nodes created by the current operation. The tree lock has to be acquired
+ * before calling this function. */
+static int
+tree_publish(sdb_btree_t *tree, node_t *root, update_t *u)
+{
+	retired_t *retired;
+	size_t i;
+
+	for (i = 0; i < u->created_num; ++i)
+		if (u->status || u->created[i]->dead)
+			node_free(u->created[i]);
+	if (u->status)
+		return u->status;
+
+	sdb_mvcc_store(&tree->root, root,
+			__atomic_load_n(&tree->size, __ATOMIC_RELAXED));
+
+	if ((! u->replaced_num) && (! u->released))
+		return 0;
+
+	retired = malloc(sizeof(*retired) + u->replaced_num * sizeof(node_t *));
+	if (! retired) {
+		/* we can't hand over the nodes to the reclamation system, so wait
+		 * for all readers instead */
+		sdb_epoch_synchronize();
+		for (i = 0; i < u->replaced_num; ++i)
+			node_free(u->replaced[i]);
+		sdb_object_deref(u->released);
+		return 0;
+	}
+
+	retired->released = u->released;
+	retired->nodes_num = u->replaced_num;
+	memcpy(retired->nodes, u->replaced, u->replaced_num * sizeof(node_t *));
+	sdb_epoch_retire(retired, retired_destroy);
+	return 0;
+} /* tree_publish */
+
+/* Insert an entry into the sub-tree rooted at 'n'. The new version of that
+ * sub-tree is returned in res[0] or, if it had to be split, in res[0] and
+ * res[1]. On error, u->status is set to a negative value. */
+static void
+node_insert(update_t *u, node_t *n, const entry_t *e, node_t *res[2])
+{
+	entry_t ents[ORDER + 1];
+	size_t num;
+	bool found;
+	int i;
+
+	i = node_search(n, e->key, e->obj->name, &found);
+	if (found && n->leaf) {
+		u->status = -1;
+		return;
+	}
+
+	if (n->leaf) {
+		num = entries_get(n, ents);
+		entries_insert(ents, &num, (size_t)(i + 1), e);
+	}
+	else {
+		node_t *sub[2];
+
+		/* new smallest object */
+		if (i < 0)
+			i = 0;
+
+		node_insert(u, n->children[i], e, sub);
+		if (u->status)
+			return;
+
+		num = entries_get(n, ents);
+		entry_set_child(&ents[i], sub[0]);
+		if (sub[1]) {
+			entry_t tmp;
+			entry_set_child(&tmp, sub[1]);
+			entries_insert(ents, &num, (size_t)(i + 1), &tmp);
+		}
+	}
+
+	node_split(u, n->leaf, ents, num, res);
+	if (! u->status)
+		node_replaced(u, n);
+} /* node_insert */
+
+/* Replace the object with the same name as the specified entry in the
+ * sub-tree rooted at 'n' and return the new version of that sub-tree. */
+static node_t *
+node_replace(update_t *u, node_t *n, const entry_t *e)
+{
+	entry_t ents[ORDER];
+	node_t *new;
+	size_t num;
+	bool found;
+	int i;
+
+	i = node_search(n, e->key, e->obj->name, &found);
+	if ((i < 0) || (n->leaf && (! found))) {
+		u->status = -1;
+		return NULL;
+	}
+
+	num = entries_get(n, ents);
+	if (n->leaf) {
+		u->released = n->objs[i];
+		ents[i].obj = e->obj;
+	}
+	else {
+		node_t *child = node_replace(u, n->children[i], e);
+		if (! child)
+			return NULL;
+		entry_set_child(&ents[i], child);
+	}
+
+	new = node_create(u, n->leaf, ents, num);
+	if (new)
+		node_replaced(u, n);
+	return new;
+} /* node_replace */
+
+/* Merge the child at index 'i' of the entries 'ents' (which has too few
+ * entries) with one of its siblings. */
+static void
+node_merge(update_t *u, entry_t *ents, size_t *num, size_t i)
+{
+	entry_t merged[2 * ORDER];
+	node_t *left, *right, *res[2];
+	size_t first, merged_num;
+
+	first = (i + 1 < *num) ? i : i - 1;
+	left = ents[first].child;
+	right = ents[first + 1].child;
+
+	merged_num = entries_get(left, merged);
+	merged_num += entries_get(right, merged + merged_num);
+
+	node_split(u, left->leaf, merged, merged_num, res);
+	if (u->status)
+		return;
+
+	node_replaced(u, left);
+	node_replaced(u, right);
+
+	entry_set_child(&ents[first], res[0]);
+	if (res[1])
+		entry_set_child(&ents[first + 1], res[1]);
+	else
+		entries_remove(ents, num, first + 1);
+} /* node_merge */
+
+/* Remove the object with the specified name from the sub-tree rooted at 'n'
+ * and return the new version of that sub-tree, which may have fewer than
+ * MIN_ENTRIES entries (or none at all). On error, u->status is set to a
+ * negative value. */
+static node_t *
+node_remove(update_t *u, node_t *n, uint64_t key, const char *name)
+{
+	entry_t ents[ORDER];
+	node_t *new;
+	size_t num;
+	bool found;
+	int i;
+
+	i = node_search(n, key, name, &found);
+	if ((i < 0) || (n->leaf && (! found))) {
+		u->status = -1;
+		return NULL;
+	}
+
+	num = entries_get(n, ents);
+	if (n->leaf) {
+		u->released = n->objs[i];
+		entries_remove(ents, &num, (size_t)i);
+	}
+	else {
+		node_t *child = node_remove(u, n->children[i], key, name);
+		if (! child)
+			return NULL;
+
+		/* all inner nodes have at least two children */
+		assert(num > 1);
+		ents[i].child = child;
+		if (child->num >= MIN_ENTRIES)
+			entry_set_child(&ents[i], child);
+		else
+			node_merge(u, ents, &num, (size_t)i);
+		if (u->status)
+			return NULL;
+	}
+
+	new = node_create(u, n->leaf, ents, num);
+	if (new)
+		node_replaced(u, n);
+	return new;
+} /* node_remove */
+
+static void
+hash_destroy(void *hash)
+{
+	sdb_hashindex_destroy(hash);
+} /* hash_destroy */
+
+/* Drop the hash index, e.g., if it could not be updated. Lookups then search
+ * the tree instead. The tree lock has to be acquired before calling this
+ * function. */
+static void
+tree_drop_hash(sdb_btree_t *tree)
+{
+	sdb_hashindex_t *hash = tree->hash;
+
+	if (! hash)
+		return;
+
+	__atomic_store_n(&tree->hash, NULL, __ATOMIC_RELEASE);
+	sdb_epoch_retire(hash, hash_destroy);
+} /* tree_drop_hash */
+
+static int
+hash_populate(sdb_hashindex_t *hash, node_t *n)
+{
+	size_t i;
+
+	if (! n)
+		return 0;
+
+	for (i = 0; i < n->num; ++i) {
+		if (n->leaf) {
+			if (sdb_hashindex_insert(hash, n->objs[i]))
+				return -1;
+		}
+		else if (hash_populate(hash, n->children[i]))
+			return -1;
+	}
+	return 0;
+} /* hash_populate */
+
+/* Add the object to the hash index or create the index if the tree has grown
+ * large enough. The tree lock has to be acquired before calling this
+ * function. */
+static void
+tree_hash_insert(sdb_btree_t *tree, sdb_object_t *obj)
+{
+	sdb_hashindex_t *hash;
+
+	if (tree->hash) {
+		if (sdb_hashindex_insert(tree->hash, obj))
+			tree_drop_hash(tree);
+		return;
+	}
+
+	if (tree->size < HASH_MIN_SIZE)
+		return;
+
+	hash = sdb_hashindex_create();
+	if (! hash)
+		return;
+	if (hash_populate(hash, tree_root(tree))) {
+		sdb_hashindex_destroy(hash);
+		return;
+	}
+	__atomic_store_n(&tree->hash, hash, __ATOMIC_RELEASE);
+} /* tree_hash_insert */
+
+static void
+tree_clear(sdb_btree_t *tree)
+{
+	node_t *root;
+
+	tree_drop_hash(tree);
+
+	root = tree_root(tree);
+	sdb_mvcc_store(&tree->root, NULL,
+			__atomic_load_n(&tree->size, __ATOMIC_RELAXED));
+	__atomic_store_n(&tree->size, 0, __ATOMIC_RELAXED);
+
+	sdb_epoch_retire(root, subtree_destroy);
+} /* tree_clear */
+
+static void
+iter_descend(sdb_btree_iter_t *iter, node_t *n)
+{
+	for ( ; n; n = n->leaf ? NULL : n->children[0]) {
+		assert(iter->depth < MAX_HEIGHT);
+		iter->nodes[iter->depth] = n;
+		iter->idx[iter->depth] = 0;
+		++iter->depth;
+	}
+} /* iter_descend */
+
+static void
+iter_advance(sdb_btree_iter_t *iter)
+{
+	while (iter->depth) {
+		size_t d = iter->depth - 1;
+
+		++iter->idx[d];
+		if (iter->idx[d] < iter->nodes[d]->num) {
+			if (! iter->nodes[d]->leaf)
+				iter_descend(iter, iter->nodes[d]->children[iter->idx[d]]);
+			return;
+		}
+		--iter->depth;
+	}
+} /* iter_advance */
+
+static bool
+node_valid(node_t *n, size_t depth, size_t *leaf_depth,
+		sdb_object_t **prev, size_t *size)
+{
+	bool status = 1;
+	size_t i;
+
+	if ((n->num > ORDER) || (! n->num)
+			|| ((depth > 0) && (n->num < MIN_ENTRIES))
+			|| ((! n->leaf) && (n->num < 2))) {
+		sdb_log(SDB_LOG_ERR, "btree: Unexpected number of entries "
+				"in node at depth %zu: %zu", depth, n->num);
+		status = 0;
+	}
+
+	for (i = 0; i < n->num; ++i) {
+		if (n->keys[i] != key_of(n->objs[i]->name)) {
+			sdb_log(SDB_LOG_ERR, "btree: Invalid key for '%s'",
+					n->objs[i]->name);
+			status = 0;
+		}
+
+		if (n->leaf) {
+			if (*prev && (strcasecmp((*prev)->name, n->objs[i]->name) >= 0)) {
+				sdb_log(SDB_LOG_ERR, "btree: Unexpected order of entries: "
+						"'%s' before '%s'", (*prev)->name, n->objs[i]->name);
+				status = 0;
+			}
+			*prev = n->objs[i];
+			++(*size);
+			continue;
+		}
+
+		if ((n->objs[i] != n->children[i]->objs[0])
+				|| (n->keys[i] != n->children[i]->keys[0])) {
+			sdb_log(SDB_LOG_ERR, "btree: Invalid separator '%s'; "
+					"expected: '%s'", n->objs[i]->name,
+					n->children[i]->objs[0]->name);
+			status = 0;
+		}
+		if (! node_valid(n->children[i], depth + 1, leaf_depth, prev, size))
+			status = 0;
+	}
+
+	if (n->leaf) {
+		if (! *leaf_depth)
+			*leaf_depth = depth + 1;
+		else if (*leaf_depth != depth + 1) {
+			sdb_log(SDB_LOG_ERR, "btree: Leaf at depth %zu; expected: %zu",
+					depth, *leaf_depth - 1);
+			status = 0;
+		}
+	}
+	return status;
+} /* node_valid */
+
+/*
+ * public API
+ */
+
+sdb_btree_t *
+sdb_btree_create(void)
+{
+	sdb_btree_t *tree;
+
+	tree = malloc(sizeof(*tree));
+	if (! tree)
+		return NULL;
+
+	pthread_mutex_init(&tree->lock, /* attr = */ NULL);
+
+	tree->root = (sdb_mvcc_ptr_t)SDB_MVCC_PTR_INIT;
+	tree->size = 0;
+	tree->gen = 0;
+	tree->hash = NULL;
+	return tree;
+} /* sdb_btree_create */
+
+void
+sdb_btree_destroy(sdb_btree_t *tree)
+{
+	if (! tree)
+		return;
+
+	pthread_mutex_lock(&tree->lock);
+	tree_clear(tree);
+	sdb_mvcc_clear(&tree->root);
+	pthread_mutex_unlock(&tree->lock);
+	pthread_mutex_destroy(&tree->lock);
+	free(tree);
+} /* sdb_btree_destroy */
+
+void
+sdb_btree_clear(sdb_btree_t *tree)
+{
+	if (! tree)
+		return;
+
+	pthread_mutex_lock(&tree->lock);
+	tree_clear(tree);
+	pthread_mutex_unlock(&tree->lock);
+} /* sdb_btree_clear */
+
+int
+sdb_btree_insert(sdb_btree_t *tree, sdb_object_t *obj)
+{
+	update_t u = UPDATE_INIT(tree);
+	node_t *root, *res[2] = { NULL, NULL };
+	entry_t e;
+
+	if ((! tree) || (! obj) || (! obj->name))
+		return -1;
+
+	e.key = key_of(obj->name);
+	e.obj = obj;
+	e.child = NULL;
+
+	pthread_mutex_lock(&tree->lock);
+	++tree->gen;
+
+	root = tree_root(tree);
+	if (! root)
+		res[0] = node_create(&u, /* leaf = */ 1, &e, 1);
+	else
+		node_insert(&u, root, &e, res);
+
+	root = res[0];
+	if (res[1]) {
+		entry_t ents[2];
+
+		entry_set_child(&ents[0], res[0]);
+		entry_set_child(&ents[1], res[1]);
+		root = node_create(&u, /* leaf = */ 0, ents, 2);
+	}
+
+	if (tree_publish(tree, root, &u)) {
+		pthread_mutex_unlock(&tree->lock);
+		return -1;
+	}
+
+	sdb_object_ref(obj);
+	__atomic_add_fetch(&tree->size, 1, __ATOMIC_RELAXED);
+	tree_hash_insert(tree, obj);
+
+	pthread_mutex_unlock(&tree->lock);
+	return 0;
+} /* sdb_btree_insert */
+
+int
+sdb_btree_replace(sdb_btree_t *tree, sdb_object_t *obj)
+{
+	update_t u = UPDATE_INIT(tree);
+	node_t *root;
+	entry_t e;
+
+	if ((! tree) || (! obj) || (! obj->name))
+		return -1;
+
+	e.key = key_of(obj->name);
+	e.obj = obj;
+	e.child = NULL;
+
+	pthread_mutex_lock(&tree->lock);
+	++tree->gen;
+
+	root = tree_root(tree);
+	if (root)
+		root = node_replace(&u, root, &e);
+	else
+		u.status = -1;
+
+	/* the object has to be owned by the tree before it's published and the
+	 * replaced object must no longer be reachable through the hash index
+	 * once it's retired */
+	if (! u.status) {
+		sdb_object_ref(obj);
+		if (tree->hash
+				&& sdb_hashindex_replace(tree->hash, u.released, obj))
+			tree_drop_hash(tree);
+	}
+	if (tree_publish(tree, root, &u)) {
+		pthread_mutex_unlock(&tree->lock);
+		return -1;
+	}
+
+	pthread_mutex_unlock(&tree->lock);
+	return 0;
+} /* sdb_btree_replace */
+
+int
+sdb_btree_remove(sdb_btree_t *tree, const char *name)
+{
+	update_t u = UPDATE_INIT(tree);
+	node_t *root;
+
+	if ((! tree) || (! name))
+		return -1;
+
+	pthread_mutex_lock(&tree->lock);
+	++tree->gen;
+
+	root = tree_root(tree);
+	if (root)
+		root = node_remove(&u, root, key_of(name), name);
+	else
+		u.status = -1;
+
+	if (! u.status) {
+		/* shrink the tree if the root became empty or has a single child */
+		if (! root->num) {
+			node_replaced(&u, root);
+			root = NULL;
+		}
+		else if ((! root->leaf) && (root->num == 1)) {
+			node_replaced(&u, root);
+			root = root->children[0];
+		}
+
+		if (tree->hash && sdb_hashindex_remove(tree->hash, u.released))
+			tree_drop_hash(tree);
+	}
+
+	if (tree_publish(tree, root, &u)) {
+		pthread_mutex_unlock(&tree->lock);
+		return -1;
+	}
+	__atomic_sub_fetch(&tree->size, 1, __ATOMIC_RELAXED);
+
+	pthread_mutex_unlock(&tree->lock);
+	return 0;
+} /* sdb_btree_remove */
+
+sdb_object_t *
+sdb_btree_lookup(sdb_btree_t *tree, const char *name)
+{
+	sdb_object_t *obj = NULL;
+	sdb_hashindex_t *hash;
+	uint64_t key;
+	node_t *n;
+
+	if ((! tree) || (! name))
+		return NULL;
+
+	sdb_epoch_enter();
+	/* the hash index only covers the current version */
+	hash = sdb_mvcc_snapshot_version()
+		? NULL : __atomic_load_n(&tree->hash, __ATOMIC_ACQUIRE);
+	if (hash) {
+		obj = sdb_hashindex_lookup(hash, name);
+		sdb_object_ref(obj);
+		sdb_epoch_exit();
+		return obj;
+	}
+
+	key = key_of(name);
+	n = tree_view(tree, NULL);
+	while (n) {
+		bool found;
+		int i = node_search(n, key, name, &found);
+
+		if (n->leaf) {
+			if (found) {
+				obj = n->objs[i];
+				sdb_object_ref(obj);
+			}
+			break;
+		}
+
+		if (i < 0)
+			break;
+		n = n->children[i];
+	}
+	sdb_epoch_exit();
+	return obj;
+} /* sdb_btree_lookup */
+
+sdb_btree_iter_t *
+sdb_btree_get_iter(sdb_btree_t *tree)
+{
+	sdb_btree_iter_t *iter;
+
+	if (! tree)
+		return NULL;
+
+	iter = malloc(sizeof(*iter));
+	if (! iter)
+		return NULL;
+
+	/* the iterator operates on the current version of the tree which
+	 * remains valid until the iterator is destroyed */
+	sdb_epoch_enter();
+
+	iter->depth = 0;
+	iter_descend(iter, tree_view(tree, NULL));
+	return iter;
+} /* sdb_btree_get_iter */
+
+void
+sdb_btree_iter_destroy(sdb_btree_iter_t *iter)
+{
+	if (! iter)
+		return;
+
+	iter->depth = 0;
+	free(iter);
+	sdb_epoch_exit();
+} /* sdb_btree_iter_destroy */
+
+bool
+sdb_btree_iter_has_next(sdb_btree_iter_t *iter)
+{
+	if (! iter)
+		return 0;
+
+	return iter->depth > 0;
+} /* sdb_btree_iter_has_next */
+
+sdb_object_t *
+sdb_btree_iter_get_next(sdb_btree_iter_t *iter)
+{
+	sdb_object_t *obj;
+
+	obj = sdb_btree_iter_peek_next(iter);
+	if (obj)
+		iter_advance(iter);
+	return obj;
+} /* sdb_btree_iter_get_next */
+
+sdb_object_t *
+sdb_btree_iter_peek_next(sdb_btree_iter_t *iter)
+{
+	size_t d;
+
+	if ((! iter) || (! iter->depth))
+		return NULL;
+
+	d = iter->depth - 1;
+	return iter->nodes[d]->objs[iter->idx[d]];
+} /* sdb_btree_iter_peek_next */
+
+size_t
+sdb_btree_size(sdb_btree_t *tree)
+{
+	size_t size = 0;
+
+	/* snapshots don't leave their critical section while active */
+	if (tree)
+		tree_view(tree, &size);
+	return size;
+} /* sdb_btree_size */
+
+bool
+sdb_btree_valid(sdb_btree_t *tree)
+{
+	sdb_btree_iter_t *iter;
+	sdb_hashindex_t *hash;
+	sdb_object_t *prev = NULL;
+	size_t leaf_depth = 0;
+	size_t size = 0;
+	bool status = 1;
+	node_t *root;
+
+	if (! tree)
+		return 1;
+
+	sdb_epoch_enter();
+	root = tree_root(tree);
+	if (root)
+		status = node_valid(root, 0, &leaf_depth, &prev, &size);
+	sdb_epoch_exit();
+
+	if (size != sdb_btree_size(tree)) {
+		sdb_log(SDB_LOG_ERR, "btree: Invalid size %zu; expected: %zu",
+				sdb_btree_size(tree), size);
+		status = 0;
+	}
+
+	/* all objects have to be accessible through the hash index; the
+	 * iterator keeps the current version of the tree and index alive */
+	iter = sdb_btree_get_iter(tree);
+	hash = __atomic_load_n(&tree->hash, __ATOMIC_ACQUIRE);
+	while (hash && sdb_btree_iter_has_next(iter)) {
+		sdb_object_t *obj = sdb_btree_iter_get_next(iter);
+		if (sdb_hashindex_lookup(hash, obj->name) != obj) {
+			sdb_log(SDB_LOG_ERR, "btree: Object '%s' missing from "
+					"hash index", obj->name);
+			status = 0;
+		}
+	}
+	sdb_btree_iter_destroy(iter);
+	return status;
+} /* sdb_btree_valid */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
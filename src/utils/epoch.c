@@ -0,0 +1,326 @@
+/*
+ * SysDB - src/utils/epoch.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module implements epoch-based reclamation as described by Keir Fraser
+ * ("Practical lock-freedom", 2004): a global epoch counter may only be
+ * advanced once all readers currently inside a critical section have
+ * observed the current epoch. Data retired during epoch 'e' is guaranteed to
+ * no longer be referenced by any reader once the global epoch has reached
+ * 'e + 2' and is destroyed the next time the epoch is advanced after that.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "utils/epoch.h"
+#include "utils/error.h"
+
+#include <assert.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+/*
+ * private data types
+ */
+
+typedef struct limbo limbo_t;
+struct limbo {
+	void *ptr;
+	void (*destructor)(void *);
+	limbo_t *next;
+};
+
+typedef struct epoch_thread epoch_thread_t;
+struct epoch_thread {
+	/* (epoch << 1) | active; accessed atomically */
+	unsigned long state;
+	/* nesting level of critical sections; only accessed by the owner */
+	unsigned int nesting;
+
+	bool in_use;
+	epoch_thread_t *next;
+};
+
+/*
+ * private variables
+ */
+
+static unsigned long global_epoch = 0;
+
+/* data retired during each of the last three epochs */
+static limbo_t *limbo[3] = { NULL, NULL, NULL };
+
+/* protects the limbo lists, the list of threads, and epoch advancement */
+static pthread_mutex_t epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+static epoch_thread_t *threads = NULL;
+
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+
+/* Shared by all threads for which we failed to allocate their own state.
+ * Readers using it block reclamation entirely while inside a critical
+ * section; its nesting level is accessed atomically. */
+static epoch_thread_t fallback_thread = { 0, 0, 1, NULL };
+
+/*
+ * private helper functions
+ */
+
+static void
+thread_release(void *p)
+{
+	epoch_thread_t *t = p;
+
+	if ((! t) || (t == &fallback_thread))
+		return;
+
+	pthread_mutex_lock(&epoch_lock);
+	__atomic_store_n(&t->state, 0, __ATOMIC_RELEASE);
+	t->nesting = 0;
+	t->in_use = 0;
+	pthread_mutex_unlock(&epoch_lock);
+} /* thread_release */
+
+static void
+thread_key_init(void)
+{
+	pthread_key_create(&thread_key, thread_release);
+} /* thread_key_init */
+
+static epoch_thread_t *
+thread_get(void)
+{
+	epoch_thread_t *t;
+
+	pthread_once(&thread_key_once, thread_key_init);
+	t = pthread_getspecific(thread_key);
+	if (t)
+		return t;
+
+	pthread_mutex_lock(&epoch_lock);
+	for (t = threads; t; t = t->next)
+		if (! t->in_use)
+			break;
+
+	if (! t) {
+		t = calloc(1, sizeof(*t));
+		if (t) {
+			t->next = threads;
+			threads = t;
+		}
+	}
+	if (t) {
+		t->state = 0;
+		t->nesting = 0;
+		t->in_use = 1;
+	}
+	pthread_mutex_unlock(&epoch_lock);
+
+	if (! t) {
+		sdb_log(SDB_LOG_ERR, "epoch: Failed to allocate reader state; "
+				"falling back to blocking reclamation");
+		t = &fallback_thread;
+	}
+	pthread_setspecific(thread_key, t);
+	return t;
+} /* thread_get */
+
+/* The epoch_lock has to be acquired before calling this function. */
+static bool
+try_advance(limbo_t **reclaim)
+{
+	unsigned long e = global_epoch;
+	epoch_thread_t *t;
+	limbo_t *l;
+
+	/* pairs with the fence in sdb_epoch_enter */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&fallback_thread.nesting, __ATOMIC_ACQUIRE))
+		return 0;
+
+	for (t = threads; t; t = t->next) {
+		unsigned long s = __atomic_load_n(&t->state, __ATOMIC_ACQUIRE);
+		if ((s & 1) && ((s >> 1) != e))
+			return 0;
+	}
+
+	__atomic_store_n(&global_epoch, e + 1, __ATOMIC_SEQ_CST);
+
+	/* all active readers have observed epoch 'e', so nothing retired
+	 * during epoch 'e - 2' may still be referenced */
+	l = limbo[(e + 1) % 3];
+	limbo[(e + 1) % 3] = NULL;
+	if (l) {
+		limbo_t *last = l;
+		while (last->next)
+			last = last->next;
+		last->next = *reclaim;
+		*reclaim = l;
+	}
+	return 1;
+} /* try_advance */
+
+static void
+reclaim_all(limbo_t *l)
+{
+	while (l) {
+		limbo_t *next = l->next;
+		l->destructor(l->ptr);
+		free(l);
+		l = next;
+	}
+} /* reclaim_all */
+
+static bool
+has_limbo(void)
+{
+	return __atomic_load_n(&limbo[0], __ATOMIC_RELAXED)
+		|| __atomic_load_n(&limbo[1], __ATOMIC_RELAXED)
+		|| __atomic_load_n(&limbo[2], __ATOMIC_RELAXED);
+} /* has_limbo */
+
+/*
+ * public API
+ */
+
+void
+sdb_epoch_enter(void)
+{
+	epoch_thread_t *t = thread_get();
+	unsigned long e;
+
+	if (t == &fallback_thread) {
+		__atomic_add_fetch(&t->nesting, 1, __ATOMIC_SEQ_CST);
+		return;
+	}
+
+	if (t->nesting++)
+		return;
+
+	e = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&t->state, (e << 1) | 1, __ATOMIC_RELAXED);
+	/* make the announcement visible before accessing any shared data */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+} /* sdb_epoch_enter */
+
+void
+sdb_epoch_exit(void)
+{
+	epoch_thread_t *t = thread_get();
+	limbo_t *reclaim = NULL;
+	int i;
+
+	if (t == &fallback_thread) {
+		__atomic_sub_fetch(&t->nesting, 1, __ATOMIC_SEQ_CST);
+		return;
+	}
+
+	assert(t->nesting > 0);
+	if (--t->nesting)
+		return;
+
+	__atomic_store_n(&t->state, 0, __ATOMIC_RELEASE);
+
+	/* opportunistically reclaim data which might have been waiting for us
+	 * but don't ever block readers on the lock */
+	if ((! has_limbo()) || pthread_mutex_trylock(&epoch_lock))
+		return;
+	for (i = 0; i < 3; ++i)
+		if (! try_advance(&reclaim))
+			break;
+	pthread_mutex_unlock(&epoch_lock);
+	reclaim_all(reclaim);
+} /* sdb_epoch_exit */
+
+void
+sdb_epoch_retire(void *ptr, void (*destructor)(void *))
+{
+	limbo_t *l, *reclaim = NULL;
+	int i;
+
+	if ((! ptr) || (! destructor))
+		return;
+
+	l = malloc(sizeof(*l));
+	if (! l) {
+		epoch_thread_t *t = thread_get();
+
+		if ((t != &fallback_thread) && t->nesting) {
+			sdb_log(SDB_LOG_ERR, "epoch: Failed to allocate memory; "
+					"leaking retired data");
+			return;
+		}
+		sdb_epoch_synchronize();
+		destructor(ptr);
+		return;
+	}
+
+	l->ptr = ptr;
+	l->destructor = destructor;
+
+	pthread_mutex_lock(&epoch_lock);
+	l->next = limbo[global_epoch % 3];
+	limbo[global_epoch % 3] = l;
+
+	/* advancing three times in a row is only possible if there are no
+	 * active readers; everything may be reclaimed right away in that case */
+	for (i = 0; i < 3; ++i)
+		if (! try_advance(&reclaim))
+			break;
+	pthread_mutex_unlock(&epoch_lock);
+
+	reclaim_all(reclaim);
+} /* sdb_epoch_retire */
+
+void
+sdb_epoch_synchronize(void)
+{
+	limbo_t *reclaim = NULL;
+	int advanced = 0;
+
+	while (42) {
+		pthread_mutex_lock(&epoch_lock);
+		while ((advanced < 3) && try_advance(&reclaim))
+			++advanced;
+		pthread_mutex_unlock(&epoch_lock);
+
+		if (advanced >= 3)
+			break;
+		sched_yield();
+	}
+
+	reclaim_all(reclaim);
+} /* sdb_epoch_synchronize */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
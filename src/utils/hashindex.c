@@ -0,0 +1,290 @@
+/*
+ * SysDB - src/utils/hashindex.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "utils/hashindex.h"
+#include "utils/epoch.h"
+
+#include <assert.h>
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/*
+ * Readers access the current table and its slots using atomic loads. Each
+ * slot's hash is stored before publishing its object. Removed objects are
+ * replaced by a tombstone, such that probe sequences stay intact. Once the
+ * table fills up, a new table is built and published while the old one is
+ * retired (see utils/epoch.h).
+ */
+
+/*
+ * private data types
+ */
+
+#define MIN_SIZE 16
+
+typedef struct {
+	uint32_t hash;
+	sdb_object_t *obj;
+} slot_t;
+
+typedef struct {
+	size_t mask;
+	/* number of slots that are not empty, including tombstones */
+	size_t used;
+	size_t live;
+	slot_t slots[];
+} table_t;
+
+struct sdb_hashindex {
+	/* accessed atomically */
+	table_t *table;
+};
+
+static sdb_object_t tombstone = SDB_OBJECT_STATIC("<removed>");
+#define TOMBSTONE (&tombstone)
+
+/*
+ * private helper functions
+ */
+
+static table_t *
+table_create(size_t size)
+{
+	table_t *t;
+
+	t = calloc(1, sizeof(*t) + size * sizeof(slot_t));
+	if (! t)
+		return NULL;
+	t->mask = size - 1;
+	return t;
+} /* table_create */
+
+static void
+table_free(void *t)
+{
+	free(t);
+} /* table_free */
+
+static table_t *
+index_table(sdb_hashindex_t *idx)
+{
+	return __atomic_load_n(&idx->table, __ATOMIC_ACQUIRE);
+} /* index_table */
+
+/* Returns the slot of the specified object or NULL. */
+static slot_t *
+table_find(table_t *t, sdb_object_t *obj)
+{
+	size_t i = sdb_hashindex_hash(obj->name) & t->mask;
+
+	while (t->slots[i].obj) {
+		if (t->slots[i].obj == obj)
+			return &t->slots[i];
+		i = (i + 1) & t->mask;
+	}
+	return NULL;
+} /* table_find */
+
+/* Add an object to a table which is known to have a free slot. */
+static void
+table_add(table_t *t, sdb_object_t *obj, uint32_t hash)
+{
+	size_t i = hash & t->mask;
+
+	while (t->slots[i].obj && (t->slots[i].obj != TOMBSTONE))
+		i = (i + 1) & t->mask;
+
+	if (! t->slots[i].obj)
+		++t->used;
+	++t->live;
+
+	__atomic_store_n(&t->slots[i].hash, hash, __ATOMIC_RELAXED);
+	__atomic_store_n(&t->slots[i].obj, obj, __ATOMIC_RELEASE);
+} /* table_add */
+
+/* Make sure there's room for another object, replacing the table by a larger
+ * (or a clean) one if necessary. */
+static int
+index_reserve(sdb_hashindex_t *idx)
+{
+	table_t *t = index_table(idx), *new;
+	size_t size, i;
+
+	if (t && ((t->used + 1) * 4 <= (t->mask + 1) * 3))
+		return 0;
+
+	size = MIN_SIZE;
+	while (t && (size <= 2 * t->live))
+		size *= 2;
+
+	new = table_create(size);
+	if (! new)
+		return -1;
+
+	for (i = 0; t && (i <= t->mask); ++i)
+		if (t->slots[i].obj && (t->slots[i].obj != TOMBSTONE))
+			table_add(new, t->slots[i].obj, t->slots[i].hash);
+
+	__atomic_store_n(&idx->table, new, __ATOMIC_RELEASE);
+	if (t)
+		sdb_epoch_retire(t, table_free);
+	return 0;
+} /* index_reserve */
+
+/*
+ * public API
+ */
+
+uint32_t
+sdb_hashindex_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	/* FNV-1a */
+	for ( ; *name; ++name) {
+		h ^= (uint32_t)tolower((unsigned char)*name);
+		h *= 16777619U;
+	}
+
+	/* mix all bits into the lower ones used to address the table */
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+} /* sdb_hashindex_hash */
+
+sdb_hashindex_t *
+sdb_hashindex_create(void)
+{
+	sdb_hashindex_t *idx;
+
+	idx = malloc(sizeof(*idx));
+	if (! idx)
+		return NULL;
+	idx->table = NULL;
+	return idx;
+} /* sdb_hashindex_create */
+
+void
+sdb_hashindex_destroy(sdb_hashindex_t *idx)
+{
+	if (! idx)
+		return;
+
+	free(idx->table);
+	idx->table = NULL;
+	free(idx);
+} /* sdb_hashindex_destroy */
+
+int
+sdb_hashindex_insert(sdb_hashindex_t *idx, sdb_object_t *obj)
+{
+	if ((! idx) || (! obj) || (! obj->name))
+		return -1;
+
+	if (index_reserve(idx))
+		return -1;
+	table_add(index_table(idx), obj, sdb_hashindex_hash(obj->name));
+	return 0;
+} /* sdb_hashindex_insert */
+
+int
+sdb_hashindex_replace(sdb_hashindex_t *idx,
+		sdb_object_t *old, sdb_object_t *obj)
+{
+	slot_t *slot;
+
+	if ((! idx) || (! old) || (! obj) || (! idx->table))
+		return -1;
+
+	slot = table_find(idx->table, old);
+	if (! slot)
+		return -1;
+
+	/* both objects have the same name, and thus, the same hash */
+	assert(sdb_hashindex_hash(obj->name) == slot->hash);
+	__atomic_store_n(&slot->obj, obj, __ATOMIC_RELEASE);
+	return 0;
+} /* sdb_hashindex_replace */
+
+int
+sdb_hashindex_remove(sdb_hashindex_t *idx, sdb_object_t *obj)
+{
+	slot_t *slot;
+
+	if ((! idx) || (! obj) || (! idx->table))
+		return -1;
+
+	slot = table_find(idx->table, obj);
+	if (! slot)
+		return -1;
+
+	__atomic_store_n(&slot->obj, TOMBSTONE, __ATOMIC_RELEASE);
+	--idx->table->live;
+	return 0;
+} /* sdb_hashindex_remove */
+
+sdb_object_t *
+sdb_hashindex_lookup(sdb_hashindex_t *idx, const char *name)
+{
+	uint32_t hash;
+	table_t *t;
+	size_t i;
+
+	if ((! idx) || (! name))
+		return NULL;
+
+	t = index_table(idx);
+	if (! t)
+		return NULL;
+
+	hash = sdb_hashindex_hash(name);
+	for (i = hash & t->mask; ; i = (i + 1) & t->mask) {
+		sdb_object_t *obj = __atomic_load_n(&t->slots[i].obj,
+				__ATOMIC_ACQUIRE);
+
+		if (! obj)
+			return NULL;
+		if ((obj != TOMBSTONE)
+				&& (__atomic_load_n(&t->slots[i].hash,
+						__ATOMIC_RELAXED) == hash)
+				&& ((obj->name == name) || (! strcasecmp(obj->name, name))))
+			return obj;
+	}
+	return NULL;
+} /* sdb_hashindex_lookup */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,227 @@
+/*
+ * SysDB - src/utils/intern.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The string table is split into a number of segments, each of which is a
+ * separately locked, chained hash table. Reference counts are only modified
+ * while holding the segment's lock, such that a string may not be looked up
+ * while it's being removed.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "utils/intern.h"
+#include "utils/error.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+/*
+ * private data types
+ */
+
+#define INTERN_SEGMENTS 64
+#define INTERN_MIN_BUCKETS 64
+
+typedef struct entry entry_t;
+struct entry {
+	entry_t *next;
+	uint32_t hash;
+	int ref_cnt;
+	char str[];
+};
+
+typedef struct {
+	entry_t **buckets;
+	size_t buckets_num;
+	size_t entries_num;
+	pthread_mutex_t lock;
+} segment_t;
+
+static segment_t segments[INTERN_SEGMENTS];
+static pthread_once_t segments_once = PTHREAD_ONCE_INIT;
+
+/*
+ * private helper functions
+ */
+
+static void
+segments_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < INTERN_SEGMENTS; ++i)
+		pthread_mutex_init(&segments[i].lock, NULL);
+} /* segments_init */
+
+/* FNV-1a */
+static uint32_t
+hash_string(const char *str)
+{
+	uint32_t h = 2166136261U;
+
+	for ( ; *str; ++str) {
+		h ^= (uint32_t)(unsigned char)*str;
+		h *= 16777619U;
+	}
+	return h;
+} /* hash_string */
+
+#define SEGMENT(h) (segments + ((h) % INTERN_SEGMENTS))
+#define BUCKET(seg, h) \
+	((seg)->buckets + (((h) / INTERN_SEGMENTS) & ((seg)->buckets_num - 1)))
+
+/* The segment's lock has to be acquired before calling this function. */
+static int
+segment_grow(segment_t *seg)
+{
+	entry_t **buckets;
+	size_t num, i;
+
+	num = seg->buckets_num ? 2 * seg->buckets_num : INTERN_MIN_BUCKETS;
+	buckets = calloc(num, sizeof(*buckets));
+	if (! buckets)
+		return -1;
+
+	for (i = 0; i < seg->buckets_num; ++i) {
+		entry_t *e = seg->buckets[i];
+
+		while (e) {
+			entry_t *next = e->next;
+			entry_t **b = buckets + ((e->hash / INTERN_SEGMENTS) & (num - 1));
+
+			e->next = *b;
+			*b = e;
+			e = next;
+		}
+	}
+
+	free(seg->buckets);
+	seg->buckets = buckets;
+	seg->buckets_num = num;
+	return 0;
+} /* segment_grow */
+
+/*
+ * public API
+ */
+
+char *
+sdb_intern(const char *str)
+{
+	segment_t *seg;
+	entry_t *e;
+	uint32_t h;
+	size_t len;
+
+	if (! str)
+		return NULL;
+
+	pthread_once(&segments_once, segments_init);
+
+	h = hash_string(str);
+	seg = SEGMENT(h);
+
+	pthread_mutex_lock(&seg->lock);
+	if (seg->buckets_num) {
+		for (e = *BUCKET(seg, h); e; e = e->next) {
+			if ((e->hash == h) && (! strcmp(e->str, str))) {
+				++e->ref_cnt;
+				pthread_mutex_unlock(&seg->lock);
+				return e->str;
+			}
+		}
+	}
+
+	if ((seg->entries_num >= seg->buckets_num) && segment_grow(seg)
+			&& (! seg->buckets_num)) {
+		pthread_mutex_unlock(&seg->lock);
+		return NULL;
+	}
+
+	len = strlen(str);
+	e = malloc(sizeof(*e) + len + 1);
+	if (! e) {
+		pthread_mutex_unlock(&seg->lock);
+		return NULL;
+	}
+	memcpy(e->str, str, len + 1);
+	e->hash = h;
+	e->ref_cnt = 1;
+
+	e->next = *BUCKET(seg, h);
+	*BUCKET(seg, h) = e;
+	++seg->entries_num;
+	pthread_mutex_unlock(&seg->lock);
+	return e->str;
+} /* sdb_intern */
+
+void
+sdb_intern_release(char *str)
+{
+	segment_t *seg;
+	entry_t **e;
+	uint32_t h;
+
+	if (! str)
+		return;
+
+	pthread_once(&segments_once, segments_init);
+
+	/* don't access the entry before making sure that this is actually an
+	 * interned string */
+	h = hash_string(str);
+	seg = SEGMENT(h);
+
+	pthread_mutex_lock(&seg->lock);
+	e = seg->buckets_num ? BUCKET(seg, h) : NULL;
+	while (e && *e && ((*e)->str != str))
+		e = &(*e)->next;
+
+	if ((! e) || (! *e)) {
+		pthread_mutex_unlock(&seg->lock);
+		sdb_log(SDB_LOG_ERR, "intern: Attempted to release "
+				"unknown string '%s'", str);
+		return;
+	}
+
+	if (--(*e)->ref_cnt <= 0) {
+		entry_t *tmp = *e;
+		*e = tmp->next;
+		--seg->entries_num;
+		free(tmp);
+	}
+	pthread_mutex_unlock(&seg->lock);
+} /* sdb_intern_release */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
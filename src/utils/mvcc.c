@@ -0,0 +1,314 @@
+/*
+ * SysDB - src/utils/mvcc.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Versions are taken from a global counter which is only advanced when
+ * taking a snapshot. Writers tag each previous value they keep with the
+ * version current at the time it was replaced, so a snapshot sees the oldest
+ * value replaced after it was taken or, if there is none, the current value.
+ *
+ * For that to be consistent, every update has to be published completely
+ * either before or after a snapshot is taken. Writers hold the read side of
+ * one of several reader-writer locks while publishing and snapshots acquire
+ * the write side of all of them. Since snapshots are rare compared to
+ * updates, writers hardly ever wait for each other that way.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "utils/mvcc.h"
+#include "utils/epoch.h"
+#include "utils/error.h"
+
+#include <assert.h>
+
+#include <stdlib.h>
+
+#include <pthread.h>
+
+/*
+ * private data types
+ */
+
+struct sdb_mvcc_version {
+	void *ptr;
+	size_t aux;
+	/* the version which was current when the value was replaced */
+	uint64_t replaced;
+	/* accessed atomically */
+	sdb_mvcc_version_t *next;
+};
+
+typedef struct snapshot snapshot_t;
+struct snapshot {
+	/* accessed atomically by the owning thread */
+	uint64_t version;
+	/* only accessed by the owning thread */
+	unsigned int nesting;
+
+	/* protected by snapshots_lock */
+	snapshot_t *prev;
+	snapshot_t *next;
+};
+
+#define MVCC_STRIPES 16
+
+typedef struct {
+	pthread_rwlock_t lock;
+} __attribute__((aligned(64))) stripe_t;
+
+/*
+ * private variables
+ */
+
+static stripe_t stripes[MVCC_STRIPES];
+static pthread_once_t stripes_once = PTHREAD_ONCE_INIT;
+static unsigned int stripes_next = 0;
+
+/* the version pinned by the next snapshot; only modified while holding all
+ * stripe locks */
+static uint64_t current_version = 1;
+
+/* the oldest version pinned by any snapshot or zero; only modified while
+ * holding all stripe locks or when releasing a snapshot */
+static uint64_t oldest_version = 0;
+
+static snapshot_t *snapshots = NULL;
+static pthread_mutex_t snapshots_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread snapshot_t thread_snapshot;
+static __thread stripe_t *thread_stripe = NULL;
+
+/*
+ * private helper functions
+ */
+
+static void
+stripes_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < MVCC_STRIPES; ++i)
+		pthread_rwlock_init(&stripes[i].lock, /* attr = */ NULL);
+} /* stripes_init */
+
+static stripe_t *
+stripe_get(void)
+{
+	unsigned int i;
+
+	if (thread_stripe)
+		return thread_stripe;
+
+	pthread_once(&stripes_once, stripes_init);
+	i = __atomic_fetch_add(&stripes_next, 1, __ATOMIC_RELAXED);
+	thread_stripe = stripes + (i % MVCC_STRIPES);
+	return thread_stripe;
+} /* stripe_get */
+
+/* The snapshots_lock has to be acquired before calling this function. */
+static void
+oldest_update(void)
+{
+	uint64_t oldest = 0;
+	snapshot_t *s;
+
+	for (s = snapshots; s; s = s->next)
+		if ((! oldest) || (s->version < oldest))
+			oldest = s->version;
+	__atomic_store_n(&oldest_version, oldest, __ATOMIC_SEQ_CST);
+} /* oldest_update */
+
+static void
+versions_destroy(void *p)
+{
+	sdb_mvcc_version_t *v = p;
+
+	while (v) {
+		sdb_mvcc_version_t *next = v->next;
+		free(v);
+		v = next;
+	}
+} /* versions_destroy */
+
+/*
+ * public API
+ */
+
+void
+sdb_mvcc_snapshot_begin(void)
+{
+	snapshot_t *s = &thread_snapshot;
+	size_t i;
+
+	if (s->nesting++)
+		return;
+
+	/* pin all data visible in the snapshot before determining its version */
+	sdb_epoch_enter();
+
+	pthread_once(&stripes_once, stripes_init);
+	for (i = 0; i < MVCC_STRIPES; ++i)
+		pthread_rwlock_wrlock(&stripes[i].lock);
+
+	__atomic_store_n(&s->version, current_version, __ATOMIC_RELAXED);
+	++current_version;
+
+	pthread_mutex_lock(&snapshots_lock);
+	s->prev = NULL;
+	s->next = snapshots;
+	if (snapshots)
+		snapshots->prev = s;
+	snapshots = s;
+	oldest_update();
+	pthread_mutex_unlock(&snapshots_lock);
+
+	for (i = 0; i < MVCC_STRIPES; ++i)
+		pthread_rwlock_unlock(&stripes[i].lock);
+} /* sdb_mvcc_snapshot_begin */
+
+void
+sdb_mvcc_snapshot_end(void)
+{
+	snapshot_t *s = &thread_snapshot;
+
+	assert(s->nesting > 0);
+	if (--s->nesting)
+		return;
+
+	pthread_mutex_lock(&snapshots_lock);
+	if (s->prev)
+		s->prev->next = s->next;
+	else
+		snapshots = s->next;
+	if (s->next)
+		s->next->prev = s->prev;
+	s->prev = s->next = NULL;
+	oldest_update();
+	pthread_mutex_unlock(&snapshots_lock);
+
+	__atomic_store_n(&s->version, 0, __ATOMIC_RELAXED);
+	sdb_epoch_exit();
+} /* sdb_mvcc_snapshot_end */
+
+uint64_t
+sdb_mvcc_snapshot_version(void)
+{
+	return thread_snapshot.version;
+} /* sdb_mvcc_snapshot_version */
+
+void *
+sdb_mvcc_load(sdb_mvcc_ptr_t *p, size_t *aux)
+{
+	uint64_t view = thread_snapshot.version;
+	sdb_mvcc_version_t *v;
+	void *ptr;
+
+	if (! p)
+		return NULL;
+
+	ptr = __atomic_load_n(&p->ptr, __ATOMIC_ACQUIRE);
+	if (! view)
+		return ptr;
+
+	/* previous values are published before the new one, so any value
+	 * replaced after the snapshot was taken is found here */
+	for (v = __atomic_load_n(&p->old, __ATOMIC_ACQUIRE); v;
+			v = __atomic_load_n(&v->next, __ATOMIC_ACQUIRE)) {
+		if (v->replaced <= view)
+			break;
+		ptr = v->ptr;
+		if (aux)
+			*aux = v->aux;
+	}
+	return ptr;
+} /* sdb_mvcc_load */
+
+void
+sdb_mvcc_store(sdb_mvcc_ptr_t *p, void *ptr, size_t old_aux)
+{
+	sdb_mvcc_version_t *v = NULL, *dead = NULL;
+	sdb_mvcc_version_t **link;
+	stripe_t *stripe = stripe_get();
+	uint64_t oldest, replaced;
+
+	assert(p);
+
+	pthread_rwlock_rdlock(&stripe->lock);
+	oldest = __atomic_load_n(&oldest_version, __ATOMIC_SEQ_CST);
+	if (oldest) {
+		/* drop all values which were replaced before the oldest snapshot
+		 * was taken; nobody will access them any longer */
+		for (link = &p->old; *link; link = &(*link)->next) {
+			if ((*link)->replaced <= oldest) {
+				dead = *link;
+				__atomic_store_n(link, NULL, __ATOMIC_RELEASE);
+				break;
+			}
+		}
+
+		/* the calling thread's own snapshot sees its own updates */
+		replaced = thread_snapshot.version;
+		if (! replaced)
+			replaced = __atomic_load_n(&current_version, __ATOMIC_RELAXED);
+
+		v = malloc(sizeof(*v));
+		if (v) {
+			v->ptr = p->ptr;
+			v->aux = old_aux;
+			v->replaced = replaced;
+			v->next = p->old;
+			__atomic_store_n(&p->old, v, __ATOMIC_RELEASE);
+		}
+		else
+			sdb_log(SDB_LOG_ERR, "mvcc: Failed to allocate memory; "
+					"snapshots may observe concurrent updates");
+	}
+	else {
+		dead = p->old;
+		__atomic_store_n(&p->old, NULL, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&p->ptr, ptr, __ATOMIC_RELEASE);
+	pthread_rwlock_unlock(&stripe->lock);
+
+	/* readers may still be walking the list */
+	if (dead)
+		sdb_epoch_retire(dead, versions_destroy);
+} /* sdb_mvcc_store */
+
+void
+sdb_mvcc_clear(sdb_mvcc_ptr_t *p)
+{
+	if (! p)
+		return;
+	versions_destroy(p->old);
+	p->old = NULL;
+} /* sdb_mvcc_clear */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
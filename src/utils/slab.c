@@ -0,0 +1,271 @@
+/*
+ * SysDB - src/utils/slab.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Size classes are multiples of SLAB_ALIGN. Each class manages a global list
+ * of free blocks and the unused remainder of the chunk it allocated most
+ * recently, both protected by the class's lock. Threads move blocks between
+ * their own cache and the global list in batches of SLAB_BATCH blocks.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "utils/slab.h"
+
+#include <assert.h>
+
+#include <stdlib.h>
+
+#include <pthread.h>
+
+/*
+ * private data types
+ */
+
+#define SLAB_ALIGN 16
+#define SLAB_CLASSES (SDB_SLAB_MAX_SIZE / SLAB_ALIGN)
+#define SLAB_CHUNK_SIZE (64 * 1024)
+#define SLAB_BATCH 64
+
+typedef struct slab_block slab_block_t;
+struct slab_block {
+	slab_block_t *next;
+};
+
+typedef struct {
+	slab_block_t *free;
+
+	/* unused space of the most recently allocated chunk */
+	char *chunk;
+	size_t chunk_len;
+
+	pthread_mutex_t lock;
+} slab_class_t;
+
+typedef struct {
+	slab_block_t *free[SLAB_CLASSES];
+	size_t free_num[SLAB_CLASSES];
+} slab_cache_t;
+
+/*
+ * private variables
+ */
+
+static slab_class_t classes[SLAB_CLASSES];
+static pthread_once_t classes_once = PTHREAD_ONCE_INIT;
+
+static pthread_key_t cache_key;
+static __thread slab_cache_t *thread_cache = NULL;
+
+/*
+ * private helper functions
+ */
+
+/* Move up to 'n' blocks from the cache back to the class's list. */
+static void
+cache_flush(slab_cache_t *cache, size_t c, size_t n)
+{
+	slab_block_t *head, *tail;
+	size_t i;
+
+	if (! cache->free[c])
+		return;
+
+	head = tail = cache->free[c];
+	for (i = 1; (i < n) && tail->next; ++i)
+		tail = tail->next;
+	cache->free[c] = tail->next;
+	cache->free_num[c] -= i;
+
+	pthread_mutex_lock(&classes[c].lock);
+	tail->next = classes[c].free;
+	classes[c].free = head;
+	pthread_mutex_unlock(&classes[c].lock);
+} /* cache_flush */
+
+static void
+cache_destroy(void *p)
+{
+	slab_cache_t *cache = p;
+	size_t c;
+
+	if (! cache)
+		return;
+
+	for (c = 0; c < SLAB_CLASSES; ++c)
+		cache_flush(cache, c, cache->free_num[c]);
+	free(cache);
+
+	/* other destructors might still release memory */
+	if (thread_cache == cache)
+		thread_cache = NULL;
+} /* cache_destroy */
+
+static void
+classes_init(void)
+{
+	size_t c;
+
+	for (c = 0; c < SLAB_CLASSES; ++c)
+		pthread_mutex_init(&classes[c].lock, /* attr = */ NULL);
+	pthread_key_create(&cache_key, cache_destroy);
+} /* classes_init */
+
+static slab_cache_t *
+cache_get(void)
+{
+	if (thread_cache)
+		return thread_cache;
+
+	pthread_once(&classes_once, classes_init);
+	thread_cache = calloc(1, sizeof(*thread_cache));
+	if (thread_cache)
+		pthread_setspecific(cache_key, thread_cache);
+	return thread_cache;
+} /* cache_get */
+
+/* Fetch a batch of blocks from the class's list or carve them from a chunk.
+ * The class's lock has to be acquired before calling this function. */
+static slab_block_t *
+class_fetch(slab_class_t *class, size_t size, size_t *n)
+{
+	slab_block_t *head = class->free;
+	slab_block_t *tail = NULL;
+	size_t i;
+
+	for (i = 0; (i < *n) && class->free; ++i) {
+		tail = class->free;
+		class->free = tail->next;
+	}
+
+	for ( ; i < *n; ++i) {
+		slab_block_t *b;
+
+		if (class->chunk_len < size) {
+			/* the remainder of the previous chunk is lost (but it's
+			 * smaller than a single block anyway) */
+			class->chunk = malloc(SLAB_CHUNK_SIZE);
+			if (! class->chunk) {
+				class->chunk_len = 0;
+				break;
+			}
+			class->chunk_len = SLAB_CHUNK_SIZE;
+		}
+
+		b = (slab_block_t *)class->chunk;
+		class->chunk += size;
+		class->chunk_len -= size;
+
+		if (tail)
+			tail->next = b;
+		else
+			head = b;
+		tail = b;
+	}
+
+	if (tail)
+		tail->next = NULL;
+	else
+		head = NULL;
+	*n = i;
+	return head;
+} /* class_fetch */
+
+/*
+ * public API
+ */
+
+void *
+sdb_slab_alloc(size_t size)
+{
+	slab_cache_t *cache;
+	slab_block_t *b;
+	size_t c, n;
+
+	if ((! size) || (size > SDB_SLAB_MAX_SIZE))
+		return malloc(size);
+
+	c = (size - 1) / SLAB_ALIGN;
+	size = (c + 1) * SLAB_ALIGN;
+
+	cache = cache_get();
+	if (cache && cache->free[c]) {
+		b = cache->free[c];
+		cache->free[c] = b->next;
+		--cache->free_num[c];
+		return b;
+	}
+
+	pthread_once(&classes_once, classes_init);
+	n = cache ? SLAB_BATCH : 1;
+	pthread_mutex_lock(&classes[c].lock);
+	b = class_fetch(&classes[c], size, &n);
+	pthread_mutex_unlock(&classes[c].lock);
+	if (! b)
+		return NULL;
+
+	/* keep the remaining blocks for later */
+	if (cache) {
+		cache->free[c] = b->next;
+		cache->free_num[c] = n - 1;
+	}
+	return b;
+} /* sdb_slab_alloc */
+
+void
+sdb_slab_free(void *ptr, size_t size)
+{
+	slab_cache_t *cache;
+	slab_block_t *b = ptr;
+	size_t c;
+
+	if ((! ptr) || (! size) || (size > SDB_SLAB_MAX_SIZE)) {
+		free(ptr);
+		return;
+	}
+
+	c = (size - 1) / SLAB_ALIGN;
+
+	cache = cache_get();
+	if (! cache) {
+		pthread_mutex_lock(&classes[c].lock);
+		b->next = classes[c].free;
+		classes[c].free = b;
+		pthread_mutex_unlock(&classes[c].lock);
+		return;
+	}
+
+	b->next = cache->free[c];
+	cache->free[c] = b;
+	++cache->free_num[c];
+	if (cache->free_num[c] > 2 * SLAB_BATCH)
+		cache_flush(cache, c, SLAB_BATCH);
+} /* sdb_slab_free */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
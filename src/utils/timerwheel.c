@@ -0,0 +1,285 @@
+/*
+ * SysDB - src/utils/timerwheel.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module implements a hierarchical timer wheel as described by Varghese
+ * and Lauck ("Hashed and Hierarchical Timing Wheels", 1987): level 'l' has
+ * WHEEL_SLOTS slots, each covering WHEEL_SLOTS^l ticks. Whenever the lower
+ * levels complete a turn, the timers of the next slot of the level above are
+ * redistributed to the lower levels. Timers further in the future than the
+ * wheel is able to represent are put into the last slot of the highest level
+ * and re-added once they reach the bottom of the wheel.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "utils/timerwheel.h"
+
+#include <assert.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+
+/*
+ * private data types
+ */
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+
+typedef struct wheel_timer wheel_timer_t;
+struct wheel_timer {
+	sdb_object_t *obj;
+	uint64_t tick;
+	wheel_timer_t *next;
+};
+
+struct sdb_timerwheel {
+	pthread_mutex_t lock;
+
+	sdb_time_t resolution;
+	/* the last tick that has been processed */
+	uint64_t current;
+
+	wheel_timer_t *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+	/* timers which are due already */
+	wheel_timer_t *due;
+	size_t size;
+};
+
+/*
+ * private helper functions
+ */
+
+static void
+timers_destroy(wheel_timer_t *t)
+{
+	while (t) {
+		wheel_timer_t *next = t->next;
+		sdb_object_deref(t->obj);
+		free(t);
+		t = next;
+	}
+} /* timers_destroy */
+
+/* Insert a timer into the slot responsible for its tick relative to the
+ * current tick. */
+static void
+wheel_insert(sdb_timerwheel_t *wheel, wheel_timer_t *t)
+{
+	uint64_t delta, tick = t->tick;
+	wheel_timer_t **slot;
+	int level;
+
+	if (tick <= wheel->current) {
+		t->next = wheel->due;
+		wheel->due = t;
+		return;
+	}
+
+	delta = tick - wheel->current;
+	for (level = 0; level < WHEEL_LEVELS - 1; ++level)
+		if (delta < ((uint64_t)1 << (WHEEL_BITS * (level + 1))))
+			break;
+
+	if (delta >= ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)))
+		/* the farthest slot; the timer will be re-added from there */
+		tick = wheel->current
+			+ ((uint64_t)WHEEL_MASK << (WHEEL_BITS * level));
+
+	slot = &wheel->slots[level][(tick >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	t->next = *slot;
+	*slot = t;
+} /* wheel_insert */
+
+/* Redistribute all timers of the specified slot. */
+static void
+wheel_cascade(sdb_timerwheel_t *wheel, int level, size_t idx)
+{
+	wheel_timer_t *t = wheel->slots[level][idx];
+
+	wheel->slots[level][idx] = NULL;
+	while (t) {
+		wheel_timer_t *next = t->next;
+		wheel_insert(wheel, t);
+		t = next;
+	}
+} /* wheel_cascade */
+
+/* Advance the wheel by a single tick. */
+static void
+wheel_tick(sdb_timerwheel_t *wheel)
+{
+	int level;
+
+	++wheel->current;
+
+	/* determine the highest level that completed a turn ... */
+	for (level = 0; level < WHEEL_LEVELS - 1; ++level)
+		if ((wheel->current >> (WHEEL_BITS * level)) & WHEEL_MASK)
+			break;
+
+	/* ... and cascade from there, such that redistributed timers may be
+	 * cascaded further in the same step */
+	for ( ; level > 0; --level)
+		wheel_cascade(wheel, level,
+				(wheel->current >> (WHEEL_BITS * level)) & WHEEL_MASK);
+
+	wheel_cascade(wheel, 0, wheel->current & WHEEL_MASK);
+} /* wheel_tick */
+
+/*
+ * public API
+ */
+
+sdb_timerwheel_t *
+sdb_timerwheel_create(sdb_time_t resolution, sdb_time_t now)
+{
+	sdb_timerwheel_t *wheel;
+
+	if (! resolution)
+		return NULL;
+
+	wheel = calloc(1, sizeof(*wheel));
+	if (! wheel)
+		return NULL;
+
+	pthread_mutex_init(&wheel->lock, /* attr = */ NULL);
+	wheel->resolution = resolution;
+	wheel->current = now / resolution;
+	return wheel;
+} /* sdb_timerwheel_create */
+
+void
+sdb_timerwheel_destroy(sdb_timerwheel_t *wheel)
+{
+	int level, i;
+
+	if (! wheel)
+		return;
+
+	for (level = 0; level < WHEEL_LEVELS; ++level)
+		for (i = 0; i < WHEEL_SLOTS; ++i)
+			timers_destroy(wheel->slots[level][i]);
+	timers_destroy(wheel->due);
+
+	pthread_mutex_destroy(&wheel->lock);
+	free(wheel);
+} /* sdb_timerwheel_destroy */
+
+int
+sdb_timerwheel_add(sdb_timerwheel_t *wheel, sdb_object_t *obj,
+		sdb_time_t expires)
+{
+	wheel_timer_t *t;
+
+	if ((! wheel) || (! obj))
+		return -1;
+
+	t = malloc(sizeof(*t));
+	if (! t)
+		return -1;
+
+	sdb_object_ref(obj);
+	t->obj = obj;
+	t->tick = expires / wheel->resolution;
+
+	pthread_mutex_lock(&wheel->lock);
+	wheel_insert(wheel, t);
+	++wheel->size;
+	pthread_mutex_unlock(&wheel->lock);
+	return 0;
+} /* sdb_timerwheel_add */
+
+int
+sdb_timerwheel_advance(sdb_timerwheel_t *wheel, sdb_time_t now,
+		sdb_llist_t *expired)
+{
+	uint64_t target;
+	wheel_timer_t *t;
+	int n = 0;
+
+	if ((! wheel) || (! expired))
+		return -1;
+
+	target = now / wheel->resolution;
+
+	pthread_mutex_lock(&wheel->lock);
+	if (! wheel->size) {
+		/* nothing to do; skip over all intermediate ticks */
+		if (target > wheel->current)
+			wheel->current = target;
+	}
+	while ((wheel->current < target) && wheel->size) {
+		/* timers are collected in 'due' */
+		wheel_tick(wheel);
+	}
+
+	t = wheel->due;
+	wheel->due = NULL;
+	while (t) {
+		wheel_timer_t *next = t->next;
+
+		if (sdb_llist_append(expired, t->obj)) {
+			/* retry with the next call */
+			t->next = wheel->due;
+			wheel->due = t;
+			t = next;
+			continue;
+		}
+
+		sdb_object_deref(t->obj);
+		free(t);
+		--wheel->size;
+		++n;
+		t = next;
+	}
+	pthread_mutex_unlock(&wheel->lock);
+	return n;
+} /* sdb_timerwheel_advance */
+
+size_t
+sdb_timerwheel_size(sdb_timerwheel_t *wheel)
+{
+	size_t size;
+
+	if (! wheel)
+		return 0;
+
+	pthread_mutex_lock(&wheel->lock);
+	size = wheel->size;
+	pthread_mutex_unlock(&wheel->lock);
+	return size;
+} /* sdb_timerwheel_size */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
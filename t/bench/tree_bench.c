@@ -0,0 +1,218 @@
+/*
+ * SysDB - t/bench/tree_bench.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Compare the performance of the AVL tree and the B-tree (see utils/avltree.h
+ * and utils/btree.h) when used as a name index.
+ *
+ * Usage: tree_bench [<number of objects> [<lookup rounds>]]
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "sysdb.h"
+#include "utils/avltree.h"
+#include "utils/btree.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+	const char *name;
+
+	void *(*create)(void);
+	void (*destroy)(void *);
+	int (*insert)(void *, sdb_object_t *);
+	int (*remove)(void *, const char *);
+	sdb_object_t *(*lookup)(void *, const char *);
+	void *(*get_iter)(void *);
+	void (*iter_destroy)(void *);
+	sdb_object_t *(*iter_get_next)(void *);
+} tree_impl_t;
+
+/* wrap each implementation's functions to provide a common interface */
+#define IMPL(prefix) \
+	static void *prefix##_create_w(void) \
+	{ return prefix##_create(); } \
+	static void prefix##_destroy_w(void *t) \
+	{ prefix##_destroy(t); } \
+	static int prefix##_insert_w(void *t, sdb_object_t *obj) \
+	{ return prefix##_insert(t, obj); } \
+	static int prefix##_remove_w(void *t, const char *name) \
+	{ return prefix##_remove(t, name); } \
+	static sdb_object_t *prefix##_lookup_w(void *t, const char *name) \
+	{ return prefix##_lookup(t, name); } \
+	static void *prefix##_get_iter_w(void *t) \
+	{ return prefix##_get_iter(t); } \
+	static void prefix##_iter_destroy_w(void *iter) \
+	{ prefix##_iter_destroy(iter); } \
+	static sdb_object_t *prefix##_iter_get_next_w(void *iter) \
+	{ return prefix##_iter_get_next(iter); }
+#define IMPL_INIT(name, prefix) { \
+		name, prefix##_create_w, prefix##_destroy_w, prefix##_insert_w, \
+		prefix##_remove_w, prefix##_lookup_w, prefix##_get_iter_w, \
+		prefix##_iter_destroy_w, prefix##_iter_get_next_w, \
+	}
+
+IMPL(sdb_avltree)
+IMPL(sdb_btree)
+
+static tree_impl_t impls[] = {
+	IMPL_INIT("AVL tree", sdb_avltree),
+	IMPL_INIT("B-tree", sdb_btree),
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+} /* now */
+
+static void
+report(const char *impl, const char *op, double secs, size_t n)
+{
+	printf("%-10s %-8s %10.3f ms %10.1f ns/op\n",
+			impl, op, secs * 1e3, secs * 1e9 / (double)n);
+} /* report */
+
+/* Fisher-Yates shuffle using a fixed seed for reproducible results */
+static void
+shuffle(char **names, size_t n)
+{
+	size_t i;
+
+	srand(42);
+	for (i = n - 1; i > 0; --i) {
+		size_t j = (size_t)rand() % (i + 1);
+		char *tmp = names[i];
+		names[i] = names[j];
+		names[j] = tmp;
+	}
+} /* shuffle */
+
+int
+main(int argc, char **argv)
+{
+	size_t num = 40000, rounds = 10;
+	sdb_object_t **objs;
+	char **names;
+	size_t i, j;
+
+	if (argc > 1)
+		num = (size_t)strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		rounds = (size_t)strtoul(argv[2], NULL, 10);
+	if ((! num) || (! rounds) || (argc > 3)) {
+		fprintf(stderr, "Usage: %s [<number of objects> [<lookup rounds>]]\n",
+				argv[0]);
+		return 1;
+	}
+
+	objs = calloc(num, sizeof(*objs));
+	names = calloc(num, sizeof(*names));
+	if ((! objs) || (! names)) {
+		fprintf(stderr, "Failed to allocate memory: %s\n", strerror(errno));
+		return 1;
+	}
+
+	for (i = 0; i < num; ++i) {
+		char name[64];
+
+		/* host names of a typical setup sharing common prefixes */
+		snprintf(name, sizeof(name), "host%zu.rack%zu.example.com",
+				i, i % 64);
+		objs[i] = sdb_object_create_simple(name, sizeof(sdb_object_t),
+				/* destructor = */ NULL);
+		/* lookups use names which are not identical to the interned ones
+		 * (like names parsed from a query) */
+		names[i] = strdup(name);
+		if ((! objs[i]) || (! names[i])) {
+			fprintf(stderr, "Failed to create objects\n");
+			return 1;
+		}
+	}
+	shuffle(names, num);
+
+	printf("%zu objects, %zu lookup rounds\n\n", num, rounds);
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(impls); ++i) {
+		tree_impl_t *impl = &impls[i];
+		void *tree, *iter;
+		size_t found = 0;
+		double start;
+
+		tree = impl->create();
+
+		start = now();
+		for (j = 0; j < num; ++j)
+			impl->insert(tree, objs[(j * 7919) % num]);
+		report(impl->name, "insert", now() - start, num);
+
+		start = now();
+		for (j = 0; j < rounds * num; ++j) {
+			sdb_object_t *obj = impl->lookup(tree, names[j % num]);
+			if (obj)
+				++found;
+			sdb_object_deref(obj);
+		}
+		report(impl->name, "lookup", now() - start, rounds * num);
+		if (found != rounds * num)
+			fprintf(stderr, "%s: found %zu objects; expected: %zu\n",
+					impl->name, found, rounds * num);
+
+		start = now();
+		iter = impl->get_iter(tree);
+		for (j = 0; impl->iter_get_next(iter); ++j)
+			/* nothing to do */;
+		impl->iter_destroy(iter);
+		report(impl->name, "iterate", now() - start, num);
+
+		start = now();
+		for (j = 0; j < num; ++j)
+			impl->remove(tree, names[j]);
+		report(impl->name, "remove", now() - start, num);
+
+		impl->destroy(tree);
+		printf("\n");
+	}
+
+	for (i = 0; i < num; ++i) {
+		sdb_object_deref(objs[i]);
+		free(names[i]);
+	}
+	free(objs);
+	free(names);
+	return 0;
+} /* main */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
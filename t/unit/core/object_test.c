@@ -33,6 +33,7 @@
 #include "testutils.h"
 
 #include <check.h>
+#include <pthread.h>
 
 /*
  * private data types
@@ -293,6 +294,58 @@ START_TEST(test_obj_ref)
 }
 END_TEST
 
+#define REF_THREADS 4
+#define REF_ITERATIONS 100000
+
+static void *
+ref_deref(void *arg)
+{
+	sdb_object_t *obj = arg;
+	int i;
+
+	for (i = 0; i < REF_ITERATIONS; ++i) {
+		sdb_object_ref(obj);
+		sdb_object_ref(obj);
+		sdb_object_deref(obj);
+		sdb_object_deref(obj);
+	}
+	return NULL;
+} /* ref_deref */
+
+START_TEST(test_obj_ref_threads)
+{
+	pthread_t threads[REF_THREADS];
+	sdb_object_t *obj;
+	size_t i;
+
+	init_noop_called = 0;
+	init_noop_retval = 0;
+	destroy_noop_called = 0;
+
+	obj = sdb_object_create("test-object", noop_type);
+	fail_unless(obj != NULL,
+			"sdb_object_create() = NULL; expected: valid object");
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(threads); ++i)
+		fail_unless(! pthread_create(&threads[i], NULL, ref_deref, obj),
+				"INTERNAL ERROR: failed to create thread");
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(threads); ++i)
+		pthread_join(threads[i], NULL);
+
+	fail_unless(obj->ref_cnt == 1,
+			"after concurrent sdb_object_{de,}ref(): obj->ref_cnt = %d; "
+			"expected: 1", obj->ref_cnt);
+	fail_unless(destroy_noop_called == 0,
+			"after concurrent sdb_object_{de,}ref(): object's destroy "
+			"called %d times; expected: 0", destroy_noop_called);
+
+	sdb_object_deref(obj);
+	fail_unless(destroy_noop_called == 1,
+			"after final sdb_object_deref(): object's destroy called "
+			"%d times; expected: 1", destroy_noop_called);
+}
+END_TEST
+
 START_TEST(test_obj_cmp)
 {
 	sdb_object_t *obj1, *obj2, *obj3, *obj4;
@@ -329,6 +382,7 @@ TEST_MAIN("core::object")
 	tcase_add_test(tc, test_obj_create);
 	tcase_add_test(tc, test_obj_wrapper);
 	tcase_add_test(tc, test_obj_ref);
+	tcase_add_test(tc, test_obj_ref_threads);
 	tcase_add_test(tc, test_obj_cmp);
 	ADD_TCASE(tc);
 }
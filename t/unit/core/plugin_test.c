@@ -0,0 +1,220 @@
+/*
+ * SysDB - t/unit/core/plugin_test.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/plugin.h"
+#include "testutils.h"
+
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SECOND SECS_TO_SDB_TIME(1)
+
+static int cname_calls = 0;
+
+/* canonicalize "hostN" to "hostN.example.com" */
+static char *
+test_cname(const char *name, sdb_object_t __attribute__((unused)) *ud)
+{
+	char buf[1024];
+
+	__atomic_add_fetch(&cname_calls, 1, __ATOMIC_RELAXED);
+	if (strncmp(name, "host", 4) || strchr(name, '.'))
+		return NULL;
+	snprintf(buf, sizeof(buf), "%s.example.com", name);
+	return strdup(buf);
+} /* test_cname */
+
+static void
+setup(void)
+{
+	cname_calls = 0;
+	sdb_plugin_set_cname_cache(16, 300 * SECOND, 60 * SECOND);
+	sdb_plugin_register_cname("test", test_cname, NULL);
+} /* setup */
+
+static void
+teardown(void)
+{
+	sdb_plugin_unregister_all();
+} /* teardown */
+
+static void
+check_cname(const char *name, const char *expected)
+{
+	char *cname = sdb_plugin_cname(strdup(name));
+
+	fail_unless(cname != NULL,
+			"sdb_plugin_cname(%s) = NULL; expected: %s", name, expected);
+	fail_unless(! strcmp(cname, expected),
+			"sdb_plugin_cname(%s) = %s; expected: %s",
+			name, cname, expected);
+	free(cname);
+} /* check_cname */
+
+START_TEST(test_cname_cache)
+{
+	int i;
+
+	for (i = 0; i < 3; ++i) {
+		check_cname("host1", "host1.example.com");
+		fail_unless(cname_calls == 1,
+				"sdb_plugin_cname(host1) invoked callbacks %d times; "
+				"expected: 1 (cached)", cname_calls);
+	}
+	/* names are case-sensitive */
+	check_cname("HOST1", "HOST1");
+	fail_unless(cname_calls == 2,
+			"sdb_plugin_cname(HOST1) invoked callbacks %d times; "
+			"expected: 2", cname_calls);
+
+	/* negative caching */
+	for (i = 0; i < 3; ++i) {
+		check_cname("other", "other");
+		fail_unless(cname_calls == 3,
+				"sdb_plugin_cname(other) invoked callbacks %d times; "
+				"expected: 3 (cached)", cname_calls);
+	}
+
+	/* re-registering the callback flushes the cache */
+	sdb_plugin_unregister_all();
+	sdb_plugin_register_cname("test", test_cname, NULL);
+	check_cname("host1", "host1.example.com");
+	check_cname("other", "other");
+	fail_unless(cname_calls == 5,
+			"sdb_plugin_cname() invoked callbacks %d times after "
+			"flushing the cache; expected: 5", cname_calls);
+}
+END_TEST
+
+START_TEST(test_cname_cache_eviction)
+{
+	char name[32], expected[64];
+	int i;
+
+	/* the cache is bounded and keeps working when full */
+	for (i = 0; i < 1000; ++i) {
+		snprintf(name, sizeof(name), "host%d", i);
+		snprintf(expected, sizeof(expected), "%s.example.com", name);
+		check_cname(name, expected);
+	}
+	fail_unless(cname_calls == 1000,
+			"sdb_plugin_cname() invoked callbacks %d times for "
+			"1000 distinct names; expected: 1000", cname_calls);
+
+	check_cname("host999", "host999.example.com");
+	fail_unless(cname_calls == 1000,
+			"sdb_plugin_cname(host999) did not use the cache");
+}
+END_TEST
+
+START_TEST(test_cname_cache_disabled)
+{
+	int i;
+
+	sdb_plugin_set_cname_cache(0, 300 * SECOND, 60 * SECOND);
+	for (i = 0; i < 3; ++i)
+		check_cname("host1", "host1.example.com");
+	fail_unless(cname_calls == 3,
+			"sdb_plugin_cname() invoked callbacks %d times with the "
+			"cache disabled; expected: 3", cname_calls);
+
+	/* only disable negative caching */
+	sdb_plugin_set_cname_cache(16, 300 * SECOND, 0);
+	for (i = 0; i < 3; ++i) {
+		check_cname("host1", "host1.example.com");
+		check_cname("other", "other");
+	}
+	fail_unless(cname_calls == 3 + 1 + 3,
+			"sdb_plugin_cname() invoked callbacks %d times without "
+			"negative caching; expected: 7", cname_calls);
+}
+END_TEST
+
+START_TEST(test_cname_cache_expiry)
+{
+	/* entries expire immediately */
+	sdb_plugin_set_cname_cache(16, 1, 1);
+	check_cname("host1", "host1.example.com");
+	check_cname("host1", "host1.example.com");
+	fail_unless(cname_calls == 2,
+			"sdb_plugin_cname() invoked callbacks %d times for "
+			"expired names; expected: 2", cname_calls);
+}
+END_TEST
+
+static void *
+cname_thread(void __attribute__((unused)) *arg)
+{
+	char name[32], expected[64];
+	int i;
+
+	for (i = 0; i < 10000; ++i) {
+		snprintf(name, sizeof(name), "host%d", i % 64);
+		snprintf(expected, sizeof(expected), "%s.example.com", name);
+		check_cname(name, expected);
+	}
+	return NULL;
+} /* cname_thread */
+
+START_TEST(test_cname_cache_threads)
+{
+	pthread_t threads[4];
+	size_t i;
+
+	sdb_plugin_set_cname_cache(1024, 300 * SECOND, 60 * SECOND);
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(threads); ++i)
+		pthread_create(threads + i, NULL, cname_thread, NULL);
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(threads); ++i)
+		pthread_join(threads[i], NULL);
+
+	/* concurrent misses may invoke the callbacks more than once */
+	fail_unless(cname_calls < 4 * 64 * 4,
+			"sdb_plugin_cname() invoked callbacks %d times for "
+			"64 distinct names; expected: a few", cname_calls);
+}
+END_TEST
+
+TEST_MAIN("core::plugin")
+{
+	TCase *tc = tcase_create("core");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_cname_cache);
+	tcase_add_test(tc, test_cname_cache_eviction);
+	tcase_add_test(tc, test_cname_cache_disabled);
+	tcase_add_test(tc, test_cname_cache_expiry);
+	tcase_add_test(tc, test_cname_cache_threads);
+	ADD_TCASE(tc);
+}
+TEST_MAIN_END
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
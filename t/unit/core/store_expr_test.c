@@ -32,9 +32,11 @@
 #include "core/store.h"
 #include "core/store-private.h"
 #include "frontend/parser.h"
+#include "utils/epoch.h"
 #include "testutils.h"
 
 #include <check.h>
+#include <string.h>
 
 static void
 populate(void)
@@ -628,11 +630,69 @@ START_TEST(test_expr_iter)
 }
 END_TEST
 
+START_TEST(test_expr_eval_ref)
+{
+	sdb_data_t one = { SDB_TYPE_INTEGER, { .integer = 1 } };
+	sdb_store_expr_t *attr, *name, *sum;
+	sdb_data_t v1 = SDB_DATA_INIT, v2 = SDB_DATA_INIT;
+	sdb_store_obj_t *obj;
+	bool owned;
+	int check;
+
+	obj = sdb_store_get_host("a");
+	ck_assert(obj != NULL);
+	attr = sdb_store_expr_attrvalue("k1");
+	name = sdb_store_expr_fieldvalue(SDB_FIELD_NAME);
+	sum = sdb_store_expr_create(SDB_DATA_ADD, sdb_store_expr_attrvalue("k2"),
+			sdb_store_expr_constvalue(&one));
+	ck_assert(attr && name && sum);
+
+	sdb_epoch_enter();
+
+	/* attribute values and fields are borrowed */
+	check = sdb_store_expr_eval_ref(attr, obj, &v1, &owned, NULL);
+	fail_unless((check == 0) && (! owned),
+			"sdb_store_expr_eval_ref(a.k1) = %d (owned: %d); "
+			"expected: 0 (borrowed)", check, owned);
+	fail_unless((v1.type == SDB_TYPE_STRING)
+				&& (! strcmp(v1.data.string, "v1")),
+			"sdb_store_expr_eval_ref(a.k1) returned an unexpected value");
+	check = sdb_store_expr_eval(attr, obj, &v2, NULL);
+	fail_unless((check == 0) && (! sdb_data_cmp(&v1, &v2))
+				&& (v1.data.string != v2.data.string),
+			"sdb_store_expr_eval(a.k1) did not return a copy of the value");
+	sdb_data_free_datum(&v2);
+
+	check = sdb_store_expr_eval_ref(name, obj, &v1, &owned, NULL);
+	fail_unless((check == 0) && (! owned)
+				&& (v1.data.string == SDB_OBJ(obj)->name),
+			"sdb_store_expr_eval_ref(a.name) = %d (owned: %d); "
+			"expected: 0 (borrowed)", check, owned);
+
+	/* computed values are owned by the caller */
+	v1 = (sdb_data_t)SDB_DATA_INIT;
+	check = sdb_store_expr_eval_ref(sum, obj, &v1, &owned, NULL);
+	fail_unless((check == 0) && owned
+				&& (v1.type == SDB_TYPE_INTEGER) && (v1.data.integer == 124),
+			"sdb_store_expr_eval_ref(a.k2 + 1) = %d (owned: %d); "
+			"expected: 0 (owned, 124)", check, owned);
+	sdb_data_free_datum(&v1);
+
+	sdb_epoch_exit();
+
+	sdb_object_deref(SDB_OBJ(attr));
+	sdb_object_deref(SDB_OBJ(name));
+	sdb_object_deref(SDB_OBJ(sum));
+	sdb_object_deref(SDB_OBJ(obj));
+}
+END_TEST
+
 TEST_MAIN("core::store_expr")
 {
 	TCase *tc = tcase_create("core");
 	tcase_add_checked_fixture(tc, populate, sdb_store_clear);
 	TC_ADD_LOOP_TEST(tc, expr_iter);
+	tcase_add_test(tc, test_expr_eval_ref);
 	ADD_TCASE(tc);
 }
 TEST_MAIN_END
@@ -0,0 +1,304 @@
+/*
+ * SysDB - t/unit/core/store_journal_test.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/store.h"
+#include "core/store-private.h"
+#include "testutils.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char journal[1024];
+static char journal_old[1024];
+static char snapshot[1024];
+
+static void
+setup(void)
+{
+	snprintf(journal, sizeof(journal), "%s/sysdb-journal-test.%d",
+			P_tmpdir, (int)getpid());
+	snprintf(journal_old, sizeof(journal_old), "%s.1", journal);
+	snprintf(snapshot, sizeof(snapshot), "%s/sysdb-journal-snapshot.%d",
+			P_tmpdir, (int)getpid());
+	unlink(journal);
+	unlink(journal_old);
+
+	fail_unless(sdb_store_journal_open(journal, SECS_TO_SDB_TIME(1)) == 0,
+			"sdb_store_journal_open(%s) = -1; expected: 0", journal);
+} /* setup */
+
+static void
+teardown(void)
+{
+	sdb_store_journal_close();
+	unlink(journal);
+	unlink(journal_old);
+	unlink(snapshot);
+	sdb_store_clear();
+} /* teardown */
+
+static void
+populate(void)
+{
+	sdb_store_snapshot_obj_t obj;
+	sdb_metric_store_t store = { "dummy-type", "dummy-id" };
+	sdb_data_t datum;
+
+	sdb_store_host("h1", SECS_TO_SDB_TIME(10));
+	sdb_store_host("h1", SECS_TO_SDB_TIME(20));
+	sdb_store_host("h2", SECS_TO_SDB_TIME(30));
+
+	datum.type = SDB_TYPE_STRING;
+	datum.data.string = "v1";
+	sdb_store_attribute("h1", "k1", &datum, SECS_TO_SDB_TIME(10));
+	datum.type = SDB_TYPE_INTEGER;
+	datum.data.integer = 42;
+	sdb_store_attribute("h1", "k2", &datum, SECS_TO_SDB_TIME(10));
+
+	sdb_store_service("h1", "s1", SECS_TO_SDB_TIME(10));
+	datum.type = SDB_TYPE_DECIMAL;
+	datum.data.decimal = 4711.0;
+	sdb_store_service_attr("h1", "s1", "k1", &datum, SECS_TO_SDB_TIME(15));
+
+	sdb_store_metric("h2", "m1", &store, SECS_TO_SDB_TIME(20));
+	sdb_store_metric("h2", "m2", NULL, SECS_TO_SDB_TIME(20));
+	datum.type = SDB_TYPE_STRING;
+	datum.data.string = "v2";
+	sdb_store_metric_attr("h2", "m1", "k1", &datum, SECS_TO_SDB_TIME(25));
+
+	memset(&obj, 0, sizeof(obj));
+	obj.type = SDB_HOST;
+	obj.hostname = obj.name = "h3";
+	obj.last_update = SECS_TO_SDB_TIME(40);
+	obj.interval = SECS_TO_SDB_TIME(5);
+	obj.backends = (uint64_t)1 << sdb_store_backend_id("b1");
+	sdb_store_restore(&obj);
+} /* populate */
+
+static int
+scan_tojson(sdb_store_obj_t *obj, sdb_store_matcher_t *filter,
+		void *user_data)
+{
+	sdb_store_json_formatter_t *f = user_data;
+	return sdb_store_json_emit_full(f, obj, filter);
+} /* scan_tojson */
+
+static char *
+store_tojson(void)
+{
+	sdb_strbuf_t *buf = sdb_strbuf_create(0);
+	sdb_store_json_formatter_t *f;
+	char *json;
+
+	f = sdb_store_json_formatter(buf, SDB_HOST, SDB_WANT_ARRAY);
+	sdb_store_scan(SDB_HOST, NULL, NULL, scan_tojson, f);
+	sdb_store_json_finish(f);
+	free(f);
+
+	json = strdup(sdb_strbuf_string(buf));
+	sdb_strbuf_destroy(buf);
+	return json;
+} /* store_tojson */
+
+static void
+replay(void)
+{
+	int status;
+
+	sdb_store_journal_close();
+	sdb_store_clear();
+	status = sdb_store_journal_replay(journal);
+	fail_unless(status == 0,
+			"sdb_store_journal_replay(%s) = %d; expected: 0",
+			journal, status);
+} /* replay */
+
+START_TEST(test_journal_replay)
+{
+	sdb_store_obj_t *host, *metric;
+	char *before, *after;
+	int status;
+
+	populate();
+	status = sdb_store_journal_sync();
+	fail_unless(status == 0,
+			"sdb_store_journal_sync() = %d; expected: 0", status);
+
+	before = store_tojson();
+	replay();
+	after = store_tojson();
+	fail_unless(! strcmp(before, after),
+			"sdb_store_journal_replay() restored store:\n%s\nexpected:\n%s",
+			after, before);
+
+	host = sdb_store_get_host("h2");
+	metric = sdb_store_get_child(host, SDB_METRIC, "m1");
+	fail_unless(metric && METRIC(metric)->store.id
+				&& (! strcmp(METRIC(metric)->store.id, "dummy-id")),
+			"sdb_store_journal_replay() did not restore metric store");
+	sdb_object_deref(SDB_OBJ(metric));
+	sdb_object_deref(SDB_OBJ(host));
+
+	/* replaying the same journal again does not change anything */
+	status = sdb_store_journal_replay(journal);
+	fail_unless(status == 0,
+			"sdb_store_journal_replay(%s) = %d; expected: 0",
+			journal, status);
+	free(after);
+	after = store_tojson();
+	fail_unless(! strcmp(before, after),
+			"sdb_store_journal_replay() (twice) restored store:\n%s\n"
+			"expected:\n%s", after, before);
+
+	free(before);
+	free(after);
+}
+END_TEST
+
+START_TEST(test_journal_remove)
+{
+	int check;
+
+	sdb_store_set_expiry(0, SECS_TO_SDB_TIME(100));
+	sdb_store_host("h1", SECS_TO_SDB_TIME(10));
+	sdb_store_host("h2", SECS_TO_SDB_TIME(10));
+	sdb_store_service("h1", "s1", SECS_TO_SDB_TIME(10));
+
+	/* all objects have expired by now */
+	check = sdb_store_expire(sdb_gettime());
+	sdb_store_set_expiry(0, 0);
+	fail_unless(check > 0,
+			"sdb_store_expire(<now>) = %d; expected: >0", check);
+	fail_unless(! sdb_store_has_host("h1"),
+			"INTERNAL ERROR: h1 did not expire");
+
+	replay();
+	fail_unless(! sdb_store_has_host("h1"),
+			"sdb_store_journal_replay() restored expired host h1");
+	fail_unless(! sdb_store_has_host("h2"),
+			"sdb_store_journal_replay() restored expired host h2");
+}
+END_TEST
+
+START_TEST(test_journal_torn)
+{
+	char buf[8192];
+	size_t len;
+	FILE *fh;
+
+	populate();
+	sdb_store_journal_close();
+
+	fh = fopen(journal, "r");
+	fail_unless(fh != NULL, "INTERNAL ERROR: failed to open %s", journal);
+	len = fread(buf, 1, sizeof(buf), fh);
+	fclose(fh);
+	fail_unless((len > 100) && (len < sizeof(buf)),
+			"INTERNAL ERROR: unexpected journal size %zu", len);
+
+	/* simulate a crash while writing the last record */
+	fh = fopen(journal, "w");
+	fail_unless(fh != NULL, "INTERNAL ERROR: failed to create %s", journal);
+	fwrite(buf, 1, len - 5, fh);
+	fclose(fh);
+
+	replay();
+	fail_unless(sdb_store_has_host("h1"),
+			"sdb_store_journal_replay(<torn>) did not restore h1");
+	fail_unless(! sdb_store_has_host("h3"),
+			"sdb_store_journal_replay(<torn>) restored incomplete record");
+
+	/* the incomplete record has been removed and new records may be
+	 * appended to the journal */
+	fail_unless(sdb_store_journal_open(journal, 0) == 0,
+			"sdb_store_journal_open(%s) = -1; expected: 0", journal);
+	sdb_store_host("h4", SECS_TO_SDB_TIME(10));
+	replay();
+	fail_unless(sdb_store_has_host("h1") && sdb_store_has_host("h4"),
+			"sdb_store_journal_replay() did not restore appended records");
+}
+END_TEST
+
+START_TEST(test_journal_checkpoint)
+{
+	char *before, *after;
+	int status;
+
+	populate();
+	status = sdb_store_snapshot_write(snapshot);
+	fail_unless(status == 0,
+			"sdb_store_snapshot_write(%s) = %d; expected: 0",
+			snapshot, status);
+	fail_unless(access(journal_old, F_OK) != 0,
+			"sdb_store_snapshot_write() did not remove previous journal");
+
+	/* updates after the snapshot are recorded in the new journal */
+	sdb_store_host("h1", SECS_TO_SDB_TIME(100));
+	sdb_store_host("h5", SECS_TO_SDB_TIME(100));
+	before = store_tojson();
+
+	replay();
+	fail_unless(! sdb_store_has_host("h2"),
+			"sdb_store_journal_replay() restored h2 from old journal");
+	status = sdb_store_snapshot_load(snapshot);
+	fail_unless(status == 0,
+			"sdb_store_snapshot_load(%s) = %d; expected: 0",
+			snapshot, status);
+	status = sdb_store_journal_replay(journal);
+	fail_unless(status == 0,
+			"sdb_store_journal_replay(%s) = %d; expected: 0",
+			journal, status);
+
+	after = store_tojson();
+	fail_unless(! strcmp(before, after),
+			"snapshot + journal restored store:\n%s\nexpected:\n%s",
+			after, before);
+	free(before);
+	free(after);
+}
+END_TEST
+
+TEST_MAIN("core::store_journal")
+{
+	TCase *tc = tcase_create("core");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_journal_replay);
+	tcase_add_test(tc, test_journal_remove);
+	tcase_add_test(tc, test_journal_torn);
+	tcase_add_test(tc, test_journal_checkpoint);
+	ADD_TCASE(tc);
+}
+TEST_MAIN_END
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -37,6 +37,7 @@
 #include <assert.h>
 
 #include <check.h>
+#include <math.h>
 #include <string.h>
 
 static void
@@ -647,6 +648,338 @@ START_TEST(test_scan)
 }
 END_TEST
 
+static sdb_store_expr_t *
+const_expr(sdb_data_t d)
+{
+	return sdb_store_expr_constvalue(&d);
+} /* const_expr */
+
+static sdb_store_matcher_t *
+cmp(sdb_store_matcher_op_cb op, sdb_store_expr_t *left,
+		sdb_store_expr_t *right)
+{
+	sdb_store_matcher_t *m = op(left, right);
+	sdb_object_deref(SDB_OBJ(left));
+	sdb_object_deref(SDB_OBJ(right));
+	return m;
+} /* cmp */
+
+static sdb_store_matcher_t *
+logical(sdb_store_matcher_t *(*op)(sdb_store_matcher_t *,
+			sdb_store_matcher_t *),
+		sdb_store_matcher_t *left, sdb_store_matcher_t *right)
+{
+	sdb_store_matcher_t *m = op(left, right);
+	sdb_object_deref(SDB_OBJ(left));
+	sdb_object_deref(SDB_OBJ(right));
+	return m;
+} /* logical */
+
+static void
+check_compiled(sdb_store_matcher_t *m, sdb_store_matcher_t *filter,
+		const char *desc, sdb_store_obj_t *obj)
+{
+	sdb_store_prog_t *prog = sdb_store_matcher_compile(m, filter);
+	int expected, status;
+
+	fail_unless(prog != NULL,
+			"sdb_store_matcher_compile(%s) = NULL; expected: <prog>", desc);
+
+	expected = sdb_store_matcher_matches(m, obj, filter);
+	status = sdb_store_prog_matches(prog, obj);
+	fail_unless(!status == !expected,
+			"sdb_store_prog_matches(%s, <%s %s>) = %d; expected: %d "
+			"(sdb_store_matcher_matches)", desc,
+			SDB_STORE_TYPE_TO_NAME(obj->type), SDB_OBJ(obj)->name,
+			status, expected);
+	sdb_store_prog_destroy(prog);
+} /* check_compiled */
+
+START_TEST(test_compile)
+{
+	const char *names[] = { "a", "s1", "m2" };
+	sdb_data_t names_array = { SDB_TYPE_ARRAY | SDB_TYPE_STRING,
+		{ .array = { SDB_STATIC_ARRAY_LEN(names), names } } };
+	sdb_data_t k1 = { SDB_TYPE_STRING, { .string = "k1" } };
+	sdb_data_t k2 = { SDB_TYPE_STRING, { .string = "k2" } };
+
+	struct {
+		const char *desc;
+		sdb_store_matcher_t *m;
+	} matchers[] = {
+		{ "name =~ '^[ab]'", cmp(sdb_store_regex_matcher,
+				sdb_store_expr_fieldvalue(SDB_FIELD_NAME),
+				const_expr((sdb_data_t){ SDB_TYPE_STRING,
+					{ .string = "^[ab]" } })) },
+		{ "name !~ '1'", cmp(sdb_store_nregex_matcher,
+				sdb_store_expr_fieldvalue(SDB_FIELD_NAME),
+				const_expr((sdb_data_t){ SDB_TYPE_STRING,
+					{ .string = "1" } })) },
+		{ "attribute[k1] = 'v1'", cmp(sdb_store_eq_matcher,
+				sdb_store_expr_attrvalue("k1"),
+				const_expr((sdb_data_t){ SDB_TYPE_STRING,
+					{ .string = "v1" } })) },
+		{ "NOT attribute[k2] > '100'", sdb_store_inv_matcher(NULL) },
+		{ "attribute[k3] IS NULL", NULL },
+		{ "attribute[k1] IS NOT NULL OR name = 'c'", NULL },
+		{ "host.attribute[k1] = 'v2'", cmp(sdb_store_eq_matcher,
+				sdb_store_expr_typed(SDB_HOST,
+					sdb_store_expr_attrvalue("k1")),
+				const_expr((sdb_data_t){ SDB_TYPE_STRING,
+					{ .string = "v2" } })) },
+		{ "host.name < 'b'", cmp(sdb_store_lt_matcher,
+				sdb_store_expr_typed(SDB_HOST,
+					sdb_store_expr_fieldvalue(SDB_FIELD_NAME)),
+				const_expr((sdb_data_t){ SDB_TYPE_STRING,
+					{ .string = "b" } })) },
+		{ "name IN ['a', 's1', 'm2']", cmp(sdb_store_in_matcher,
+				sdb_store_expr_fieldvalue(SDB_FIELD_NAME),
+				const_expr(names_array)) },
+		{ "name NOT IN ['a', 's1', 'm2']", cmp(sdb_store_nin_matcher,
+				sdb_store_expr_fieldvalue(SDB_FIELD_NAME),
+				const_expr(names_array)) },
+		{ "last_update + last_update > 1", NULL },
+		{ "ANY attribute.name = 'k2'", NULL },
+	};
+
+	sdb_store_matcher_t *filters[] = {
+		NULL,
+		/* filter a host and its children */
+		cmp(sdb_store_ne_matcher,
+				sdb_store_expr_fieldvalue(SDB_FIELD_NAME),
+				const_expr((sdb_data_t){ SDB_TYPE_STRING,
+					{ .string = "b" } })),
+		/* filter an attribute */
+		cmp(sdb_store_ne_matcher,
+				sdb_store_expr_fieldvalue(SDB_FIELD_NAME),
+				const_expr(k1)),
+	};
+
+	const char *hosts[] = { "a", "b", "c" };
+	const char *children[] = { "s1", "s2", "s3", "m1", "m2" };
+	size_t i, j, h, c;
+
+	matchers[3].m = sdb_store_inv_matcher(cmp(sdb_store_gt_matcher,
+				sdb_store_expr_attrvalue("k2"),
+				const_expr((sdb_data_t){ SDB_TYPE_STRING,
+					{ .string = "100" } })));
+	sdb_object_deref(SDB_OBJ(UOP_M(matchers[3].m)->op));
+	matchers[4].m = sdb_store_isnull_matcher(sdb_store_expr_attrvalue("k3"));
+	sdb_object_deref(SDB_OBJ(ISNULL_M(matchers[4].m)->expr));
+	matchers[5].m = logical(sdb_store_dis_matcher,
+			sdb_store_isnnull_matcher(sdb_store_expr_attrvalue("k1")),
+			cmp(sdb_store_eq_matcher,
+				sdb_store_expr_fieldvalue(SDB_FIELD_NAME),
+				const_expr((sdb_data_t){ SDB_TYPE_STRING,
+					{ .string = "c" } })));
+	matchers[10].m = cmp(sdb_store_gt_matcher,
+			sdb_store_expr_create(SDB_DATA_ADD,
+				sdb_store_expr_fieldvalue(SDB_FIELD_LAST_UPDATE),
+				sdb_store_expr_fieldvalue(SDB_FIELD_LAST_UPDATE)),
+			const_expr((sdb_data_t){ SDB_TYPE_DATETIME,
+				{ .datetime = 1 } }));
+	matchers[11].m = sdb_store_any_matcher(
+			sdb_store_expr_typed(SDB_ATTRIBUTE,
+				sdb_store_expr_fieldvalue(SDB_FIELD_NAME)),
+			cmp(sdb_store_eq_matcher, NULL, const_expr(k2)));
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(matchers); ++i)
+		fail_unless(matchers[i].m != NULL,
+				"INTERNAL ERROR: failed to create matcher %s",
+				matchers[i].desc);
+
+	for (h = 0; h < SDB_STATIC_ARRAY_LEN(hosts); ++h) {
+		sdb_store_obj_t *host = sdb_store_get_host(hosts[h]);
+		fail_unless(host != NULL,
+				"sdb_store_get_host(%s) = NULL; expected: <host>", hosts[h]);
+
+		for (i = 0; i < SDB_STATIC_ARRAY_LEN(matchers); ++i) {
+			for (j = 0; j < SDB_STATIC_ARRAY_LEN(filters); ++j) {
+				check_compiled(matchers[i].m, filters[j],
+						matchers[i].desc, host);
+
+				for (c = 0; c < SDB_STATIC_ARRAY_LEN(children); ++c) {
+					int type = (children[c][0] == 's')
+						? SDB_SERVICE : SDB_METRIC;
+					sdb_store_obj_t *child = sdb_store_get_child(host,
+							type, children[c]);
+
+					if (! child)
+						continue;
+					check_compiled(matchers[i].m, filters[j],
+							matchers[i].desc, child);
+					sdb_object_deref(SDB_OBJ(child));
+				}
+			}
+		}
+		sdb_object_deref(SDB_OBJ(host));
+	}
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(matchers); ++i)
+		sdb_object_deref(SDB_OBJ(matchers[i].m));
+	for (j = 0; j < SDB_STATIC_ARRAY_LEN(filters); ++j)
+		sdb_object_deref(SDB_OBJ(filters[j]));
+}
+END_TEST
+
+START_TEST(test_in_set)
+{
+	int64_t ints[] = { 3, 1, 2, 1 };
+	double decs[] = { 1.5, NAN, -2.0 };
+	char *strs[] = { "b", "A", "c", "a" };
+	double nans[] = { NAN };
+	sdb_data_t arrays[] = {
+		{ SDB_TYPE_ARRAY | SDB_TYPE_INTEGER,
+			{ .array = { SDB_STATIC_ARRAY_LEN(ints), ints } } },
+		{ SDB_TYPE_ARRAY | SDB_TYPE_DECIMAL,
+			{ .array = { SDB_STATIC_ARRAY_LEN(decs), decs } } },
+		{ SDB_TYPE_ARRAY | SDB_TYPE_STRING,
+			{ .array = { SDB_STATIC_ARRAY_LEN(strs), strs } } },
+		{ SDB_TYPE_ARRAY | SDB_TYPE_INTEGER, { .array = { 0, NULL } } },
+		{ SDB_TYPE_ARRAY | SDB_TYPE_STRING, { .array = { 0, NULL } } },
+		/* empty after dropping NaN */
+		{ SDB_TYPE_ARRAY | SDB_TYPE_DECIMAL,
+			{ .array = { SDB_STATIC_ARRAY_LEN(nans), nans } } },
+	};
+
+	int64_t int_values[] = { 1, 4 };
+	int64_t int_mixed[] = { 1, 4 };
+	char *str_values[] = { "C", "B" };
+	double dec_values[] = { 1.5, NAN };
+	sdb_data_t values[] = {
+		{ SDB_TYPE_INTEGER, { .integer = 1 } },
+		{ SDB_TYPE_INTEGER, { .integer = 3 } },
+		{ SDB_TYPE_INTEGER, { .integer = 0 } },
+		{ SDB_TYPE_DECIMAL, { .decimal = 1.5 } },
+		{ SDB_TYPE_DECIMAL, { .decimal = -2.0 } },
+		{ SDB_TYPE_DECIMAL, { .decimal = NAN } },
+		{ SDB_TYPE_DECIMAL, { .decimal = 0.0 } },
+		{ SDB_TYPE_STRING, { .string = "a" } },
+		{ SDB_TYPE_STRING, { .string = "B" } },
+		{ SDB_TYPE_STRING, { .string = "x" } },
+		{ SDB_TYPE_STRING, { .string = NULL } },
+		{ SDB_TYPE_ARRAY | SDB_TYPE_INTEGER,
+			{ .array = { 1, int_values } } },
+		{ SDB_TYPE_ARRAY | SDB_TYPE_INTEGER,
+			{ .array = { SDB_STATIC_ARRAY_LEN(int_mixed), int_mixed } } },
+		{ SDB_TYPE_ARRAY | SDB_TYPE_STRING,
+			{ .array = { SDB_STATIC_ARRAY_LEN(str_values), str_values } } },
+		{ SDB_TYPE_ARRAY | SDB_TYPE_DECIMAL, { .array = { 1, dec_values } } },
+		{ SDB_TYPE_ARRAY | SDB_TYPE_DECIMAL,
+			{ .array = { SDB_STATIC_ARRAY_LEN(dec_values), dec_values } } },
+		/* empty arrays are included in any array of the same type */
+		{ SDB_TYPE_ARRAY | SDB_TYPE_INTEGER, { .array = { 0, NULL } } },
+		{ SDB_TYPE_ARRAY | SDB_TYPE_STRING, { .array = { 0, NULL } } },
+		{ SDB_TYPE_ARRAY | SDB_TYPE_DECIMAL, { .array = { 0, NULL } } },
+	};
+
+	sdb_store_obj_t *host;
+	size_t i, j;
+
+	host = sdb_store_get_host("a");
+	fail_unless(host != NULL,
+			"sdb_store_get_host(a) = NULL; expected: <host>");
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(arrays); ++i) {
+		for (j = 0; j < SDB_STATIC_ARRAY_LEN(values); ++j) {
+			sdb_store_matcher_t *in, *nin;
+			char a_str[64], v_str[64];
+			int expected, status;
+
+			sdb_data_format(&arrays[i], a_str, sizeof(a_str), SDB_UNQUOTED);
+			sdb_data_format(&values[j], v_str, sizeof(v_str), SDB_UNQUOTED);
+			expected = sdb_data_inarray(&values[j], &arrays[i]);
+
+			in = cmp(sdb_store_in_matcher, const_expr(values[j]),
+					const_expr(arrays[i]));
+			nin = cmp(sdb_store_nin_matcher, const_expr(values[j]),
+					const_expr(arrays[i]));
+			fail_unless((in != NULL) && (nin != NULL),
+					"INTERNAL ERROR: failed to create matcher %s IN %s",
+					v_str, a_str);
+
+			status = sdb_store_matcher_matches(in, host, NULL);
+			fail_unless(!status == !expected,
+					"sdb_store_matcher_matches(%s IN %s) = %d; expected: %d "
+					"(sdb_data_inarray)", v_str, a_str, status, expected);
+			status = sdb_store_matcher_matches(nin, host, NULL);
+			fail_unless(!status == !!expected,
+					"sdb_store_matcher_matches(%s NOT IN %s) = %d; "
+					"expected: %d", v_str, a_str, status, !expected);
+
+			check_compiled(in, NULL, "<value> IN <array>", host);
+			check_compiled(nin, NULL, "<value> NOT IN <array>", host);
+
+			sdb_object_deref(SDB_OBJ(in));
+			sdb_object_deref(SDB_OBJ(nin));
+		}
+	}
+	sdb_object_deref(SDB_OBJ(host));
+}
+END_TEST
+
+START_TEST(test_scan_names)
+{
+	char *in_names[] = { "x", "B", "a", "A" };
+	sdb_data_t names = { SDB_TYPE_ARRAY | SDB_TYPE_STRING,
+		{ .array = { SDB_STATIC_ARRAY_LEN(in_names), in_names } } };
+
+	struct {
+		sdb_store_matcher_t *m;
+		const char *desc;
+		int expected;
+	} golden_data[] = {
+		{ NULL, "name IN ['x', 'B', 'a', 'A']", 2 },
+		{ NULL, "name NOT IN ['x', 'B', 'a', 'A']", 1 },
+		{ NULL, "name = 'C'", 1 },
+		{ NULL, "'b' = name", 1 },
+		{ NULL, "name = 'x'", 0 },
+		{ NULL, "name IN ['x', 'B', 'a', 'A'] AND name = 'a'", 1 },
+	};
+
+	size_t i;
+
+	golden_data[0].m = cmp(sdb_store_in_matcher,
+			sdb_store_expr_fieldvalue(SDB_FIELD_NAME), const_expr(names));
+	golden_data[1].m = cmp(sdb_store_nin_matcher,
+			sdb_store_expr_fieldvalue(SDB_FIELD_NAME), const_expr(names));
+	golden_data[2].m = cmp(sdb_store_eq_matcher,
+			sdb_store_expr_fieldvalue(SDB_FIELD_NAME),
+			const_expr((sdb_data_t){ SDB_TYPE_STRING, { .string = "C" } }));
+	golden_data[3].m = cmp(sdb_store_eq_matcher,
+			const_expr((sdb_data_t){ SDB_TYPE_STRING, { .string = "b" } }),
+			sdb_store_expr_fieldvalue(SDB_FIELD_NAME));
+	golden_data[4].m = cmp(sdb_store_eq_matcher,
+			sdb_store_expr_fieldvalue(SDB_FIELD_NAME),
+			const_expr((sdb_data_t){ SDB_TYPE_STRING, { .string = "x" } }));
+	golden_data[5].m = logical(sdb_store_con_matcher,
+			cmp(sdb_store_in_matcher,
+				sdb_store_expr_fieldvalue(SDB_FIELD_NAME), const_expr(names)),
+			cmp(sdb_store_eq_matcher,
+				sdb_store_expr_fieldvalue(SDB_FIELD_NAME),
+				const_expr((sdb_data_t){ SDB_TYPE_STRING,
+					{ .string = "a" } })));
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+		int n = 0, status;
+
+		fail_unless(golden_data[i].m != NULL,
+				"INTERNAL ERROR: failed to create matcher %s",
+				golden_data[i].desc);
+
+		status = sdb_store_scan(SDB_HOST, golden_data[i].m, NULL,
+				scan_cb, &n);
+		fail_unless(status == 0,
+				"sdb_store_scan(HOST, %s) = %d; expected: 0",
+				golden_data[i].desc, status);
+		fail_unless(n == golden_data[i].expected,
+				"sdb_store_scan(HOST, %s) found %d hosts; expected: %d",
+				golden_data[i].desc, n, golden_data[i].expected);
+		sdb_object_deref(SDB_OBJ(golden_data[i].m));
+	}
+}
+END_TEST
+
 TEST_MAIN("core::store_lookup")
 {
 	TCase *tc = tcase_create("core");
@@ -656,6 +989,9 @@ TEST_MAIN("core::store_lookup")
 	TC_ADD_LOOP_TEST(tc, cmp_obj);
 	TC_ADD_LOOP_TEST(tc, scan);
 	tcase_add_test(tc, test_store_match_op);
+	tcase_add_test(tc, test_compile);
+	tcase_add_test(tc, test_in_set);
+	tcase_add_test(tc, test_scan_names);
 	ADD_TCASE(tc);
 }
 TEST_MAIN_END
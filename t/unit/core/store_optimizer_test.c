@@ -0,0 +1,287 @@
+/*
+ * SysDB - t/unit/core/store_optimizer_test.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/store.h"
+#include "core/store-private.h"
+#include "testutils.h"
+
+#include <check.h>
+
+static void
+populate(void)
+{
+	const char *hosts[] = { "a", "b", "c" };
+	sdb_data_t v = { SDB_TYPE_STRING, { .string = "v1" } };
+	size_t i;
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(hosts); ++i) {
+		sdb_store_host(hosts[i], 1);
+		sdb_store_service(hosts[i], "s1", 1);
+		sdb_store_service(hosts[i], "s2", 1);
+	}
+	sdb_store_attribute("a", "k1", &v, 1);
+} /* populate */
+
+static sdb_store_expr_t *
+str(const char *s)
+{
+	sdb_data_t d = { SDB_TYPE_STRING, { .string = (char *)s } };
+	return sdb_store_expr_constvalue(&d);
+} /* str */
+
+static sdb_store_expr_t *
+num(int64_t i)
+{
+	sdb_data_t d = { SDB_TYPE_INTEGER, { .integer = i } };
+	return sdb_store_expr_constvalue(&d);
+} /* num */
+
+/* Consumes the references to both operands. */
+static sdb_store_matcher_t *
+cmp(sdb_store_matcher_op_cb op,
+		sdb_store_expr_t *left, sdb_store_expr_t *right)
+{
+	sdb_store_matcher_t *m = op(left, right);
+	sdb_object_deref(SDB_OBJ(left));
+	sdb_object_deref(SDB_OBJ(right));
+	return m;
+} /* cmp */
+
+static sdb_store_matcher_t *
+name_eq(const char *name)
+{
+	return cmp(sdb_store_eq_matcher,
+			sdb_store_expr_fieldvalue(SDB_FIELD_NAME), str(name));
+} /* name_eq */
+
+/* Consumes the references to both operands. */
+static sdb_store_matcher_t *
+logical(sdb_store_matcher_t *(*op)(sdb_store_matcher_t *,
+			sdb_store_matcher_t *),
+		sdb_store_matcher_t *left, sdb_store_matcher_t *right)
+{
+	sdb_store_matcher_t *m = op(left, right);
+	sdb_object_deref(SDB_OBJ(left));
+	sdb_object_deref(SDB_OBJ(right));
+	return m;
+} /* logical */
+
+static sdb_store_matcher_t *
+inv(sdb_store_matcher_t *m)
+{
+	sdb_store_matcher_t *n = sdb_store_inv_matcher(m);
+	sdb_object_deref(SDB_OBJ(m));
+	return n;
+} /* inv */
+
+/* ANY service.name =~ 'x' */
+static sdb_store_matcher_t *
+any_service(void)
+{
+	sdb_store_expr_t *name = sdb_store_expr_fieldvalue(SDB_FIELD_NAME);
+	sdb_store_expr_t *iter = sdb_store_expr_typed(SDB_SERVICE, name);
+	sdb_store_matcher_t *re = cmp(sdb_store_regex_matcher, NULL, str("x"));
+	sdb_store_matcher_t *m = sdb_store_any_matcher(iter, re);
+
+	sdb_object_deref(SDB_OBJ(name));
+	sdb_object_deref(SDB_OBJ(iter));
+	sdb_object_deref(SDB_OBJ(re));
+	return m;
+} /* any_service */
+
+static void
+check_equivalent(sdb_store_matcher_t *m, sdb_store_matcher_t *opt)
+{
+	const char *hosts[] = { "a", "b", "c", "x" };
+	size_t i;
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(hosts); ++i) {
+		sdb_store_obj_t *host = sdb_store_get_host(hosts[i]);
+		int expected, got;
+
+		if (! host)
+			continue;
+
+		expected = sdb_store_matcher_matches(m, host, NULL);
+		got = sdb_store_matcher_matches(opt, host, NULL);
+		fail_unless(!got == !expected,
+				"sdb_store_matcher_matches(<optimized>, %s) = %d; "
+				"expected: %d (original matcher)", hosts[i], got, expected);
+		sdb_object_deref(SDB_OBJ(host));
+	}
+} /* check_equivalent */
+
+START_TEST(test_double_negation)
+{
+	sdb_store_matcher_t *eq = name_eq("a");
+	sdb_store_matcher_t *m, *opt;
+
+	sdb_object_ref(SDB_OBJ(eq));
+	m = inv(inv(eq));
+	opt = sdb_store_matcher_optimize(m, SDB_HOST);
+	fail_unless(opt == eq,
+			"sdb_store_matcher_optimize(NOT NOT name = 'a') = %p; "
+			"expected: %p (name = 'a')", opt, eq);
+	check_equivalent(m, opt);
+	sdb_object_deref(SDB_OBJ(opt));
+	sdb_object_deref(SDB_OBJ(m));
+
+	/* a single negation has to be kept */
+	m = inv(inv(inv(eq)));
+	opt = sdb_store_matcher_optimize(m, SDB_HOST);
+	fail_unless(opt && (opt->type == MATCHER_NOT)
+			&& (UOP_M(opt)->op == eq),
+			"sdb_store_matcher_optimize(NOT NOT NOT name = 'a') = %s; "
+			"expected: NOT name = 'a'",
+			opt ? MATCHER_SYM(opt->type) : "NULL");
+	check_equivalent(m, opt);
+	sdb_object_deref(SDB_OBJ(opt));
+	sdb_object_deref(SDB_OBJ(m));
+}
+END_TEST
+
+START_TEST(test_constants)
+{
+	sdb_store_matcher_t *eq = name_eq("a");
+	sdb_store_matcher_t *m, *opt;
+
+	/* constant operands of AND which are always true are dropped */
+	sdb_object_ref(SDB_OBJ(eq));
+	m = logical(sdb_store_con_matcher,
+			cmp(sdb_store_eq_matcher, num(1), num(1)), eq);
+	opt = sdb_store_matcher_optimize(m, SDB_HOST);
+	fail_unless(opt == eq,
+			"sdb_store_matcher_optimize(1 = 1 AND name = 'a') = %p; "
+			"expected: %p (name = 'a')", opt, eq);
+	check_equivalent(m, opt);
+	sdb_object_deref(SDB_OBJ(opt));
+	sdb_object_deref(SDB_OBJ(m));
+
+	/* ... and those which are always false make AND false */
+	sdb_object_ref(SDB_OBJ(eq));
+	m = logical(sdb_store_con_matcher, eq,
+			cmp(sdb_store_regex_matcher, str("abc"), str("^x")));
+	opt = sdb_store_matcher_optimize(m, SDB_HOST);
+	fail_unless(opt && (opt->type == MATCHER_ISNULL)
+			&& (! ISNULL_M(opt)->expr->type),
+			"sdb_store_matcher_optimize(name = 'a' AND 'abc' =~ '^x') = %s; "
+			"expected: <constant> IS NULL",
+			opt ? MATCHER_SYM(opt->type) : "NULL");
+	check_equivalent(m, opt);
+	sdb_object_deref(SDB_OBJ(opt));
+	sdb_object_deref(SDB_OBJ(m));
+
+	/* OR with a true constant is always true */
+	sdb_object_ref(SDB_OBJ(eq));
+	m = logical(sdb_store_dis_matcher, eq,
+			inv(cmp(sdb_store_lt_matcher, num(2), num(1))));
+	opt = sdb_store_matcher_optimize(m, SDB_HOST);
+	fail_unless(opt && (opt->type == MATCHER_ISNNULL)
+			&& (! ISNULL_M(opt)->expr->type),
+			"sdb_store_matcher_optimize(name = 'a' OR NOT 2 < 1) = %s; "
+			"expected: <constant> IS NOT NULL",
+			opt ? MATCHER_SYM(opt->type) : "NULL");
+	check_equivalent(m, opt);
+	sdb_object_deref(SDB_OBJ(opt));
+	sdb_object_deref(SDB_OBJ(m));
+
+	sdb_object_deref(SDB_OBJ(eq));
+}
+END_TEST
+
+START_TEST(test_reorder)
+{
+	sdb_store_matcher_t *eq = name_eq("a");
+	sdb_store_matcher_t *any = any_service();
+	sdb_store_matcher_t *m, *opt;
+
+	/* cheap and selective operands of AND go first */
+	sdb_object_ref(SDB_OBJ(eq));
+	sdb_object_ref(SDB_OBJ(any));
+	m = logical(sdb_store_con_matcher, any, eq);
+	opt = sdb_store_matcher_optimize(m, SDB_HOST);
+	fail_unless(opt && (opt->type == MATCHER_AND)
+			&& (OP_M(opt)->left == eq) && (OP_M(opt)->right == any),
+			"sdb_store_matcher_optimize(ANY service.name =~ 'x' AND "
+			"name = 'a') did not evaluate 'name = a' first");
+	check_equivalent(m, opt);
+	sdb_object_deref(SDB_OBJ(opt));
+	sdb_object_deref(SDB_OBJ(m));
+
+	/* nested chains are flattened and sorted as a whole */
+	sdb_object_ref(SDB_OBJ(eq));
+	sdb_object_ref(SDB_OBJ(any));
+	m = logical(sdb_store_con_matcher,
+			logical(sdb_store_con_matcher, any,
+				cmp(sdb_store_eq_matcher,
+					sdb_store_expr_attrvalue("k1"), str("v1"))),
+			eq);
+	opt = sdb_store_matcher_optimize(m, SDB_HOST);
+	fail_unless(opt && (opt->type == MATCHER_AND)
+			&& (OP_M(opt)->right == any)
+			&& (OP_M(opt)->left->type == MATCHER_AND)
+			&& (OP_M(OP_M(opt)->left)->left == eq),
+			"sdb_store_matcher_optimize((ANY ... AND attribute[k1] = 'v1') "
+			"AND name = 'a') = <unexpected order>");
+	check_equivalent(m, opt);
+	sdb_object_deref(SDB_OBJ(opt));
+	sdb_object_deref(SDB_OBJ(m));
+
+	/* operands of OR which are likely to match go first */
+	sdb_object_ref(SDB_OBJ(eq));
+	m = logical(sdb_store_dis_matcher, eq, inv(name_eq("b")));
+	opt = sdb_store_matcher_optimize(m, SDB_HOST);
+	fail_unless(opt && (opt->type == MATCHER_OR)
+			&& (OP_M(opt)->left->type == MATCHER_NOT)
+			&& (OP_M(opt)->right == eq),
+			"sdb_store_matcher_optimize(name = 'a' OR NOT name = 'b') "
+			"did not evaluate 'NOT name = b' first");
+	check_equivalent(m, opt);
+	sdb_object_deref(SDB_OBJ(opt));
+	sdb_object_deref(SDB_OBJ(m));
+
+	sdb_object_deref(SDB_OBJ(eq));
+	sdb_object_deref(SDB_OBJ(any));
+}
+END_TEST
+
+TEST_MAIN("core::store_optimizer")
+{
+	TCase *tc = tcase_create("core");
+	tcase_add_checked_fixture(tc, populate, sdb_store_clear);
+	tcase_add_test(tc, test_double_negation);
+	tcase_add_test(tc, test_constants);
+	tcase_add_test(tc, test_reorder);
+	ADD_TCASE(tc);
+}
+TEST_MAIN_END
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,187 @@
+/*
+ * SysDB - t/unit/core/store_regex_test.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/store-private.h"
+#include "utils/epoch.h"
+#include "testutils.h"
+
+#include <check.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *patterns[] = {
+	"host", "^host", "host$", "^host$", "^HOST1$", "o", "^h", "t$",
+	"ho+st", "^ho?st", "^host[0-9]+$", "^host.*", "h.st", "host|other",
+	"^other|host", "a{0}host", "^hosta*", "-_", "^a b$", "",
+	"^", "$", "^$", ".*",
+};
+
+static const char *values[] = {
+	"", "host", "HOST", "host1", "Host1", "hst", "hooost", "other",
+	"myhost", "myhost1", "a b", "A B", "x-_y", "hos", "h", "t",
+};
+
+START_TEST(test_regex_exec)
+{
+	size_t i, j;
+
+	/* compare with the regex engine */
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(patterns); ++i) {
+		sdb_store_regex_t *re = sdb_store_regex_create(patterns[i]);
+		regex_t regex;
+
+		fail_unless(sdb_store_regex_valid(re),
+				"sdb_store_regex_create(%s) = <invalid>; expected: <regex>",
+				patterns[i]);
+		fail_unless(regcomp(&regex, patterns[i],
+					REG_EXTENDED | REG_ICASE | REG_NOSUB) == 0,
+				"INTERNAL ERROR: regcomp(%s) failed", patterns[i]);
+
+		for (j = 0; j < SDB_STATIC_ARRAY_LEN(values); ++j) {
+			bool expected = regexec(&regex, values[j], 0, NULL, 0) == 0;
+			bool got = sdb_store_regex_exec(re, values[j]);
+
+			fail_unless(got == expected,
+					"sdb_store_regex_exec(%s, %s) = %d; expected: %d",
+					patterns[i], values[j], got, expected);
+		}
+
+		regfree(&regex);
+		sdb_store_regex_destroy(re);
+	}
+}
+END_TEST
+
+START_TEST(test_regex_invalid)
+{
+	sdb_store_regex_t *re = sdb_store_regex_create("[invalid");
+
+	fail_unless(re != NULL,
+			"sdb_store_regex_create([invalid) = NULL; expected: <regex>");
+	fail_unless(! sdb_store_regex_valid(re),
+			"sdb_store_regex_create([invalid) = <valid>; expected: <invalid>");
+	fail_unless(! sdb_store_regex_exec(re, "[invalid"),
+			"sdb_store_regex_exec(<invalid>) matched");
+	sdb_store_regex_destroy(re);
+
+	sdb_epoch_enter();
+	fail_unless(sdb_store_regex_lookup("[invalid") == NULL,
+			"sdb_store_regex_lookup([invalid) = <regex>; expected: NULL");
+	sdb_epoch_exit();
+}
+END_TEST
+
+START_TEST(test_regex_cache)
+{
+	const sdb_store_regex_t *re1, *re2;
+	char pattern[32];
+	int i;
+
+	sdb_epoch_enter();
+	re1 = sdb_store_regex_lookup("^host");
+	re2 = sdb_store_regex_lookup("^host");
+	fail_unless(re1 && (re1 == re2),
+			"sdb_store_regex_lookup(^host) = %p, %p; expected: "
+			"the same (cached) regex", re1, re2);
+	fail_unless(sdb_store_regex_exec(re1, "host1"),
+			"sdb_store_regex_exec(^host, host1) did not match");
+	sdb_epoch_exit();
+
+	/* the cache is bounded and keeps working when full; evicted entries
+	 * remain valid until leaving the critical section */
+	sdb_epoch_enter();
+	re1 = sdb_store_regex_lookup("^host");
+	for (i = 0; i < 1000; ++i) {
+		snprintf(pattern, sizeof(pattern), "^host%d$", i);
+		re2 = sdb_store_regex_lookup(pattern);
+		fail_unless(re2 != NULL,
+				"sdb_store_regex_lookup(%s) = NULL; expected: <regex>",
+				pattern);
+		snprintf(pattern, sizeof(pattern), "host%d", i);
+		fail_unless(sdb_store_regex_exec(re2, pattern),
+				"sdb_store_regex_exec(^%s$, %s) did not match",
+				pattern, pattern);
+	}
+	fail_unless(sdb_store_regex_exec(re1, "host1"),
+			"sdb_store_regex_exec(^host, host1) did not match "
+			"after evicting the regex");
+	sdb_epoch_exit();
+}
+END_TEST
+
+static void *
+lookup_thread(void __attribute__((unused)) *arg)
+{
+	char pattern[32], value[32];
+	int i;
+
+	for (i = 0; i < 10000; ++i) {
+		const sdb_store_regex_t *re;
+
+		snprintf(pattern, sizeof(pattern), "^host%d$", i % 512);
+		snprintf(value, sizeof(value), "HOST%d", i % 512);
+
+		sdb_epoch_enter();
+		re = sdb_store_regex_lookup(pattern);
+		fail_unless(re && sdb_store_regex_exec(re, value),
+				"sdb_store_regex_exec(%s, %s) did not match",
+				pattern, value);
+		sdb_epoch_exit();
+	}
+	return NULL;
+} /* lookup_thread */
+
+START_TEST(test_regex_cache_threads)
+{
+	pthread_t threads[4];
+	size_t i;
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(threads); ++i)
+		pthread_create(threads + i, NULL, lookup_thread, NULL);
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(threads); ++i)
+		pthread_join(threads[i], NULL);
+}
+END_TEST
+
+TEST_MAIN("core::store_regex")
+{
+	TCase *tc = tcase_create("core");
+	tcase_add_test(tc, test_regex_exec);
+	tcase_add_test(tc, test_regex_invalid);
+	tcase_add_test(tc, test_regex_cache);
+	tcase_add_test(tc, test_regex_cache_threads);
+	ADD_TCASE(tc);
+}
+TEST_MAIN_END
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,249 @@
+/*
+ * SysDB - t/unit/core/store_snapshot_test.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/store.h"
+#include "core/store-private.h"
+#include "testutils.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char snapshot[1024];
+
+static void
+setup(void)
+{
+	sdb_store_snapshot_obj_t obj;
+	sdb_metric_store_t store = { "dummy-type", "dummy-id" };
+	sdb_data_t datum;
+
+	snprintf(snapshot, sizeof(snapshot), "%s/sysdb-snapshot-test.%d",
+			P_tmpdir, (int)getpid());
+
+	sdb_store_host("h1", SECS_TO_SDB_TIME(10));
+	sdb_store_host("h1", SECS_TO_SDB_TIME(20));
+	sdb_store_host("h2", SECS_TO_SDB_TIME(30));
+
+	datum.type = SDB_TYPE_STRING;
+	datum.data.string = "v1";
+	sdb_store_attribute("h1", "k1", &datum, SECS_TO_SDB_TIME(10));
+	datum.type = SDB_TYPE_INTEGER;
+	datum.data.integer = 42;
+	sdb_store_attribute("h1", "k2", &datum, SECS_TO_SDB_TIME(10));
+
+	sdb_store_service("h1", "s1", SECS_TO_SDB_TIME(10));
+	datum.type = SDB_TYPE_DECIMAL;
+	datum.data.decimal = 4711.0;
+	sdb_store_service_attr("h1", "s1", "k1", &datum, SECS_TO_SDB_TIME(15));
+
+	sdb_store_metric("h2", "m1", &store, SECS_TO_SDB_TIME(20));
+	sdb_store_metric("h2", "m2", NULL, SECS_TO_SDB_TIME(20));
+	datum.type = SDB_TYPE_STRING;
+	datum.data.string = "v2";
+	sdb_store_metric_attr("h2", "m1", "k1", &datum, SECS_TO_SDB_TIME(25));
+
+	/* objects provided by backends */
+	memset(&obj, 0, sizeof(obj));
+	obj.type = SDB_HOST;
+	obj.hostname = obj.name = "h3";
+	obj.last_update = SECS_TO_SDB_TIME(40);
+	obj.interval = SECS_TO_SDB_TIME(5);
+	obj.backends = ((uint64_t)1 << sdb_store_backend_id("b1"))
+		| ((uint64_t)1 << sdb_store_backend_id("b2"));
+	sdb_store_restore(&obj);
+} /* setup */
+
+static void
+teardown(void)
+{
+	unlink(snapshot);
+	sdb_store_clear();
+} /* teardown */
+
+static int
+scan_tojson(sdb_store_obj_t *obj, sdb_store_matcher_t *filter,
+		void *user_data)
+{
+	sdb_store_json_formatter_t *f = user_data;
+	return sdb_store_json_emit_full(f, obj, filter);
+} /* scan_tojson */
+
+static char *
+store_tojson(void)
+{
+	sdb_strbuf_t *buf = sdb_strbuf_create(0);
+	sdb_store_json_formatter_t *f;
+	char *json;
+
+	f = sdb_store_json_formatter(buf, SDB_HOST, SDB_WANT_ARRAY);
+	sdb_store_scan(SDB_HOST, NULL, NULL, scan_tojson, f);
+	sdb_store_json_finish(f);
+	free(f);
+
+	json = strdup(sdb_strbuf_string(buf));
+	sdb_strbuf_destroy(buf);
+	return json;
+} /* store_tojson */
+
+START_TEST(test_snapshot_roundtrip)
+{
+	sdb_store_obj_t *host, *metric;
+	char *before, *after;
+	int status;
+
+	before = store_tojson();
+
+	status = sdb_store_snapshot_write(snapshot);
+	fail_unless(status == 0,
+			"sdb_store_snapshot_write(%s) = %d; expected: 0",
+			snapshot, status);
+
+	sdb_store_clear();
+	status = sdb_store_snapshot_load(snapshot);
+	fail_unless(status == 0,
+			"sdb_store_snapshot_load(%s) = %d; expected: 0",
+			snapshot, status);
+
+	after = store_tojson();
+	fail_unless(! strcmp(before, after),
+			"sdb_store_snapshot_load() restored store:\n%s\nexpected:\n%s",
+			after, before);
+
+	/* the metric store is not included in the JSON representation */
+	host = sdb_store_get_host("h2");
+	metric = sdb_store_get_child(host, SDB_METRIC, "m1");
+	fail_unless(metric != NULL,
+			"sdb_store_get_child(h2, METRIC, m1) = NULL; expected: <metric>");
+	fail_unless(METRIC(metric)->store.type
+				&& (! strcmp(METRIC(metric)->store.type, "dummy-type"))
+				&& METRIC(metric)->store.id
+				&& (! strcmp(METRIC(metric)->store.id, "dummy-id")),
+			"sdb_store_snapshot_load() restored metric store %s/%s; "
+			"expected: dummy-type/dummy-id",
+			METRIC(metric)->store.type, METRIC(metric)->store.id);
+	sdb_object_deref(SDB_OBJ(metric));
+	sdb_object_deref(SDB_OBJ(host));
+
+	free(before);
+	free(after);
+}
+END_TEST
+
+START_TEST(test_snapshot_newer)
+{
+	sdb_store_obj_t *host;
+	int status;
+
+	status = sdb_store_snapshot_write(snapshot);
+	fail_unless(status == 0,
+			"sdb_store_snapshot_write(%s) = %d; expected: 0",
+			snapshot, status);
+
+	/* objects updated since taking the snapshot are left untouched */
+	sdb_store_host("h1", SECS_TO_SDB_TIME(100));
+	status = sdb_store_snapshot_load(snapshot);
+	fail_unless(status == 0,
+			"sdb_store_snapshot_load(%s) = %d; expected: 0",
+			snapshot, status);
+
+	host = sdb_store_get_host("h1");
+	fail_unless(host != NULL,
+			"sdb_store_get_host(h1) = NULL; expected: <host>");
+	fail_unless(host->last_update == SECS_TO_SDB_TIME(100),
+			"sdb_store_snapshot_load() updated h1 to last_update=%"PRIsdbTIME
+			"; expected: %"PRIsdbTIME, host->last_update,
+			SECS_TO_SDB_TIME(100));
+	sdb_object_deref(SDB_OBJ(host));
+}
+END_TEST
+
+START_TEST(test_snapshot_invalid)
+{
+	char buf[4096];
+	size_t len;
+	FILE *fh;
+	int status;
+
+	/* a missing snapshot is not an error */
+	unlink(snapshot);
+	status = sdb_store_snapshot_load(snapshot);
+	fail_unless(status == 0,
+			"sdb_store_snapshot_load(<missing>) = %d; expected: 0", status);
+
+	fh = fopen(snapshot, "w");
+	fail_unless(fh != NULL, "INTERNAL ERROR: failed to create %s", snapshot);
+	fputs("garbage", fh);
+	fclose(fh);
+	status = sdb_store_snapshot_load(snapshot);
+	fail_unless(status < 0,
+			"sdb_store_snapshot_load(<garbage>) = %d; expected: <0", status);
+
+	/* truncated snapshots restore as much as possible */
+	status = sdb_store_snapshot_write(snapshot);
+	fail_unless(status == 0,
+			"sdb_store_snapshot_write(%s) = %d; expected: 0",
+			snapshot, status);
+	fh = fopen(snapshot, "r");
+	fail_unless(fh != NULL, "INTERNAL ERROR: failed to open %s", snapshot);
+	len = fread(buf, 1, sizeof(buf), fh);
+	fclose(fh);
+	fail_unless((len > 100) && (len < sizeof(buf)),
+			"INTERNAL ERROR: unexpected snapshot size %zu", len);
+
+	fh = fopen(snapshot, "w");
+	fail_unless(fh != NULL, "INTERNAL ERROR: failed to create %s", snapshot);
+	fwrite(buf, 1, len - 10, fh);
+	fclose(fh);
+
+	sdb_store_clear();
+	status = sdb_store_snapshot_load(snapshot);
+	fail_unless(status < 0,
+			"sdb_store_snapshot_load(<truncated>) = %d; expected: <0", status);
+	fail_unless(sdb_store_has_host("h1"),
+			"sdb_store_snapshot_load(<truncated>) did not restore h1");
+}
+END_TEST
+
+TEST_MAIN("core::store_snapshot")
+{
+	TCase *tc = tcase_create("core");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_snapshot_roundtrip);
+	tcase_add_test(tc, test_snapshot_newer);
+	tcase_add_test(tc, test_snapshot_invalid);
+	ADD_TCASE(tc);
+}
+TEST_MAIN_END
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
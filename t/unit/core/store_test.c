@@ -31,9 +31,13 @@
 
 #include "core/store.h"
 #include "core/store-private.h"
+#include "utils/epoch.h"
 #include "testutils.h"
 
 #include <check.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <string.h>
 #include <strings.h>
 
@@ -765,6 +769,1097 @@ START_TEST(test_scan)
 }
 END_TEST
 
+static int
+scan_order(sdb_store_obj_t *obj, sdb_store_matcher_t __attribute__((unused)) *filter,
+		void *user_data)
+{
+	const char **prev = user_data;
+
+	fail_unless((! *prev) || (strcasecmp(*prev, SDB_OBJ(obj)->name) < 0),
+			"sdb_store_scan returned '%s' after '%s'; expected: "
+			"objects sorted by name", SDB_OBJ(obj)->name, *prev);
+	*prev = SDB_OBJ(obj)->name;
+	return 0;
+} /* scan_order */
+
+START_TEST(test_shards)
+{
+	const char *names[] = {
+		"k", "B", "x", "a", "Q", "m", "c", "z", "h", "y", "D", "p",
+	};
+	size_t shards[] = { 1, 3, 16, 256 };
+	size_t i, j;
+	int check;
+
+	check = sdb_store_set_shards(0);
+	fail_unless((check < 0) && (errno == EINVAL),
+			"sdb_store_set_shards(0) = %d (errno: %d); expected: <0 "
+			"(EINVAL)", check, errno);
+	check = sdb_store_set_shards(257);
+	fail_unless((check < 0) && (errno == EINVAL),
+			"sdb_store_set_shards(257) = %d (errno: %d); expected: <0 "
+			"(EINVAL)", check, errno);
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(shards); ++i) {
+		const char *prev = NULL;
+
+		sdb_store_clear();
+		check = sdb_store_set_shards(shards[i]);
+		fail_unless(check == 0,
+				"sdb_store_set_shards(%zu) = %d; expected: 0",
+				shards[i], check);
+
+		for (j = 0; j < SDB_STATIC_ARRAY_LEN(names); ++j)
+			sdb_store_host(names[j], 1);
+		for (j = 0; j < SDB_STATIC_ARRAY_LEN(names); ++j)
+			fail_unless(sdb_store_has_host(names[j]),
+					"sdb_store_has_host(%s) = false (%zu shards); "
+					"expected: true", names[j], shards[i]);
+
+		check = sdb_store_scan(SDB_HOST, /* m, filter = */ NULL, NULL,
+				scan_order, &prev);
+		fail_unless(check == 0,
+				"sdb_store_scan(HOST) = %d (%zu shards); expected: 0",
+				check, shards[i]);
+		fail_unless(prev && (! strcasecmp(prev, "z")),
+				"sdb_store_scan(HOST) ended at '%s'; expected: 'z'", prev);
+
+		if (shards[i] == 1)
+			continue;
+
+		check = sdb_store_set_shards(1);
+		fail_unless((check < 0) && (errno == EBUSY),
+				"sdb_store_set_shards(1) on populated store = %d "
+				"(errno: %d); expected: <0 (EBUSY)", check, errno);
+		check = sdb_store_set_shards(shards[i]);
+		fail_unless(check == 0,
+				"sdb_store_set_shards(%zu) (unchanged) on populated store "
+				"= %d; expected: 0", shards[i], check);
+	}
+}
+END_TEST
+
+static int
+scan_names(sdb_store_obj_t *obj, sdb_store_matcher_t __attribute__((unused)) *filter,
+		void *user_data)
+{
+	char *names = user_data;
+
+	if (*names)
+		strcat(names, ",");
+	strcat(names, SDB_OBJ(obj)->name);
+	return 0;
+} /* scan_names */
+
+START_TEST(test_index)
+{
+	char *fra_ber[] = { "fra1", "ber1" };
+	char *ams_ber[] = { "ams1", "ber1" };
+	sdb_data_t values[] = {
+		{ SDB_TYPE_STRING, { .string = "fra1" } },
+		{ SDB_TYPE_STRING, { .string = "ams1" } },
+		{ SDB_TYPE_STRING, { .string = "FRA1" } },
+		{ SDB_TYPE_INTEGER, { .integer = 1 } },
+		{ SDB_TYPE_STRING | SDB_TYPE_ARRAY,
+			{ .array = { SDB_STATIC_ARRAY_LEN(fra_ber), fra_ber } } },
+	};
+	sdb_data_t in_fra_ber = {
+		SDB_TYPE_STRING | SDB_TYPE_ARRAY,
+		{ .array = { SDB_STATIC_ARRAY_LEN(fra_ber), fra_ber } },
+	};
+	sdb_data_t in_ams_ber = {
+		SDB_TYPE_STRING | SDB_TYPE_ARRAY,
+		{ .array = { SDB_STATIC_ARRAY_LEN(ams_ber), ams_ber } },
+	};
+	sdb_data_t h1 = { SDB_TYPE_STRING, { .string = "h1" } };
+
+	struct {
+		sdb_store_matcher_op_cb op;
+		sdb_data_t *value;
+		/* optional second condition */
+		sdb_store_matcher_t *(*logical)(sdb_store_matcher_t *,
+				sdb_store_matcher_t *);
+		int field;
+		sdb_data_t *value2;
+		const char *expected;
+	} golden_data[] = {
+		{ sdb_store_eq_matcher, &values[0], NULL, 0, NULL, "h1,h3" },
+		{ sdb_store_eq_matcher, &values[1], NULL, 0, NULL, "h2" },
+		{ sdb_store_eq_matcher, &values[3], NULL, 0, NULL, "h4" },
+		{ sdb_store_in_matcher, &in_fra_ber, NULL, 0, NULL, "h1,h3,h5" },
+		{ sdb_store_in_matcher, &in_ams_ber, NULL, 0, NULL, "h2" },
+		{ sdb_store_eq_matcher, &values[0], sdb_store_con_matcher,
+			SDB_FIELD_NAME, &h1, "h1" },
+		{ sdb_store_eq_matcher, &values[0], sdb_store_dis_matcher,
+			-1, &values[1], "h1,h2,h3" },
+		{ sdb_store_eq_matcher, &values[0], sdb_store_dis_matcher,
+			SDB_FIELD_NAME, &values[1], "h1,h3" },
+	};
+
+	size_t i, pass;
+	int check;
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(values); ++i) {
+		char name[] = { 'h', (char)('1' + i), '\0' };
+		sdb_store_host(name, 1);
+		sdb_store_attribute(name, "dc", &values[i], 1);
+	}
+	sdb_store_host("h6", 1);
+
+	/* first pass: full scan; second pass: using the index */
+	for (pass = 0; pass < 2; ++pass) {
+		if (pass) {
+			check = sdb_store_index_attribute("dc");
+			fail_unless(check == 0,
+					"sdb_store_index_attribute(dc) = %d; expected: 0", check);
+		}
+
+		for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+			sdb_store_expr_t *attr, *value;
+			sdb_store_matcher_t *m;
+			char names[256] = "";
+
+			attr = sdb_store_expr_attrvalue("dc");
+			value = sdb_store_expr_constvalue(golden_data[i].value);
+			m = golden_data[i].op(attr, value);
+			sdb_object_deref(SDB_OBJ(attr));
+			sdb_object_deref(SDB_OBJ(value));
+
+			if (golden_data[i].logical) {
+				sdb_store_matcher_t *m2, *tmp;
+
+				if (golden_data[i].field >= 0)
+					attr = sdb_store_expr_fieldvalue(golden_data[i].field);
+				else
+					attr = sdb_store_expr_attrvalue("dc");
+				value = sdb_store_expr_constvalue(golden_data[i].value2);
+				m2 = sdb_store_eq_matcher(attr, value);
+				sdb_object_deref(SDB_OBJ(attr));
+				sdb_object_deref(SDB_OBJ(value));
+
+				tmp = golden_data[i].logical(m, m2);
+				sdb_object_deref(SDB_OBJ(m));
+				sdb_object_deref(SDB_OBJ(m2));
+				m = tmp;
+			}
+			fail_unless(m != NULL,
+					"INTERNAL ERROR: failed to create matcher %zu", i);
+
+			check = sdb_store_scan(SDB_HOST, m, /* filter = */ NULL,
+					scan_names, names);
+			fail_unless(check == 0,
+					"sdb_store_scan(HOST, <matcher %zu>) = %d (pass %zu); "
+					"expected: 0", i, check, pass);
+			fail_unless(! strcmp(names, golden_data[i].expected),
+					"sdb_store_scan(HOST, <matcher %zu>) returned %s "
+					"(pass %zu); expected: %s", i, names, pass,
+					golden_data[i].expected);
+			sdb_object_deref(SDB_OBJ(m));
+		}
+	}
+
+	/* updates are reflected in the index */
+	sdb_store_attribute("h1", "dc", &values[1], 2);
+	sdb_store_host("h7", 1);
+	sdb_store_attribute("h7", "dc", &values[0], 1);
+	for (i = 0; i < 2; ++i) {
+		const char *expected[] = { "h3,h7", "h1,h2" };
+		sdb_store_expr_t *attr, *value;
+		sdb_store_matcher_t *m;
+		char names[256] = "";
+
+		attr = sdb_store_expr_attrvalue("dc");
+		value = sdb_store_expr_constvalue(&values[i]);
+		m = sdb_store_eq_matcher(attr, value);
+		sdb_object_deref(SDB_OBJ(attr));
+		sdb_object_deref(SDB_OBJ(value));
+
+		check = sdb_store_scan(SDB_HOST, m, /* filter = */ NULL,
+				scan_names, names);
+		fail_unless((check == 0) && (! strcmp(names, expected[i])),
+				"sdb_store_scan(HOST, dc = %s) after update = %d, %s; "
+				"expected: 0, %s", values[i].data.string, check, names,
+				expected[i]);
+		sdb_object_deref(SDB_OBJ(m));
+	}
+}
+END_TEST
+
+START_TEST(test_names_index)
+{
+	const char *hosts[] = {
+		"web-1-prod", "web-2-prod", "web-3-dev", "db-1-prod", "WEB-4-PROD",
+	};
+	struct {
+		int type;
+		const char *re;
+		const char *expected;
+	} golden_data[] = {
+		{ SDB_HOST, "web-.*-prod", "web-1-prod,web-2-prod,WEB-4-PROD" },
+		{ SDB_HOST, "^db", "db-1-prod" },
+		{ SDB_HOST, "1-prod|dev", "db-1-prod,web-1-prod,web-3-dev" },
+		{ SDB_HOST, "(web|db)-1", "db-1-prod,web-1-prod" },
+		{ SDB_HOST, "web-[12]-prod", "web-1-prod,web-2-prod" },
+		{ SDB_HOST, "we+b-1", "web-1-prod" },
+		{ SDB_HOST, "webx?-1", "web-1-prod" },
+		{ SDB_HOST, "b-4\\-pr", "WEB-4-PROD" },
+		{ SDB_HOST, "eb-.-prod$", "web-1-prod,web-2-prod,WEB-4-PROD" },
+		{ SDB_HOST, "nomatch", "" },
+		{ SDB_SERVICE, "http-.*end", "http-backend,http-frontend,"
+			"http-backend,http-frontend" },
+		{ SDB_SERVICE, "ssh", "ssh" },
+		{ SDB_METRIC, "load", "load" },
+	};
+
+	size_t i, pass;
+	int check;
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(hosts); ++i)
+		sdb_store_host(hosts[i], 1);
+	sdb_store_service("web-1-prod", "http-frontend", 1);
+	sdb_store_service("web-1-prod", "http-backend", 1);
+	sdb_store_service("db-1-prod", "ssh", 1);
+	sdb_store_metric("db-1-prod", "load", /* store */ NULL, 1);
+
+	/* first pass: full scan; second pass: using the index */
+	for (pass = 0; pass < 2; ++pass) {
+		if (pass) {
+			check = sdb_store_index_names();
+			fail_unless(check == 0,
+					"sdb_store_index_names() = %d; expected: 0", check);
+
+			/* objects added later on are indexed as well */
+			sdb_store_service("web-2-prod", "http-frontend", 1);
+			sdb_store_service("web-2-prod", "http-backend", 1);
+		}
+
+		for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+			sdb_data_t re = { SDB_TYPE_STRING, { .string = NULL } };
+			sdb_store_expr_t *field, *value;
+			sdb_store_matcher_t *m;
+			char names[256] = "";
+			const char *expected = golden_data[i].expected;
+
+			re.data.string = (char *)golden_data[i].re;
+			field = sdb_store_expr_fieldvalue(SDB_FIELD_NAME);
+			value = sdb_store_expr_constvalue(&re);
+			m = sdb_store_regex_matcher(field, value);
+			sdb_object_deref(SDB_OBJ(field));
+			sdb_object_deref(SDB_OBJ(value));
+			fail_unless(m != NULL,
+					"INTERNAL ERROR: failed to create matcher =~ %s",
+					golden_data[i].re);
+
+			/* services of web-2-prod have only been added in the 2nd pass */
+			if ((! pass) && (golden_data[i].type == SDB_SERVICE)
+					&& (! strcmp(golden_data[i].re, "http-.*end")))
+				expected = "http-backend,http-frontend";
+
+			check = sdb_store_scan(golden_data[i].type, m, /* filter = */ NULL,
+					scan_names, names);
+			fail_unless(check == 0,
+					"sdb_store_scan(%s, name =~ %s) = %d (pass %zu); "
+					"expected: 0", SDB_STORE_TYPE_TO_NAME(golden_data[i].type),
+					golden_data[i].re, check, pass);
+			fail_unless(! strcmp(names, expected),
+					"sdb_store_scan(%s, name =~ %s) returned %s (pass %zu); "
+					"expected: %s", SDB_STORE_TYPE_TO_NAME(golden_data[i].type),
+					golden_data[i].re, names, pass, expected);
+			sdb_object_deref(SDB_OBJ(m));
+		}
+	}
+}
+END_TEST
+
+START_TEST(test_expire)
+{
+	sdb_time_t now = sdb_gettime();
+	sdb_data_t dc = { SDB_TYPE_STRING, { .string = "fra1" } };
+	sdb_time_t steps[] = {
+		now,
+		now + SECS_TO_SDB_TIME(50),
+		now + SECS_TO_SDB_TIME(150),
+	};
+	struct {
+		const char *host;
+		int type;
+		const char *name;
+		bool present[3];
+	} golden_data[] = {
+		/* stale; re-created after the first step */
+		{ "h1", SDB_HOST,      NULL, { 0, 1, 0 } },
+		{ "h1", SDB_ATTRIBUTE, "dc", { 0, 0, 0 } },
+		{ "h2", SDB_HOST,      NULL, { 1, 1, 0 } },
+		{ "h2", SDB_ATTRIBUTE, "dc", { 0, 0, 0 } },
+		/* kept alive by its service */
+		{ "h3", SDB_HOST,      NULL, { 1, 1, 0 } },
+		{ "h3", SDB_SERVICE,   "s1", { 1, 1, 0 } },
+		/* missed two updates */
+		{ "h4", SDB_HOST,      NULL, { 1, 0, 0 } },
+	};
+
+	size_t i, step;
+	int check;
+
+	check = sdb_store_index_attribute("dc");
+	fail_unless(check == 0,
+			"sdb_store_index_attribute(dc) = %d; expected: 0", check);
+	check = sdb_store_set_expiry(2, SECS_TO_SDB_TIME(100));
+	fail_unless(check == 0,
+			"sdb_store_set_expiry(2, 100s) = %d; expected: 0", check);
+
+	sdb_store_host("h1", now - SECS_TO_SDB_TIME(200));
+	sdb_store_attribute("h1", "dc", &dc, now - SECS_TO_SDB_TIME(200));
+	sdb_store_host("h2", now);
+	sdb_store_attribute("h2", "dc", &dc, now - SECS_TO_SDB_TIME(200));
+	sdb_store_host("h3", now - SECS_TO_SDB_TIME(200));
+	sdb_store_service("h3", "s1", now);
+	sdb_store_host("h4", now - SECS_TO_SDB_TIME(30));
+	sdb_store_host("h4", now - SECS_TO_SDB_TIME(20));
+	sdb_store_host("h4", now - SECS_TO_SDB_TIME(10));
+
+	for (step = 0; step < SDB_STATIC_ARRAY_LEN(steps); ++step) {
+		check = sdb_store_expire(steps[step]);
+		fail_unless(check > 0,
+				"sdb_store_expire(<step %zu>) = %d; expected: >0",
+				step, check);
+
+		for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+			sdb_store_obj_t *obj;
+
+			obj = sdb_store_get_host(golden_data[i].host);
+			if (obj && (golden_data[i].type != SDB_HOST)) {
+				sdb_store_obj_t *tmp = sdb_store_get_child(obj,
+						golden_data[i].type, golden_data[i].name);
+				sdb_object_deref(SDB_OBJ(obj));
+				obj = tmp;
+			}
+
+			fail_unless((obj != NULL) == golden_data[i].present[step],
+					"after sdb_store_expire(<step %zu>), %s %s.%s is %s; "
+					"expected: %s", step,
+					SDB_STORE_TYPE_TO_NAME(golden_data[i].type),
+					golden_data[i].host,
+					golden_data[i].name ? golden_data[i].name : "",
+					obj ? "present" : "missing",
+					golden_data[i].present[step] ? "present" : "missing");
+			sdb_object_deref(SDB_OBJ(obj));
+		}
+
+		if (! step) {
+			sdb_store_expr_t *attr, *value;
+			sdb_store_matcher_t *m;
+			char names[256] = "";
+
+			/* expired objects are removed from the index */
+			attr = sdb_store_expr_attrvalue("dc");
+			value = sdb_store_expr_constvalue(&dc);
+			m = sdb_store_eq_matcher(attr, value);
+			sdb_object_deref(SDB_OBJ(attr));
+			sdb_object_deref(SDB_OBJ(value));
+
+			check = sdb_store_scan(SDB_HOST, m, /* filter = */ NULL,
+					scan_names, names);
+			fail_unless((check == 0) && (! strcmp(names, "")),
+					"sdb_store_scan(HOST, dc = fra1) after expiry = %d, %s; "
+					"expected: 0, <empty>", check, names);
+			sdb_object_deref(SDB_OBJ(m));
+
+			sdb_store_host("h1", now + SECS_TO_SDB_TIME(40));
+		}
+	}
+
+	sdb_store_set_expiry(0, 0);
+}
+END_TEST
+
+START_TEST(test_batch)
+{
+	sdb_data_t datum = { SDB_TYPE_INTEGER, { .integer = 42 } };
+	sdb_metric_store_t store = { "dummy-type", "dummy-id" };
+	sdb_store_batch_t *batch;
+	sdb_store_obj_t *host, *obj;
+	sdb_data_t value = SDB_DATA_INIT;
+	int check;
+
+	struct {
+		const char *host;
+		int type;
+		const char *name;
+		sdb_time_t last_update;
+	} golden_data[] = {
+		{ "h1", SDB_HOST,      NULL, 2 },
+		{ "h1", SDB_ATTRIBUTE, "k1", 1 },
+		{ "h1", SDB_METRIC,    "m1", 1 },
+		{ "h1", SDB_SERVICE,   "s1", 1 },
+		{ "h2", SDB_HOST,      NULL, 1 },
+		{ "h2", SDB_METRIC,    "m1", 3 },
+	};
+	size_t i;
+
+	sdb_store_clear();
+
+	batch = sdb_store_batch_begin();
+	fail_unless(batch != NULL,
+			"sdb_store_batch_begin() = NULL; expected: <batch>");
+
+	/* children are added before their parents on purpose */
+	check = sdb_store_batch_metric_attr(batch, "h1", "m1", "k1", &datum, 1);
+	fail_unless(check == 0,
+			"sdb_store_batch_metric_attr() = %d; expected: 0", check);
+	sdb_store_batch_service_attr(batch, "h1", "s1", "k1", &datum, 1);
+	sdb_store_batch_metric(batch, "h1", "m1", &store, 1);
+	sdb_store_batch_service(batch, "h1", "s1", 1);
+	sdb_store_batch_attribute(batch, "h1", "k1", &datum, 1);
+	sdb_store_batch_host(batch, "h1", 1);
+	sdb_store_batch_host(batch, "h1", 2);
+	sdb_store_batch_metric(batch, "h2", "m1", NULL, 3);
+	sdb_store_batch_host(batch, "h2", 1);
+	sdb_store_batch_metric(batch, "h2", "m1", NULL, 2);
+	/* values are copied */
+	datum.data.integer = 23;
+	/* unknown parents fail while all other updates are applied */
+	sdb_store_batch_service(batch, "h3", "s1", 1);
+
+	check = sdb_store_batch_commit(batch);
+	fail_unless(check < 0,
+			"sdb_store_batch_commit(<update of unknown host>) = %d; "
+			"expected: <0", check);
+	fail_unless(! sdb_store_has_host("h3"),
+			"sdb_store_batch_commit() created host h3 implicitly");
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+		host = sdb_store_get_host(golden_data[i].host);
+		obj = host;
+		if (host && (golden_data[i].type != SDB_HOST))
+			obj = sdb_store_get_child(host,
+					golden_data[i].type, golden_data[i].name);
+
+		fail_unless(obj != NULL,
+				"sdb_store_batch_commit() did not store %s %s.%s",
+				SDB_STORE_TYPE_TO_NAME(golden_data[i].type),
+				golden_data[i].host,
+				golden_data[i].name ? golden_data[i].name : "");
+		fail_unless(obj->last_update == golden_data[i].last_update,
+				"sdb_store_batch_commit() stored %s %s.%s with "
+				"last_update=%"PRIsdbTIME"; expected: %"PRIsdbTIME,
+				SDB_STORE_TYPE_TO_NAME(golden_data[i].type),
+				golden_data[i].host,
+				golden_data[i].name ? golden_data[i].name : "",
+				obj->last_update, golden_data[i].last_update);
+
+		if (obj != host)
+			sdb_object_deref(SDB_OBJ(obj));
+		sdb_object_deref(SDB_OBJ(host));
+	}
+
+	host = sdb_store_get_host("h1");
+	obj = sdb_store_get_child(host, SDB_METRIC, "m1");
+	check = sdb_store_get_attr(obj, "k1", &value, /* filter = */ NULL);
+	fail_unless((check == 0) && (value.type == SDB_TYPE_INTEGER)
+				&& (value.data.integer == 42),
+			"sdb_store_batch_commit() stored metric attribute h1.m1.k1 = "
+			"%"PRId64" (status %d); expected: 42",
+			value.data.integer, check);
+	fail_unless(METRIC(obj)->store.id
+				&& (! strcmp(METRIC(obj)->store.id, "dummy-id")),
+			"sdb_store_batch_commit() stored metric store %s; "
+			"expected: dummy-id", METRIC(obj)->store.id);
+	sdb_data_free_datum(&value);
+	sdb_object_deref(SDB_OBJ(obj));
+	sdb_object_deref(SDB_OBJ(host));
+}
+END_TEST
+
+static char watch_events[1024];
+
+static void
+watch_cb(sdb_store_obj_t *obj, int event, sdb_object_t *user_data)
+{
+	size_t len = strlen(watch_events);
+
+	fail_unless(user_data != NULL,
+			"watch callback called without user-data");
+	snprintf(watch_events + len, sizeof(watch_events) - len, "%s:%s:%s;",
+			event == SDB_STORE_EXPIRED ? "expired" : "updated",
+			SDB_STORE_TYPE_TO_NAME(obj->type), SDB_OBJ(obj)->name);
+} /* watch_cb */
+
+START_TEST(test_watch)
+{
+	sdb_data_t datum = { SDB_TYPE_INTEGER, { .integer = 42 } };
+	sdb_time_t now = sdb_gettime();
+	sdb_object_t *hosts, *services;
+	int check;
+
+	const char *expected =
+		"updated:host:h1;"
+		/* host attribute */
+		"updated:host:h1;"
+		/* service: reported to both watchers */
+		"updated:host:h1;updated:service:s1;"
+		/* service attribute */
+		"updated:host:h1;updated:service:s1;"
+		/* old value: no update */
+		/* expired service attribute and service */
+		"updated:host:h1;updated:service:s1;"
+		"updated:host:h1;expired:service:s1;";
+
+	hosts = sdb_object_create_T("hosts", sdb_object_t);
+	services = sdb_object_create_T("services", sdb_object_t);
+	watch_events[0] = '\0';
+
+	check = sdb_store_watch(SDB_ATTRIBUTE, watch_cb, hosts);
+	fail_unless(check < 0,
+			"sdb_store_watch(ATTRIBUTE) = %d; expected: <0", check);
+	check = sdb_store_watch(SDB_HOST, watch_cb, hosts);
+	fail_unless(check == 0,
+			"sdb_store_watch(HOST) = %d; expected: 0", check);
+	check = sdb_store_watch(SDB_SERVICE, watch_cb, services);
+	fail_unless(check == 0,
+			"sdb_store_watch(SERVICE) = %d; expected: 0", check);
+	fail_unless(hosts->ref_cnt == 2,
+			"sdb_store_watch() did not take a reference to user-data");
+
+	sdb_store_set_expiry(0, SECS_TO_SDB_TIME(100));
+	sdb_store_host("h1", now);
+	sdb_store_attribute("h1", "k1", &datum, now);
+	sdb_store_service("h1", "s1", now - SECS_TO_SDB_TIME(200));
+	sdb_store_service_attr("h1", "s1", "k1", &datum,
+			now - SECS_TO_SDB_TIME(200));
+	sdb_store_service("h1", "s1", now - SECS_TO_SDB_TIME(300));
+	sdb_store_expire(now);
+	sdb_store_set_expiry(0, 0);
+
+	fail_unless(! strcmp(watch_events, expected),
+			"store watchers reported events '%s'; expected: '%s'",
+			watch_events, expected);
+
+	check = sdb_store_unwatch(watch_cb, hosts);
+	fail_unless(check == 0,
+			"sdb_store_unwatch(hosts) = %d; expected: 0", check);
+	check = sdb_store_unwatch(watch_cb, hosts);
+	fail_unless(check < 0,
+			"sdb_store_unwatch(hosts) (again) = %d; expected: <0", check);
+	check = sdb_store_unwatch(watch_cb, services);
+	fail_unless(check == 0,
+			"sdb_store_unwatch(services) = %d; expected: 0", check);
+	fail_unless(hosts->ref_cnt == 1,
+			"sdb_store_unwatch() did not release user-data");
+
+	watch_events[0] = '\0';
+	sdb_store_host("h1", now + 1);
+	fail_unless(watch_events[0] == '\0',
+			"unregistered watchers reported events '%s'", watch_events);
+
+	sdb_object_deref(hosts);
+	sdb_object_deref(services);
+}
+END_TEST
+
+START_TEST(test_generation)
+{
+	sdb_data_t datum = { SDB_TYPE_INTEGER, { .integer = 42 } };
+	sdb_time_t now = sdb_gettime();
+	sdb_store_obj_t *host, *svc;
+	uint64_t h_gen, s_gen, gen;
+
+	sdb_store_host("h1", now);
+	sdb_store_host("h2", now);
+	sdb_store_service("h1", "s1", now);
+
+	host = sdb_store_get_host("h1");
+	ck_assert(host != NULL);
+	svc = sdb_store_get_child(host, SDB_SERVICE, "s1");
+	ck_assert(svc != NULL);
+	h_gen = sdb_store_get_generation(host);
+	s_gen = sdb_store_get_generation(svc);
+	fail_unless(h_gen >= s_gen,
+			"host generation %"PRIu64" < service generation %"PRIu64,
+			h_gen, s_gen);
+
+	/* old values don't change anything */
+	sdb_store_host("h1", now - 1);
+	sdb_store_service("h1", "s1", now - 1);
+	gen = sdb_store_get_generation(host);
+	fail_unless(gen == h_gen,
+			"stale update changed host generation from %"PRIu64" to "
+			"%"PRIu64, h_gen, gen);
+
+	/* updates of other hosts don't change anything */
+	sdb_store_host("h2", now + 1);
+	gen = sdb_store_get_generation(host);
+	fail_unless(gen == h_gen,
+			"update of another host changed host generation from "
+			"%"PRIu64" to %"PRIu64, h_gen, gen);
+
+	/* updates propagate to all ancestors */
+	sdb_store_service_attr("h1", "s1", "k1", &datum, now + 1);
+	gen = sdb_store_get_generation(svc);
+	fail_unless(gen > s_gen,
+			"service attribute update did not change service generation "
+			"(%"PRIu64")", gen);
+	s_gen = gen;
+	gen = sdb_store_get_generation(host);
+	fail_unless(gen == s_gen,
+			"service attribute update changed host generation to "
+			"%"PRIu64"; expected: %"PRIu64, gen, s_gen);
+	h_gen = gen;
+
+	/* changing an attribute value replaces the attribute */
+	datum.data.integer = 23;
+	sdb_store_service_attr("h1", "s1", "k1", &datum, now + 2);
+	gen = sdb_store_get_generation(host);
+	fail_unless(gen > h_gen,
+			"service attribute change did not change host generation "
+			"(%"PRIu64")", gen);
+	h_gen = gen;
+
+	/* expired children change their ancestors */
+	sdb_store_set_expiry(0, SECS_TO_SDB_TIME(100));
+	sdb_store_expire(now + SECS_TO_SDB_TIME(101));
+	sdb_store_set_expiry(0, 0);
+	gen = sdb_store_get_generation(host);
+	fail_unless(gen > h_gen,
+			"expired service did not change host generation (%"PRIu64")",
+			gen);
+
+	sdb_object_deref(SDB_OBJ(svc));
+	sdb_object_deref(SDB_OBJ(host));
+}
+END_TEST
+
+START_TEST(test_service_attrs)
+{
+	sdb_data_t datum = { SDB_TYPE_INTEGER, { .integer = 0 } };
+	sdb_store_obj_t *host, *svc;
+	sdb_attrs_t *attrs;
+	int i, j;
+
+	sdb_store_host("h1", 1);
+	sdb_store_service("h1", "s1", 1);
+	host = sdb_store_get_host("h1");
+	ck_assert(host != NULL);
+	svc = sdb_store_get_child(host, SDB_SERVICE, "s1");
+	ck_assert(svc != NULL);
+	attrs = &SVC(svc)->attributes;
+	fail_unless((attrs->array.ptr == NULL) && (attrs->tree == NULL),
+			"new service has attributes allocated; expected: none");
+
+	/* insert in reverse order; small sets are stored inline */
+	for (i = 2 * STORE_ATTRS_INLINE; i > 0; --i) {
+		char name[16];
+		sdb_attrs_iter_t iter;
+		size_t n = (size_t)(2 * STORE_ATTRS_INLINE - i + 1);
+
+		snprintf(name, sizeof(name), "k%02d", i);
+		datum.data.integer = i;
+		sdb_store_service_attr("h1", "s1", name, &datum, 1);
+
+		fail_unless(sdb_attrs_size(attrs) == n,
+				"sdb_attrs_size() = %zu; expected: %zu",
+				sdb_attrs_size(attrs), n);
+		fail_unless((n <= STORE_ATTRS_INLINE) == (attrs->tree == NULL),
+				"service with %zu attributes uses %s; expected: %s", n,
+				attrs->tree ? "a tree" : "an array",
+				n <= STORE_ATTRS_INLINE ? "an array" : "a tree");
+
+		sdb_store_attrs_iter(&iter, svc);
+		for (j = i; sdb_attrs_iter_has_next(&iter); ++j) {
+			sdb_store_obj_t *attr = sdb_attrs_iter_get_next(&iter);
+			snprintf(name, sizeof(name), "k%02d", j);
+			fail_unless(! strcmp(SDB_OBJ(attr)->name, name),
+					"attribute iterator returned %s; expected: %s",
+					SDB_OBJ(attr)->name, name);
+		}
+		sdb_attrs_iter_finish(&iter);
+		fail_unless(j == 2 * STORE_ATTRS_INLINE + 1,
+				"attribute iterator returned %d attributes; expected: %zu",
+				j - i, n);
+	}
+
+	for (i = 1; i <= 2 * STORE_ATTRS_INLINE; ++i) {
+		char name[16];
+		sdb_data_t value = SDB_DATA_INIT;
+
+		snprintf(name, sizeof(name), "K%02d", i);
+		fail_unless(! sdb_store_get_attr(svc, name, &value, NULL),
+				"sdb_store_get_attr(s1, %s) = -1; expected: 0", name);
+		fail_unless(value.data.integer == i,
+				"sdb_store_get_attr(s1, %s) = %"PRId64"; expected: %d",
+				name, value.data.integer, i);
+	}
+	fail_unless(sdb_store_get_attr(svc, "k00", NULL, NULL) < 0,
+			"sdb_store_get_attr(s1, <unknown>) = 0; expected: -1");
+
+	sdb_object_deref(SDB_OBJ(svc));
+	sdb_object_deref(SDB_OBJ(host));
+}
+END_TEST
+
+START_TEST(test_attrs)
+{
+	sdb_attrs_t attrs = SDB_ATTRS_INIT;
+	sdb_store_obj_t *objs[STORE_ATTRS_INLINE + 1];
+	sdb_store_obj_t *o;
+	int i;
+
+	for (i = 0; i < (int)SDB_STATIC_ARRAY_LEN(objs); ++i) {
+		char name[16];
+
+		snprintf(name, sizeof(name), "a%d", (i * 7) % 9);
+		sdb_store_host(name, 1);
+		objs[i] = sdb_store_get_host(name);
+		ck_assert(objs[i] != NULL);
+	}
+
+	for (i = 0; i < STORE_ATTRS_INLINE; ++i)
+		fail_unless(! sdb_attrs_insert(&attrs, objs[i]),
+				"sdb_attrs_insert(%s) = -1; expected: 0",
+				SDB_OBJ(objs[i])->name);
+	fail_unless(sdb_attrs_insert(&attrs, objs[0]) < 0,
+			"sdb_attrs_insert(<duplicate>) = 0; expected: -1");
+	fail_unless(attrs.array.ptr && (! attrs.tree),
+			"attribute set with %d entries is not an array",
+			STORE_ATTRS_INLINE);
+
+	/* replace and remove */
+	fail_unless(! sdb_attrs_replace(&attrs, objs[1]),
+			"sdb_attrs_replace(%s) = -1; expected: 0",
+			SDB_OBJ(objs[1])->name);
+	fail_unless(sdb_attrs_replace(&attrs, objs[STORE_ATTRS_INLINE]) < 0,
+			"sdb_attrs_replace(<unknown>) = 0; expected: -1");
+	fail_unless(! sdb_attrs_remove(&attrs, SDB_OBJ(objs[2])->name),
+			"sdb_attrs_remove(%s) = -1; expected: 0",
+			SDB_OBJ(objs[2])->name);
+	fail_unless(sdb_attrs_remove(&attrs, SDB_OBJ(objs[2])->name) < 0,
+			"sdb_attrs_remove(<unknown>) = 0; expected: -1");
+	o = sdb_attrs_lookup(&attrs, SDB_OBJ(objs[2])->name);
+	fail_unless(o == NULL, "sdb_attrs_lookup(<removed>) = %p; expected: NULL",
+			o);
+	fail_unless(sdb_attrs_size(&attrs) == STORE_ATTRS_INLINE - 1,
+			"sdb_attrs_size() = %zu; expected: %d",
+			sdb_attrs_size(&attrs), STORE_ATTRS_INLINE - 1);
+
+	/* growing beyond the limit moves the set to a tree */
+	sdb_attrs_insert(&attrs, objs[2]);
+	fail_unless(! sdb_attrs_insert(&attrs, objs[STORE_ATTRS_INLINE]),
+			"sdb_attrs_insert(%s) = -1; expected: 0",
+			SDB_OBJ(objs[STORE_ATTRS_INLINE])->name);
+	fail_unless((! attrs.array.ptr) && attrs.tree,
+			"attribute set with %d entries is not a tree",
+			STORE_ATTRS_INLINE + 1);
+	for (i = 0; i < (int)SDB_STATIC_ARRAY_LEN(objs); ++i) {
+		o = sdb_attrs_lookup(&attrs, SDB_OBJ(objs[i])->name);
+		fail_unless(o == objs[i], "sdb_attrs_lookup(%s) = %p; expected: %p",
+				SDB_OBJ(objs[i])->name, o, objs[i]);
+		sdb_object_deref(SDB_OBJ(o));
+	}
+
+	sdb_attrs_destroy(&attrs);
+	for (i = 0; i < (int)SDB_STATIC_ARRAY_LEN(objs); ++i) {
+		fail_unless(SDB_OBJ(objs[i])->ref_cnt >= 1,
+				"sdb_attrs_destroy() released too many references");
+		sdb_object_deref(SDB_OBJ(objs[i]));
+	}
+}
+END_TEST
+
+/* Update the store as done by the test_view test; writers must not hold a
+ * view. */
+static void *
+update_store(void __attribute__((unused)) *arg)
+{
+	sdb_data_t datum = { SDB_TYPE_INTEGER, { .integer = 2 } };
+	int i;
+
+	sdb_store_attribute("h1", "k", &datum, 2);
+	sdb_store_host("h2", 2);
+	sdb_store_service("h1", "s2", 2);
+	for (i = 0; i <= STORE_ATTRS_INLINE; ++i) {
+		char name[16];
+		snprintf(name, sizeof(name), "k%d", i);
+		sdb_store_service_attr("h1", "s1", name, &datum, 2);
+	}
+	return NULL;
+} /* update_store */
+
+static void
+check_view(int64_t value, sdb_store_obj_t *expected_h2,
+		size_t svc_attrs, intptr_t services)
+{
+	sdb_data_t datum = SDB_DATA_INIT;
+	sdb_store_obj_t *host, *obj;
+	intptr_t n = 0;
+
+	host = sdb_store_get_host("h1");
+	ck_assert(host != NULL);
+	fail_unless(! sdb_store_get_attr(host, "k", &datum, NULL),
+			"sdb_store_get_attr(h1, k) = -1; expected: 0");
+	fail_unless(datum.data.integer == value,
+			"sdb_store_get_attr(h1, k) = %"PRId64"; expected: %"PRId64,
+			datum.data.integer, value);
+
+	obj = sdb_store_get_child(host, SDB_SERVICE, "s1");
+	ck_assert(obj != NULL);
+	fail_unless(sdb_attrs_size(&SVC(obj)->attributes) == svc_attrs,
+			"s1 has %zu attributes; expected: %zu",
+			sdb_attrs_size(&SVC(obj)->attributes), svc_attrs);
+	sdb_object_deref(SDB_OBJ(obj));
+	sdb_object_deref(SDB_OBJ(host));
+
+	obj = sdb_store_get_host("h2");
+	fail_unless((obj != NULL) == (expected_h2 != NULL),
+			"sdb_store_get_host(h2) = %p; expected: %s",
+			obj, expected_h2 ? "<host>" : "NULL");
+	sdb_object_deref(SDB_OBJ(obj));
+
+	sdb_store_scan(SDB_SERVICE, /* m, filter = */ NULL, NULL, scan_count, &n);
+	fail_unless(n == services,
+			"sdb_store_scan(SERVICE) called callback %d times; "
+			"expected: %d", (int)n, (int)services);
+} /* check_view */
+
+START_TEST(test_view)
+{
+	sdb_data_t datum = { SDB_TYPE_INTEGER, { .integer = 1 } };
+	sdb_store_obj_t *h2;
+	pthread_t thread;
+
+	sdb_store_host("h1", 1);
+	sdb_store_attribute("h1", "k", &datum, 1);
+	sdb_store_service("h1", "s1", 1);
+	sdb_store_service_attr("h1", "s1", "k", &datum, 1);
+
+	sdb_store_view_begin();
+	pthread_create(&thread, NULL, update_store, NULL);
+	pthread_join(thread, NULL);
+
+	/* none of the updates are visible while holding the view */
+	check_view(1, NULL, 1, 1);
+	sdb_store_view_end();
+
+	h2 = sdb_store_get_host("h2");
+	check_view(2, h2, STORE_ATTRS_INLINE + 2, 2);
+	sdb_object_deref(SDB_OBJ(h2));
+}
+END_TEST
+
+static void
+check_usage(const char *what, sdb_store_usage_t *usage,
+		uint64_t objects, uint64_t bytes)
+{
+	fail_unless((usage->objects == objects) && (usage->bytes == bytes),
+			"%s usage = { %"PRIu64", %"PRIu64" }; expected: "
+			"{ %"PRIu64", %"PRIu64" }", what, usage->objects, usage->bytes,
+			objects, bytes);
+} /* check_usage */
+
+START_TEST(test_usage)
+{
+	sdb_data_t datum = { SDB_TYPE_STRING, { .string = "v1" } };
+	sdb_store_snapshot_obj_t obj = {
+		SDB_HOST, "h2", 0, NULL, "h2", 1, 0, 0, NULL, NULL, NULL,
+	};
+	sdb_store_usage_t before[4], usage;
+	int types[] = { SDB_HOST, SDB_SERVICE, SDB_METRIC, SDB_ATTRIBUTE };
+	uint64_t h_size = sizeof(sdb_host_t) + strlen("h1") + 1;
+	uint64_t s_size = sizeof(sdb_service_t) + strlen("s1") + 1;
+	uint64_t m_size = sizeof(sdb_metric_t) + strlen("m1") + 1;
+	uint64_t a_size = sizeof(sdb_attribute_t) + strlen("k1") + 1;
+	sdb_strbuf_t *buf;
+	size_t i;
+	int id;
+
+	sdb_store_clear();
+	sdb_epoch_synchronize();
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(types); ++i)
+		fail_unless(! sdb_store_get_usage(types[i], &before[i]),
+				"sdb_store_get_usage(%s) = -1; expected: 0",
+				SDB_STORE_TYPE_TO_NAME(types[i]));
+	fail_unless(sdb_store_get_usage(SDB_ATTRIBUTE | SDB_HOST, &usage) < 0,
+			"sdb_store_get_usage(<invalid type>) = 0; expected: <0");
+
+	sdb_store_host("h1", 1);
+	sdb_store_attribute("h1", "k1", &datum, 1);
+	sdb_store_service("h1", "s1", 1);
+	sdb_store_metric("h1", "m1", NULL, 1);
+	sdb_store_metric_attr("h1", "m1", "k1", &datum, 1);
+
+	sdb_store_get_usage(SDB_HOST, &usage);
+	usage.objects -= before[0].objects;
+	usage.bytes -= before[0].bytes;
+	check_usage("host", &usage, 1, h_size);
+	sdb_store_get_usage(SDB_SERVICE, &usage);
+	usage.objects -= before[1].objects;
+	usage.bytes -= before[1].bytes;
+	check_usage("service", &usage, 1, s_size);
+	sdb_store_get_usage(SDB_METRIC, &usage);
+	usage.objects -= before[2].objects;
+	usage.bytes -= before[2].bytes;
+	check_usage("metric", &usage, 1, m_size);
+	sdb_store_get_usage(SDB_ATTRIBUTE, &usage);
+	usage.objects -= before[3].objects;
+	usage.bytes -= before[3].bytes;
+	check_usage("attribute", &usage, 2, 2 * (a_size + strlen("v1") + 1));
+
+	fail_unless(! sdb_store_get_host_usage("h1", &usage),
+			"sdb_store_get_host_usage(h1) = -1; expected: 0");
+	check_usage("h1", &usage, 5,
+			h_size + s_size + m_size + 2 * (a_size + strlen("v1") + 1));
+	fail_unless(sdb_store_get_host_usage("h2", &usage) < 0,
+			"sdb_store_get_host_usage(<unknown host>) = 0; expected: <0");
+
+	/* replacing an attribute accounts for the new value */
+	datum.data.string = "a longer value";
+	sdb_store_attribute("h1", "k1", &datum, 2);
+	sdb_store_get_host_usage("h1", &usage);
+	check_usage("h1", &usage, 5, h_size + s_size + m_size
+			+ 2 * a_size + strlen("v1") + strlen("a longer value") + 2);
+
+	/* removing objects accounts for all of their children */
+	sdb_store_set_expiry(0, 10);
+	sdb_store_host("h1", 100);
+	sdb_store_service("h1", "s1", 100);
+	sdb_store_attribute("h1", "k1", &datum, 100);
+	sdb_store_expire(105);
+	sdb_store_set_expiry(0, 0);
+	sdb_store_get_host_usage("h1", &usage);
+	check_usage("h1", &usage, 3, h_size + s_size
+			+ a_size + strlen("a longer value") + 1);
+
+	/* removed objects are accounted for until they are destroyed */
+	sdb_epoch_synchronize();
+	sdb_store_get_usage(SDB_METRIC, &usage);
+	usage.objects -= before[2].objects;
+	usage.bytes -= before[2].bytes;
+	check_usage("metric", &usage, 0, 0);
+
+	/* backends */
+	id = sdb_store_backend_id("usage-test");
+	ck_assert(id >= 0);
+	obj.backends = (uint64_t)1 << id;
+	fail_unless(! sdb_store_restore(&obj),
+			"sdb_store_restore(h2) = -1; expected: 0");
+	fail_unless(! sdb_store_get_backend_usage("usage-test", &usage),
+			"sdb_store_get_backend_usage(usage-test) = -1; expected: 0");
+	check_usage("usage-test", &usage, 1, sizeof(sdb_host_t) + strlen("h2") + 1);
+	fail_unless(sdb_store_get_backend_usage("unknown", &usage) < 0,
+			"sdb_store_get_backend_usage(<unknown backend>) = 0; "
+			"expected: <0");
+
+	/* hosts are sorted by their usage */
+	buf = sdb_strbuf_create(0);
+	fail_unless(! sdb_store_stats_tojson(buf, 0),
+			"sdb_store_stats_tojson() = -1; expected: 0");
+	fail_unless(strstr(sdb_strbuf_string(buf), "\"hosts\": [{\"name\": \"h1\"")
+			&& strstr(sdb_strbuf_string(buf), "}, {\"name\": \"h2\"")
+			&& strstr(sdb_strbuf_string(buf), "{\"name\": \"usage-test\", "
+				"\"objects\": 1, "),
+			"sdb_store_stats_tojson() = %s; expected hosts h1, h2 and "
+			"backend usage-test", sdb_strbuf_string(buf));
+	sdb_strbuf_clear(buf);
+	sdb_store_stats_tojson(buf, 1);
+	fail_unless(! strstr(sdb_strbuf_string(buf), "\"h2\""),
+			"sdb_store_stats_tojson(max_hosts = 1) = %s; expected only h1",
+			sdb_strbuf_string(buf));
+	sdb_strbuf_destroy(buf);
+
+	sdb_store_clear();
+	sdb_epoch_synchronize();
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(types); ++i) {
+		sdb_store_get_usage(types[i], &usage);
+		check_usage(SDB_STORE_TYPE_TO_NAME(types[i]), &usage,
+				before[i].objects, before[i].bytes);
+	}
+}
+END_TEST
+
+START_TEST(test_backends)
+{
+	sdb_store_snapshot_obj_t obj = {
+		SDB_HOST, "h1", 0, NULL, "h1", 1, 0, 0, NULL, NULL, NULL,
+	};
+	const char *names[STORE_BACKENDS_MAX];
+	const char *backends[] = { "backend-a", "backend-b", "backend-c" };
+	int ids[SDB_STATIC_ARRAY_LEN(backends)];
+	sdb_store_usage_t usage;
+	sdb_store_obj_t *host;
+	char name[32];
+	size_t n, i;
+	int id = 0;
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(backends); ++i) {
+		ids[i] = sdb_store_backend_id(backends[i]);
+		fail_unless(ids[i] >= 0,
+				"sdb_store_backend_id(%s) = %d; expected: >=0",
+				backends[i], ids[i]);
+		fail_unless((! i) || (ids[i] != ids[i - 1]),
+				"sdb_store_backend_id(%s) = %d; expected: a new ID",
+				backends[i], ids[i]);
+	}
+	id = sdb_store_backend_id("BACKEND-A");
+	fail_unless(id == ids[0],
+			"sdb_store_backend_id(BACKEND-A) = %d; expected: %d",
+			id, ids[0]);
+	fail_unless(sdb_store_backend_id(NULL) < 0,
+			"sdb_store_backend_id(NULL) = 0; expected: <0");
+
+	/* names are returned in the order in which they have been registered */
+	n = sdb_store_backend_names(((uint64_t)1 << ids[2])
+			| ((uint64_t)1 << ids[0]), names);
+	fail_unless((n == 2) && (! strcmp(names[0], "backend-a"))
+			&& (! strcmp(names[1], "backend-c")),
+			"sdb_store_backend_names(<backend-a, backend-c>) = %zu "
+			"(%s, %s); expected: 2 (backend-a, backend-c)", n,
+			n > 0 ? names[0] : "", n > 1 ? names[1] : "");
+	n = sdb_store_backend_names(0, names);
+	fail_unless(n == 0,
+			"sdb_store_backend_names(<none>) = %zu; expected: 0", n);
+
+	/* recording a backend again does not count the object twice */
+	obj.backends = (uint64_t)1 << ids[0];
+	fail_unless(! sdb_store_restore(&obj),
+			"sdb_store_restore(h1) = -1; expected: 0");
+	obj.last_update = 2;
+	fail_unless(! sdb_store_restore(&obj),
+			"sdb_store_restore(h1) = -1; expected: 0");
+	fail_unless(! sdb_store_get_backend_usage("backend-a", &usage),
+			"sdb_store_get_backend_usage(backend-a) = -1; expected: 0");
+	check_usage("backend-a", &usage, 1, sizeof(sdb_host_t) + strlen("h1") + 1);
+
+	host = sdb_store_get_host("h1");
+	fail_unless(host != NULL,
+			"sdb_store_get_host(h1) = NULL; expected: <host>");
+	n = sdb_store_backend_names(STORE_OBJ_BACKENDS(host), names);
+	fail_unless((n == 1) && (! strcmp(names[0], "backend-a")),
+			"backends of h1 = %zu (%s); expected: 1 (backend-a)",
+			n, n > 0 ? names[0] : "");
+	sdb_object_deref(SDB_OBJ(host));
+
+	/* the number of backends is limited */
+	for (i = 0; i <= STORE_BACKENDS_MAX; ++i) {
+		snprintf(name, sizeof(name), "backend-%zu", i);
+		id = sdb_store_backend_id(name);
+		if (id < 0)
+			break;
+	}
+	fail_unless(id < 0,
+			"sdb_store_backend_id() registered %zu backends; expected: "
+			"at most %d", i, STORE_BACKENDS_MAX);
+	id = sdb_store_backend_id("backend-b");
+	fail_unless(id == ids[1],
+			"sdb_store_backend_id(backend-b) = %d after registering the "
+			"maximum number of backends; expected: %d", id, ids[1]);
+	n = sdb_store_backend_names(~(uint64_t)0, names);
+	fail_unless(n == STORE_BACKENDS_MAX,
+			"sdb_store_backend_names(<all>) = %zu; expected: %d",
+			n, STORE_BACKENDS_MAX);
+
+	sdb_store_clear();
+}
+END_TEST
+
 TEST_MAIN("core::store")
 {
 	TCase *tc = tcase_create("core");
@@ -779,6 +1874,18 @@ TEST_MAIN("core::store")
 	tcase_add_test(tc, test_get_child);
 	tcase_add_test(tc, test_interval);
 	tcase_add_test(tc, test_scan);
+	tcase_add_test(tc, test_shards);
+	tcase_add_test(tc, test_index);
+	tcase_add_test(tc, test_names_index);
+	tcase_add_test(tc, test_expire);
+	tcase_add_test(tc, test_batch);
+	tcase_add_test(tc, test_watch);
+	tcase_add_test(tc, test_generation);
+	tcase_add_test(tc, test_service_attrs);
+	tcase_add_test(tc, test_attrs);
+	tcase_add_test(tc, test_view);
+	tcase_add_test(tc, test_usage);
+	tcase_add_test(tc, test_backends);
 	tcase_add_unchecked_fixture(tc, NULL, sdb_store_clear);
 	ADD_TCASE(tc);
 }
@@ -62,6 +62,12 @@ struct {
 	  "'host'.'service'",    -1,  1, SDB_CONNECTION_FETCH  },
 	{ "FETCH metric "
 	  "'host'.'metric'",     -1,  1, SDB_CONNECTION_FETCH  },
+	{ "FETCH host 'host' "
+	  "IF NEWER THAN 123",   -1,  1, SDB_CONNECTION_FETCH  },
+	{ "FETCH metric "
+	  "'host'.'metric' "
+	  "IF NEWER THAN 123 "
+	  "FILTER age > 60s",    -1,  1, SDB_CONNECTION_FETCH  },
 
 	/* LIST commands */
 	{ "LIST hosts",            -1,  1, SDB_CONNECTION_LIST   },
@@ -528,6 +534,11 @@ struct {
 	{ "FETCH foo 'host'",    -1, -1, 0 },
 	{ "FETCH foo 'host' FILTER "
 	  "age > 60s",           -1, -1, 0 },
+	{ "FETCH host 'host' "
+	  "IF NEWER THAN 'x'",   -1, -1, 0 },
+	{ "FETCH host 'host' "
+	  "FILTER age > 60s "
+	  "IF NEWER THAN 123",   -1, -1, 0 },
 
 	/* invalid LOOKUP commands */
 	{ "LOOKUP foo",          -1, -1, 0 },
@@ -334,7 +334,8 @@ START_TEST(test_exec_fetch)
 	}
 
 	check = sdb_fe_exec_fetch(conn, exec_fetch_data[_i].type,
-			exec_fetch_data[_i].hostname, exec_fetch_data[_i].name, filter);
+			exec_fetch_data[_i].hostname, exec_fetch_data[_i].name, filter,
+			/* newer_than = */ NULL);
 	fail_unless(check == exec_fetch_data[_i].expected,
 			"sdb_fe_exec_fetch(%s, %s, %s, %s) = %d; expected: %d",
 			SDB_STORE_TYPE_TO_NAME(exec_fetch_data[_i].type),
@@ -388,11 +389,136 @@ START_TEST(test_exec_fetch)
 }
 END_TEST
 
+START_TEST(test_exec_fetch_newer_than)
+{
+	sdb_data_t datum = { SDB_TYPE_INTEGER, { .integer = 4711 } };
+	sdb_conn_t *conn = mock_conn_create();
+	sdb_store_obj_t *host;
+	uint64_t gen = 0;
+
+	uint32_t code = UINT32_MAX, msg_len = UINT32_MAX;
+	const char *data;
+	ssize_t tmp;
+	size_t len;
+	int check, i;
+
+	struct {
+		bool modified;
+		int64_t update;
+	} golden_data[] = {
+		{ 1, 0 },
+		{ 0, 0 },
+		/* changes of child objects change the host */
+		{ 1, 3 },
+		{ 0, 0 },
+	};
+
+	host = sdb_store_get_host("h2");
+	ck_assert(host != NULL);
+
+	for (i = 0; i < (int)SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+		if (golden_data[i].update) {
+			datum.data.integer = golden_data[i].update;
+			sdb_store_service_attr("h2", "s1", "k1", &datum,
+					golden_data[i].update);
+		}
+
+		sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+		check = sdb_fe_exec_fetch(conn, SDB_HOST, "h2", NULL,
+				/* filter = */ NULL, &gen);
+		fail_unless(check == 0,
+				"sdb_fe_exec_fetch(HOST, h2, IF NEWER THAN %"PRIu64") = %d; "
+				"expected: 0", gen, check);
+
+		data = sdb_strbuf_string(MOCK_CONN(conn)->write_buf);
+		len = sdb_strbuf_len(MOCK_CONN(conn)->write_buf);
+		tmp = sdb_proto_unmarshal_header(data, len, &code, &msg_len);
+		ck_assert_msg(tmp == (ssize_t)(2 * sizeof(uint32_t)));
+		data += tmp;
+
+		if (! golden_data[i].modified) {
+			fail_unless((code == SDB_CONNECTION_OK)
+						&& (! strncmp(data, "Not modified", msg_len)),
+					"sdb_fe_exec_fetch(HOST, h2, IF NEWER THAN %"PRIu64") "
+					"returned %u, '%.*s'; expected: OK, 'Not modified'",
+					gen, code, (int)msg_len, data);
+			continue;
+		}
+
+		fail_unless(code == SDB_CONNECTION_DATA,
+				"sdb_fe_exec_fetch(HOST, h2, IF NEWER THAN %"PRIu64") "
+				"returned %u; expected: DATA", gen, code);
+		fail_unless(strstr(data + sizeof(uint32_t), "\"generation\": ") != NULL,
+				"sdb_fe_exec_fetch(HOST, h2, IF NEWER THAN %"PRIu64") "
+				"did not include the generation", gen);
+		fail_unless(sdb_store_get_generation(host) > gen,
+				"sdb_fe_exec_fetch(HOST, h2, IF NEWER THAN %"PRIu64") "
+				"sent unchanged host", gen);
+		gen = sdb_store_get_generation(host);
+	}
+
+	sdb_object_deref(SDB_OBJ(host));
+	mock_conn_destroy(conn);
+}
+END_TEST
+
+START_TEST(test_exec_watch)
+{
+	sdb_conn_t *conn = mock_conn_create();
+	uint32_t code = UINT32_MAX, msg_len = UINT32_MAX;
+	const char *data;
+	ssize_t tmp;
+	size_t len;
+	int check, i;
+
+	for (i = 0; i < 2; ++i) {
+		sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+		check = sdb_fe_exec_watch(conn, SDB_HOST, NULL, NULL);
+		fail_unless(check == 0,
+				"sdb_fe_exec_watch(HOST) = %d; expected: 0", check);
+
+		sdb_store_host("h3", 10 + i);
+		/* delivers pending notifications before stopping the notifier */
+		sdb_fe_watch_shutdown();
+
+		data = sdb_strbuf_string(MOCK_CONN(conn)->write_buf);
+		len = sdb_strbuf_len(MOCK_CONN(conn)->write_buf);
+		tmp = sdb_proto_unmarshal_header(data, len, &code, &msg_len);
+		fail_unless((tmp == (ssize_t)(2 * sizeof(uint32_t)))
+					&& (code == SDB_CONNECTION_DATA)
+					&& (msg_len == sizeof(uint32_t)),
+				"sdb_fe_exec_watch(HOST) did not acknowledge the command");
+		data += tmp + msg_len;
+		len -= (size_t)tmp + msg_len;
+
+		tmp = sdb_proto_unmarshal_header(data, len, &code, &msg_len);
+		fail_unless((tmp == (ssize_t)(2 * sizeof(uint32_t)))
+					&& (code == SDB_CONNECTION_DATA),
+				"sdb_fe_watch_shutdown() did not deliver pending "
+				"notifications (run %d)", i);
+		data += tmp + sizeof(uint32_t);
+		fail_unless(strstr(data, "\"name\": \"h3\"") != NULL,
+				"WATCH notification = %s; expected: host h3", data);
+
+		sdb_fe_watch_cancel(conn);
+	}
+
+	/* no-op once the notifier has been stopped */
+	sdb_fe_watch_shutdown();
+	fail_unless(SDB_OBJ(conn)->ref_cnt == 1,
+			"WATCH left connection with ref_cnt = %d; expected: 1",
+			SDB_OBJ(conn)->ref_cnt);
+	mock_conn_destroy(conn);
+}
+END_TEST
+
 TEST_MAIN("frontend::query")
 {
 	TCase *tc = tcase_create("core");
 	tcase_add_checked_fixture(tc, populate, sdb_store_clear);
 	tcase_add_loop_test(tc, test_exec_fetch, 0, SDB_STATIC_ARRAY_LEN(exec_fetch_data));
+	tcase_add_test(tc, test_exec_fetch_newer_than);
+	tcase_add_test(tc, test_exec_watch);
 	ADD_TCASE(tc);
 }
 TEST_MAIN_END
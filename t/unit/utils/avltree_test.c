@@ -30,9 +30,12 @@
 #endif
 
 #include "utils/avltree.h"
+#include "utils/mvcc.h"
 #include "testutils.h"
 
 #include <check.h>
+#include <pthread.h>
+#include <stdio.h>
 
 static sdb_avltree_t *tree;
 
@@ -253,6 +256,260 @@ START_TEST(test_iter)
 }
 END_TEST
 
+START_TEST(test_replace)
+{
+	sdb_object_t replacements[SDB_STATIC_ARRAY_LEN(test_data)];
+	sdb_object_t unused = SDB_OBJECT_STATIC("x");
+	sdb_avltree_iter_t *iter;
+	size_t i;
+	int check;
+
+	populate();
+
+	check = sdb_avltree_replace(tree, &unused);
+	fail_unless(check < 0,
+			"sdb_avltree_replace(<tree>, <x>) = %d; expected: <0", check);
+	fail_unless(unused.ref_cnt == 1,
+			"sdb_avltree_replace(<tree>, <x>) incremented ref-cnt");
+
+	/* iterators operate on a snapshot of the tree */
+	iter = sdb_avltree_get_iter(tree);
+	fail_unless(iter != NULL,
+			"sdb_avltree_get_iter(<tree>) = NULL; expected: <iter>");
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(test_data); ++i) {
+		sdb_object_t *obj;
+
+		replacements[i] = test_data[i];
+		replacements[i].ref_cnt = 1;
+
+		check = sdb_avltree_replace(tree, &replacements[i]);
+		fail_unless(check == 0,
+				"sdb_avltree_replace(<tree>, <%s>) = %d; expected: 0",
+				replacements[i].name, check);
+		fail_unless(sdb_avltree_valid(tree),
+				"sdb_avltree_replace(<tree>, <%s>) left behind invalid tree",
+				replacements[i].name);
+
+		obj = sdb_avltree_lookup(tree, test_data[i].name);
+		fail_unless(obj == &replacements[i],
+				"sdb_avltree_lookup(<tree>, %s) = %p after replace; "
+				"expected: %p", test_data[i].name, obj, &replacements[i]);
+		sdb_object_deref(obj);
+
+		/* the old object may not be released while the iterator exists */
+		fail_unless(test_data[i].ref_cnt == 2,
+				"sdb_avltree_replace(<tree>, <%s>) released object "
+				"still in use; ref-cnt = %d; expected: 2",
+				test_data[i].name, test_data[i].ref_cnt);
+	}
+
+	check = (int)sdb_avltree_size(tree);
+	fail_unless(check == SDB_STATIC_ARRAY_LEN(test_data),
+			"sdb_avltree_size(<tree>) = %d after replace; expected: %zu",
+			check, SDB_STATIC_ARRAY_LEN(test_data));
+
+	for (i = 0; sdb_avltree_iter_has_next(iter); ++i) {
+		sdb_object_t *obj = sdb_avltree_iter_get_next(iter);
+		fail_unless((obj->ref_cnt == 2) && (obj < replacements
+					|| obj >= replacements + SDB_STATIC_ARRAY_LEN(replacements)),
+				"sdb_avltree_iter[%zu] = %p (%s); expected: original object",
+				i, obj, obj->name);
+	}
+	fail_unless(i == SDB_STATIC_ARRAY_LEN(test_data),
+			"sdb_avltree_iter returned %zu objects; expected: %zu",
+			i, SDB_STATIC_ARRAY_LEN(test_data));
+	sdb_avltree_iter_destroy(iter);
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(test_data); ++i) {
+		fail_unless(test_data[i].ref_cnt == 1,
+				"sdb_avltree_replace(<tree>, <%s>) did not release the "
+				"replaced object; ref-cnt = %d; expected: 1",
+				test_data[i].name, test_data[i].ref_cnt);
+	}
+
+	sdb_avltree_clear(tree);
+}
+END_TEST
+
+START_TEST(test_remove)
+{
+	size_t i;
+	int check;
+
+	populate();
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(unused_names); ++i) {
+		check = sdb_avltree_remove(tree, unused_names[i]);
+		fail_unless(check < 0,
+				"sdb_avltree_remove(<tree>, %s) = %d; expected: <0",
+				unused_names[i], check);
+	}
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(test_data); ++i) {
+		sdb_object_t *obj;
+		size_t j;
+
+		check = sdb_avltree_remove(tree, test_data[i].name);
+		fail_unless(check == 0,
+				"sdb_avltree_remove(<tree>, %s) = %d; expected: 0",
+				test_data[i].name, check);
+		fail_unless(sdb_avltree_valid(tree),
+				"sdb_avltree_remove(<tree>, %s) left behind invalid tree",
+				test_data[i].name);
+
+		check = (int)sdb_avltree_size(tree);
+		fail_unless(check == (int)(SDB_STATIC_ARRAY_LEN(test_data) - i - 1),
+				"sdb_avltree_size(<tree>) = %d; expected: %zu",
+				check, SDB_STATIC_ARRAY_LEN(test_data) - i - 1);
+		fail_unless(test_data[i].ref_cnt == 1,
+				"sdb_avltree_remove(<tree>, %s) did not release the "
+				"object; ref-cnt = %d; expected: 1",
+				test_data[i].name, test_data[i].ref_cnt);
+
+		obj = sdb_avltree_lookup(tree, test_data[i].name);
+		fail_unless(obj == NULL,
+				"sdb_avltree_lookup(<tree>, %s) = %p after remove; "
+				"expected: NULL", test_data[i].name, obj);
+
+		/* all remaining objects are still accessible */
+		for (j = i + 1; j < SDB_STATIC_ARRAY_LEN(test_data); ++j) {
+			obj = sdb_avltree_lookup(tree, test_data[j].name);
+			fail_unless(obj == &test_data[j],
+					"sdb_avltree_lookup(<tree>, %s) = %p after removing "
+					"%s; expected: %p", test_data[j].name, obj,
+					test_data[i].name, &test_data[j]);
+			sdb_object_deref(obj);
+		}
+	}
+
+	check = sdb_avltree_remove(tree, test_data[0].name);
+	fail_unless(check < 0,
+			"sdb_avltree_remove(<empty tree>, %s) = %d; expected: <0",
+			test_data[0].name, check);
+}
+END_TEST
+
+START_TEST(test_large)
+{
+	sdb_object_t *objs[100];
+	size_t i;
+	int check;
+
+	/* large trees use a hash index for lookups */
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(objs); ++i) {
+		char name[32];
+		snprintf(name, sizeof(name), "Host%zu", i);
+		objs[i] = sdb_object_create_simple(name, sizeof(sdb_object_t),
+				/* destructor = */ NULL);
+		check = sdb_avltree_insert(tree, objs[i]);
+		fail_unless(check == 0,
+				"sdb_avltree_insert(<tree>, %s) = %d; expected: 0",
+				name, check);
+	}
+	fail_unless(sdb_avltree_valid(tree),
+			"sdb_avltree_insert() left behind invalid tree");
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(objs); i += 2) {
+		sdb_object_t *obj = sdb_object_create_simple(objs[i]->name,
+				sizeof(sdb_object_t), /* destructor = */ NULL);
+		check = sdb_avltree_replace(tree, obj);
+		fail_unless(check == 0,
+				"sdb_avltree_replace(<tree>, %s) = %d; expected: 0",
+				obj->name, check);
+		sdb_object_deref(objs[i]);
+		objs[i] = obj;
+	}
+	for (i = 1; i < SDB_STATIC_ARRAY_LEN(objs); i += 2) {
+		check = sdb_avltree_remove(tree, objs[i]->name);
+		fail_unless(check == 0,
+				"sdb_avltree_remove(<tree>, %s) = %d; expected: 0",
+				objs[i]->name, check);
+	}
+	fail_unless(sdb_avltree_valid(tree),
+			"sdb_avltree_{replace,remove}() left behind invalid tree");
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(objs); ++i) {
+		char name[32];
+		sdb_object_t *obj, *expected = (i % 2) ? NULL : objs[i];
+
+		snprintf(name, sizeof(name), "hOST%zu", i);
+		obj = sdb_avltree_lookup(tree, name);
+		fail_unless(obj == expected,
+				"sdb_avltree_lookup(<tree>, %s) = %p; expected: %p",
+				name, obj, expected);
+		sdb_object_deref(obj);
+	}
+
+	sdb_avltree_clear(tree);
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(objs); ++i)
+		sdb_object_deref(objs[i]);
+}
+END_TEST
+
+static sdb_object_t new_obj = SDB_OBJECT_STATIC("x");
+
+/* Writers must not hold a snapshot. */
+static void *
+update_tree(void __attribute__((unused)) *arg)
+{
+	sdb_avltree_remove(tree, "a");
+	sdb_avltree_insert(tree, &new_obj);
+	return NULL;
+} /* update_tree */
+
+START_TEST(test_snapshot)
+{
+	sdb_avltree_iter_t *iter;
+	sdb_object_t *obj;
+	pthread_t thread;
+	char prev = '\0';
+	size_t n;
+
+	populate();
+
+	sdb_mvcc_snapshot_begin();
+	pthread_create(&thread, NULL, update_tree, NULL);
+	pthread_join(thread, NULL);
+
+	obj = sdb_avltree_lookup(tree, "a");
+	fail_unless(obj != NULL,
+			"sdb_avltree_lookup(<tree>, a) = NULL in snapshot; "
+			"expected: <obj>");
+	sdb_object_deref(obj);
+	obj = sdb_avltree_lookup(tree, "x");
+	fail_unless(obj == NULL,
+			"sdb_avltree_lookup(<tree>, x) = %p in snapshot; "
+			"expected: NULL", obj);
+	fail_unless(sdb_avltree_size(tree) == SDB_STATIC_ARRAY_LEN(test_data),
+			"sdb_avltree_size(<tree>) = %zu in snapshot; expected: %zu",
+			sdb_avltree_size(tree), SDB_STATIC_ARRAY_LEN(test_data));
+
+	iter = sdb_avltree_get_iter(tree);
+	for (n = 0; (obj = sdb_avltree_iter_get_next(iter)); ++n) {
+		fail_unless(obj->name[0] == prev + (prev ? 1 : 'a'),
+				"sdb_avltree_iter_get_next() = %s in snapshot; "
+				"expected: %c", obj->name, prev + (prev ? 1 : 'a'));
+		prev = obj->name[0];
+	}
+	sdb_avltree_iter_destroy(iter);
+	fail_unless(n == SDB_STATIC_ARRAY_LEN(test_data),
+			"sdb_avltree_iter_get_next() returned %zu objects in snapshot; "
+			"expected: %zu", n, SDB_STATIC_ARRAY_LEN(test_data));
+	sdb_mvcc_snapshot_end();
+
+	obj = sdb_avltree_lookup(tree, "a");
+	fail_unless(obj == NULL,
+			"sdb_avltree_lookup(<tree>, a) = %p after releasing the "
+			"snapshot; expected: NULL", obj);
+	obj = sdb_avltree_lookup(tree, "x");
+	fail_unless(obj == &new_obj,
+			"sdb_avltree_lookup(<tree>, x) = %p after releasing the "
+			"snapshot; expected: %p", obj, &new_obj);
+	sdb_object_deref(obj);
+}
+END_TEST
+
 TEST_MAIN("utils::avltree")
 {
 	TCase *tc = tcase_create("core");
@@ -261,6 +518,10 @@ TEST_MAIN("utils::avltree")
 	tcase_add_test(tc, test_insert);
 	tcase_add_test(tc, test_lookup);
 	tcase_add_test(tc, test_iter);
+	tcase_add_test(tc, test_replace);
+	tcase_add_test(tc, test_remove);
+	tcase_add_test(tc, test_large);
+	tcase_add_test(tc, test_snapshot);
 	ADD_TCASE(tc);
 }
 TEST_MAIN_END
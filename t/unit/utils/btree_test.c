@@ -0,0 +1,382 @@
+/*
+ * SysDB - t/unit/utils/btree_test.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "utils/btree.h"
+#include "utils/mvcc.h"
+#include "testutils.h"
+
+#include <check.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+static sdb_btree_t *tree;
+
+/* enough objects to build a tree with at least three levels */
+#define OBJECTS_NUM 2000
+static sdb_object_t *objects[OBJECTS_NUM];
+
+/* Short names and long names sharing a common prefix, such that both key
+ * comparisons and full name comparisons are exercised. */
+static void
+object_name(size_t i, char *buf, size_t len)
+{
+	if (i % 2)
+		snprintf(buf, len, "h%zu", i);
+	else
+		snprintf(buf, len, "some.long.host.name-%zu", i);
+} /* object_name */
+
+/* a permutation of the objects */
+#define NEXT(i) (((i) * 7919) % OBJECTS_NUM)
+
+static void
+setup(void)
+{
+	size_t i;
+
+	tree = sdb_btree_create();
+	fail_unless(tree != NULL,
+			"sdb_btree_create() = NULL; expected B-tree object");
+
+	for (i = 0; i < OBJECTS_NUM; ++i) {
+		char name[64];
+		object_name(i, name, sizeof(name));
+		objects[i] = sdb_object_create_simple(name, sizeof(sdb_object_t),
+				/* destructor = */ NULL);
+		fail_unless(objects[i] != NULL,
+				"INTERNAL ERROR: failed to create object");
+	}
+} /* setup */
+
+static void
+teardown(void)
+{
+	size_t i;
+
+	sdb_btree_destroy(tree);
+	tree = NULL;
+	for (i = 0; i < OBJECTS_NUM; ++i) {
+		sdb_object_deref(objects[i]);
+		objects[i] = NULL;
+	}
+} /* teardown */
+
+static void
+populate(void)
+{
+	size_t i;
+
+	for (i = 0; i < OBJECTS_NUM; ++i) {
+		int check = sdb_btree_insert(tree, objects[NEXT(i)]);
+		fail_unless(check == 0,
+				"sdb_btree_insert(<tree>, %s) = %d; expected: 0",
+				objects[NEXT(i)]->name, check);
+	}
+	fail_unless(sdb_btree_valid(tree),
+			"populating the tree left behind invalid tree");
+} /* populate */
+
+START_TEST(test_null)
+{
+	sdb_object_t o1 = SDB_OBJECT_STATIC("obj");
+	sdb_btree_iter_t *iter;
+	int check;
+
+	/* all functions should work even when passed null values */
+	sdb_btree_destroy(NULL);
+	sdb_btree_clear(NULL);
+
+	check = sdb_btree_insert(NULL, &o1);
+	fail_unless(check < 0,
+			"sdb_btree_insert(NULL, <obj>) = %d; expected: <0", check);
+	fail_unless(o1.ref_cnt == 1,
+			"sdb_btree_insert(NULL, <obj>) incremented ref-cnt");
+	check = sdb_btree_insert(tree, NULL);
+	fail_unless(check < 0,
+			"sdb_btree_insert(<tree>, NULL) = %d; expected: <0", check);
+	check = sdb_btree_replace(tree, &o1);
+	fail_unless(check < 0,
+			"sdb_btree_replace(<empty tree>, <obj>) = %d; expected: <0",
+			check);
+	check = sdb_btree_remove(tree, "obj");
+	fail_unless(check < 0,
+			"sdb_btree_remove(<empty tree>, obj) = %d; expected: <0",
+			check);
+	fail_unless(sdb_btree_lookup(tree, "obj") == NULL,
+			"sdb_btree_lookup(<empty tree>, obj) != NULL");
+
+	iter = sdb_btree_get_iter(NULL);
+	fail_unless(iter == NULL,
+			"sdb_btree_get_iter(NULL) = %p; expected: NULL", iter);
+	fail_unless(! sdb_btree_iter_has_next(NULL),
+			"sdb_btree_iter_has_next(NULL) = true; expected: false");
+	fail_unless(sdb_btree_iter_get_next(NULL) == NULL,
+			"sdb_btree_iter_get_next(NULL) != NULL");
+	sdb_btree_iter_destroy(NULL);
+
+	fail_unless(sdb_btree_size(NULL) == 0,
+			"sdb_btree_size(NULL) = %zu; expected: 0", sdb_btree_size(NULL));
+}
+END_TEST
+
+START_TEST(test_insert_lookup)
+{
+	size_t i;
+	int check;
+
+	populate();
+
+	check = (int)sdb_btree_size(tree);
+	fail_unless(check == OBJECTS_NUM,
+			"sdb_btree_size(<tree>) = %d; expected: %d", check, OBJECTS_NUM);
+
+	for (i = 0; i < OBJECTS_NUM; i += 7) {
+		char name[64];
+		sdb_object_t *obj;
+		size_t j;
+
+		check = sdb_btree_insert(tree, objects[i]);
+		fail_unless(check < 0,
+				"sdb_btree_insert(<tree>, %s) = %d (duplicate); "
+				"expected: <0", objects[i]->name, check);
+
+		/* lookups are case-insensitive */
+		object_name(i, name, sizeof(name));
+		for (j = 0; j < strlen(name); ++j)
+			name[j] = (char)toupper((int)name[j]);
+		obj = sdb_btree_lookup(tree, name);
+		fail_unless(obj == objects[i],
+				"sdb_btree_lookup(<tree>, %s) = %p; expected: %p",
+				name, obj, objects[i]);
+		sdb_object_deref(obj);
+
+		strncat(name, "x", sizeof(name) - strlen(name) - 1);
+		obj = sdb_btree_lookup(tree, name);
+		fail_unless(obj == NULL,
+				"sdb_btree_lookup(<tree>, %s) = %p; expected: NULL",
+				name, obj);
+	}
+
+	fail_unless(objects[0]->ref_cnt == 2,
+			"sdb_btree_insert() did not take ownership of the object; "
+			"ref-cnt = %d; expected: 2", objects[0]->ref_cnt);
+}
+END_TEST
+
+START_TEST(test_iter)
+{
+	sdb_btree_iter_t *iter;
+	sdb_object_t *prev = NULL;
+	size_t n = 0;
+
+	populate();
+
+	iter = sdb_btree_get_iter(tree);
+	fail_unless(iter != NULL,
+			"sdb_btree_get_iter(<tree>) = NULL; expected: <iter>");
+
+	while (sdb_btree_iter_has_next(iter)) {
+		sdb_object_t *peek = sdb_btree_iter_peek_next(iter);
+		sdb_object_t *obj = sdb_btree_iter_get_next(iter);
+
+		fail_unless(peek == obj,
+				"sdb_btree_iter_peek_next(<iter>) = %p; expected: %p",
+				peek, obj);
+		fail_unless((! prev) || (strcasecmp(prev->name, obj->name) < 0),
+				"sdb_btree_iter_get_next(<iter>) = %s after %s; "
+				"expected objects in ascending order",
+				obj->name, prev->name);
+		prev = obj;
+		++n;
+	}
+	fail_unless(n == OBJECTS_NUM,
+			"iterating the tree returned %zu objects; expected: %d",
+			n, OBJECTS_NUM);
+	fail_unless(sdb_btree_iter_get_next(iter) == NULL,
+			"sdb_btree_iter_get_next(<iter>) != NULL at end of iterator");
+	sdb_btree_iter_destroy(iter);
+}
+END_TEST
+
+START_TEST(test_replace)
+{
+	size_t i;
+	int check;
+
+	populate();
+
+	for (i = 0; i < OBJECTS_NUM; i += 3) {
+		sdb_object_t *obj, *old = objects[i];
+
+		obj = sdb_object_create_simple(old->name, sizeof(sdb_object_t),
+				/* destructor = */ NULL);
+		check = sdb_btree_replace(tree, obj);
+		fail_unless(check == 0,
+				"sdb_btree_replace(<tree>, %s) = %d; expected: 0",
+				obj->name, check);
+		fail_unless(old->ref_cnt == 1,
+				"sdb_btree_replace(<tree>, %s) did not release the old "
+				"object; ref-cnt = %d; expected: 1", old->name, old->ref_cnt);
+		sdb_object_deref(old);
+		objects[i] = obj;
+	}
+	fail_unless(sdb_btree_valid(tree),
+			"sdb_btree_replace() left behind invalid tree");
+
+	for (i = 0; i < OBJECTS_NUM; ++i) {
+		sdb_object_t *obj = sdb_btree_lookup(tree, objects[i]->name);
+		fail_unless(obj == objects[i],
+				"sdb_btree_lookup(<tree>, %s) = %p after replace; "
+				"expected: %p", objects[i]->name, obj, objects[i]);
+		sdb_object_deref(obj);
+	}
+}
+END_TEST
+
+START_TEST(test_remove)
+{
+	size_t i;
+	int check;
+
+	populate();
+
+	for (i = 0; i < OBJECTS_NUM; ++i) {
+		size_t idx = NEXT(OBJECTS_NUM - i - 1);
+		sdb_object_t *obj;
+
+		check = sdb_btree_remove(tree, objects[idx]->name);
+		fail_unless(check == 0,
+				"sdb_btree_remove(<tree>, %s) = %d; expected: 0",
+				objects[idx]->name, check);
+		fail_unless(objects[idx]->ref_cnt == 1,
+				"sdb_btree_remove(<tree>, %s) did not release the "
+				"object; ref-cnt = %d; expected: 1",
+				objects[idx]->name, objects[idx]->ref_cnt);
+
+		obj = sdb_btree_lookup(tree, objects[idx]->name);
+		fail_unless(obj == NULL,
+				"sdb_btree_lookup(<tree>, %s) = %p after remove; "
+				"expected: NULL", objects[idx]->name, obj);
+
+		check = sdb_btree_remove(tree, objects[idx]->name);
+		fail_unless(check < 0,
+				"sdb_btree_remove(<tree>, %s) = %d (removed before); "
+				"expected: <0", objects[idx]->name, check);
+
+		if (! (i % 97))
+			fail_unless(sdb_btree_valid(tree),
+					"sdb_btree_remove(<tree>, %s) left behind invalid tree",
+					objects[idx]->name);
+	}
+
+	fail_unless(sdb_btree_valid(tree),
+			"removing all objects left behind invalid tree");
+	fail_unless(sdb_btree_size(tree) == 0,
+			"sdb_btree_size(<tree>) = %zu after removing all objects; "
+			"expected: 0", sdb_btree_size(tree));
+}
+END_TEST
+
+/* Remove every other object; writers must not hold a snapshot. */
+static void *
+remove_objects(void __attribute__((unused)) *arg)
+{
+	size_t i;
+
+	for (i = 0; i < OBJECTS_NUM; i += 2)
+		sdb_btree_remove(tree, objects[i]->name);
+	return NULL;
+} /* remove_objects */
+
+START_TEST(test_snapshot)
+{
+	sdb_btree_iter_t *iter;
+	pthread_t thread;
+	size_t i, n;
+
+	populate();
+
+	sdb_mvcc_snapshot_begin();
+	pthread_create(&thread, NULL, remove_objects, NULL);
+	pthread_join(thread, NULL);
+
+	/* the snapshot still sees all objects */
+	fail_unless(sdb_btree_size(tree) == OBJECTS_NUM,
+			"sdb_btree_size(<tree>) = %zu in snapshot; expected: %d",
+			sdb_btree_size(tree), OBJECTS_NUM);
+	for (i = 0; i < OBJECTS_NUM; ++i) {
+		sdb_object_t *obj = sdb_btree_lookup(tree, objects[i]->name);
+		fail_unless(obj == objects[i],
+				"sdb_btree_lookup(<tree>, %s) = %p in snapshot; "
+				"expected: %p", objects[i]->name, obj, objects[i]);
+		sdb_object_deref(obj);
+	}
+	iter = sdb_btree_get_iter(tree);
+	for (n = 0; sdb_btree_iter_get_next(iter); ++n)
+		/* nothing to do */;
+	sdb_btree_iter_destroy(iter);
+	fail_unless(n == OBJECTS_NUM,
+			"sdb_btree_iter_get_next() returned %zu objects in snapshot; "
+			"expected: %d", n, OBJECTS_NUM);
+	sdb_mvcc_snapshot_end();
+
+	fail_unless(sdb_btree_size(tree) == OBJECTS_NUM / 2,
+			"sdb_btree_size(<tree>) = %zu; expected: %d",
+			sdb_btree_size(tree), OBJECTS_NUM / 2);
+	for (i = 0; i < OBJECTS_NUM; ++i) {
+		sdb_object_t *obj = sdb_btree_lookup(tree, objects[i]->name);
+		fail_unless((obj != NULL) == (i % 2),
+				"sdb_btree_lookup(<tree>, %s) = %p after releasing "
+				"the snapshot", objects[i]->name, obj);
+		sdb_object_deref(obj);
+	}
+	fail_unless(sdb_btree_valid(tree),
+			"removing objects left behind invalid tree");
+}
+END_TEST
+
+TEST_MAIN("utils::btree")
+{
+	TCase *tc = tcase_create("core");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_null);
+	tcase_add_test(tc, test_insert_lookup);
+	tcase_add_test(tc, test_iter);
+	tcase_add_test(tc, test_replace);
+	tcase_add_test(tc, test_remove);
+	tcase_add_test(tc, test_snapshot);
+	ADD_TCASE(tc);
+}
+TEST_MAIN_END
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
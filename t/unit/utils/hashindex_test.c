@@ -0,0 +1,219 @@
+/*
+ * SysDB - t/unit/utils/hashindex_test.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "utils/hashindex.h"
+#include "utils/epoch.h"
+#include "testutils.h"
+
+#include <check.h>
+#include <stdio.h>
+
+static sdb_hashindex_t *idx;
+
+#define OBJECTS_NUM 100
+static sdb_object_t *objects[OBJECTS_NUM];
+
+static void
+setup(void)
+{
+	size_t i;
+
+	idx = sdb_hashindex_create();
+	fail_unless(idx != NULL,
+			"sdb_hashindex_create() = NULL; expected hash index object");
+
+	for (i = 0; i < OBJECTS_NUM; ++i) {
+		char name[32];
+		snprintf(name, sizeof(name), "Host%zu", i);
+		objects[i] = sdb_object_create_simple(name, sizeof(sdb_object_t),
+				/* destructor = */ NULL);
+		fail_unless(objects[i] != NULL,
+				"INTERNAL ERROR: failed to create object");
+	}
+} /* setup */
+
+static void
+teardown(void)
+{
+	size_t i;
+
+	sdb_hashindex_destroy(idx);
+	idx = NULL;
+	for (i = 0; i < OBJECTS_NUM; ++i) {
+		sdb_object_deref(objects[i]);
+		objects[i] = NULL;
+	}
+} /* teardown */
+
+START_TEST(test_null)
+{
+	sdb_object_t o = SDB_OBJECT_STATIC("obj");
+	int check;
+
+	sdb_hashindex_destroy(NULL);
+
+	check = sdb_hashindex_insert(NULL, &o);
+	fail_unless(check < 0,
+			"sdb_hashindex_insert(NULL, <obj>) = %d; expected: <0", check);
+	check = sdb_hashindex_remove(idx, &o);
+	fail_unless(check < 0,
+			"sdb_hashindex_remove(<empty idx>, <obj>) = %d; expected: <0",
+			check);
+	check = sdb_hashindex_replace(idx, &o, &o);
+	fail_unless(check < 0,
+			"sdb_hashindex_replace(<empty idx>, <obj>, <obj>) = %d; "
+			"expected: <0", check);
+	fail_unless(sdb_hashindex_lookup(idx, "obj") == NULL,
+			"sdb_hashindex_lookup(<empty idx>, obj) != NULL");
+	fail_unless(sdb_hashindex_lookup(NULL, "obj") == NULL,
+			"sdb_hashindex_lookup(NULL, obj) != NULL");
+}
+END_TEST
+
+START_TEST(test_hash)
+{
+	uint32_t h1 = sdb_hashindex_hash("Some.Host");
+	uint32_t h2 = sdb_hashindex_hash("some.host");
+	uint32_t h3 = sdb_hashindex_hash("some.hosT2");
+
+	fail_unless(h1 == h2,
+			"sdb_hashindex_hash() returned different hashes for names "
+			"differing in case only: %u != %u", h1, h2);
+	fail_unless(h1 != h3,
+			"sdb_hashindex_hash(Some.Host) = sdb_hashindex_hash(some.hosT2) "
+			"= %u; expected different values", h1);
+}
+END_TEST
+
+START_TEST(test_insert_lookup)
+{
+	size_t i;
+
+	sdb_epoch_enter();
+	for (i = 0; i < OBJECTS_NUM; ++i) {
+		int check = sdb_hashindex_insert(idx, objects[i]);
+		fail_unless(check == 0,
+				"sdb_hashindex_insert(<idx>, %s) = %d; expected: 0",
+				objects[i]->name, check);
+	}
+
+	for (i = 0; i < OBJECTS_NUM; ++i) {
+		char name[32];
+		sdb_object_t *obj;
+
+		/* lookups are case-insensitive */
+		snprintf(name, sizeof(name), "hOST%zu", i);
+		obj = sdb_hashindex_lookup(idx, name);
+		fail_unless(obj == objects[i],
+				"sdb_hashindex_lookup(<idx>, %s) = %p; expected: %p",
+				name, obj, objects[i]);
+
+		snprintf(name, sizeof(name), "host%zu", i + OBJECTS_NUM);
+		obj = sdb_hashindex_lookup(idx, name);
+		fail_unless(obj == NULL,
+				"sdb_hashindex_lookup(<idx>, %s) = %p; expected: NULL",
+				name, obj);
+	}
+	sdb_epoch_exit();
+
+	fail_unless(objects[0]->ref_cnt == 1,
+			"sdb_hashindex_insert() changed the ref-count; "
+			"got: %d; expected: 1", objects[0]->ref_cnt);
+}
+END_TEST
+
+START_TEST(test_replace_remove)
+{
+	sdb_object_t *obj;
+	size_t i;
+	int check;
+
+	for (i = 0; i < OBJECTS_NUM; ++i)
+		sdb_hashindex_insert(idx, objects[i]);
+
+	sdb_epoch_enter();
+
+	obj = sdb_object_create_simple("HOST1", sizeof(sdb_object_t), NULL);
+	check = sdb_hashindex_replace(idx, objects[1], obj);
+	fail_unless(check == 0,
+			"sdb_hashindex_replace(<idx>, host1, HOST1) = %d; expected: 0",
+			check);
+	fail_unless(sdb_hashindex_lookup(idx, "host1") == obj,
+			"sdb_hashindex_lookup(<idx>, host1) did not return the "
+			"replacement object");
+	check = sdb_hashindex_replace(idx, objects[1], obj);
+	fail_unless(check < 0,
+			"sdb_hashindex_replace(<idx>, <replaced obj>, HOST1) = %d; "
+			"expected: <0", check);
+	sdb_object_deref(objects[1]);
+	objects[1] = obj;
+
+	/* remove every other object and re-add them, reusing removed slots */
+	for (i = 0; i < OBJECTS_NUM; i += 2) {
+		check = sdb_hashindex_remove(idx, objects[i]);
+		fail_unless(check == 0,
+				"sdb_hashindex_remove(<idx>, %s) = %d; expected: 0",
+				objects[i]->name, check);
+		fail_unless(sdb_hashindex_lookup(idx, objects[i]->name) == NULL,
+				"sdb_hashindex_lookup(<idx>, %s) returned removed object",
+				objects[i]->name);
+		check = sdb_hashindex_remove(idx, objects[i]);
+		fail_unless(check < 0,
+				"sdb_hashindex_remove(<idx>, %s) = %d (removed before); "
+				"expected: <0", objects[i]->name, check);
+	}
+	for (i = 0; i < OBJECTS_NUM; i += 2)
+		sdb_hashindex_insert(idx, objects[i]);
+
+	for (i = 0; i < OBJECTS_NUM; ++i) {
+		obj = sdb_hashindex_lookup(idx, objects[i]->name);
+		fail_unless(obj == objects[i],
+				"sdb_hashindex_lookup(<idx>, %s) = %p; expected: %p",
+				objects[i]->name, obj, objects[i]);
+	}
+
+	sdb_epoch_exit();
+}
+END_TEST
+
+TEST_MAIN("utils::hashindex")
+{
+	TCase *tc = tcase_create("core");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_null);
+	tcase_add_test(tc, test_hash);
+	tcase_add_test(tc, test_insert_lookup);
+	tcase_add_test(tc, test_replace_remove);
+	ADD_TCASE(tc);
+}
+TEST_MAIN_END
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,123 @@
+/*
+ * SysDB - t/unit/utils/intern_test.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "utils/intern.h"
+#include "testutils.h"
+
+#include <stdio.h>
+#include <string.h>
+
+START_TEST(test_intern)
+{
+	char *s1, *s2, *s3;
+	char buf[] = "architecture";
+
+	s1 = sdb_intern("architecture");
+	fail_unless(s1 != NULL,
+			"sdb_intern(architecture) = NULL; expected: <string>");
+	fail_unless(! strcmp(s1, "architecture"),
+			"sdb_intern(architecture) = '%s'; expected: 'architecture'", s1);
+	fail_unless(s1 != buf,
+			"sdb_intern(architecture) returned its argument; "
+			"expected: a copy");
+
+	s2 = sdb_intern(buf);
+	fail_unless(s2 == s1,
+			"sdb_intern(architecture) = %p (second call); expected: %p",
+			s2, s1);
+
+	/* interning is case-sensitive */
+	s3 = sdb_intern("Architecture");
+	fail_unless((s3 != NULL) && (s3 != s1),
+			"sdb_intern(Architecture) = %p; expected: a string "
+			"different from %p", s3, s1);
+
+	sdb_intern_release(s3);
+	sdb_intern_release(s2);
+
+	/* s1 is still referenced */
+	fail_unless(! strcmp(s1, "architecture"),
+			"sdb_intern_release() destroyed a referenced string");
+	s2 = sdb_intern("architecture");
+	fail_unless(s2 == s1,
+			"sdb_intern(architecture) = %p (after release); expected: %p",
+			s2, s1);
+	sdb_intern_release(s2);
+	sdb_intern_release(s1);
+
+	fail_unless(sdb_intern(NULL) == NULL,
+			"sdb_intern(NULL) = <string>; expected: NULL");
+	/* releasing unknown strings is safe */
+	sdb_intern_release(buf);
+	sdb_intern_release(NULL);
+}
+END_TEST
+
+START_TEST(test_intern_many)
+{
+	char *strings[1000];
+	char name[32];
+	size_t i;
+
+	/* this will grow the hash tables */
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(strings); ++i) {
+		snprintf(name, sizeof(name), "key%zu", i);
+		strings[i] = sdb_intern(name);
+		fail_unless(strings[i] != NULL,
+				"sdb_intern(%s) = NULL; expected: <string>", name);
+	}
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(strings); ++i) {
+		char *s;
+
+		snprintf(name, sizeof(name), "key%zu", i);
+		s = sdb_intern(name);
+		fail_unless(s == strings[i],
+				"sdb_intern(%s) = %p (second call); expected: %p",
+				name, s, strings[i]);
+		fail_unless(! strcmp(s, name),
+				"sdb_intern(%s) = '%s'; expected: '%s'", name, s, name);
+		sdb_intern_release(s);
+		sdb_intern_release(strings[i]);
+	}
+}
+END_TEST
+
+TEST_MAIN("utils::intern")
+{
+	TCase *tc = tcase_create("core");
+	tcase_add_test(tc, test_intern);
+	tcase_add_test(tc, test_intern_many);
+	ADD_TCASE(tc);
+}
+TEST_MAIN_END
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
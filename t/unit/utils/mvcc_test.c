@@ -0,0 +1,226 @@
+/*
+ * SysDB - t/unit/utils/mvcc_test.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "utils/mvcc.h"
+#include "testutils.h"
+
+#include <check.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * private helper functions
+ */
+
+static sdb_mvcc_ptr_t ptr = SDB_MVCC_PTR_INIT;
+static int values[4];
+
+/* Store values[i], as done by writers holding no snapshot. */
+static void *
+store_value(void *arg)
+{
+	size_t i = (size_t)arg;
+
+	sdb_mvcc_store(&ptr, values + i, i ? i - 1 : 0);
+	return NULL;
+} /* store_value */
+
+static void
+store_in_thread(size_t i)
+{
+	pthread_t thread;
+
+	pthread_create(&thread, NULL, store_value, (void *)i);
+	pthread_join(thread, NULL);
+} /* store_in_thread */
+
+static void
+check_load(int *expected, size_t expected_aux)
+{
+	size_t aux = 42;
+	int *v = sdb_mvcc_load(&ptr, &aux);
+
+	fail_unless(v == expected,
+			"sdb_mvcc_load() = values[%td]; expected: values[%td]",
+			v ? v - values : -1, expected ? expected - values : -1);
+	fail_unless(aux == expected_aux,
+			"sdb_mvcc_load() returned aux = %zu; expected: %zu",
+			aux, expected_aux);
+} /* check_load */
+
+static void
+teardown(void)
+{
+	sdb_mvcc_clear(&ptr);
+	ptr.ptr = NULL;
+} /* teardown */
+
+/*
+ * tests
+ */
+
+START_TEST(test_no_snapshot)
+{
+	size_t i;
+
+	check_load(NULL, 42);
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(values); ++i) {
+		store_value((void *)i);
+		check_load(values + i, 42);
+	}
+	fail_unless(sdb_mvcc_snapshot_version() == 0,
+			"sdb_mvcc_snapshot_version() = %"PRIu64" without a snapshot; "
+			"expected: 0", sdb_mvcc_snapshot_version());
+}
+END_TEST
+
+START_TEST(test_snapshot)
+{
+	uint64_t version;
+
+	store_value((void *)0);
+
+	sdb_mvcc_snapshot_begin();
+	version = sdb_mvcc_snapshot_version();
+	fail_unless(version != 0,
+			"sdb_mvcc_snapshot_version() = 0 inside a snapshot");
+
+	/* updates after taking the snapshot are invisible; the auxiliary
+	 * value is versioned along with the pointer */
+	store_in_thread(1);
+	check_load(values, 0);
+	store_in_thread(2);
+	check_load(values, 0);
+
+	/* nested snapshots share the version of the outer one */
+	sdb_mvcc_snapshot_begin();
+	fail_unless(sdb_mvcc_snapshot_version() == version,
+			"sdb_mvcc_snapshot_version() = %"PRIu64" in nested snapshot; "
+			"expected: %"PRIu64, sdb_mvcc_snapshot_version(), version);
+	check_load(values, 0);
+	sdb_mvcc_snapshot_end();
+	check_load(values, 0);
+	sdb_mvcc_snapshot_end();
+
+	check_load(values + 2, 42);
+	fail_unless(sdb_mvcc_snapshot_version() == 0,
+			"sdb_mvcc_snapshot_version() = %"PRIu64" after releasing the "
+			"snapshot; expected: 0", sdb_mvcc_snapshot_version());
+
+	/* a new snapshot sees the current version */
+	sdb_mvcc_snapshot_begin();
+	fail_unless(sdb_mvcc_snapshot_version() > version,
+			"sdb_mvcc_snapshot_version() = %"PRIu64"; expected: > %"PRIu64,
+			sdb_mvcc_snapshot_version(), version);
+	check_load(values + 2, 42);
+	store_in_thread(3);
+	check_load(values + 2, 2);
+	sdb_mvcc_snapshot_end();
+	check_load(values + 3, 42);
+}
+END_TEST
+
+typedef struct {
+	pthread_barrier_t start;
+	pthread_barrier_t taken;
+	pthread_barrier_t stored;
+	int *seen;
+} reader_t;
+
+static void *
+read_snapshot(void *arg)
+{
+	reader_t *r = arg;
+
+	pthread_barrier_wait(&r->start);
+	sdb_mvcc_snapshot_begin();
+	pthread_barrier_wait(&r->taken);
+	pthread_barrier_wait(&r->stored);
+	r->seen = sdb_mvcc_load(&ptr, NULL);
+	sdb_mvcc_snapshot_end();
+	return NULL;
+} /* read_snapshot */
+
+START_TEST(test_concurrent_snapshots)
+{
+	reader_t readers[2];
+	pthread_t threads[2];
+	size_t i;
+
+	store_value((void *)0);
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(readers); ++i) {
+		pthread_barrier_init(&readers[i].start, NULL, 2);
+		pthread_barrier_init(&readers[i].taken, NULL, 2);
+		pthread_barrier_init(&readers[i].stored, NULL, 2);
+		readers[i].seen = NULL;
+		pthread_create(threads + i, NULL, read_snapshot, readers + i);
+	}
+
+	/* each reader sees the version current when taking its snapshot */
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(readers); ++i) {
+		pthread_barrier_wait(&readers[i].start);
+		pthread_barrier_wait(&readers[i].taken);
+		store_value((void *)(i + 1));
+	}
+	store_value((void *)3);
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(readers); ++i) {
+		pthread_barrier_wait(&readers[i].stored);
+		pthread_join(threads[i], NULL);
+		fail_unless(readers[i].seen == values + i,
+				"reader %zu saw values[%td]; expected: values[%zu]",
+				i, readers[i].seen ? readers[i].seen - values : -1, i);
+		pthread_barrier_destroy(&readers[i].start);
+		pthread_barrier_destroy(&readers[i].taken);
+		pthread_barrier_destroy(&readers[i].stored);
+	}
+	check_load(values + 3, 42);
+
+	/* previous versions are dropped once there are no more snapshots */
+	store_value((void *)0);
+	fail_unless(ptr.old == NULL,
+			"sdb_mvcc_store() kept previous versions without snapshots");
+}
+END_TEST
+
+TEST_MAIN("utils::mvcc")
+{
+	TCase *tc = tcase_create("core");
+	tcase_add_checked_fixture(tc, NULL, teardown);
+	tcase_add_test(tc, test_no_snapshot);
+	tcase_add_test(tc, test_snapshot);
+	tcase_add_test(tc, test_concurrent_snapshots);
+	ADD_TCASE(tc);
+}
+TEST_MAIN_END
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
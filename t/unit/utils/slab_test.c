@@ -0,0 +1,165 @@
+/*
+ * SysDB - t/unit/utils/slab_test.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "utils/slab.h"
+#include "testutils.h"
+
+#include <check.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * private helper functions
+ */
+
+#define BLOCKS_NUM 1000
+
+static void *blocks[BLOCKS_NUM];
+
+static void *
+free_blocks(void *arg)
+{
+	size_t i;
+
+	for (i = 0; i < BLOCKS_NUM; ++i)
+		sdb_slab_free(blocks[i], (size_t)arg);
+	return NULL;
+} /* free_blocks */
+
+/*
+ * tests
+ */
+
+START_TEST(test_alloc)
+{
+	size_t sizes[] = { 1, 8, 16, 17, 48, 100, SDB_SLAB_MAX_SIZE };
+	size_t i, j;
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(sizes); ++i) {
+		for (j = 0; j < BLOCKS_NUM; ++j) {
+			blocks[j] = sdb_slab_alloc(sizes[i]);
+			fail_unless(blocks[j] != NULL,
+					"sdb_slab_alloc(%zu) = NULL; expected: valid pointer",
+					sizes[i]);
+			fail_unless(((uintptr_t)blocks[j] % 16) == 0,
+					"sdb_slab_alloc(%zu) = %p; expected: 16-byte aligned "
+					"pointer", sizes[i], blocks[j]);
+			memset(blocks[j], (int)j, sizes[i]);
+		}
+
+		for (j = 0; j < BLOCKS_NUM; ++j) {
+			size_t k;
+			for (k = 0; k < sizes[i]; ++k)
+				fail_unless(((unsigned char *)blocks[j])[k]
+							== (unsigned char)j,
+						"sdb_slab_alloc(%zu) returned overlapping blocks",
+						sizes[i]);
+		}
+
+		for (j = 0; j < BLOCKS_NUM; ++j)
+			sdb_slab_free(blocks[j], sizes[i]);
+	}
+}
+END_TEST
+
+START_TEST(test_reuse)
+{
+	void *p1, *p2;
+
+	p1 = sdb_slab_alloc(40);
+	fail_unless(p1 != NULL,
+			"sdb_slab_alloc(40) = NULL; expected: valid pointer");
+	sdb_slab_free(p1, 40);
+
+	/* sizes of the same class share their blocks */
+	p2 = sdb_slab_alloc(33);
+	fail_unless(p2 == p1,
+			"sdb_slab_alloc(33) = %p; expected: %p (released block)",
+			p2, p1);
+	sdb_slab_free(p2, 33);
+}
+END_TEST
+
+START_TEST(test_large)
+{
+	void *p;
+
+	p = sdb_slab_alloc(SDB_SLAB_MAX_SIZE + 1);
+	fail_unless(p != NULL,
+			"sdb_slab_alloc(%d) = NULL; expected: valid pointer",
+			SDB_SLAB_MAX_SIZE + 1);
+	memset(p, 0, SDB_SLAB_MAX_SIZE + 1);
+	sdb_slab_free(p, SDB_SLAB_MAX_SIZE + 1);
+
+	/* must not crash */
+	sdb_slab_free(NULL, 0);
+	sdb_slab_free(NULL, 16);
+}
+END_TEST
+
+START_TEST(test_threads)
+{
+	pthread_t thread;
+	size_t i;
+
+	for (i = 0; i < BLOCKS_NUM; ++i) {
+		blocks[i] = sdb_slab_alloc(64);
+		fail_unless(blocks[i] != NULL,
+				"sdb_slab_alloc(64) = NULL; expected: valid pointer");
+	}
+
+	/* blocks released by another thread are returned to the global list */
+	fail_unless(! pthread_create(&thread, NULL, free_blocks, (void *)64),
+			"INTERNAL ERROR: failed to create thread");
+	pthread_join(thread, NULL);
+
+	for (i = 0; i < BLOCKS_NUM; ++i) {
+		blocks[i] = sdb_slab_alloc(64);
+		fail_unless(blocks[i] != NULL,
+				"sdb_slab_alloc(64) = NULL; expected: valid pointer");
+	}
+	free_blocks((void *)64);
+}
+END_TEST
+
+TEST_MAIN("utils::slab")
+{
+	TCase *tc = tcase_create("core");
+	tcase_add_test(tc, test_alloc);
+	tcase_add_test(tc, test_reuse);
+	tcase_add_test(tc, test_large);
+	tcase_add_test(tc, test_threads);
+	ADD_TCASE(tc);
+}
+TEST_MAIN_END
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
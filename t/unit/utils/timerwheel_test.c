@@ -0,0 +1,166 @@
+/*
+ * SysDB - t/unit/utils/timerwheel_test.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "utils/timerwheel.h"
+#include "testutils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define T0 SECS_TO_SDB_TIME(1000)
+
+/* timers are named after their expiry time in seconds */
+static sdb_time_t golden_timers[] = {
+	/* due already */
+	T0 - SECS_TO_SDB_TIME(5),
+	T0,
+	T0 + SECS_TO_SDB_TIME(1),
+	T0 + SECS_TO_SDB_TIME(63),
+	T0 + SECS_TO_SDB_TIME(64),
+	T0 + SECS_TO_SDB_TIME(4095),
+	T0 + SECS_TO_SDB_TIME(4096),
+	T0 + SECS_TO_SDB_TIME(300000),
+	/* beyond the range of the wheel */
+	T0 + SECS_TO_SDB_TIME((1 << 24) + 5),
+};
+
+static struct {
+	sdb_time_t now;
+	const char *expected;
+} golden_data[] = {
+	{ T0,                                    "995,1000" },
+	{ T0 + SECS_TO_SDB_TIME(1),              "1001" },
+	{ T0 + SECS_TO_SDB_TIME(62),             "" },
+	/* the wheel has a resolution of one second */
+	{ T0 + SECS_TO_SDB_TIME(63) + 1,         "1063" },
+	{ T0 + SECS_TO_SDB_TIME(64),             "1064" },
+	{ T0 + SECS_TO_SDB_TIME(4094),           "" },
+	{ T0 + SECS_TO_SDB_TIME(4095),           "5095" },
+	{ T0 + SECS_TO_SDB_TIME(4096),           "5096" },
+	{ T0 + SECS_TO_SDB_TIME(299999),         "" },
+	{ T0 + SECS_TO_SDB_TIME(300000),         "301000" },
+	{ T0 + SECS_TO_SDB_TIME((1 << 24) + 4),  "" },
+	{ T0 + SECS_TO_SDB_TIME((1 << 24) + 5),  "16778221" },
+	{ T0 + SECS_TO_SDB_TIME(1 << 25),        "" },
+};
+
+static int
+cmp_names(const void *a, const void *b)
+{
+	const sdb_object_t *o1 = *(const sdb_object_t * const *)a;
+	const sdb_object_t *o2 = *(const sdb_object_t * const *)b;
+	return (int)(atoll(o1->name) - atoll(o2->name));
+} /* cmp_names */
+
+START_TEST(test_timerwheel)
+{
+	sdb_timerwheel_t *wheel;
+	sdb_object_t *obj;
+	size_t i;
+	int check;
+
+	wheel = sdb_timerwheel_create(SECS_TO_SDB_TIME(1), T0);
+	fail_unless(wheel != NULL,
+			"sdb_timerwheel_create() = NULL; expected: <wheel>");
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_timers); ++i) {
+		char name[32];
+
+		snprintf(name, sizeof(name), "%"PRIsdbTIME,
+				SDB_TIME_TO_SECS(golden_timers[i]));
+		obj = sdb_object_create_T(name, sdb_object_t);
+		check = sdb_timerwheel_add(wheel, obj, golden_timers[i]);
+		fail_unless(check == 0,
+				"sdb_timerwheel_add(%s) = %d; expected: 0", name, check);
+		sdb_object_deref(obj);
+	}
+	fail_unless(sdb_timerwheel_size(wheel) == SDB_STATIC_ARRAY_LEN(golden_timers),
+			"sdb_timerwheel_size() = %zu; expected: %zu",
+			sdb_timerwheel_size(wheel), SDB_STATIC_ARRAY_LEN(golden_timers));
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+		sdb_llist_t *expired = sdb_llist_create();
+		sdb_object_t *objs[SDB_STATIC_ARRAY_LEN(golden_timers)];
+		char names[256] = "";
+		size_t n = 0, j;
+
+		check = sdb_timerwheel_advance(wheel, golden_data[i].now, expired);
+		while (n < SDB_STATIC_ARRAY_LEN(objs)) {
+			objs[n] = sdb_llist_shift(expired);
+			if (! objs[n])
+				break;
+			++n;
+		}
+		fail_unless(check == (int)n,
+				"sdb_timerwheel_advance(%"PRIsdbTIME") = %d; "
+				"expected: %zu", golden_data[i].now, check, n);
+
+		qsort(objs, n, sizeof(*objs), cmp_names);
+		for (j = 0; j < n; ++j) {
+			if (j)
+				strcat(names, ",");
+			strcat(names, objs[j]->name);
+			sdb_object_deref(objs[j]);
+		}
+		fail_unless(! strcmp(names, golden_data[i].expected),
+				"sdb_timerwheel_advance(%"PRIsdbTIME") expired %s; "
+				"expected: %s", golden_data[i].now, names,
+				golden_data[i].expected);
+		sdb_llist_destroy(expired);
+	}
+	fail_unless(sdb_timerwheel_size(wheel) == 0,
+			"sdb_timerwheel_size() = %zu after expiring all timers; "
+			"expected: 0", sdb_timerwheel_size(wheel));
+
+	/* pending timers are released when destroying the wheel */
+	obj = sdb_object_create_T("pending", sdb_object_t);
+	sdb_timerwheel_add(wheel, obj, T0 + SECS_TO_SDB_TIME(1 << 26));
+	fail_unless(obj->ref_cnt == 2,
+			"sdb_timerwheel_add() did not take a reference; "
+			"ref_cnt = %d; expected: 2", obj->ref_cnt);
+	sdb_timerwheel_destroy(wheel);
+	fail_unless(obj->ref_cnt == 1,
+			"sdb_timerwheel_destroy() did not release pending objects; "
+			"ref_cnt = %d; expected: 1", obj->ref_cnt);
+	sdb_object_deref(obj);
+}
+END_TEST
+
+TEST_MAIN("utils::timerwheel")
+{
+	TCase *tc = tcase_create("core");
+	tcase_add_test(tc, test_timerwheel);
+	ADD_TCASE(tc);
+}
+TEST_MAIN_END
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */